@@ -6,10 +6,25 @@
 #include "dx9mt/packets.h"
 #include "dx9mt/upload_arena.h"
 
+/*
+ * Where submit_packets does its work. OFF parses on the calling thread.
+ * The other modes hand packets to a backend worker thread through a
+ * lock-free SPSC ring of ring_capacity_bytes and differ only in how idle
+ * or blocked threads wait: BLOCK sleeps on an event after a short spin,
+ * SPIN keeps spinning and yielding (lowest latency, burns a core).
+ */
+enum dx9mt_backend_packet_thread_mode {
+  DX9MT_BACKEND_PACKET_THREAD_OFF = 0,
+  DX9MT_BACKEND_PACKET_THREAD_BLOCK = 1,
+  DX9MT_BACKEND_PACKET_THREAD_SPIN = 2,
+};
+
 typedef struct dx9mt_backend_init_desc {
   uint32_t protocol_version;
   uint32_t ring_capacity_bytes;
   dx9mt_upload_arena_desc upload_desc;
+  uint32_t packet_thread_mode; /* dx9mt_backend_packet_thread_mode */
+  uint32_t capabilities;       /* offered DX9MT_PROTOCOL_CAP_* */
 } dx9mt_backend_init_desc;
 
 typedef struct dx9mt_backend_present_target_desc {
@@ -21,14 +36,114 @@ typedef struct dx9mt_backend_present_target_desc {
   uint32_t windowed;
 } dx9mt_backend_present_target_desc;
 
+/*
+ * Serialization cost of the last IPC frame (zero while IPC is unmapped).
+ * With async present this is the last frame the worker finished.
+ */
+typedef struct dx9mt_backend_ipc_stats {
+  uint32_t frames; /* IPC frames written since init */
+  uint32_t draw_count;
+  uint32_t changed_draws; /* table entries written; all but in delta frames */
+  uint32_t frame_bytes;   /* header, table entries and bulk bytes written */
+  uint32_t copied_bytes;
+  uint32_t referenced_bytes; /* zero-copy payloads spliced in place */
+  uint32_t caps;             /* DX9MT_METAL_IPC_CAP_* the frame was written with */
+  uint32_t draws_dropped;    /* past the command cap or the frame region */
+  uint32_t repeated_frames;  /* presents that only bumped repeat_count */
+  uint32_t ring_slot;        /* frame ring slot of the last ring frame */
+  uint32_t ring_skipped;     /* ring frames dropped with no slot free */
+  uint32_t threads;          /* threads that wrote the last frame's table */
+  uint32_t state_blocks;     /* interned state blocks the frame's draws use */
+  uint32_t state_bytes;      /* bytes of those blocks' tables */
+} dx9mt_backend_ipc_stats;
+
+/*
+ * Async present: with DX9MT_BACKEND_FRAMES_IN_FLIGHT=N (1..MAX) and IPC
+ * mapped, present() queues the frame's replay state to a serializer thread
+ * and returns. It only waits while N frames are still being serialized.
+ * The upload arena's slot count covers the frame being recorded plus MAX
+ * in flight.
+ */
+#define DX9MT_BACKEND_MAX_FRAMES_IN_FLIGHT 4u
+
+/* Async present queue counters; all zero while presents serialize inline. */
+typedef struct dx9mt_backend_present_stats {
+  uint32_t frames_in_flight; /* configured limit */
+  uint32_t frames;           /* frames the worker has serialized */
+  uint32_t queue_depth;      /* frames in flight after the last present */
+  uint32_t waits;            /* presents that waited for a free slot */
+  uint64_t wait_us;          /* time those presents spent waiting */
+  uint64_t latency_total_us;
+  uint32_t latency_us; /* present() queueing a frame to its IPC publish */
+  uint32_t latency_max_us;
+  /* presents by queue depth after queueing (index 0 is unused) */
+  uint32_t depth_histogram[DX9MT_BACKEND_MAX_FRAMES_IN_FLIGHT + 1];
+} dx9mt_backend_present_stats;
+
+typedef const void *(*dx9mt_backend_upload_resolve_fn)(
+    const dx9mt_upload_ref *ref);
+
+/*
+ * Fails when desc->protocol_version is not DX9MT_PROTOCOL_VERSION. Offered
+ * capabilities the backend lacks are dropped, never an error; a packet
+ * thread is started only when DX9MT_PROTOCOL_CAP_PACKET_THREAD is agreed.
+ */
 int dx9mt_backend_bridge_init(const dx9mt_backend_init_desc *desc);
+/* DX9MT_PROTOCOL_CAP_* agreed by the last successful init. */
+uint32_t dx9mt_backend_bridge_capabilities(void);
 int dx9mt_backend_bridge_update_present_target(
     const dx9mt_backend_present_target_desc *desc);
+/*
+ * With a packet thread running this only queues the packets (blocking while
+ * the ring is full) and returns 0; validation failures are then counted in
+ * dx9mt_backend_bridge_debug_get_submit_errors(). present(), begin_frame()
+ * and update_present_target() wait for queued packets first.
+ */
 int dx9mt_backend_bridge_submit_packets(const dx9mt_packet_header *packets,
                                         uint32_t packet_bytes);
 int dx9mt_backend_bridge_begin_frame(uint32_t frame_id);
+/*
+ * With async present the return value covers validation and the frame
+ * being queued; serialization happens later on the worker.
+ */
 int dx9mt_backend_bridge_present(uint32_t frame_id);
+/*
+ * Upload retirement fence: the number of present() calls whose upload refs
+ * the backend has finished reading (serialized, with async present).
+ * Monotonic for the life of the process (not reset by init/shutdown). An
+ * upload slot written before the Nth present may be reused once this
+ * reaches N.
+ */
+uint32_t dx9mt_backend_bridge_completed_fence(void);
+/*
+ * The viewer's dx9mt_metal_ipc_header.viewer_resync, or 0 while IPC is
+ * unmapped. When it changes the viewer lost an upload it caches, so the
+ * frontend sends every such upload whole again before trusting the
+ * viewer's copy.
+ */
+uint32_t dx9mt_backend_bridge_viewer_resync(void);
+/*
+ * Zero-copy upload memory: upload slot `slot`'s region inside the shared
+ * IPC mapping, or NULL when there is none (IPC disabled, IPC file smaller
+ * than DX9MT_METAL_IPC_ZERO_COPY_SIZE, or DX9MT_BACKEND_IPC_ZERO_COPY=0).
+ * Valid until dx9mt_backend_bridge_shutdown().
+ */
+void *dx9mt_backend_bridge_ipc_upload_slot(uint32_t slot, uint32_t *out_bytes);
+/*
+ * Where IPC assembly reads upload payloads. The PE build defaults to
+ * dx9mt_frontend_upload_resolve(); native hosts (capture replay) install
+ * their own. NULL restores the default.
+ */
+void dx9mt_backend_bridge_set_upload_resolver(
+    dx9mt_backend_upload_resolve_fn resolve);
 void dx9mt_backend_bridge_shutdown(void);
 uint32_t dx9mt_backend_bridge_debug_get_last_replay_hash(void);
+/* Packet batches rejected since init, whichever thread parsed them. */
+uint32_t dx9mt_backend_bridge_debug_get_submit_errors(void);
+void dx9mt_backend_bridge_debug_get_ipc_stats(
+    dx9mt_backend_ipc_stats *out_stats);
+/* Worker-written counters are only stable once the fence catches up. */
+void dx9mt_backend_bridge_debug_get_present_stats(
+    dx9mt_backend_present_stats *out_stats);
 
 #endif
@@ -0,0 +1,61 @@
+#ifndef DX9MT_DRAW_RANGE_H
+#define DX9MT_DRAW_RANGE_H
+
+#include <stdint.h>
+
+/*
+ * Byte ranges an indexed draw reads from its buffers. A draw whose buffer
+ * is still write-locked uploads only these ranges (see
+ * dx9mt_device_DrawIndexedPrimitive); each helper returns 0 when the range
+ * does not fit the buffer, and the caller then uploads the buffer whole.
+ */
+
+/*
+ * Vertices [base_vertex + min_vertex_index, +num_vertices) of one stream,
+ * clamped to the end of the buffer.
+ */
+static inline int dx9mt_draw_vertex_range(uint32_t buffer_size,
+                                          uint32_t stream_offset,
+                                          uint32_t stride, int32_t base_vertex,
+                                          uint32_t min_vertex_index,
+                                          uint32_t num_vertices,
+                                          uint32_t *out_offset,
+                                          uint32_t *out_size) {
+  int64_t first_vertex = (int64_t)base_vertex + (int64_t)min_vertex_index;
+  uint64_t begin;
+  uint64_t bytes = (uint64_t)num_vertices * stride;
+
+  if (stride == 0 || num_vertices == 0 || first_vertex < 0) {
+    return 0;
+  }
+  begin = (uint64_t)stream_offset + (uint64_t)first_vertex * stride;
+  if (begin >= buffer_size) {
+    return 0;
+  }
+  if (bytes > buffer_size - begin) {
+    bytes = buffer_size - begin;
+  }
+  *out_offset = (uint32_t)begin;
+  *out_size = (uint32_t)bytes;
+  return 1;
+}
+
+/* Indices [start_index, +index_count); never clamped. */
+static inline int dx9mt_draw_index_range(uint32_t buffer_size,
+                                         uint32_t index_size,
+                                         uint32_t start_index,
+                                         uint32_t index_count,
+                                         uint32_t *out_offset,
+                                         uint32_t *out_size) {
+  uint64_t begin = (uint64_t)start_index * index_size;
+  uint64_t bytes = (uint64_t)index_count * index_size;
+
+  if (bytes == 0 || begin + bytes > buffer_size) {
+    return 0;
+  }
+  *out_offset = (uint32_t)begin;
+  *out_size = (uint32_t)bytes;
+  return 1;
+}
+
+#endif
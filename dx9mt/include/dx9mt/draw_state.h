@@ -0,0 +1,65 @@
+#ifndef DX9MT_DRAW_STATE_H
+#define DX9MT_DRAW_STATE_H
+
+#include <stdint.h>
+
+#include "dx9mt/metal_ipc.h"
+#include "dx9mt/packets.h"
+
+/*
+ * Current value of each state group, set by the DX9MT_PACKET_STATE_*
+ * packets; slim DRAW packets are expanded against it. The backend keeps one
+ * per open frame. A frontend without DX9MT_PROTOCOL_CAP_STATE_DELTA keeps
+ * its own and sends the expansion as DRAW_INDEXED, so both paths produce
+ * the same draw records and hashes.
+ */
+typedef struct dx9mt_draw_state {
+  uint32_t present_mask;     /* DX9MT_STATE_GROUP_* received since reset */
+  uint32_t tex_data_pending; /* stages whose tex_data the next draw takes */
+  int hashes_valid;
+  uint32_t viewport_hash;
+  uint32_t scissor_hash;
+  uint32_t texture_stage_hash;
+  uint32_t sampler_state_hash;
+  uint32_t state_hash;
+  dx9mt_state_depth_stencil depth_stencil;
+  dx9mt_state_blend blend;
+  dx9mt_state_raster raster;
+  dx9mt_state_viewport viewport;
+  dx9mt_state_sampler samplers[DX9MT_MAX_PS_SAMPLERS];
+  dx9mt_state_texture_stage texture_stages[DX9MT_MAX_PS_SAMPLERS];
+  dx9mt_shader_control_constants control_vs;
+  dx9mt_shader_control_constants control_ps;
+} dx9mt_draw_state;
+
+void dx9mt_draw_state_reset(dx9mt_draw_state *state);
+/*
+ * Stores one STATE_* packet. Returns the DX9MT_STATE_GROUP_* bit it set, or
+ * 0 for a packet that is not a state packet, too small, or names a stage
+ * out of range. Upload refs are stored as-is; validating them is the
+ * caller's business.
+ */
+uint32_t dx9mt_draw_state_apply(dx9mt_draw_state *state,
+                                const dx9mt_packet_header *header);
+/*
+ * Expands a slim DRAW into the full DRAW_INDEXED snapshot (header included,
+ * sequence taken from the draw). Pending texture uploads ride on this draw
+ * and are cleared from the state.
+ */
+void dx9mt_draw_state_expand(dx9mt_draw_state *state,
+                             const dx9mt_packet_draw *draw,
+                             dx9mt_packet_draw_indexed *out);
+/*
+ * Expands a slim DRAW straight into the IPC table entry a backend command
+ * records, without the DRAW_INDEXED snapshot in between. Fills what the
+ * entry holds inline; state indices and bulk ranges stay zero, and the
+ * state blocks, hashes and draw refs are read from `state` and `draw`.
+ * Moves the pending texture uploads into tex_data like
+ * dx9mt_draw_state_expand does. Returns the draw's state_block_hash.
+ */
+uint32_t dx9mt_draw_state_expand_ipc(
+    dx9mt_draw_state *state, const dx9mt_packet_draw *draw,
+    dx9mt_metal_ipc_draw *out,
+    dx9mt_upload_ref tex_data[DX9MT_MAX_PS_SAMPLERS]);
+
+#endif
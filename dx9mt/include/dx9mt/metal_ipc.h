@@ -1,34 +1,174 @@
 #ifndef DX9MT_METAL_IPC_H
 #define DX9MT_METAL_IPC_H
 
+#include <stddef.h>
 #include <stdint.h>
 
-#include "dx9mt/packets.h" /* DX9MT_MAX_PS_SAMPLERS */
+#include "dx9mt/packets.h" /* DX9MT_MAX_PS_SAMPLERS, packed state */
 
 /*
  * Shared memory IPC for PE DLL <-> native Metal viewer.
  *
- * Layout (16MB region):
+ * Layout (frame region, DX9MT_METAL_IPC_SIZE):
  *   [0..header_size)            dx9mt_metal_ipc_header
- *   [header_size..draws_end)    dx9mt_metal_ipc_draw[draw_count]
+ *   [header_size..draws_end)    dx9mt_metal_ipc_draw[draw_count], any length
+ *                               up to DX9MT_METAL_IPC_MAX_DRAWS
  *   [bulk_data_offset..]        bulk VB/IB bytes referenced by draw entries
+ *                               and the interned state tables
+ *
+ * Optional upload arena (file of at least DX9MT_METAL_IPC_ZERO_COPY_SIZE):
+ *   [DX9MT_METAL_IPC_ARENA_OFFSET..]  one DX9MT_METAL_IPC_ARENA_SLOT_BYTES
+ *                                     region per upload slot
+ *
+ * With the arena mapped, the frontend writes upload payloads straight into
+ * it and present() only references them: the first
+ * align16(arena_data_size) bytes of the bulk range are left unwritten, and
+ * their contents live at [arena_data_offset, +arena_data_size) instead.
+ * Readers splice that range in when snapshotting, so every bulk offset
+ * stays relative to bulk_data_offset either way.
  *
  * The PE DLL writes the entire region on present(), then stores the
  * sequence number last with release semantics. The viewer polls the
  * sequence number with acquire semantics.
+ *
+ * Frame ring (DX9MT_METAL_IPC_CAP_FRAME_RING): the frame region is split
+ * into a control header and DX9MT_METAL_IPC_RING_SLOTS slots:
+ *   [0..header_size)             control dx9mt_metal_ipc_header: magic,
+ *                                sequence, backend_caps, repeat_count,
+ *                                viewer_caps, viewer_resync and the ring
+ *                                fields
+ *   [DX9MT_METAL_IPC_RING_OFFSET + k * DX9MT_METAL_IPC_RING_SLOT_BYTES..]
+ *                                slot k: one whole frame laid out as
+ *                                above, offsets relative to the slot
+ * The PE DLL writes each full frame into a slot no reader owns, and
+ * patches a delta into the slot of the frame it builds on when it can
+ * claim that (READY -> WRITING); either way it marks the slot READY,
+ * points ring_latest at it and then stores the control sequence. The
+ * viewer claims ring_latest (READY -> READING), renders straight from it
+ * and hands it back (READING -> READY). Neither side waits for the other
+ * or copies a frame out of the mapping, so ring frames are never
+ * zero-copy.
  */
 
 #define DX9MT_METAL_IPC_MAGIC 0xDEAD9001u
 #define DX9MT_METAL_IPC_PATH "/tmp/dx9mt_metal_frame.bin"
 #define DX9MT_METAL_IPC_WIN_PATH "Z:\\tmp\\dx9mt_metal_frame.bin"
 #define DX9MT_METAL_IPC_SIZE (256u * 1024u * 1024u)
-#define DX9MT_METAL_IPC_MAX_DRAWS 2048u
+#define DX9MT_METAL_IPC_ARENA_OFFSET DX9MT_METAL_IPC_SIZE
+#define DX9MT_METAL_IPC_ARENA_SLOT_BYTES ((uint32_t)DX9MT_UPLOAD_ARENA_CHUNK_BYTES)
+#define DX9MT_METAL_IPC_ARENA_BYTES                                             \
+  ((uint32_t)DX9MT_UPLOAD_ARENA_MAX_SLOTS * DX9MT_METAL_IPC_ARENA_SLOT_BYTES)
+#define DX9MT_METAL_IPC_ZERO_COPY_SIZE                                          \
+  (DX9MT_METAL_IPC_ARENA_OFFSET + DX9MT_METAL_IPC_ARENA_BYTES)
+/* One writing, one being read, one holding the latest frame. */
+#define DX9MT_METAL_IPC_RING_SLOTS 3u
+#define DX9MT_METAL_IPC_RING_OFFSET 4096u
+#define DX9MT_METAL_IPC_RING_SLOT_BYTES                                         \
+  (((DX9MT_METAL_IPC_SIZE - DX9MT_METAL_IPC_RING_OFFSET) /                      \
+    DX9MT_METAL_IPC_RING_SLOTS) &                                               \
+   ~4095u)
 
 enum dx9mt_metal_ipc_command_type {
   DX9MT_METAL_IPC_COMMAND_DRAW = 0,
   DX9MT_METAL_IPC_COMMAND_STRETCH_RECT = 1,
+  /* dst_* is the cleared rect; 0,0,width,height clears the whole target. */
+  DX9MT_METAL_IPC_COMMAND_CLEAR = 2,
+};
+
+/*
+ * IPC encodings the viewer understands. The viewer stores its set in
+ * viewer_caps (with DX9MT_METAL_IPC_CAPS_VALID) when it maps the file; the
+ * backend preserves that word, writes each frame with the intersection
+ * and records it in backend_caps. Before any viewer has announced itself
+ * the backend writes its full set.
+ */
+enum dx9mt_metal_ipc_caps {
+  /* CLEAR commands in the draw table; else only the header clear fields. */
+  DX9MT_METAL_IPC_CAP_ORDERED_CLEAR = 1u << 0,
+  /* Arena range spliced into bulk data; else every payload is copied. */
+  DX9MT_METAL_IPC_CAP_ZERO_COPY = 1u << 1,
+  /* Static frames bump repeat_count; else every frame is rewritten. */
+  DX9MT_METAL_IPC_CAP_REPEAT_FRAME = 1u << 2,
+  /* Change lists against the previous frame; else every frame is whole. */
+  DX9MT_METAL_IPC_CAP_DRAW_DELTA = 1u << 3,
+  /* Frames go to ring slots; else to the one region at offset 0. */
+  DX9MT_METAL_IPC_CAP_FRAME_RING = 1u << 4,
+};
+#define DX9MT_METAL_IPC_CAPS_ALL 0x0000001Fu
+#define DX9MT_METAL_IPC_CAPS_VALID 0x80000000u
+
+/* Owner of a ring slot, in dx9mt_metal_ipc_header.ring_state[]. */
+enum dx9mt_metal_ipc_slot_state {
+  DX9MT_METAL_IPC_SLOT_FREE = 0,    /* holds no frame */
+  DX9MT_METAL_IPC_SLOT_WRITING = 1, /* the PE DLL is filling it */
+  /* A whole frame. The viewer only claims ring_latest; the PE DLL only
+   * reclaims the others. */
+  DX9MT_METAL_IPC_SLOT_READY = 2,
+  DX9MT_METAL_IPC_SLOT_READING = 3, /* the viewer is reading it */
+};
+
+/*
+ * Render state groups interned per frame. Each draw entry holds an index
+ * per group into that group's table of distinct blocks in bulk data
+ * (state_table_offset/count in the header), so a frame carries each
+ * blend, depth-stencil, raster, sampler, shader control and bound
+ * texture combination once.
+ */
+enum dx9mt_metal_ipc_state_group {
+  DX9MT_METAL_IPC_STATE_DEPTH_STENCIL = 0, /* dx9mt_state_depth_stencil */
+  DX9MT_METAL_IPC_STATE_BLEND = 1,         /* dx9mt_state_blend */
+  DX9MT_METAL_IPC_STATE_RASTER = 2,        /* dx9mt_state_raster */
+  DX9MT_METAL_IPC_STATE_SAMPLERS = 3,      /* dx9mt_metal_ipc_sampler_set */
+  /* dx9mt_shader_control_constants, bound as-is next to the float block */
+  DX9MT_METAL_IPC_STATE_CONTROL_VS = 4,
+  DX9MT_METAL_IPC_STATE_CONTROL_PS = 5,
+  DX9MT_METAL_IPC_STATE_TEXTURES = 6, /* dx9mt_metal_ipc_texture_set */
+  DX9MT_METAL_IPC_STATE_GROUPS = 7,
 };
 
+/* Sampler table entry: every stage's packed sampler word. */
+typedef struct dx9mt_metal_ipc_sampler_set {
+  dx9mt_state_sampler stage[DX9MT_MAX_PS_SAMPLERS];
+} dx9mt_metal_ipc_sampler_set;
+
+/*
+ * The texture bound to one stage (id 0: none). The viewer caches textures
+ * by id and generation; the pixels ride in the draw's tex_bulk range.
+ */
+typedef struct dx9mt_metal_ipc_texture {
+  uint32_t id;
+  uint32_t generation;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t pitch;
+} dx9mt_metal_ipc_texture;
+
+/* Texture table entry: every stage's bound texture. */
+typedef struct dx9mt_metal_ipc_texture_set {
+  dx9mt_metal_ipc_texture stage[DX9MT_MAX_PS_SAMPLERS];
+} dx9mt_metal_ipc_texture_set;
+
+static inline uint32_t dx9mt_metal_ipc_state_entry_bytes(uint32_t group) {
+  switch (group) {
+  case DX9MT_METAL_IPC_STATE_DEPTH_STENCIL:
+    return (uint32_t)sizeof(dx9mt_state_depth_stencil);
+  case DX9MT_METAL_IPC_STATE_BLEND:
+    return (uint32_t)sizeof(dx9mt_state_blend);
+  case DX9MT_METAL_IPC_STATE_RASTER:
+    return (uint32_t)sizeof(dx9mt_state_raster);
+  case DX9MT_METAL_IPC_STATE_SAMPLERS:
+    return (uint32_t)sizeof(dx9mt_metal_ipc_sampler_set);
+  case DX9MT_METAL_IPC_STATE_CONTROL_VS:
+  case DX9MT_METAL_IPC_STATE_CONTROL_PS:
+    return (uint32_t)sizeof(dx9mt_shader_control_constants);
+  case DX9MT_METAL_IPC_STATE_TEXTURES:
+    return (uint32_t)sizeof(dx9mt_metal_ipc_texture_set);
+  default:
+    return 0;
+  }
+}
+
 typedef struct dx9mt_metal_ipc_draw {
   uint32_t command_type;
   uint32_t primitive_type;
@@ -57,6 +197,13 @@ typedef struct dx9mt_metal_ipc_draw {
   int32_t dst_bottom;
   uint32_t stretch_filter;
 
+  /* CLEAR: D3DCLEAR_* flags and values; depth is the RT's paired buffer. */
+  uint32_t depth_stencil_id;
+  uint32_t clear_flags;
+  uint32_t clear_color_argb;
+  float clear_z;
+  uint32_t clear_stencil;
+
   uint32_t viewport_x;
   uint32_t viewport_y;
   uint32_t viewport_width;
@@ -74,44 +221,37 @@ typedef struct dx9mt_metal_ipc_draw {
   uint32_t stream0_offset;
   uint32_t stream0_stride;
   uint32_t index_format;
+  uint32_t tss0_combiner; /* dx9mt_packed_combiner_field */
+
+  /*
+   * Persistent VB/IB store (see dx9mt_buffer_update): vb/ib bulk bytes are
+   * the update payload, and a zero bulk size with a nonzero generation means
+   * the viewer reuses its cached copy of that generation.
+   */
+  uint32_t vertex_buffer_id;
+  uint32_t index_buffer_id;
+  dx9mt_buffer_update vertex_update;
+  dx9mt_buffer_update index_update;
+
+  /* RB3 Phase 3: shader cache keys; bytecode is attached only when the
+   * viewer may not have interned it yet (bulk size 0 otherwise). */
+  uint32_t vertex_shader_id;
+  uint32_t vs_bytecode_hash;
+  uint32_t ps_bytecode_hash;
+
+  /* Everything from here on is filled in at serialization. */
 
-  /* RB5: multi-texture stage arrays (stages 0..7) */
-  uint32_t tex_id[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t tex_generation[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t tex_format[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t tex_width[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t tex_height[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t tex_pitch[DX9MT_MAX_PS_SAMPLERS];
-
-  uint32_t sampler_min_filter[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_mag_filter[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_mip_filter[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_address_u[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_address_v[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_address_w[DX9MT_MAX_PS_SAMPLERS];
-
-  /* Stage-0 fixed-function combiner state (TSS path only) */
-  uint32_t tss0_color_op;
-  uint32_t tss0_color_arg1;
-  uint32_t tss0_color_arg2;
-  uint32_t tss0_alpha_op;
-  uint32_t tss0_alpha_arg1;
-  uint32_t tss0_alpha_arg2;
-  uint32_t rs_texture_factor;
-
-  /* RB3 Phase 2B: key render states for UI composition */
-  uint32_t rs_alpha_blend_enable;
-  uint32_t rs_src_blend;
-  uint32_t rs_dest_blend;
-  uint32_t rs_alpha_test_enable;
-  uint32_t rs_alpha_ref;
-  uint32_t rs_alpha_func;
+  /* DRAW: dx9mt_metal_ipc_state_group table indices; the render state
+   * blocks hold packed state words, decoded with dx9mt_packed_get(). */
+  uint16_t state_index[DX9MT_METAL_IPC_STATE_GROUPS];
+  uint16_t _pad1;
 
   /* Offsets into bulk data region (relative to bulk_data_offset) */
   uint32_t vb_bulk_offset;
   uint32_t vb_bulk_size;
   uint32_t ib_bulk_offset;
   uint32_t ib_bulk_size;
+  /* Per-stage texture uploads; the stage's texture is in its table entry */
   uint32_t tex_bulk_offset[DX9MT_MAX_PS_SAMPLERS];
   uint32_t tex_bulk_size[DX9MT_MAX_PS_SAMPLERS];
 
@@ -120,47 +260,29 @@ typedef struct dx9mt_metal_ipc_draw {
   uint16_t decl_count;
   uint16_t _pad0;
 
-  /* Shader constants (256 float4s = 4096 bytes each) */
+  /* Shader constants (256 float4s = 4096 bytes each), rebuilt from the
+   * frontend deltas; draws with identical constants share one block. */
   uint32_t vs_constants_bulk_offset;
   uint32_t vs_constants_size;
   uint32_t ps_constants_bulk_offset;
   uint32_t ps_constants_size;
 
-  /* RB3 Phase 3: shader bytecode for translation */
-  uint32_t vertex_shader_id;
   uint32_t vs_bytecode_bulk_offset;
   uint32_t vs_bytecode_bulk_size;
   uint32_t ps_bytecode_bulk_offset;
   uint32_t ps_bytecode_bulk_size;
-
-  /* RB4: depth/stencil render states */
-  uint32_t rs_zenable;
-  uint32_t rs_zwriteenable;
-  uint32_t rs_zfunc;
-  uint32_t rs_stencilenable;
-  uint32_t rs_stencilfunc;
-  uint32_t rs_stencilref;
-  uint32_t rs_stencilmask;
-  uint32_t rs_stencilwritemask;
-
-  /* RB5: rasterizer state */
-  uint32_t rs_cull_mode;
-
-  /* RB6: in-game rendering states */
-  uint32_t rs_scissortestenable;
-  uint32_t rs_blendop;
-  uint32_t rs_colorwriteenable;
-  uint32_t rs_stencilpass;
-  uint32_t rs_stencilfail;
-  uint32_t rs_stencilzfail;
-  uint32_t rs_fogenable;
-  uint32_t rs_fogcolor;
-  float rs_fogstart;
-  float rs_fogend;
-  float rs_fogdensity;
-  uint32_t rs_fogtablemode;
 } dx9mt_metal_ipc_draw;
 
+/*
+ * The backend records each command straight into this layout (the bulk
+ * offsets are filled in at serialization) and publishes it with one copy,
+ * so the i686 frontend build, the backend and the viewer must agree on it
+ * byte for byte: fixed-width fields, no pointers or 8-byte members.
+ */
+_Static_assert(sizeof(dx9mt_metal_ipc_draw) == 384, "IPC draw entry layout");
+_Static_assert(offsetof(dx9mt_metal_ipc_draw, state_index) % 4 == 0,
+               "IPC state indices start on a 4-byte boundary");
+
 typedef struct dx9mt_metal_ipc_header {
   uint32_t magic;
   volatile uint32_t sequence;
@@ -177,9 +299,119 @@ typedef struct dx9mt_metal_ipc_header {
   uint32_t present_render_target_id;
   uint32_t bulk_data_offset;
   uint32_t bulk_data_used;
+  /* Zero-copy arena range spliced in at the start of the bulk range. */
+  uint32_t arena_data_offset;
+  uint32_t arena_data_size;
+  /*
+   * Delta frames: the file holds the whole frame, but since frame
+   * base_sequence only change_count table entries (their indices are a
+   * uint32_t list at bulk offset change_list_offset) and the bulk bytes from
+   * bulk_delta_offset on were written. Full frames have base_sequence 0.
+   */
+  uint32_t base_sequence;
+  uint32_t change_count;
+  uint32_t change_list_offset;
+  uint32_t bulk_delta_offset;
+  uint32_t backend_caps; /* DX9MT_METAL_IPC_CAP_* this frame uses */
+  /*
+   * Bumped, with sequence left alone, for each present identical to the
+   * published frame. The viewer keeps showing its last output.
+   */
+  volatile uint32_t repeat_count;
+  /* Written by the viewer only; see dx9mt_metal_ipc_caps. */
+  volatile uint32_t viewer_caps;
+  /*
+   * Written by the viewer only: bumped after a frame that referenced a
+   * cached upload it never received (a buffer patch's base, or shader
+   * bytecode by hash). The PE DLL then resends those uploads whole.
+   */
+  volatile uint32_t viewer_resync;
+  /* Frame ring, control header only: the slot holding sequence, and each
+   * slot's dx9mt_metal_ipc_slot_state. */
+  volatile uint32_t ring_latest;
+  volatile uint32_t ring_state[DX9MT_METAL_IPC_RING_SLOTS];
+  /*
+   * Each dx9mt_metal_ipc_state_group's table: count blocks at a bulk
+   * offset. Delta frames only append blocks, moving a grown table into
+   * the delta range, so unchanged entries keep valid indices.
+   */
+  uint32_t state_table_offset[DX9MT_METAL_IPC_STATE_GROUPS];
+  uint32_t state_table_count[DX9MT_METAL_IPC_STATE_GROUPS];
 } dx9mt_metal_ipc_header;
 
+/*
+ * The draw table holds draw_count entries with bulk data right after it, so
+ * only the frame region bounds its length. A frame this long leaves no room
+ * for bulk data; real frames stop far short of it. A ring slot bounds it
+ * the same way with DX9MT_METAL_IPC_RING_SLOT_BYTES.
+ */
+#define DX9MT_METAL_IPC_MAX_DRAWS_IN(bytes)                                     \
+  ((uint32_t)(((bytes) - sizeof(dx9mt_metal_ipc_header)) /                      \
+              sizeof(dx9mt_metal_ipc_draw)))
+#define DX9MT_METAL_IPC_MAX_DRAWS                                               \
+  DX9MT_METAL_IPC_MAX_DRAWS_IN(DX9MT_METAL_IPC_SIZE)
+
 /* Back-compat alias for code that only reads the header */
 typedef dx9mt_metal_ipc_header dx9mt_metal_frame_data;
 
+/*
+ * Points tables[g] at each state table of the frame at `frame` (header
+ * first, as published). Returns 0 when a table lies outside the frame's
+ * bulk data.
+ */
+static inline int
+dx9mt_metal_ipc_state_tables(const volatile unsigned char *frame,
+                             const volatile unsigned char **tables) {
+  const volatile dx9mt_metal_ipc_header *header =
+      (const volatile dx9mt_metal_ipc_header *)frame;
+  uint32_t g;
+
+  for (g = 0; g < DX9MT_METAL_IPC_STATE_GROUPS; ++g) {
+    uint64_t bytes = (uint64_t)header->state_table_count[g] *
+                     dx9mt_metal_ipc_state_entry_bytes(g);
+
+    if (header->state_table_offset[g] > header->bulk_data_used ||
+        bytes > header->bulk_data_used - header->state_table_offset[g]) {
+      return 0;
+    }
+    tables[g] =
+        frame + header->bulk_data_offset + header->state_table_offset[g];
+  }
+  return 1;
+}
+
+static inline unsigned char *
+dx9mt_metal_ipc_ring_slot(volatile dx9mt_metal_ipc_header *control,
+                          uint32_t slot) {
+  return (unsigned char *)control + DX9MT_METAL_IPC_RING_OFFSET +
+         (uint64_t)slot * DX9MT_METAL_IPC_RING_SLOT_BYTES;
+}
+
+/*
+ * Viewer side: claims the slot holding the latest frame and returns its
+ * index, or -1 when there is none yet or the PE DLL reclaimed it between
+ * the two loads (the next poll sees a newer frame). Hand the slot back
+ * with dx9mt_metal_ipc_ring_release once done reading it.
+ */
+static inline int
+dx9mt_metal_ipc_ring_acquire(volatile dx9mt_metal_ipc_header *control) {
+  uint32_t slot = __atomic_load_n(&control->ring_latest, __ATOMIC_ACQUIRE);
+  uint32_t expected = DX9MT_METAL_IPC_SLOT_READY;
+
+  if (slot >= DX9MT_METAL_IPC_RING_SLOTS ||
+      !__atomic_compare_exchange_n(&control->ring_state[slot], &expected,
+                                   DX9MT_METAL_IPC_SLOT_READING, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    return -1;
+  }
+  return (int)slot;
+}
+
+static inline void
+dx9mt_metal_ipc_ring_release(volatile dx9mt_metal_ipc_header *control,
+                             int slot) {
+  __atomic_store_n(&control->ring_state[slot], DX9MT_METAL_IPC_SLOT_READY,
+                   __ATOMIC_RELEASE);
+}
+
 #endif
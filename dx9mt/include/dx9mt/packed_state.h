@@ -0,0 +1,169 @@
+#ifndef DX9MT_PACKED_STATE_H
+#define DX9MT_PACKED_STATE_H
+
+#include <stdint.h>
+
+/*
+ * Packed render, sampler and combiner state. D3D9 stores every state as a
+ * DWORD, but the enums replay reads fit in 1-5 bits, so draw state travels
+ * as a few 32-bit words (see dx9mt_packed_render_state in packets.h).
+ *
+ * Fields are explicit shift/width descriptors rather than C bit-fields:
+ * the PE32 frontend (mingw, ms_bitfields), the ARM64 backend and the viewer
+ * then agree on the layout without trusting each compiler's bit-field rules.
+ *
+ * Enum fields saturate. Each keeps its all-ones code unused, so an
+ * out-of-range value decodes as an unknown enum and the viewer falls back
+ * to its default. Integer fields (alpha ref, stencil ref and masks, color
+ * write mask) keep their low bits, which is all the hardware uses.
+ */
+#define DX9MT_PACKED_FIELD(shift, bits, truncate)                              \
+  ((uint32_t)(shift) | ((uint32_t)(bits) << 8) | ((uint32_t)(truncate) << 16))
+#define DX9MT_PACKED_FIELD_SHIFT(field) ((field) & 0xFFu)
+#define DX9MT_PACKED_FIELD_BITS(field) (((field) >> 8) & 0xFFu)
+#define DX9MT_PACKED_FIELD_END(field)                                          \
+  (DX9MT_PACKED_FIELD_SHIFT(field) + DX9MT_PACKED_FIELD_BITS(field))
+
+/* dx9mt_state_depth_stencil.depth */
+enum dx9mt_packed_depth_field {
+  DX9MT_PACKED_ZENABLE = DX9MT_PACKED_FIELD(0, 2, 0),
+  DX9MT_PACKED_ZWRITEENABLE = DX9MT_PACKED_FIELD(2, 1, 0),
+  DX9MT_PACKED_ZFUNC = DX9MT_PACKED_FIELD(3, 4, 0),
+  DX9MT_PACKED_STENCILENABLE = DX9MT_PACKED_FIELD(7, 1, 0),
+  DX9MT_PACKED_STENCILFUNC = DX9MT_PACKED_FIELD(8, 4, 0),
+  DX9MT_PACKED_STENCILPASS = DX9MT_PACKED_FIELD(12, 4, 0),
+  DX9MT_PACKED_STENCILFAIL = DX9MT_PACKED_FIELD(16, 4, 0),
+  DX9MT_PACKED_STENCILZFAIL = DX9MT_PACKED_FIELD(20, 4, 0),
+};
+
+/* dx9mt_state_depth_stencil.stencil (8-bit stencil buffers only) */
+enum dx9mt_packed_stencil_field {
+  DX9MT_PACKED_STENCILREF = DX9MT_PACKED_FIELD(0, 8, 1),
+  DX9MT_PACKED_STENCILMASK = DX9MT_PACKED_FIELD(8, 8, 1),
+  DX9MT_PACKED_STENCILWRITEMASK = DX9MT_PACKED_FIELD(16, 8, 1),
+};
+
+/* dx9mt_state_blend.blend */
+enum dx9mt_packed_blend_field {
+  DX9MT_PACKED_ALPHABLENDENABLE = DX9MT_PACKED_FIELD(0, 1, 0),
+  DX9MT_PACKED_SRCBLEND = DX9MT_PACKED_FIELD(1, 5, 0),
+  DX9MT_PACKED_DESTBLEND = DX9MT_PACKED_FIELD(6, 5, 0),
+  DX9MT_PACKED_BLENDOP = DX9MT_PACKED_FIELD(11, 3, 0),
+  DX9MT_PACKED_ALPHATESTENABLE = DX9MT_PACKED_FIELD(14, 1, 0),
+  DX9MT_PACKED_ALPHAFUNC = DX9MT_PACKED_FIELD(15, 4, 0),
+  DX9MT_PACKED_ALPHAREF = DX9MT_PACKED_FIELD(19, 8, 1),
+  DX9MT_PACKED_COLORWRITEENABLE = DX9MT_PACKED_FIELD(27, 4, 1),
+};
+
+/* dx9mt_state_raster.raster */
+enum dx9mt_packed_raster_field {
+  DX9MT_PACKED_CULLMODE = DX9MT_PACKED_FIELD(0, 3, 0),
+  DX9MT_PACKED_SCISSORTESTENABLE = DX9MT_PACKED_FIELD(3, 1, 0),
+  DX9MT_PACKED_FOGENABLE = DX9MT_PACKED_FIELD(4, 1, 0),
+  DX9MT_PACKED_FOGTABLEMODE = DX9MT_PACKED_FIELD(5, 3, 0),
+};
+
+/* dx9mt_state_sampler.sampler, one word per stage */
+enum dx9mt_packed_sampler_field {
+  DX9MT_PACKED_MINFILTER = DX9MT_PACKED_FIELD(0, 4, 0),
+  DX9MT_PACKED_MAGFILTER = DX9MT_PACKED_FIELD(4, 4, 0),
+  DX9MT_PACKED_MIPFILTER = DX9MT_PACKED_FIELD(8, 4, 0),
+  DX9MT_PACKED_ADDRESSU = DX9MT_PACKED_FIELD(12, 3, 0),
+  DX9MT_PACKED_ADDRESSV = DX9MT_PACKED_FIELD(15, 3, 0),
+  DX9MT_PACKED_ADDRESSW = DX9MT_PACKED_FIELD(18, 3, 0),
+};
+
+/*
+ * dx9mt_state_texture_stage.combiner. Arguments use the 5-bit form from
+ * dx9mt_packed_texture_arg(): the D3DTA_* selector in bits 0-2 (7 means
+ * unknown), D3DTA_COMPLEMENT in bit 3, D3DTA_ALPHAREPLICATE in bit 4.
+ */
+enum dx9mt_packed_combiner_field {
+  DX9MT_PACKED_COLOROP = DX9MT_PACKED_FIELD(0, 5, 0),
+  DX9MT_PACKED_COLORARG1 = DX9MT_PACKED_FIELD(5, 5, 1),
+  DX9MT_PACKED_COLORARG2 = DX9MT_PACKED_FIELD(10, 5, 1),
+  DX9MT_PACKED_ALPHAOP = DX9MT_PACKED_FIELD(15, 5, 0),
+  DX9MT_PACKED_ALPHAARG1 = DX9MT_PACKED_FIELD(20, 5, 1),
+  DX9MT_PACKED_ALPHAARG2 = DX9MT_PACKED_FIELD(25, 5, 1),
+};
+
+#define DX9MT_PACKED_ASSERT_NEXT(a, b)                                         \
+  _Static_assert(DX9MT_PACKED_FIELD_END(a) <= DX9MT_PACKED_FIELD_SHIFT(b),    \
+                 #a " overlaps " #b)
+#define DX9MT_PACKED_ASSERT_LAST(a)                                            \
+  _Static_assert(DX9MT_PACKED_FIELD_END(a) <= 32u, #a " overflows its word")
+
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_ZENABLE, DX9MT_PACKED_ZWRITEENABLE);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_ZWRITEENABLE, DX9MT_PACKED_ZFUNC);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_ZFUNC, DX9MT_PACKED_STENCILENABLE);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_STENCILENABLE, DX9MT_PACKED_STENCILFUNC);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_STENCILFUNC, DX9MT_PACKED_STENCILPASS);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_STENCILPASS, DX9MT_PACKED_STENCILFAIL);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_STENCILFAIL, DX9MT_PACKED_STENCILZFAIL);
+DX9MT_PACKED_ASSERT_LAST(DX9MT_PACKED_STENCILZFAIL);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_STENCILREF, DX9MT_PACKED_STENCILMASK);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_STENCILMASK,
+                         DX9MT_PACKED_STENCILWRITEMASK);
+DX9MT_PACKED_ASSERT_LAST(DX9MT_PACKED_STENCILWRITEMASK);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_ALPHABLENDENABLE, DX9MT_PACKED_SRCBLEND);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_SRCBLEND, DX9MT_PACKED_DESTBLEND);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_DESTBLEND, DX9MT_PACKED_BLENDOP);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_BLENDOP, DX9MT_PACKED_ALPHATESTENABLE);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_ALPHATESTENABLE, DX9MT_PACKED_ALPHAFUNC);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_ALPHAFUNC, DX9MT_PACKED_ALPHAREF);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_ALPHAREF, DX9MT_PACKED_COLORWRITEENABLE);
+DX9MT_PACKED_ASSERT_LAST(DX9MT_PACKED_COLORWRITEENABLE);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_CULLMODE, DX9MT_PACKED_SCISSORTESTENABLE);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_SCISSORTESTENABLE,
+                         DX9MT_PACKED_FOGENABLE);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_FOGENABLE, DX9MT_PACKED_FOGTABLEMODE);
+DX9MT_PACKED_ASSERT_LAST(DX9MT_PACKED_FOGTABLEMODE);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_MINFILTER, DX9MT_PACKED_MAGFILTER);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_MAGFILTER, DX9MT_PACKED_MIPFILTER);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_MIPFILTER, DX9MT_PACKED_ADDRESSU);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_ADDRESSU, DX9MT_PACKED_ADDRESSV);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_ADDRESSV, DX9MT_PACKED_ADDRESSW);
+DX9MT_PACKED_ASSERT_LAST(DX9MT_PACKED_ADDRESSW);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_COLOROP, DX9MT_PACKED_COLORARG1);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_COLORARG1, DX9MT_PACKED_COLORARG2);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_COLORARG2, DX9MT_PACKED_ALPHAOP);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_ALPHAOP, DX9MT_PACKED_ALPHAARG1);
+DX9MT_PACKED_ASSERT_NEXT(DX9MT_PACKED_ALPHAARG1, DX9MT_PACKED_ALPHAARG2);
+DX9MT_PACKED_ASSERT_LAST(DX9MT_PACKED_ALPHAARG2);
+
+static inline uint32_t dx9mt_packed_get(uint32_t word, uint32_t field) {
+  uint32_t mask = (1u << DX9MT_PACKED_FIELD_BITS(field)) - 1u;
+  return (word >> DX9MT_PACKED_FIELD_SHIFT(field)) & mask;
+}
+
+/* Returns `word` with `field` replaced by `value` (saturated or truncated). */
+static inline uint32_t dx9mt_packed_set(uint32_t word, uint32_t field,
+                                        uint32_t value) {
+  uint32_t mask = (1u << DX9MT_PACKED_FIELD_BITS(field)) - 1u;
+  uint32_t shift = DX9MT_PACKED_FIELD_SHIFT(field);
+
+  if ((field >> 16) != 0) {
+    value &= mask;
+  } else if (value > mask) {
+    value = mask;
+  }
+  return (word & ~(mask << shift)) | (value << shift);
+}
+
+/* D3DTA_* texture argument <-> 5-bit combiner argument. */
+static inline uint32_t dx9mt_packed_texture_arg(uint32_t d3d_arg) {
+  uint32_t selector = d3d_arg & 0x0Fu; /* D3DTA_SELECTMASK */
+
+  if (selector > 6u) { /* past D3DTA_CONSTANT */
+    selector = 7u;
+  }
+  return selector | ((d3d_arg & 0x30u) >> 1);
+}
+
+static inline uint32_t dx9mt_unpacked_texture_arg(uint32_t packed_arg) {
+  uint32_t selector = packed_arg & 0x7u;
+
+  return (selector == 7u ? 0x0Fu : selector) | ((packed_arg & 0x18u) << 1);
+}
+
+#endif
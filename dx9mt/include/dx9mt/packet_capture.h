@@ -0,0 +1,146 @@
+#ifndef DX9MT_PACKET_CAPTURE_H
+#define DX9MT_PACKET_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "dx9mt/backend_bridge.h"
+#include "dx9mt/packets.h"
+
+/*
+ * Packet-stream capture: every call the frontend makes into the backend
+ * bridge, plus the upload-arena bytes its packets reference, so the bridge
+ * can be replayed headless (src/tools/capture_replay.c).
+ *
+ * File: a dx9mt_capture_file_header, then records (dx9mt_capture_record +
+ * payload padded to 8 bytes) in call order:
+ *   INIT            dx9mt_capture_init; capture starts at bridge init
+ *                   because backend and viewer state is cumulative
+ *   PRESENT_TARGET  dx9mt_capture_present_target
+ *   UPLOAD          dx9mt_capture_upload + ref.size bytes, written before
+ *                   the PACKETS record whose refs cover them
+ *   PACKETS         one submit_packets() batch, verbatim
+ *   PRESENT         dx9mt_capture_present, after the bridge call
+ *   END             no payload; missing if the process died mid-capture
+ * All fields are fixed-width little endian. The header records the packet
+ * struct sizes; a reader rejects captures whose sizes differ from its own.
+ */
+#define DX9MT_CAPTURE_MAGIC 0x50433958u /* "X9CP" */
+#define DX9MT_CAPTURE_VERSION 3u
+/* Distinct upload refs remembered per frame to avoid rewriting payloads. */
+#define DX9MT_CAPTURE_SEEN_REFS 4096u
+
+enum dx9mt_capture_record_type {
+  DX9MT_CAPTURE_RECORD_INIT = 1,
+  DX9MT_CAPTURE_RECORD_PRESENT_TARGET = 2,
+  DX9MT_CAPTURE_RECORD_UPLOAD = 3,
+  DX9MT_CAPTURE_RECORD_PACKETS = 4,
+  DX9MT_CAPTURE_RECORD_PRESENT = 5,
+  DX9MT_CAPTURE_RECORD_END = 6,
+};
+
+typedef struct dx9mt_capture_file_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t header_bytes;
+  uint32_t packet_header_bytes;
+  uint32_t draw_bytes;
+  uint32_t draw_indexed_bytes;
+  uint32_t texture_stage_bytes;
+  uint32_t upload_ref_bytes;
+} dx9mt_capture_file_header;
+
+typedef struct dx9mt_capture_record {
+  uint32_t type;
+  uint32_t bytes; /* payload bytes, excluding padding */
+} dx9mt_capture_record;
+
+typedef struct dx9mt_capture_init {
+  uint32_t protocol_version;
+  uint32_t ring_capacity_bytes;
+  uint32_t slot_count;
+  uint32_t bytes_per_slot;
+  uint32_t packet_thread_mode;
+  uint32_t capabilities; /* offered DX9MT_PROTOCOL_CAP_* */
+} dx9mt_capture_init;
+
+typedef struct dx9mt_capture_present_target {
+  uint64_t target_id;
+  uint64_t window_handle;
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;
+  uint32_t windowed;
+} dx9mt_capture_present_target;
+
+typedef struct dx9mt_capture_upload {
+  dx9mt_upload_ref ref;
+  uint32_t _pad0;
+} dx9mt_capture_upload;
+
+typedef struct dx9mt_capture_present {
+  uint32_t frame_id;
+  int32_t result;       /* bridge present() return value */
+  uint32_t replay_hash; /* backend replay hash after the present */
+  uint32_t _pad0;
+} dx9mt_capture_present;
+
+_Static_assert(sizeof(dx9mt_capture_file_header) == 32, "capture header");
+_Static_assert(sizeof(dx9mt_capture_init) == 24, "capture init record");
+_Static_assert(sizeof(dx9mt_capture_present_target) == 32,
+               "capture present target record");
+_Static_assert(sizeof(dx9mt_capture_upload) == 16, "capture upload record");
+_Static_assert(sizeof(dx9mt_capture_present) == 16, "capture present record");
+
+typedef struct dx9mt_packet_capture_stats {
+  uint32_t frames;
+  uint32_t batches;
+  uint32_t uploads;
+  uint64_t packet_bytes;
+  uint64_t upload_bytes;
+} dx9mt_packet_capture_stats;
+
+/*
+ * Writer state, caller-owned. `resolve` maps upload refs to the bytes
+ * behind them (dx9mt_frontend_upload_resolve in the frontend). The file is
+ * closed after `frame_limit` presents, or on the first write error.
+ */
+typedef struct dx9mt_packet_capture {
+  FILE *file;
+  dx9mt_backend_upload_resolve_fn resolve;
+  uint32_t frame_limit;
+  dx9mt_packet_capture_stats stats;
+  dx9mt_upload_ref seen[DX9MT_CAPTURE_SEEN_REFS];
+} dx9mt_packet_capture;
+
+int dx9mt_packet_capture_open(dx9mt_packet_capture *capture, const char *path,
+                              uint32_t frame_limit,
+                              dx9mt_backend_upload_resolve_fn resolve);
+int dx9mt_packet_capture_active(const dx9mt_packet_capture *capture);
+void dx9mt_packet_capture_init(dx9mt_packet_capture *capture,
+                               const dx9mt_backend_init_desc *desc);
+void dx9mt_packet_capture_present_target(
+    dx9mt_packet_capture *capture,
+    const dx9mt_backend_present_target_desc *desc);
+/* Writes the payloads the batch references, then the batch itself. */
+void dx9mt_packet_capture_packets(dx9mt_packet_capture *capture,
+                                  const dx9mt_packet_header *packets,
+                                  uint32_t packet_bytes);
+void dx9mt_packet_capture_present(dx9mt_packet_capture *capture,
+                                  uint32_t frame_id, int result,
+                                  uint32_t replay_hash);
+void dx9mt_packet_capture_close(dx9mt_packet_capture *capture);
+
+/*
+ * Reader over a capture loaded into memory. check_header returns the
+ * offset of the first record, or 0 when the header is not one this build
+ * can replay. next returns the record at *cursor and advances past it, or
+ * NULL at the end of the data or on a truncated record.
+ */
+size_t dx9mt_packet_capture_check_header(const void *data, size_t bytes);
+const dx9mt_capture_record *dx9mt_packet_capture_next(const void *data,
+                                                      size_t bytes,
+                                                      size_t *cursor);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef DX9MT_PACKET_RING_H
+#define DX9MT_PACKET_RING_H
+
+#include <stdint.h>
+
+#include "dx9mt/packets.h"
+
+/* Receives a batch of whole packets; matches submit_packets(). */
+typedef int (*dx9mt_packet_ring_sink)(const dx9mt_packet_header *packets,
+                                      uint32_t packet_bytes);
+
+typedef struct dx9mt_packet_ring_stats {
+  uint32_t flushes;
+  uint32_t threshold_flushes; /* batch reached flush_threshold */
+  uint32_t pressure_flushes;  /* next packet did not fit */
+  uint32_t failed_flushes;    /* sink returned non-zero */
+  uint32_t max_batch_packets;
+  uint64_t packets;
+  uint64_t bytes;
+} dx9mt_packet_ring_stats;
+
+/*
+ * Frontend packet batch. Packets are appended back to back into
+ * caller-owned storage and handed to the sink in one call when the batch
+ * reaches flush_threshold, when the next packet would not fit, or on an
+ * explicit flush (Present). The whole batch drains per flush, so the
+ * storage is used linearly rather than wrapping.
+ *
+ * flush_threshold == 0 submits every append immediately (unbatched).
+ */
+typedef struct dx9mt_packet_ring {
+  unsigned char *bytes;
+  uint32_t capacity;
+  uint32_t used;
+  uint32_t packet_count;
+  uint32_t flush_threshold;
+  dx9mt_packet_ring_sink sink;
+  dx9mt_packet_ring_stats stats;
+} dx9mt_packet_ring;
+
+void dx9mt_packet_ring_init(dx9mt_packet_ring *ring, void *storage,
+                            uint32_t capacity, uint32_t flush_threshold,
+                            dx9mt_packet_ring_sink sink);
+
+/*
+ * Queues `packet_bytes` of whole packets. Returns the sink result of any
+ * flush this append triggered, 0 otherwise. Batches larger than the ring
+ * bypass it after the pending packets are flushed, keeping order.
+ */
+int dx9mt_packet_ring_append(dx9mt_packet_ring *ring,
+                             const dx9mt_packet_header *packets,
+                             uint32_t packet_bytes);
+
+int dx9mt_packet_ring_flush(dx9mt_packet_ring *ring);
+
+#endif
@@ -3,9 +3,47 @@
 
 #include <stdint.h>
 
+#include "dx9mt/packed_state.h"
 #include "dx9mt/upload_arena.h"
 
 #define DX9MT_MAX_PS_SAMPLERS 8
+/* Float4 registers per shader stage; a full constant block is 4096 bytes. */
+#define DX9MT_SHADER_FLOAT_CONSTANT_REGISTERS 256u
+#define DX9MT_SHADER_FLOAT_CONSTANT_BLOCK_BYTES                                  \
+  (DX9MT_SHADER_FLOAT_CONSTANT_REGISTERS * 16u)
+#define DX9MT_SHADER_INT_CONSTANT_REGISTERS 16u
+#define DX9MT_SHADER_BOOL_CONSTANT_REGISTERS 16u
+
+/*
+ * Bumped for any incompatible change to the packet layouts. Optional
+ * encodings are negotiated as capability bits instead. Packed render state
+ * (packed_state.h) is part of the layouts, not a cap: the unpacked fields
+ * are gone, so there is no fallback encoding to negotiate down to, and a
+ * frontend built against the other layout is refused at init.
+ */
+#define DX9MT_PROTOCOL_VERSION 2u
+
+/*
+ * Encodings the frontend offers in dx9mt_backend_init_desc.capabilities.
+ * The backend keeps the ones it supports and reports the agreed set via
+ * dx9mt_backend_bridge_capabilities(); the INIT packet carries it too. A
+ * bit that is not agreed selects the fallback noted beside it.
+ */
+enum dx9mt_protocol_caps {
+  /* STATE_* groups + slim DRAW; else one DRAW_INDEXED snapshot per draw. */
+  DX9MT_PROTOCOL_CAP_STATE_DELTA = 1u << 0,
+  /* Packets batched in the frontend ring; else one submit per packet. */
+  DX9MT_PROTOCOL_CAP_PACKET_BATCH = 1u << 1,
+  /* Packets parsed on a backend worker thread; else parsed inline. */
+  DX9MT_PROTOCOL_CAP_PACKET_THREAD = 1u << 2,
+  /*
+   * VB/IB contents as persistent-store updates (dx9mt_buffer_update with a
+   * generation) and shader bytecode by hash once the viewer has it; else
+   * each draw carries the vertex/index ranges it reads and its bytecode.
+   */
+  DX9MT_PROTOCOL_CAP_RESOURCE_HANDLES = 1u << 3,
+};
+#define DX9MT_PROTOCOL_CAPS_ALL 0x0000000Fu
 
 enum dx9mt_packet_type {
   DX9MT_PACKET_INVALID = 0,
@@ -16,8 +54,141 @@ enum dx9mt_packet_type {
   DX9MT_PACKET_SHUTDOWN = 5,
   DX9MT_PACKET_CLEAR = 6,
   DX9MT_PACKET_STRETCH_RECT = 7,
+  DX9MT_PACKET_STATE_DEPTH_STENCIL = 8,
+  DX9MT_PACKET_STATE_BLEND = 9,
+  DX9MT_PACKET_STATE_RASTER = 10,
+  DX9MT_PACKET_STATE_VIEWPORT = 11,
+  DX9MT_PACKET_STATE_SAMPLER = 12,
+  DX9MT_PACKET_STATE_TEXTURE_STAGE = 13,
+  DX9MT_PACKET_STATE_SHADER_CONTROL = 14,
+  DX9MT_PACKET_DRAW = 15,
 };
 
+/*
+ * State groups carried by the DX9MT_PACKET_STATE_* packets, as bits of a
+ * dirty/present mask. Samplers and texture stages take one bit per stage.
+ */
+enum dx9mt_state_group_bits {
+  DX9MT_STATE_GROUP_DEPTH_STENCIL = 1u << 0,
+  DX9MT_STATE_GROUP_BLEND = 1u << 1,
+  DX9MT_STATE_GROUP_RASTER = 1u << 2,
+  DX9MT_STATE_GROUP_VIEWPORT = 1u << 3,
+  DX9MT_STATE_GROUP_CONTROL_VS = 1u << 4,
+  DX9MT_STATE_GROUP_CONTROL_PS = 1u << 5,
+  DX9MT_STATE_GROUP_SAMPLER0 = 1u << 8,
+  DX9MT_STATE_GROUP_TEXTURE_STAGE0 = 1u << 16,
+};
+#define DX9MT_STATE_GROUP_ALL 0x00FFFF3Fu
+
+enum dx9mt_shader_stage {
+  DX9MT_SHADER_STAGE_VERTEX = 0,
+  DX9MT_SHADER_STAGE_PIXEL = 1,
+};
+
+/*
+ * Versioned VB/IB update for the persistent buffer store. generation is the
+ * contents version after the update is applied (0 = per-draw data, not
+ * cached). When the draw also carries vertex_data/index_data, those bytes
+ * land at [offset, offset + size) of a buffer_size-byte buffer: on top of a
+ * cached copy at base_generation, or into a fresh zeroed buffer when
+ * base_generation is 0. An empty ref means "reuse the cached copy".
+ */
+enum dx9mt_buffer_update_flags {
+  /* Only NOOVERWRITE locks since base_generation: patch in place. */
+  DX9MT_BUFFER_UPDATE_IN_PLACE = 1u << 0,
+};
+
+/*
+ * Integer (i#) and boolean (b#) constants for one shader stage. They drive
+ * rep/loop counts and static if b# branches. Bit n of b_mask is b#n. The
+ * layout matches the MSL struct the shader emitter declares (int4 i[16];
+ * ushort b), padded to its 16-byte alignment, so the viewer binds it as is.
+ */
+typedef struct dx9mt_shader_control_constants {
+  int32_t i[DX9MT_SHADER_INT_CONSTANT_REGISTERS][4];
+  uint16_t b_mask;
+  uint16_t _pad0[7];
+} dx9mt_shader_control_constants;
+
+/*
+ * Render state groups hold packed words (packed_state.h) plus the values
+ * that need their full width.
+ */
+typedef struct dx9mt_state_depth_stencil {
+  uint32_t depth;   /* DX9MT_PACKED_Z*, DX9MT_PACKED_STENCIL{ENABLE,FUNC,...} */
+  uint32_t stencil; /* DX9MT_PACKED_STENCILREF/MASK/WRITEMASK */
+} dx9mt_state_depth_stencil;
+
+typedef struct dx9mt_state_blend {
+  uint32_t blend;          /* dx9mt_packed_blend_field */
+  uint32_t texture_factor; /* fixed-function combiner constant */
+} dx9mt_state_blend;
+
+typedef struct dx9mt_state_raster {
+  uint32_t raster; /* dx9mt_packed_raster_field */
+  uint32_t fogcolor;
+  float fogstart;
+  float fogend;
+  float fogdensity;
+} dx9mt_state_raster;
+
+typedef struct dx9mt_state_viewport {
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+  float min_z;
+  float max_z;
+  int32_t scissor_left;
+  int32_t scissor_top;
+  int32_t scissor_right;
+  int32_t scissor_bottom;
+} dx9mt_state_viewport;
+
+typedef struct dx9mt_state_sampler {
+  uint32_t sampler; /* dx9mt_packed_sampler_field */
+} dx9mt_state_sampler;
+
+/*
+ * Bound texture plus that stage's combiner ops. tex_data is a one-shot
+ * attachment: the backend hands it to the next draw only, later draws in
+ * the same state resolve the texture from the viewer cache.
+ */
+typedef struct dx9mt_state_texture_stage {
+  uint32_t tex_id;
+  uint32_t tex_generation;
+  uint32_t tex_format;
+  uint32_t tex_width;
+  uint32_t tex_height;
+  uint32_t tex_pitch;
+  dx9mt_upload_ref tex_data;
+  uint32_t combiner; /* dx9mt_packed_combiner_field */
+} dx9mt_state_texture_stage;
+
+/*
+ * Everything replay needs from the render states and the stage-0 combiner,
+ * as carried by DRAW_INDEXED, backend draw commands and IPC draws. Sampler
+ * state rides next to it as one dx9mt_state_sampler word per stage.
+ */
+typedef struct dx9mt_packed_render_state {
+  dx9mt_state_depth_stencil depth_stencil;
+  dx9mt_state_blend blend;
+  dx9mt_state_raster raster;
+  uint32_t tss0_combiner; /* dx9mt_packed_combiner_field */
+} dx9mt_packed_render_state;
+
+_Static_assert(sizeof(dx9mt_state_sampler) == 4, "packed sampler word");
+_Static_assert(sizeof(dx9mt_packed_render_state) == 40,
+               "packed render state layout");
+
+typedef struct dx9mt_buffer_update {
+  uint32_t generation;
+  uint32_t base_generation;
+  uint32_t offset;
+  uint32_t buffer_size;
+  uint32_t flags;
+} dx9mt_buffer_update;
+
 typedef struct dx9mt_packet_header {
   uint16_t type;
   uint16_t size;
@@ -29,6 +200,7 @@ typedef struct dx9mt_packet_init {
   uint32_t protocol_version;
   uint32_t ring_capacity_bytes;
   dx9mt_upload_arena_desc upload_desc;
+  uint32_t capabilities; /* agreed DX9MT_PROTOCOL_CAP_* */
 } dx9mt_packet_init;
 
 typedef struct dx9mt_packet_begin_frame {
@@ -74,32 +246,21 @@ typedef struct dx9mt_packet_draw_indexed {
   uint32_t tex_pitch[DX9MT_MAX_PS_SAMPLERS];
   dx9mt_upload_ref tex_data[DX9MT_MAX_PS_SAMPLERS];
 
-  uint32_t sampler_min_filter[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_mag_filter[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_mip_filter[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_address_u[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_address_v[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_address_w[DX9MT_MAX_PS_SAMPLERS];
-
-  /* Stage-0 fixed-function combiner state (TSS path only) */
-  uint32_t tss0_color_op;
-  uint32_t tss0_color_arg1;
-  uint32_t tss0_color_arg2;
-  uint32_t tss0_alpha_op;
-  uint32_t tss0_alpha_arg1;
-  uint32_t tss0_alpha_arg2;
-  uint32_t rs_texture_factor;
-
-  /* RB3 Phase 2B: key render states for UI composition */
-  uint32_t rs_alpha_blend_enable;
-  uint32_t rs_src_blend;
-  uint32_t rs_dest_blend;
-  uint32_t rs_alpha_test_enable;
-  uint32_t rs_alpha_ref;
-  uint32_t rs_alpha_func;
+  dx9mt_state_sampler samplers[DX9MT_MAX_PS_SAMPLERS];
+  dx9mt_packed_render_state render_state;
 
+  /*
+   * Float constant deltas: the float4 registers written since the previous
+   * draw, starting at register constants_*_start. The first draw of a frame
+   * carries the whole block; a zero-size ref means "unchanged". The backend
+   * rebuilds full per-draw views from these.
+   */
   dx9mt_upload_ref constants_vs;
   dx9mt_upload_ref constants_ps;
+  uint16_t constants_vs_start;
+  uint16_t constants_ps_start;
+  dx9mt_shader_control_constants control_vs;
+  dx9mt_shader_control_constants control_ps;
 
   /* RB3: actual viewport/scissor values (previously only hashes) */
   uint32_t viewport_x;
@@ -123,40 +284,122 @@ typedef struct dx9mt_packet_draw_indexed {
   uint16_t vertex_decl_count;
   uint16_t _pad1;
 
-  /* RB3 Phase 3: shader bytecode for translation */
+  /* Persistent VB/IB store updates, cached under vertex/index_buffer_id */
+  dx9mt_buffer_update vertex_update;
+  dx9mt_buffer_update index_update;
+
+  /*
+   * RB3 Phase 3: shader bytecode for translation. The hashes are FNV-1a over
+   * the bytecode dwords (dx9mt_sm_bytecode_hash), computed once when the
+   * shader object is created. The bytecode refs are attached only on a
+   * shader's first draw and then on a slow refresh; other draws carry just
+   * the hash and resolve through the viewer's shader cache.
+   */
   dx9mt_upload_ref vs_bytecode;
   uint32_t vs_bytecode_dwords;
   dx9mt_upload_ref ps_bytecode;
   uint32_t ps_bytecode_dwords;
-
-  /* RB4: depth/stencil render states */
-  uint32_t rs_zenable;
-  uint32_t rs_zwriteenable;
-  uint32_t rs_zfunc;
-  uint32_t rs_stencilenable;
-  uint32_t rs_stencilfunc;
-  uint32_t rs_stencilref;
-  uint32_t rs_stencilmask;
-  uint32_t rs_stencilwritemask;
-
-  /* RB5: rasterizer state */
-  uint32_t rs_cull_mode;
-
-  /* RB6: in-game rendering states */
-  uint32_t rs_scissortestenable;
-  uint32_t rs_blendop;
-  uint32_t rs_colorwriteenable;
-  uint32_t rs_stencilpass;
-  uint32_t rs_stencilfail;
-  uint32_t rs_stencilzfail;
-  uint32_t rs_fogenable;
-  uint32_t rs_fogcolor;
-  float rs_fogstart;
-  float rs_fogend;
-  float rs_fogdensity;
-  uint32_t rs_fogtablemode;
+  uint32_t vs_bytecode_hash;
+  uint32_t ps_bytecode_hash;
 } dx9mt_packet_draw_indexed;
 
+/*
+ * Delta-encoded draw state. The frontend sends a state group only when it
+ * changed since the previous draw, and every group on the first draw of a
+ * frame. The backend keeps the current value of each group for the frame
+ * and expands DX9MT_PACKET_DRAW against it. DRAW_INDEXED stays a
+ * self-contained snapshot and does not touch that state.
+ */
+typedef struct dx9mt_packet_state_depth_stencil {
+  dx9mt_packet_header header;
+  dx9mt_state_depth_stencil state;
+} dx9mt_packet_state_depth_stencil;
+
+typedef struct dx9mt_packet_state_blend {
+  dx9mt_packet_header header;
+  dx9mt_state_blend state;
+} dx9mt_packet_state_blend;
+
+typedef struct dx9mt_packet_state_raster {
+  dx9mt_packet_header header;
+  dx9mt_state_raster state;
+} dx9mt_packet_state_raster;
+
+typedef struct dx9mt_packet_state_viewport {
+  dx9mt_packet_header header;
+  dx9mt_state_viewport state;
+} dx9mt_packet_state_viewport;
+
+typedef struct dx9mt_packet_state_sampler {
+  dx9mt_packet_header header;
+  uint32_t stage;
+  dx9mt_state_sampler state;
+} dx9mt_packet_state_sampler;
+
+typedef struct dx9mt_packet_state_texture_stage {
+  dx9mt_packet_header header;
+  uint32_t stage;
+  dx9mt_state_texture_stage state;
+} dx9mt_packet_state_texture_stage;
+
+typedef struct dx9mt_packet_state_shader_control {
+  dx9mt_packet_header header;
+  uint32_t shader_stage; /* enum dx9mt_shader_stage */
+  dx9mt_shader_control_constants constants;
+} dx9mt_packet_state_shader_control;
+
+/*
+ * Slim draw: only the per-draw call parameters, bindings and upload refs.
+ * Render, sampler and texture stage state come from the state groups.
+ */
+typedef struct dx9mt_packet_draw {
+  dx9mt_packet_header header;
+  uint32_t primitive_type;
+  int32_t base_vertex;
+  uint32_t min_vertex_index;
+  uint32_t num_vertices;
+  uint32_t start_index;
+  uint32_t primitive_count;
+  uint32_t render_target_id;
+  uint32_t depth_stencil_id;
+  uint32_t render_target_texture_id;
+  uint32_t render_target_width;
+  uint32_t render_target_height;
+  uint32_t render_target_format;
+  uint32_t vertex_buffer_id;
+  uint32_t index_buffer_id;
+  uint32_t vertex_decl_id;
+  uint32_t vertex_shader_id;
+  uint32_t pixel_shader_id;
+  uint32_t fvf;
+  uint32_t stream0_offset;
+  uint32_t stream0_stride;
+  uint32_t stream_binding_hash;
+
+  dx9mt_upload_ref constants_vs;
+  dx9mt_upload_ref constants_ps;
+  uint16_t constants_vs_start;
+  uint16_t constants_ps_start;
+
+  dx9mt_upload_ref vertex_data;
+  uint32_t vertex_data_size;
+  dx9mt_upload_ref index_data;
+  uint32_t index_data_size;
+  uint32_t index_format;
+  dx9mt_upload_ref vertex_decl_data;
+  uint16_t vertex_decl_count;
+  uint16_t _pad1;
+  dx9mt_buffer_update vertex_update;
+  dx9mt_buffer_update index_update;
+
+  dx9mt_upload_ref vs_bytecode;
+  uint32_t vs_bytecode_dwords;
+  dx9mt_upload_ref ps_bytecode;
+  uint32_t ps_bytecode_dwords;
+  uint32_t vs_bytecode_hash;
+  uint32_t ps_bytecode_hash;
+} dx9mt_packet_draw;
+
 typedef struct dx9mt_packet_present {
   dx9mt_packet_header header;
   uint32_t frame_id;
@@ -164,14 +407,30 @@ typedef struct dx9mt_packet_present {
   uint32_t render_target_id;
 } dx9mt_packet_present;
 
+/*
+ * One CLEAR per cleared rect, in call order with the draws. The frontend
+ * clips each Clear() rect to the viewport (and scissor, when enabled) and
+ * emits rect_count 0 when the result covers the whole render target, so the
+ * viewer can fold it into the next pass's load action.
+ */
 typedef struct dx9mt_packet_clear {
   dx9mt_packet_header header;
   uint32_t frame_id;
-  uint32_t rect_count;
+  uint32_t rect_count; /* 0: whole target, 1: rect_* below */
   uint32_t flags;
   uint32_t color;
   float z;
   uint32_t stencil;
+  uint32_t render_target_id;
+  uint32_t render_target_texture_id;
+  uint32_t render_target_width;
+  uint32_t render_target_height;
+  uint32_t render_target_format;
+  uint32_t depth_stencil_id;
+  int32_t rect_left;
+  int32_t rect_top;
+  int32_t rect_right;
+  int32_t rect_bottom;
 } dx9mt_packet_clear;
 
 typedef struct dx9mt_packet_stretch_rect {
@@ -215,5 +474,9 @@ _Static_assert(sizeof(dx9mt_packet_clear) <= UINT16_MAX,
                "packet_clear exceeds uint16 size field");
 _Static_assert(sizeof(dx9mt_packet_stretch_rect) <= UINT16_MAX,
                "packet_stretch_rect exceeds uint16 size field");
+_Static_assert(sizeof(dx9mt_packet_state_shader_control) <= UINT16_MAX,
+               "packet_state_shader_control exceeds uint16 size field");
+_Static_assert(sizeof(dx9mt_packet_draw) <= UINT16_MAX,
+               "packet_draw exceeds uint16 size field");
 
 #endif
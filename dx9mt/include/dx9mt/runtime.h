@@ -3,8 +3,30 @@
 
 #include <stdint.h>
 
+#include "dx9mt/backend_bridge.h"
+#include "dx9mt/packet_ring.h"
+
 void dx9mt_runtime_ensure_initialized(void);
+/* DX9MT_PROTOCOL_CAP_* agreed with the backend at initialization. */
+uint32_t dx9mt_runtime_protocol_caps(void);
 uint32_t dx9mt_runtime_next_packet_sequence(void);
+
+/*
+ * Queues packets in the frontend packet ring. They reach the backend in
+ * order, batched, no later than the next dx9mt_runtime_flush_packets().
+ * Flush before any direct backend call that must observe them (present).
+ */
+int dx9mt_runtime_submit_packets(const dx9mt_packet_header *packets,
+                                 uint32_t packet_bytes);
+int dx9mt_runtime_flush_packets(void);
+/*
+ * Bridge calls that bypass the packet ring. present() flushes first. Both
+ * are recorded when a packet capture is running.
+ */
+int dx9mt_runtime_update_present_target(
+    const dx9mt_backend_present_target_desc *desc);
+int dx9mt_runtime_present(uint32_t frame_id);
+void dx9mt_runtime_get_packet_stats(dx9mt_packet_ring_stats *out_stats);
 void dx9mt_runtime_shutdown(void);
 
 #endif
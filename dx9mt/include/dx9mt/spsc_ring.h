@@ -0,0 +1,50 @@
+#ifndef DX9MT_SPSC_RING_H
+#define DX9MT_SPSC_RING_H
+
+#include <stdint.h>
+
+enum {
+  DX9MT_SPSC_RING_RECORD_HEADER_BYTES = 8,
+  DX9MT_SPSC_RING_CACHE_LINE = 64,
+};
+
+/*
+ * Lock-free single-producer/single-consumer byte ring of variable-size
+ * records. Every record is contiguous in memory (a record that would cross
+ * the end is preceded by a pad record and starts at offset 0), so the
+ * consumer can parse it in place.
+ *
+ * `head` is written only by the producer and `tail` only by the consumer;
+ * both are free-running byte counters published with release stores.
+ * Waiting is the caller's business: try_push/peek never block.
+ */
+typedef struct dx9mt_spsc_ring {
+  unsigned char *bytes;
+  uint32_t capacity; /* power of two, multiple of 8 */
+  _Alignas(DX9MT_SPSC_RING_CACHE_LINE) uint32_t head;
+  _Alignas(DX9MT_SPSC_RING_CACHE_LINE) uint32_t tail;
+  uint32_t consumer_pending; /* bytes the current peek will release */
+} dx9mt_spsc_ring;
+
+/* Returns 0 when capacity is not a power of two >= 64. */
+int dx9mt_spsc_ring_init(dx9mt_spsc_ring *ring, void *storage,
+                         uint32_t capacity);
+
+/* Largest payload try_push can always place, even on a wrapped ring. */
+uint32_t dx9mt_spsc_ring_max_record(const dx9mt_spsc_ring *ring);
+
+/* Producer. Returns 1 when queued, 0 when the ring is too full right now. */
+int dx9mt_spsc_ring_try_push(dx9mt_spsc_ring *ring, const void *data,
+                             uint32_t bytes);
+
+/*
+ * Consumer. Returns the oldest record, or NULL when empty. The pointer
+ * stays valid until dx9mt_spsc_ring_pop() hands the space back.
+ */
+const void *dx9mt_spsc_ring_peek(dx9mt_spsc_ring *ring, uint32_t *out_bytes);
+void dx9mt_spsc_ring_pop(dx9mt_spsc_ring *ring);
+
+/* Either side; a snapshot that may be stale by the time it returns. */
+int dx9mt_spsc_ring_empty(const dx9mt_spsc_ring *ring);
+
+#endif
@@ -3,9 +3,24 @@
 
 #include <stdint.h>
 
+/*
+ * Each slot is a chain of chunks. The first chunk stays committed across
+ * frames; overflow chunks are committed on demand and released when the
+ * slot is reused. Upload ref offsets are slot-relative: chunk N starts where
+ * chunk N-1's capacity ends, so BYTES_PER_SLOT is the address-space cap a
+ * frame may grow to, not memory committed up front.
+ */
+/*
+ * Slots are reused only once the backend's retirement fence has passed the
+ * present that consumed them. The frontend starts with SLOTS in rotation
+ * and adds slots (up to MAX_SLOTS) before it stalls on an in-flight one.
+ */
 enum {
   DX9MT_UPLOAD_ARENA_SLOTS = 3,
-  DX9MT_UPLOAD_ARENA_BYTES_PER_SLOT = 256u << 20,
+  DX9MT_UPLOAD_ARENA_MAX_SLOTS = 6,
+  DX9MT_UPLOAD_ARENA_CHUNK_BYTES = 32u << 20,
+  DX9MT_UPLOAD_ARENA_BYTES_PER_SLOT = 1u << 30,
+  DX9MT_UPLOAD_ARENA_USAGE_HISTORY = 256,
 };
 
 /*
@@ -23,11 +38,48 @@ typedef struct dx9mt_upload_ref {
   uint32_t size;
 } dx9mt_upload_ref;
 
+/*
+ * Whether an upload the viewer caches across frames must be sent whole at
+ * frame_id: it never was (sent_frame_id 0), frame ids went backwards, its
+ * last send predates resync_frame_id (the frame that saw the viewer's
+ * resync counter change, see dx9mt_backend_bridge_viewer_resync()), or it
+ * is refresh_interval frames old.
+ */
+static inline int dx9mt_upload_resend_due(uint32_t sent_frame_id,
+                                          uint32_t frame_id,
+                                          uint32_t resync_frame_id,
+                                          uint32_t refresh_interval) {
+  return sent_frame_id == 0 || sent_frame_id > frame_id ||
+         sent_frame_id < resync_frame_id ||
+         frame_id - sent_frame_id >= refresh_interval;
+}
+
 typedef struct dx9mt_upload_arena_desc {
   uint32_t slot_count;
   uint32_t bytes_per_slot;
 } dx9mt_upload_arena_desc;
 
+/*
+ * Arena telemetry. Frame usage is the sum of aligned payload bytes a frame
+ * copied; percentiles cover the last DX9MT_UPLOAD_ARENA_USAGE_HISTORY frames.
+ */
+typedef struct dx9mt_upload_arena_stats {
+  uint32_t frames_sampled;
+  uint32_t peak_frame_bytes;
+  uint32_t p50_frame_bytes;
+  uint32_t p95_frame_bytes;
+  uint32_t p99_frame_bytes;
+  uint32_t slot_high_water[DX9MT_UPLOAD_ARENA_MAX_SLOTS];
+  uint32_t committed_bytes;
+  uint32_t overflow_chunks;
+  uint32_t failed_copies;
+  uint32_t active_slots;
+  uint32_t stall_count;
+  uint32_t stall_max_us;
+  uint64_t stall_total_us;
+  uint32_t fence_timeouts;
+} dx9mt_upload_arena_stats;
+
 /*
  * Resolve an upload ref to a read-only data pointer. Returns NULL if
  * the ref is invalid or the arena is not available. Only valid in the
@@ -35,4 +87,10 @@ typedef struct dx9mt_upload_arena_desc {
  */
 const void *dx9mt_frontend_upload_resolve(const dx9mt_upload_ref *ref);
 
+/*
+ * Snapshot arena telemetry. Frontend process only; zeroed when the arena
+ * has not been touched yet.
+ */
+void dx9mt_frontend_upload_get_stats(dx9mt_upload_arena_stats *out);
+
 #endif
@@ -0,0 +1,58 @@
+#ifndef DX9MT_UPLOAD_DEDUP_H
+#define DX9MT_UPLOAD_DEDUP_H
+
+#include <stdint.h>
+
+enum {
+  /* Open-addressed entries per upload slot; must be a power of two. */
+  DX9MT_UPLOAD_DEDUP_CAPACITY = 4096,
+  /*
+   * Payloads above this size skip dedup. Hashing never beats copying
+   * (see upload_dedup_bench), and large VB/IB contents already go through
+   * the persistent buffer store, so only small repeated blocks qualify.
+   */
+  DX9MT_UPLOAD_DEDUP_MAX_BYTES = 64u << 10,
+};
+
+typedef struct dx9mt_upload_dedup_entry {
+  uint64_t hash;
+  const unsigned char *bytes; /* resident copy, valid until reset */
+  uint32_t offset;
+  uint32_t size;
+} dx9mt_upload_dedup_entry;
+
+/*
+ * Content-addressed index over one upload slot: payload hash -> offset of
+ * the bytes already written this frame. Reset whenever the slot is reused.
+ * Lookups compare the stored bytes, so a hash collision is only a miss.
+ */
+typedef struct dx9mt_upload_dedup_table {
+  uint32_t count;
+  dx9mt_upload_dedup_entry entries[DX9MT_UPLOAD_DEDUP_CAPACITY];
+} dx9mt_upload_dedup_table;
+
+typedef struct dx9mt_upload_dedup_stats {
+  uint32_t hits;
+  uint32_t misses;
+  uint64_t bytes_saved;
+} dx9mt_upload_dedup_stats;
+
+uint64_t dx9mt_upload_dedup_hash(const void *data, uint32_t size);
+void dx9mt_upload_dedup_reset(dx9mt_upload_dedup_table *table);
+
+/*
+ * Returns 1 and stores the slot offset when `data` was already recorded.
+ */
+int dx9mt_upload_dedup_find(const dx9mt_upload_dedup_table *table,
+                            uint64_t hash, const void *data, uint32_t size,
+                            uint32_t *out_offset);
+
+/*
+ * Records a freshly copied payload. Silently drops the entry once the table
+ * is 3/4 full; the upload itself still succeeds, it just cannot be shared.
+ */
+void dx9mt_upload_dedup_insert(dx9mt_upload_dedup_table *table, uint64_t hash,
+                               const unsigned char *bytes, uint32_t offset,
+                               uint32_t size);
+
+#endif
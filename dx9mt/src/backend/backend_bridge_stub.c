@@ -1,3 +1,7 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "dx9mt/backend_bridge.h"
 
 #include <stddef.h>
@@ -9,10 +13,20 @@
 #define WIN32_LEAN_AND_MEAN
 #endif
 #include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
+#include "dx9mt/draw_state.h"
 #include "dx9mt/log.h"
 #include "dx9mt/metal_ipc.h"
+#include "dx9mt/upload_dedup.h"
+#include "packet_thread.h"
+#include "present_thread.h"
+#include "worker_pool.h"
 
 #if defined(__APPLE__) && !defined(DX9MT_NO_METAL)
 #include "metal_presenter.h"
@@ -21,16 +35,48 @@
 /*
  * Shared-memory IPC for PE DLL -> native Metal viewer.
  * Under Wine (_WIN32), the PE DLL maps a file and writes frame data
- * that the standalone native viewer process reads and renders.
+ * that the standalone native viewer process reads and renders. Native
+ * hosts (capture replay) map DX9MT_BACKEND_IPC_PATH instead.
  */
 #ifdef _WIN32
 static HANDLE g_metal_ipc_file = INVALID_HANDLE_VALUE;
 static HANDLE g_metal_ipc_mapping = NULL;
+static const dx9mt_backend_upload_resolve_fn g_default_upload_resolve =
+    dx9mt_frontend_upload_resolve;
+#else
+static int g_metal_ipc_fd = -1;
+static const dx9mt_backend_upload_resolve_fn g_default_upload_resolve = NULL;
+#endif
 static dx9mt_metal_frame_data *g_metal_ipc_ptr = NULL;
+static uint32_t g_metal_ipc_map_bytes = 0;
 static uint32_t g_metal_ipc_sequence = 0;
-#endif
+static int g_metal_ipc_zero_copy = 0;
+static dx9mt_backend_ipc_stats g_ipc_stats;
+static dx9mt_backend_upload_resolve_fn g_upload_resolve;
+static int g_ipc_static_frames = 1;
+static int g_ipc_draw_delta = 1;
+static int g_ipc_frame_ring;
+/* Whether the last frame went to the ring; entering it resets the slots. */
+static int g_ipc_ring_active;
+static uint32_t g_ipc_ring_slot; /* slot of the frame being written */
+/*
+ * The frame being written: the whole region at g_metal_ipc_ptr, or one
+ * ring slot. Control fields (repeat_count, viewer_*, ring_*) always
+ * stay on g_metal_ipc_ptr.
+ */
+static dx9mt_metal_ipc_header *g_ipc_frame;
+static uint32_t g_ipc_frame_bytes;
+/* Frames the present worker may hold; 0 serializes inside present(). */
+static uint32_t g_frames_in_flight;
+/* Full frames with fewer draws are serialized on one thread. */
+#define DX9MT_BACKEND_IPC_PARALLEL_MIN_DRAWS 256u
+
+/* Every optional encoding this backend can parse or write. */
+#define DX9MT_BACKEND_PROTOCOL_CAPS DX9MT_PROTOCOL_CAPS_ALL
+#define DX9MT_BACKEND_IPC_CAPS DX9MT_METAL_IPC_CAPS_ALL
 
 static int g_backend_ready;
+static uint32_t g_protocol_caps;
 static uint32_t g_last_frame_id;
 static uint32_t g_frame_packet_count;
 static uint32_t g_frame_draw_indexed_count;
@@ -51,6 +97,8 @@ static int g_soft_present = -1;
 static int g_metal_present = -1;
 static dx9mt_upload_arena_desc g_upload_desc;
 static uint32_t g_last_replay_hash;
+static uint32_t g_completed_fence;
+static uint32_t g_submit_errors;
 
 typedef struct dx9mt_backend_frame_snapshot {
   uint32_t frame_id;
@@ -68,96 +116,59 @@ typedef struct dx9mt_backend_frame_snapshot {
   uint32_t replay_draw_count;
 } dx9mt_backend_frame_snapshot;
 
+/*
+ * The IPC state groups too large to copy into every command: the i#/b#
+ * control blocks and the bound texture set. Each replay frame keeps a table
+ * of its blocks per group, in the order draws used them, and a command
+ * holds an index into it. A draw whose block matches the previous draw's
+ * reuses that index, so a block is copied and hashed once per change
+ * rather than once per draw. The arrays double on demand and are kept for
+ * later frames.
+ */
+#define DX9MT_BACKEND_REPLAY_FIRST_GROUP DX9MT_METAL_IPC_STATE_CONTROL_VS
+#define DX9MT_BACKEND_REPLAY_GROUPS                                             \
+  (DX9MT_METAL_IPC_STATE_GROUPS - DX9MT_BACKEND_REPLAY_FIRST_GROUP)
+
+typedef struct dx9mt_backend_block_table {
+  unsigned char *blocks;
+  uint32_t *hashes;
+  uint32_t count;
+  uint32_t capacity;
+} dx9mt_backend_block_table;
+
+/*
+ * One recorded command. `draw` is its IPC table entry, filled in once when
+ * the command is recorded; its bulk offsets, sizes and state indices stay
+ * zero until the entry is serialized, so publishing it is a struct copy.
+ * The rest is backend-only: state hashes, the state blocks serialization
+ * interns and the upload refs it stages.
+ */
 typedef struct dx9mt_backend_draw_command {
-  uint32_t command_type;
+  dx9mt_metal_ipc_draw draw;
+
   uint32_t state_block_hash;
-  uint32_t primitive_type;
-  int32_t base_vertex;
-  uint32_t min_vertex_index;
-  uint32_t num_vertices;
-  uint32_t start_index;
-  uint32_t primitive_count;
-  uint32_t render_target_id;
-  uint32_t depth_stencil_id;
-  uint32_t render_target_texture_id;
-  uint32_t render_target_width;
-  uint32_t render_target_height;
-  uint32_t render_target_format;
-  uint32_t src_surface_id;
-  uint32_t src_texture_id;
-  uint32_t src_width;
-  uint32_t src_height;
-  uint32_t src_format;
-  int32_t src_left;
-  int32_t src_top;
-  int32_t src_right;
-  int32_t src_bottom;
-  int32_t dst_left;
-  int32_t dst_top;
-  int32_t dst_right;
-  int32_t dst_bottom;
-  uint32_t stretch_filter;
-  uint32_t vertex_buffer_id;
-  uint32_t index_buffer_id;
   uint32_t vertex_decl_id;
-  uint32_t vertex_shader_id;
-  uint32_t pixel_shader_id;
-  uint32_t fvf;
-  uint32_t stream0_offset;
-  uint32_t stream0_stride;
   uint32_t viewport_hash;
   uint32_t scissor_hash;
   uint32_t texture_stage_hash;
   uint32_t sampler_state_hash;
   uint32_t stream_binding_hash;
 
-  /* RB5: multi-texture stage arrays (stages 0..7) */
-  uint32_t tex_id[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t tex_generation[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t tex_format[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t tex_width[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t tex_height[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t tex_pitch[DX9MT_MAX_PS_SAMPLERS];
+  dx9mt_packed_render_state render_state;
+  dx9mt_metal_ipc_sampler_set samplers;
+
   dx9mt_upload_ref tex_data[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_min_filter[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_mag_filter[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_mip_filter[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_address_u[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_address_v[DX9MT_MAX_PS_SAMPLERS];
-  uint32_t sampler_address_w[DX9MT_MAX_PS_SAMPLERS];
-
-  uint32_t tss0_color_op;
-  uint32_t tss0_color_arg1;
-  uint32_t tss0_color_arg2;
-  uint32_t tss0_alpha_op;
-  uint32_t tss0_alpha_arg1;
-  uint32_t tss0_alpha_arg2;
-  uint32_t rs_texture_factor;
-  uint32_t rs_alpha_blend_enable;
-  uint32_t rs_src_blend;
-  uint32_t rs_dest_blend;
-  uint32_t rs_alpha_test_enable;
-  uint32_t rs_alpha_ref;
-  uint32_t rs_alpha_func;
   dx9mt_upload_ref constants_vs;
   dx9mt_upload_ref constants_ps;
-
-  uint32_t viewport_x;
-  uint32_t viewport_y;
-  uint32_t viewport_width;
-  uint32_t viewport_height;
-  float viewport_min_z;
-  float viewport_max_z;
-  int32_t scissor_left;
-  int32_t scissor_top;
-  int32_t scissor_right;
-  int32_t scissor_bottom;
+  uint16_t constants_vs_start;
+  uint16_t constants_ps_start;
+  /* Index into the frame's table of each DX9MT_BACKEND_REPLAY_GROUPS group */
+  uint32_t block[DX9MT_BACKEND_REPLAY_GROUPS];
 
   dx9mt_upload_ref vertex_data;
   uint32_t vertex_data_size;
   dx9mt_upload_ref index_data;
   uint32_t index_data_size;
-  uint32_t index_format;
   dx9mt_upload_ref vertex_decl_data;
   uint16_t vertex_decl_count;
   uint16_t _pad1;
@@ -167,36 +178,17 @@ typedef struct dx9mt_backend_draw_command {
   uint32_t vs_bytecode_dwords;
   dx9mt_upload_ref ps_bytecode;
   uint32_t ps_bytecode_dwords;
-
-  /* RB4: depth/stencil render states */
-  uint32_t rs_zenable;
-  uint32_t rs_zwriteenable;
-  uint32_t rs_zfunc;
-  uint32_t rs_stencilenable;
-  uint32_t rs_stencilfunc;
-  uint32_t rs_stencilref;
-  uint32_t rs_stencilmask;
-  uint32_t rs_stencilwritemask;
-
-  /* RB5: rasterizer state */
-  uint32_t rs_cull_mode;
-
-  /* RB6: in-game rendering states */
-  uint32_t rs_scissortestenable;
-  uint32_t rs_blendop;
-  uint32_t rs_colorwriteenable;
-  uint32_t rs_stencilpass;
-  uint32_t rs_stencilfail;
-  uint32_t rs_stencilzfail;
-  uint32_t rs_fogenable;
-  uint32_t rs_fogcolor;
-  float rs_fogstart;
-  float rs_fogend;
-  float rs_fogdensity;
-  uint32_t rs_fogtablemode;
 } dx9mt_backend_draw_command;
 
-#define DX9MT_BACKEND_MAX_DRAW_COMMANDS_PER_FRAME 8192u
+/*
+ * Replay commands live in fixed-size chunks allocated on first use and kept
+ * for later frames, so memory follows the heaviest frame seen rather than a
+ * worst-case array. The chunk table only bounds a runaway frame.
+ */
+#define DX9MT_BACKEND_DRAW_CHUNK_COMMANDS 256u
+#define DX9MT_BACKEND_MAX_DRAW_CHUNKS 256u
+#define DX9MT_BACKEND_MAX_DRAW_COMMANDS_PER_FRAME                               \
+  (DX9MT_BACKEND_DRAW_CHUNK_COMMANDS * DX9MT_BACKEND_MAX_DRAW_CHUNKS)
 
 typedef struct dx9mt_backend_frame_replay_state {
   uint32_t frame_id;
@@ -204,36 +196,168 @@ typedef struct dx9mt_backend_frame_replay_state {
   uint32_t draw_stored;
   uint32_t draw_dropped;
   int have_clear;
-  dx9mt_packet_clear last_clear_packet;
   int have_present_packet;
   uint32_t present_packet_frame_id;
   uint32_t present_render_target_id;
-  dx9mt_backend_draw_command
-      draws[DX9MT_BACKEND_MAX_DRAW_COMMANDS_PER_FRAME];
+  /* Everything from here on survives the per-frame reset. */
+  uint32_t chunk_count;
+  dx9mt_backend_draw_command *chunks[DX9MT_BACKEND_MAX_DRAW_CHUNKS];
+  dx9mt_backend_block_table tables[DX9MT_BACKEND_REPLAY_GROUPS];
 } dx9mt_backend_frame_replay_state;
 
 static dx9mt_backend_frame_snapshot g_current_frame_snapshot;
 static dx9mt_backend_frame_snapshot g_last_presented_snapshot;
+/*
+ * The frame being recorded. With async present it rotates through the
+ * pool: a presented frame's state goes to the worker, and recording moves
+ * to the state of the oldest frame the worker has finished.
+ */
 static dx9mt_backend_frame_replay_state *g_frame_replay_state;
+static dx9mt_backend_frame_replay_state
+    *g_replay_pool[DX9MT_BACKEND_MAX_FRAMES_IN_FLIGHT + 1];
+static uint32_t g_replay_index;
+
+/* A presented frame waiting for, or being serialized by, the worker. */
+typedef struct dx9mt_backend_present_job {
+  uint32_t frame_id;
+  dx9mt_backend_frame_snapshot snapshot;
+  const dx9mt_backend_frame_replay_state *replay;
+} dx9mt_backend_present_job;
+
+static dx9mt_backend_present_job
+    g_present_jobs[DX9MT_BACKEND_MAX_FRAMES_IN_FLIGHT];
+/* State groups for the open frame; reset with it, so each frame starts
+ * from the frontend's keyframe. */
+static dx9mt_draw_state g_draw_state;
+
+/* The constant deltas one IPC table entry applies, in register units. */
+typedef struct dx9mt_backend_ipc_constant_key {
+  uint16_t vs_start;
+  uint16_t ps_start;
+  uint32_t vs_size;
+  uint32_t ps_size;
+} dx9mt_backend_ipc_constant_key;
+
+/* One frame's constant deltas; their bytes follow each other in `bytes`. */
+typedef struct dx9mt_backend_ipc_constant_log {
+  dx9mt_backend_ipc_constant_key *keys;
+  unsigned char *bytes;
+  uint32_t used;
+  uint32_t capacity; /* bytes */
+} dx9mt_backend_ipc_constant_log;
+
+/*
+ * The frame published in the IPC file, kept so the next present can be
+ * sent as a repeat (DX9MT_METAL_IPC_CAP_REPEAT_FRAME) or as a change list
+ * (DX9MT_METAL_IPC_CAP_DRAW_DELTA). Its entries and state blocks are read
+ * back from where they were published; logs[published] holds its constant
+ * deltas, which the file only has folded into blocks, and the other log is
+ * filled for the frame being assembled. The per-entry arrays start at
+ * MIN_ENTRIES and double with the draw count.
+ */
+#define DX9MT_BACKEND_IPC_HISTORY_MIN_ENTRIES 64u
+#define DX9MT_BACKEND_IPC_HISTORY_MIN_CONSTANT_BYTES 4096u
+
+typedef struct dx9mt_backend_ipc_history {
+  int valid;
+  int self_contained; /* no payload left in the upload arena */
+  uint32_t draw_count;
+  uint32_t globals_hash;
+  uint32_t bulk_offset;
+  uint32_t bulk_used;
+  uint32_t published;
+  const dx9mt_metal_ipc_header *frame; /* where it was published */
+  uint32_t capacity; /* entries in `changed` and in each log's keys */
+  unsigned char *changed; /* entries of the frame being assembled */
+  dx9mt_backend_ipc_constant_log logs[2];
+} dx9mt_backend_ipc_history;
+
+static dx9mt_backend_ipc_history *g_ipc_history;
+
+/*
+ * One table entry of a full frame serialized by the worker pool. The
+ * sizing pass walks the draws in order and records where each one's
+ * payloads start in bulk, so the fill pass can write any draw range
+ * independently. Constant blocks and interned state are running state and
+ * are settled by the sizing pass itself. The plan grows like the history.
+ */
+typedef struct dx9mt_backend_ipc_draw_plan {
+  uint32_t command;         /* replay command index */
+  uint32_t bulk_used;       /* bulk->used before the draw's payloads */
+  uint32_t constants_bytes; /* bulk taken by blocks the draw staged */
+  uint32_t vs_constants_bulk_offset;
+  uint32_t vs_constants_size;
+  uint32_t ps_constants_bulk_offset;
+  uint32_t ps_constants_size;
+  uint16_t state_index[DX9MT_METAL_IPC_STATE_GROUPS];
+} dx9mt_backend_ipc_draw_plan;
+
+static dx9mt_backend_ipc_draw_plan *g_ipc_plan;
+static uint32_t g_ipc_plan_capacity;
+
+/*
+ * State blocks interned for the published frame, one table per
+ * dx9mt_metal_ipc_state_group. A full frame starts the tables over; a
+ * delta frame only appends, so the entries it leaves alone keep valid
+ * indices. Slots map block hashes to indices and carry the epoch of the
+ * frame that filled them, so starting over does not clear them.
+ *
+ * A table starts at MIN_BLOCKS and doubles when it fills, so memory
+ * follows the distinct blocks frames use, not their draw count. Growing
+ * keeps every index.
+ */
+#define DX9MT_BACKEND_IPC_STATE_MIN_BLOCKS 64u
+#define DX9MT_BACKEND_IPC_STATE_MAX_BLOCKS                                      \
+  DX9MT_BACKEND_MAX_DRAW_COMMANDS_PER_FRAME
+
+_Static_assert(DX9MT_BACKEND_IPC_STATE_MAX_BLOCKS <= 65536u,
+               "state indices are 16 bits");
+
+typedef struct dx9mt_backend_ipc_states {
+  uint32_t epoch; /* 1..65535, in the top half of filled slots */
+  uint32_t count[DX9MT_METAL_IPC_STATE_GROUPS];
+  uint32_t published[DX9MT_METAL_IPC_STATE_GROUPS]; /* blocks in the file */
+  uint32_t table_offset[DX9MT_METAL_IPC_STATE_GROUPS];
+  uint32_t capacity[DX9MT_METAL_IPC_STATE_GROUPS]; /* slots hold twice this */
+  uint32_t *slots[DX9MT_METAL_IPC_STATE_GROUPS];
+  unsigned char *blocks[DX9MT_METAL_IPC_STATE_GROUPS];
+} dx9mt_backend_ipc_states;
+
+static dx9mt_backend_ipc_states *g_ipc_states;
+
+static dx9mt_backend_frame_replay_state *dx9mt_backend_replay_alloc(void) {
+  dx9mt_backend_frame_replay_state *state;
 
-static dx9mt_backend_frame_replay_state *dx9mt_backend_replay_ensure(void) {
-  if (!g_frame_replay_state) {
 #if defined(_WIN32)
-    g_frame_replay_state = (dx9mt_backend_frame_replay_state *)VirtualAlloc(
-        NULL, sizeof(dx9mt_backend_frame_replay_state), MEM_COMMIT | MEM_RESERVE,
-        PAGE_READWRITE);
+  state = (dx9mt_backend_frame_replay_state *)VirtualAlloc(
+      NULL, sizeof(dx9mt_backend_frame_replay_state), MEM_COMMIT | MEM_RESERVE,
+      PAGE_READWRITE);
 #else
-    g_frame_replay_state = (dx9mt_backend_frame_replay_state *)calloc(
-        1, sizeof(dx9mt_backend_frame_replay_state));
+  state = (dx9mt_backend_frame_replay_state *)calloc(
+      1, sizeof(dx9mt_backend_frame_replay_state));
 #endif
-    if (!g_frame_replay_state) {
-      dx9mt_logf("backend", "FATAL: alloc failed for replay state (%u bytes)",
-                 (unsigned)sizeof(dx9mt_backend_frame_replay_state));
-    }
+  if (!state) {
+    dx9mt_logf("backend", "FATAL: alloc failed for replay state (%u bytes)",
+               (unsigned)sizeof(dx9mt_backend_frame_replay_state));
+  }
+  return state;
+}
+
+static dx9mt_backend_frame_replay_state *dx9mt_backend_replay_ensure(void) {
+  if (!g_replay_pool[g_replay_index]) {
+    g_replay_pool[g_replay_index] = dx9mt_backend_replay_alloc();
   }
+  g_frame_replay_state = g_replay_pool[g_replay_index];
   return g_frame_replay_state;
 }
 
+static dx9mt_backend_draw_command *
+dx9mt_backend_replay_command(const dx9mt_backend_frame_replay_state *state,
+                             uint32_t index) {
+  return &state->chunks[index / DX9MT_BACKEND_DRAW_CHUNK_COMMANDS]
+                       [index % DX9MT_BACKEND_DRAW_CHUNK_COMMANDS];
+}
+
 static const char *dx9mt_packet_type_name(uint16_t type) {
   switch (type) {
   case DX9MT_PACKET_INIT:
@@ -250,6 +374,22 @@ static const char *dx9mt_packet_type_name(uint16_t type) {
     return "CLEAR";
   case DX9MT_PACKET_STRETCH_RECT:
     return "STRETCH_RECT";
+  case DX9MT_PACKET_STATE_DEPTH_STENCIL:
+    return "STATE_DEPTH_STENCIL";
+  case DX9MT_PACKET_STATE_BLEND:
+    return "STATE_BLEND";
+  case DX9MT_PACKET_STATE_RASTER:
+    return "STATE_RASTER";
+  case DX9MT_PACKET_STATE_VIEWPORT:
+    return "STATE_VIEWPORT";
+  case DX9MT_PACKET_STATE_SAMPLER:
+    return "STATE_SAMPLER";
+  case DX9MT_PACKET_STATE_TEXTURE_STAGE:
+    return "STATE_TEXTURE_STAGE";
+  case DX9MT_PACKET_STATE_SHADER_CONTROL:
+    return "STATE_SHADER_CONTROL";
+  case DX9MT_PACKET_DRAW:
+    return "DRAW";
   default:
     return "UNKNOWN";
   }
@@ -261,6 +401,20 @@ static uint32_t dx9mt_backend_hash_u32(uint32_t hash, uint32_t value) {
   return hash;
 }
 
+/* State group structs are whole uint32_t/float fields. */
+static uint32_t dx9mt_backend_hash_words(uint32_t hash, const void *data,
+                                         uint32_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  uint32_t offset;
+
+  for (offset = 0; offset + 4u <= size; offset += 4u) {
+    uint32_t word;
+    memcpy(&word, bytes + offset, sizeof(word));
+    hash = dx9mt_backend_hash_u32(hash, word);
+  }
+  return hash;
+}
+
 static uint32_t dx9mt_backend_hash_upload_ref(uint32_t hash,
                                               const dx9mt_upload_ref *ref) {
   if (!ref) {
@@ -274,108 +428,117 @@ static uint32_t dx9mt_backend_hash_upload_ref(uint32_t hash,
 }
 
 static uint32_t
-dx9mt_backend_draw_command_hash(const dx9mt_backend_draw_command *command) {
+dx9mt_backend_hash_buffer_update(uint32_t hash,
+                                 const dx9mt_buffer_update *update) {
+  hash = dx9mt_backend_hash_u32(hash, update->generation);
+  hash = dx9mt_backend_hash_u32(hash, update->base_generation);
+  hash = dx9mt_backend_hash_u32(hash, update->offset);
+  hash = dx9mt_backend_hash_u32(hash, update->buffer_size);
+  hash = dx9mt_backend_hash_u32(hash, update->flags);
+  return hash;
+}
+
+/*
+ * Without ref locations an upload ref only contributes its size, so the same
+ * frame hashes the same whichever arena slot its payloads landed in.
+ */
+static uint32_t dx9mt_backend_hash_command_ref(uint32_t hash,
+                                               const dx9mt_upload_ref *ref,
+                                               int with_location) {
+  return with_location ? dx9mt_backend_hash_upload_ref(hash, ref)
+                       : dx9mt_backend_hash_u32(hash, ref->size);
+}
+
+/* A draw's control and texture blocks enter through their table hashes. */
+static uint32_t
+dx9mt_backend_command_hash(const dx9mt_backend_frame_replay_state *state,
+                           const dx9mt_backend_draw_command *command,
+                           int with_ref_locations) {
+  const dx9mt_metal_ipc_draw *d;
   uint32_t hash = 2166136261u;
 
   if (!command) {
     return 0;
   }
+  d = &command->draw;
 
-  hash = dx9mt_backend_hash_u32(hash, command->command_type);
+  hash = dx9mt_backend_hash_u32(hash, d->command_type);
   hash = dx9mt_backend_hash_u32(hash, command->state_block_hash);
-  hash = dx9mt_backend_hash_u32(hash, command->primitive_type);
-  hash = dx9mt_backend_hash_u32(hash, (uint32_t)command->base_vertex);
-  hash = dx9mt_backend_hash_u32(hash, command->min_vertex_index);
-  hash = dx9mt_backend_hash_u32(hash, command->num_vertices);
-  hash = dx9mt_backend_hash_u32(hash, command->start_index);
-  hash = dx9mt_backend_hash_u32(hash, command->primitive_count);
-  hash = dx9mt_backend_hash_u32(hash, command->render_target_id);
-  hash = dx9mt_backend_hash_u32(hash, command->depth_stencil_id);
-  hash = dx9mt_backend_hash_u32(hash, command->render_target_texture_id);
-  hash = dx9mt_backend_hash_u32(hash, command->render_target_width);
-  hash = dx9mt_backend_hash_u32(hash, command->render_target_height);
-  hash = dx9mt_backend_hash_u32(hash, command->render_target_format);
-  hash = dx9mt_backend_hash_u32(hash, command->src_surface_id);
-  hash = dx9mt_backend_hash_u32(hash, command->src_texture_id);
-  hash = dx9mt_backend_hash_u32(hash, command->src_width);
-  hash = dx9mt_backend_hash_u32(hash, command->src_height);
-  hash = dx9mt_backend_hash_u32(hash, command->src_format);
-  hash = dx9mt_backend_hash_u32(hash, (uint32_t)command->src_left);
-  hash = dx9mt_backend_hash_u32(hash, (uint32_t)command->src_top);
-  hash = dx9mt_backend_hash_u32(hash, (uint32_t)command->src_right);
-  hash = dx9mt_backend_hash_u32(hash, (uint32_t)command->src_bottom);
-  hash = dx9mt_backend_hash_u32(hash, (uint32_t)command->dst_left);
-  hash = dx9mt_backend_hash_u32(hash, (uint32_t)command->dst_top);
-  hash = dx9mt_backend_hash_u32(hash, (uint32_t)command->dst_right);
-  hash = dx9mt_backend_hash_u32(hash, (uint32_t)command->dst_bottom);
-  hash = dx9mt_backend_hash_u32(hash, command->stretch_filter);
-  hash = dx9mt_backend_hash_u32(hash, command->vertex_buffer_id);
-  hash = dx9mt_backend_hash_u32(hash, command->index_buffer_id);
+  hash = dx9mt_backend_hash_u32(hash, d->primitive_type);
+  hash = dx9mt_backend_hash_u32(hash, (uint32_t)d->base_vertex);
+  hash = dx9mt_backend_hash_u32(hash, d->min_vertex_index);
+  hash = dx9mt_backend_hash_u32(hash, d->num_vertices);
+  hash = dx9mt_backend_hash_u32(hash, d->start_index);
+  hash = dx9mt_backend_hash_u32(hash, d->primitive_count);
+  hash = dx9mt_backend_hash_u32(hash, d->render_target_id);
+  hash = dx9mt_backend_hash_u32(hash, d->depth_stencil_id);
+  hash = dx9mt_backend_hash_u32(hash, d->render_target_texture_id);
+  hash = dx9mt_backend_hash_u32(hash, d->render_target_width);
+  hash = dx9mt_backend_hash_u32(hash, d->render_target_height);
+  hash = dx9mt_backend_hash_u32(hash, d->render_target_format);
+  hash = dx9mt_backend_hash_u32(hash, d->src_surface_id);
+  hash = dx9mt_backend_hash_u32(hash, d->src_texture_id);
+  hash = dx9mt_backend_hash_u32(hash, d->src_width);
+  hash = dx9mt_backend_hash_u32(hash, d->src_height);
+  hash = dx9mt_backend_hash_u32(hash, d->src_format);
+  hash = dx9mt_backend_hash_u32(hash, (uint32_t)d->src_left);
+  hash = dx9mt_backend_hash_u32(hash, (uint32_t)d->src_top);
+  hash = dx9mt_backend_hash_u32(hash, (uint32_t)d->src_right);
+  hash = dx9mt_backend_hash_u32(hash, (uint32_t)d->src_bottom);
+  hash = dx9mt_backend_hash_u32(hash, (uint32_t)d->dst_left);
+  hash = dx9mt_backend_hash_u32(hash, (uint32_t)d->dst_top);
+  hash = dx9mt_backend_hash_u32(hash, (uint32_t)d->dst_right);
+  hash = dx9mt_backend_hash_u32(hash, (uint32_t)d->dst_bottom);
+  hash = dx9mt_backend_hash_u32(hash, d->stretch_filter);
+  hash = dx9mt_backend_hash_u32(hash, d->clear_flags);
+  hash = dx9mt_backend_hash_u32(hash, d->clear_color_argb);
+  hash = dx9mt_backend_hash_words(hash, &d->clear_z,
+                                  sizeof(d->clear_z));
+  hash = dx9mt_backend_hash_u32(hash, d->clear_stencil);
+  hash = dx9mt_backend_hash_u32(hash, d->vertex_buffer_id);
+  hash = dx9mt_backend_hash_u32(hash, d->index_buffer_id);
+  hash = dx9mt_backend_hash_buffer_update(hash, &d->vertex_update);
+  hash = dx9mt_backend_hash_buffer_update(hash, &d->index_update);
   hash = dx9mt_backend_hash_u32(hash, command->vertex_decl_id);
-  hash = dx9mt_backend_hash_u32(hash, command->vertex_shader_id);
-  hash = dx9mt_backend_hash_u32(hash, command->pixel_shader_id);
-  hash = dx9mt_backend_hash_u32(hash, command->fvf);
-  hash = dx9mt_backend_hash_u32(hash, command->stream0_offset);
-  hash = dx9mt_backend_hash_u32(hash, command->stream0_stride);
+  hash = dx9mt_backend_hash_u32(hash, d->vertex_shader_id);
+  hash = dx9mt_backend_hash_u32(hash, d->pixel_shader_id);
+  hash = dx9mt_backend_hash_u32(hash, d->fvf);
+  hash = dx9mt_backend_hash_u32(hash, d->stream0_offset);
+  hash = dx9mt_backend_hash_u32(hash, d->stream0_stride);
   hash = dx9mt_backend_hash_u32(hash, command->viewport_hash);
   hash = dx9mt_backend_hash_u32(hash, command->scissor_hash);
   hash = dx9mt_backend_hash_u32(hash, command->texture_stage_hash);
   hash = dx9mt_backend_hash_u32(hash, command->sampler_state_hash);
   hash = dx9mt_backend_hash_u32(hash, command->stream_binding_hash);
   for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
-    hash = dx9mt_backend_hash_u32(hash, command->tex_id[s]);
-    hash = dx9mt_backend_hash_u32(hash, command->tex_generation[s]);
-    hash = dx9mt_backend_hash_u32(hash, command->tex_format[s]);
-    hash = dx9mt_backend_hash_u32(hash, command->tex_width[s]);
-    hash = dx9mt_backend_hash_u32(hash, command->tex_height[s]);
-    hash = dx9mt_backend_hash_u32(hash, command->tex_pitch[s]);
-    hash = dx9mt_backend_hash_upload_ref(hash, &command->tex_data[s]);
-    hash = dx9mt_backend_hash_u32(hash, command->sampler_min_filter[s]);
-    hash = dx9mt_backend_hash_u32(hash, command->sampler_mag_filter[s]);
-    hash = dx9mt_backend_hash_u32(hash, command->sampler_mip_filter[s]);
-    hash = dx9mt_backend_hash_u32(hash, command->sampler_address_u[s]);
-    hash = dx9mt_backend_hash_u32(hash, command->sampler_address_v[s]);
-    hash = dx9mt_backend_hash_u32(hash, command->sampler_address_w[s]);
-  }
-  hash = dx9mt_backend_hash_u32(hash, command->tss0_color_op);
-  hash = dx9mt_backend_hash_u32(hash, command->tss0_color_arg1);
-  hash = dx9mt_backend_hash_u32(hash, command->tss0_color_arg2);
-  hash = dx9mt_backend_hash_u32(hash, command->tss0_alpha_op);
-  hash = dx9mt_backend_hash_u32(hash, command->tss0_alpha_arg1);
-  hash = dx9mt_backend_hash_u32(hash, command->tss0_alpha_arg2);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_texture_factor);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_alpha_blend_enable);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_src_blend);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_dest_blend);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_alpha_test_enable);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_alpha_ref);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_alpha_func);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_zenable);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_zwriteenable);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_zfunc);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_stencilenable);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_stencilfunc);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_stencilref);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_stencilmask);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_stencilwritemask);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_cull_mode);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_scissortestenable);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_blendop);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_colorwriteenable);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_stencilpass);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_stencilfail);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_stencilzfail);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_fogenable);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_fogcolor);
-  hash = dx9mt_backend_hash_u32(hash, *(const uint32_t *)&command->rs_fogstart);
-  hash = dx9mt_backend_hash_u32(hash, *(const uint32_t *)&command->rs_fogend);
-  hash = dx9mt_backend_hash_u32(hash, *(const uint32_t *)&command->rs_fogdensity);
-  hash = dx9mt_backend_hash_u32(hash, command->rs_fogtablemode);
-  hash = dx9mt_backend_hash_upload_ref(hash, &command->constants_vs);
-  hash = dx9mt_backend_hash_upload_ref(hash, &command->constants_ps);
+    hash = dx9mt_backend_hash_command_ref(hash, &command->tex_data[s],
+                                          with_ref_locations);
+  }
+  hash = dx9mt_backend_hash_words(hash, &command->samplers,
+                                  sizeof(command->samplers));
+  hash = dx9mt_backend_hash_words(hash, &command->render_state,
+                                  sizeof(command->render_state));
+  hash = dx9mt_backend_hash_command_ref(hash, &command->constants_vs,
+                                        with_ref_locations);
+  hash = dx9mt_backend_hash_command_ref(hash, &command->constants_ps,
+                                        with_ref_locations);
+  hash = dx9mt_backend_hash_u32(hash, command->constants_vs_start);
+  hash = dx9mt_backend_hash_u32(hash, command->constants_ps_start);
+  if (d->command_type == DX9MT_METAL_IPC_COMMAND_DRAW) {
+    for (uint32_t g = 0; g < DX9MT_BACKEND_REPLAY_GROUPS; ++g) {
+      hash = dx9mt_backend_hash_u32(
+          hash, state->tables[g].hashes[command->block[g]]);
+    }
+  }
   return hash;
 }
 
+static uint32_t
+dx9mt_backend_draw_command_hash(const dx9mt_backend_frame_replay_state *state,
+                                const dx9mt_backend_draw_command *command) {
+  return dx9mt_backend_command_hash(state, command, 1);
+}
+
 static uint32_t dx9mt_backend_compute_frame_replay_hash(
     const dx9mt_backend_frame_replay_state *state) {
   uint32_t hash = 2166136261u;
@@ -391,7 +554,8 @@ static uint32_t dx9mt_backend_compute_frame_replay_hash(
   hash = dx9mt_backend_hash_u32(hash, state->draw_dropped);
   for (i = 0; i < state->draw_stored; ++i) {
     hash = dx9mt_backend_hash_u32(
-        hash, dx9mt_backend_draw_command_hash(&state->draws[i]));
+        hash, dx9mt_backend_draw_command_hash(
+                  state, dx9mt_backend_replay_command(state, i)));
   }
   return hash;
 }
@@ -434,8 +598,74 @@ static int dx9mt_backend_soft_present_enabled(void) {
 
   return g_soft_present;
 }
+
+/* Zero-copy IPC uploads default ON when the IPC file has room for them. */
+static int dx9mt_backend_ipc_zero_copy_enabled(void) {
+  const char *value = getenv("DX9MT_BACKEND_IPC_ZERO_COPY");
+
+  if (value && (*value == '0' || strcmp(value, "false") == 0 ||
+                strcmp(value, "FALSE") == 0 || strcmp(value, "off") == 0 ||
+                strcmp(value, "OFF") == 0 || strcmp(value, "no") == 0 ||
+                strcmp(value, "NO") == 0)) {
+    return 0;
+  }
+  return 1;
+}
 #endif
 
+/* Optional IPC encodings default ON; setting `name` to 0 turns one off. */
+static int dx9mt_backend_ipc_encoding_enabled(const char *name) {
+  const char *value = getenv(name);
+
+  if (value && (*value == '0' || strcmp(value, "false") == 0 ||
+                strcmp(value, "FALSE") == 0 || strcmp(value, "off") == 0 ||
+                strcmp(value, "OFF") == 0 || strcmp(value, "no") == 0 ||
+                strcmp(value, "NO") == 0)) {
+    return 0;
+  }
+  return 1;
+}
+
+/* DX9MT_BACKEND_FRAMES_IN_FLIGHT=N queues presents to a worker. */
+static uint32_t dx9mt_backend_frames_in_flight_config(void) {
+  const char *value = getenv("DX9MT_BACKEND_FRAMES_IN_FLIGHT");
+  char *end = NULL;
+  unsigned long frames;
+
+  if (!value || !*value) {
+    return 0;
+  }
+  frames = strtoul(value, &end, 0);
+  if (end == value) {
+    return 0;
+  }
+  return frames > DX9MT_BACKEND_MAX_FRAMES_IN_FLIGHT
+             ? DX9MT_BACKEND_MAX_FRAMES_IN_FLIGHT
+             : (uint32_t)frames;
+}
+
+/*
+ * DX9MT_BACKEND_IPC_THREADS=N splits full IPC frames across N threads.
+ * The default is 1: the two-pass split has only been measured on a
+ * single-CPU host, where it is slower.
+ */
+static uint32_t dx9mt_backend_ipc_threads_config(void) {
+  const char *value = getenv("DX9MT_BACKEND_IPC_THREADS");
+  char *end = NULL;
+  unsigned long threads;
+
+  if (!value || !*value) {
+    return 1;
+  }
+  threads = strtoul(value, &end, 0);
+  if (end == value || threads == 0) {
+    return 1;
+  }
+  return threads > DX9MT_WORKER_POOL_MAX_THREADS
+             ? DX9MT_WORKER_POOL_MAX_THREADS
+             : (uint32_t)threads;
+}
+
 #if defined(__APPLE__) && !defined(DX9MT_NO_METAL)
 static int dx9mt_backend_metal_present_enabled(void) {
   const char *value;
@@ -492,8 +722,9 @@ static void dx9mt_backend_soft_present_draw_replay_preview(
     RECT cell;
     uint32_t row = i / cells_per_row;
     uint32_t col = i % cells_per_row;
-    uint32_t draw_hash =
-        dx9mt_backend_draw_command_hash(&g_frame_replay_state->draws[i]);
+    uint32_t draw_hash = dx9mt_backend_draw_command_hash(
+        g_frame_replay_state,
+        dx9mt_backend_replay_command(g_frame_replay_state, i));
     COLORREF color = RGB((draw_hash >> 16) & 0xffu, (draw_hash >> 8) & 0xffu,
                          (draw_hash ^ frame_id) & 0xffu);
     HBRUSH brush;
@@ -656,6 +887,58 @@ static int dx9mt_backend_validate_upload_ref(const dx9mt_upload_ref *ref,
   return 1;
 }
 
+/*
+ * Constant refs are deltas: empty means unchanged, otherwise whole float4
+ * registers that must fit inside the 256-register block.
+ */
+static int dx9mt_backend_validate_constant_delta(const dx9mt_upload_ref *ref,
+                                                 uint32_t start_register,
+                                                 const char *name,
+                                                 uint32_t sequence) {
+  if (ref->size == 0) {
+    return 1;
+  }
+  if (!dx9mt_backend_validate_upload_ref(ref, name, sequence)) {
+    return 0;
+  }
+  if ((ref->size & 15u) != 0 ||
+      start_register >= DX9MT_SHADER_FLOAT_CONSTANT_REGISTERS ||
+      ref->size > DX9MT_SHADER_FLOAT_CONSTANT_BLOCK_BYTES -
+                      start_register * 16u) {
+    dx9mt_logf("backend",
+               "constant delta invalid for %s: start=%u size=%u seq=%u", name,
+               start_register, ref->size, sequence);
+    return 0;
+  }
+  return 1;
+}
+
+static int dx9mt_backend_validate_buffer_update(
+    const dx9mt_buffer_update *update, uint32_t data_size, const char *name,
+    uint32_t sequence) {
+  if (update->generation != 0 &&
+      !(g_protocol_caps & DX9MT_PROTOCOL_CAP_RESOURCE_HANDLES)) {
+    dx9mt_logf("backend",
+               "buffer update for %s without resource handles: gen=%u seq=%u",
+               name, update->generation, sequence);
+    return 0;
+  }
+  if (update->generation == 0 || data_size == 0) {
+    return 1;
+  }
+  if (data_size > update->buffer_size ||
+      update->offset > update->buffer_size - data_size ||
+      update->base_generation == update->generation) {
+    dx9mt_logf(
+        "backend",
+        "buffer update invalid for %s: gen=%u base=%u offset=%u size=%u buffer=%u seq=%u",
+        name, update->generation, update->base_generation, update->offset,
+        data_size, update->buffer_size, sequence);
+    return 0;
+  }
+  return 1;
+}
+
 static void dx9mt_backend_reset_frame_stats(void) {
   g_frame_packet_count = 0;
   g_frame_draw_indexed_count = 0;
@@ -695,127 +978,210 @@ static void dx9mt_backend_reset_frame_replay_state(uint32_t frame_id) {
   if (!g_frame_replay_state) {
     return;
   }
-  memset(g_frame_replay_state, 0, sizeof(*g_frame_replay_state));
+  memset(g_frame_replay_state, 0,
+         offsetof(dx9mt_backend_frame_replay_state, chunk_count));
+  for (uint32_t g = 0; g < DX9MT_BACKEND_REPLAY_GROUPS; ++g) {
+    g_frame_replay_state->tables[g].count = 0;
+  }
   g_frame_replay_state->frame_id = frame_id;
+  dx9mt_draw_state_reset(&g_draw_state);
+}
+
+static dx9mt_backend_draw_command *dx9mt_backend_alloc_draw_chunk(void) {
+  size_t bytes = DX9MT_BACKEND_DRAW_CHUNK_COMMANDS *
+                 sizeof(dx9mt_backend_draw_command);
+#if defined(_WIN32)
+  return (dx9mt_backend_draw_command *)VirtualAlloc(
+      NULL, bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+  return (dx9mt_backend_draw_command *)malloc(bytes);
+#endif
+}
+
+/* Appends a zeroed replay command, growing the chunk list when needed. */
+static dx9mt_backend_draw_command *
+dx9mt_backend_next_command(uint32_t command_type) {
+  dx9mt_backend_frame_replay_state *state = g_frame_replay_state;
+  uint32_t chunk = state->draw_stored / DX9MT_BACKEND_DRAW_CHUNK_COMMANDS;
+  dx9mt_backend_draw_command *command;
+
+  ++state->draw_total;
+  if (chunk < DX9MT_BACKEND_MAX_DRAW_CHUNKS && chunk == state->chunk_count) {
+    state->chunks[chunk] = dx9mt_backend_alloc_draw_chunk();
+    if (state->chunks[chunk]) {
+      ++state->chunk_count;
+    } else {
+      dx9mt_logf("backend", "draw chunk alloc failed (%u commands stored)",
+                 state->draw_stored);
+    }
+  }
+  if (chunk >= state->chunk_count) {
+    ++state->draw_dropped;
+    if (state->draw_dropped == 1 || (state->draw_dropped % 256u) == 0u) {
+      dx9mt_logf("backend",
+                 "draw command capture overflow frame=%u total=%u dropped=%u",
+                 state->frame_id, state->draw_total, state->draw_dropped);
+    }
+    return NULL;
+  }
+
+  command = dx9mt_backend_replay_command(state, state->draw_stored++);
+  memset(command, 0, sizeof(*command));
+  command->draw.command_type = command_type;
+  return command;
+}
+
+/*
+ * Index of `block` in the frame's table for `group`: the previous draw's
+ * when it matches, a new entry otherwise. Returns 0 when the table cannot
+ * grow.
+ */
+static int dx9mt_backend_record_block(uint32_t group, const void *block,
+                                      uint32_t *out_index) {
+  dx9mt_backend_block_table *table =
+      &g_frame_replay_state->tables[group - DX9MT_BACKEND_REPLAY_FIRST_GROUP];
+  uint32_t bytes = dx9mt_metal_ipc_state_entry_bytes(group);
+
+  if (table->count > 0 &&
+      memcmp(table->blocks + (size_t)(table->count - 1) * bytes, block,
+             bytes) == 0) {
+    *out_index = table->count - 1;
+    return 1;
+  }
+  if (table->count == table->capacity) {
+    uint32_t capacity = table->capacity ? table->capacity * 2u : 64u;
+    unsigned char *blocks =
+        (unsigned char *)realloc(table->blocks, (size_t)capacity * bytes);
+    uint32_t *hashes;
+
+    if (!blocks) {
+      dx9mt_logf("backend", "replay table %u alloc failed (%u blocks)", group,
+                 capacity);
+      return 0;
+    }
+    table->blocks = blocks;
+    hashes = (uint32_t *)realloc(table->hashes,
+                                 (size_t)capacity * sizeof(*hashes));
+    if (!hashes) {
+      dx9mt_logf("backend", "replay table %u alloc failed (%u blocks)", group,
+                 capacity);
+      return 0;
+    }
+    table->hashes = hashes;
+    table->capacity = capacity;
+  }
+  memcpy(table->blocks + (size_t)table->count * bytes, block, bytes);
+  table->hashes[table->count] =
+      dx9mt_backend_hash_words(2166136261u, block, bytes);
+  *out_index = table->count++;
+  return 1;
+}
+
+/*
+ * Records a new draw command's replay blocks. When a table cannot grow the
+ * command is taken back and counted as dropped, and 0 is returned.
+ */
+static int dx9mt_backend_record_draw_blocks(
+    dx9mt_backend_draw_command *command,
+    const dx9mt_shader_control_constants *control_vs,
+    const dx9mt_shader_control_constants *control_ps,
+    const dx9mt_metal_ipc_texture_set *textures) {
+  if (dx9mt_backend_record_block(DX9MT_METAL_IPC_STATE_CONTROL_VS, control_vs,
+                                 &command->block[0]) &&
+      dx9mt_backend_record_block(DX9MT_METAL_IPC_STATE_CONTROL_PS, control_ps,
+                                 &command->block[1]) &&
+      dx9mt_backend_record_block(DX9MT_METAL_IPC_STATE_TEXTURES, textures,
+                                 &command->block[2])) {
+    return 1;
+  }
+  --g_frame_replay_state->draw_stored;
+  ++g_frame_replay_state->draw_dropped;
+  return 0;
 }
 
 static void
 dx9mt_backend_record_draw_command(const dx9mt_packet_draw_indexed *draw_packet) {
   dx9mt_backend_draw_command *command;
+  dx9mt_metal_ipc_draw *d;
+  dx9mt_metal_ipc_texture_set textures;
 
   if (!draw_packet) {
     return;
   }
 
-  ++g_frame_replay_state->draw_total;
-  if (g_frame_replay_state->draw_stored >=
-      DX9MT_BACKEND_MAX_DRAW_COMMANDS_PER_FRAME) {
-    ++g_frame_replay_state->draw_dropped;
-    if (g_frame_replay_state->draw_dropped == 1 ||
-        (g_frame_replay_state->draw_dropped % 256u) == 0u) {
-      dx9mt_logf("backend",
-                 "draw command capture overflow frame=%u total=%u dropped=%u",
-                 g_frame_replay_state->frame_id, g_frame_replay_state->draw_total,
-                 g_frame_replay_state->draw_dropped);
-    }
+  command = dx9mt_backend_next_command(DX9MT_METAL_IPC_COMMAND_DRAW);
+  if (!command) {
+    return;
+  }
+  for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
+    textures.stage[s].id = draw_packet->tex_id[s];
+    textures.stage[s].generation = draw_packet->tex_generation[s];
+    textures.stage[s].format = draw_packet->tex_format[s];
+    textures.stage[s].width = draw_packet->tex_width[s];
+    textures.stage[s].height = draw_packet->tex_height[s];
+    textures.stage[s].pitch = draw_packet->tex_pitch[s];
+  }
+  if (!dx9mt_backend_record_draw_blocks(command, &draw_packet->control_vs,
+                                        &draw_packet->control_ps,
+                                        &textures)) {
     return;
   }
+  d = &command->draw;
+  d->primitive_type = draw_packet->primitive_type;
+  d->base_vertex = draw_packet->base_vertex;
+  d->min_vertex_index = draw_packet->min_vertex_index;
+  d->num_vertices = draw_packet->num_vertices;
+  d->start_index = draw_packet->start_index;
+  d->primitive_count = draw_packet->primitive_count;
+  d->render_target_id = draw_packet->render_target_id;
+  d->depth_stencil_id = draw_packet->depth_stencil_id;
+  d->render_target_texture_id = draw_packet->render_target_texture_id;
+  d->render_target_width = draw_packet->render_target_width;
+  d->render_target_height = draw_packet->render_target_height;
+  d->render_target_format = draw_packet->render_target_format;
+  d->vertex_buffer_id = draw_packet->vertex_buffer_id;
+  d->index_buffer_id = draw_packet->index_buffer_id;
+  d->vertex_shader_id = draw_packet->vertex_shader_id;
+  d->pixel_shader_id = draw_packet->pixel_shader_id;
+  d->fvf = draw_packet->fvf;
+  d->stream0_offset = draw_packet->stream0_offset;
+  d->stream0_stride = draw_packet->stream0_stride;
+  d->tss0_combiner = draw_packet->render_state.tss0_combiner;
+  d->viewport_x = draw_packet->viewport_x;
+  d->viewport_y = draw_packet->viewport_y;
+  d->viewport_width = draw_packet->viewport_width;
+  d->viewport_height = draw_packet->viewport_height;
+  d->viewport_min_z = draw_packet->viewport_min_z;
+  d->viewport_max_z = draw_packet->viewport_max_z;
+  d->scissor_left = draw_packet->scissor_left;
+  d->scissor_top = draw_packet->scissor_top;
+  d->scissor_right = draw_packet->scissor_right;
+  d->scissor_bottom = draw_packet->scissor_bottom;
+  d->index_format = draw_packet->index_format;
+  d->vertex_update = draw_packet->vertex_update;
+  d->index_update = draw_packet->index_update;
+  d->vs_bytecode_hash = draw_packet->vs_bytecode_hash;
+  d->ps_bytecode_hash = draw_packet->ps_bytecode_hash;
 
-  command = &g_frame_replay_state->draws[g_frame_replay_state->draw_stored++];
-  memset(command, 0, sizeof(*command));
-  command->command_type = DX9MT_METAL_IPC_COMMAND_DRAW;
   command->state_block_hash = draw_packet->state_block_hash;
-  command->primitive_type = draw_packet->primitive_type;
-  command->base_vertex = draw_packet->base_vertex;
-  command->min_vertex_index = draw_packet->min_vertex_index;
-  command->num_vertices = draw_packet->num_vertices;
-  command->start_index = draw_packet->start_index;
-  command->primitive_count = draw_packet->primitive_count;
-  command->render_target_id = draw_packet->render_target_id;
-  command->depth_stencil_id = draw_packet->depth_stencil_id;
-  command->render_target_texture_id = draw_packet->render_target_texture_id;
-  command->render_target_width = draw_packet->render_target_width;
-  command->render_target_height = draw_packet->render_target_height;
-  command->render_target_format = draw_packet->render_target_format;
-  command->vertex_buffer_id = draw_packet->vertex_buffer_id;
-  command->index_buffer_id = draw_packet->index_buffer_id;
   command->vertex_decl_id = draw_packet->vertex_decl_id;
-  command->vertex_shader_id = draw_packet->vertex_shader_id;
-  command->pixel_shader_id = draw_packet->pixel_shader_id;
-  command->fvf = draw_packet->fvf;
-  command->stream0_offset = draw_packet->stream0_offset;
-  command->stream0_stride = draw_packet->stream0_stride;
   command->viewport_hash = draw_packet->viewport_hash;
   command->scissor_hash = draw_packet->scissor_hash;
   command->texture_stage_hash = draw_packet->texture_stage_hash;
   command->sampler_state_hash = draw_packet->sampler_state_hash;
   command->stream_binding_hash = draw_packet->stream_binding_hash;
-  for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
-    command->tex_id[s] = draw_packet->tex_id[s];
-    command->tex_generation[s] = draw_packet->tex_generation[s];
-    command->tex_format[s] = draw_packet->tex_format[s];
-    command->tex_width[s] = draw_packet->tex_width[s];
-    command->tex_height[s] = draw_packet->tex_height[s];
-    command->tex_pitch[s] = draw_packet->tex_pitch[s];
-    command->tex_data[s] = draw_packet->tex_data[s];
-    command->sampler_min_filter[s] = draw_packet->sampler_min_filter[s];
-    command->sampler_mag_filter[s] = draw_packet->sampler_mag_filter[s];
-    command->sampler_mip_filter[s] = draw_packet->sampler_mip_filter[s];
-    command->sampler_address_u[s] = draw_packet->sampler_address_u[s];
-    command->sampler_address_v[s] = draw_packet->sampler_address_v[s];
-    command->sampler_address_w[s] = draw_packet->sampler_address_w[s];
-  }
-  command->tss0_color_op = draw_packet->tss0_color_op;
-  command->tss0_color_arg1 = draw_packet->tss0_color_arg1;
-  command->tss0_color_arg2 = draw_packet->tss0_color_arg2;
-  command->tss0_alpha_op = draw_packet->tss0_alpha_op;
-  command->tss0_alpha_arg1 = draw_packet->tss0_alpha_arg1;
-  command->tss0_alpha_arg2 = draw_packet->tss0_alpha_arg2;
-  command->rs_texture_factor = draw_packet->rs_texture_factor;
-  command->rs_alpha_blend_enable = draw_packet->rs_alpha_blend_enable;
-  command->rs_src_blend = draw_packet->rs_src_blend;
-  command->rs_dest_blend = draw_packet->rs_dest_blend;
-  command->rs_alpha_test_enable = draw_packet->rs_alpha_test_enable;
-  command->rs_alpha_ref = draw_packet->rs_alpha_ref;
-  command->rs_alpha_func = draw_packet->rs_alpha_func;
-  command->rs_zenable = draw_packet->rs_zenable;
-  command->rs_zwriteenable = draw_packet->rs_zwriteenable;
-  command->rs_zfunc = draw_packet->rs_zfunc;
-  command->rs_stencilenable = draw_packet->rs_stencilenable;
-  command->rs_stencilfunc = draw_packet->rs_stencilfunc;
-  command->rs_stencilref = draw_packet->rs_stencilref;
-  command->rs_stencilmask = draw_packet->rs_stencilmask;
-  command->rs_stencilwritemask = draw_packet->rs_stencilwritemask;
-  command->rs_cull_mode = draw_packet->rs_cull_mode;
-  command->rs_scissortestenable = draw_packet->rs_scissortestenable;
-  command->rs_blendop = draw_packet->rs_blendop;
-  command->rs_colorwriteenable = draw_packet->rs_colorwriteenable;
-  command->rs_stencilpass = draw_packet->rs_stencilpass;
-  command->rs_stencilfail = draw_packet->rs_stencilfail;
-  command->rs_stencilzfail = draw_packet->rs_stencilzfail;
-  command->rs_fogenable = draw_packet->rs_fogenable;
-  command->rs_fogcolor = draw_packet->rs_fogcolor;
-  command->rs_fogstart = draw_packet->rs_fogstart;
-  command->rs_fogend = draw_packet->rs_fogend;
-  command->rs_fogdensity = draw_packet->rs_fogdensity;
-  command->rs_fogtablemode = draw_packet->rs_fogtablemode;
+  command->render_state = draw_packet->render_state;
+  memcpy(command->samplers.stage, draw_packet->samplers,
+         sizeof(command->samplers.stage));
+  memcpy(command->tex_data, draw_packet->tex_data, sizeof(command->tex_data));
   command->constants_vs = draw_packet->constants_vs;
   command->constants_ps = draw_packet->constants_ps;
-  command->viewport_x = draw_packet->viewport_x;
-  command->viewport_y = draw_packet->viewport_y;
-  command->viewport_width = draw_packet->viewport_width;
-  command->viewport_height = draw_packet->viewport_height;
-  command->viewport_min_z = draw_packet->viewport_min_z;
-  command->viewport_max_z = draw_packet->viewport_max_z;
-  command->scissor_left = draw_packet->scissor_left;
-  command->scissor_top = draw_packet->scissor_top;
-  command->scissor_right = draw_packet->scissor_right;
-  command->scissor_bottom = draw_packet->scissor_bottom;
+  command->constants_vs_start = draw_packet->constants_vs_start;
+  command->constants_ps_start = draw_packet->constants_ps_start;
   command->vertex_data = draw_packet->vertex_data;
   command->vertex_data_size = draw_packet->vertex_data_size;
   command->index_data = draw_packet->index_data;
   command->index_data_size = draw_packet->index_data_size;
-  command->index_format = draw_packet->index_format;
   command->vertex_decl_data = draw_packet->vertex_decl_data;
   command->vertex_decl_count = draw_packet->vertex_decl_count;
   command->vs_bytecode = draw_packet->vs_bytecode;
@@ -824,107 +1190,878 @@ dx9mt_backend_record_draw_command(const dx9mt_packet_draw_indexed *draw_packet)
   command->ps_bytecode_dwords = draw_packet->ps_bytecode_dwords;
 }
 
+static int dx9mt_backend_packet_fits(const dx9mt_packet_header *header,
+                                     uint32_t expected) {
+  if (header->size < expected) {
+    dx9mt_logf("backend", "%s packet too small: size=%u expected=%u",
+               dx9mt_packet_type_name(header->type), header->size, expected);
+    return 0;
+  }
+  return 1;
+}
+
+static int dx9mt_backend_apply_state_packet(const dx9mt_packet_header *header) {
+  if (header->type == DX9MT_PACKET_STATE_TEXTURE_STAGE &&
+      header->size >= sizeof(dx9mt_packet_state_texture_stage)) {
+    const dx9mt_packet_state_texture_stage *packet =
+        (const dx9mt_packet_state_texture_stage *)header;
+    if (packet->state.tex_data.size > 0 &&
+        !dx9mt_backend_validate_upload_ref(&packet->state.tex_data, "tex_data",
+                                           header->sequence)) {
+      return -1;
+    }
+  }
+  if (dx9mt_draw_state_apply(&g_draw_state, header) == 0) {
+    dx9mt_logf("backend", "%s packet rejected: size=%u seq=%u",
+               dx9mt_packet_type_name(header->type), header->size,
+               header->sequence);
+    return -1;
+  }
+  return 0;
+}
+
+static int dx9mt_backend_validate_draw_packet(const dx9mt_packet_draw *draw,
+                                              uint32_t sequence) {
+  uint32_t missing = DX9MT_STATE_GROUP_ALL & ~g_draw_state.present_mask;
+
+  if (missing != 0) {
+    dx9mt_logf("backend",
+               "draw packet before state keyframe: missing=0x%08x seq=%u",
+               missing, sequence);
+    return 0;
+  }
+  if (draw->render_target_id == 0 || draw->vertex_buffer_id == 0 ||
+      draw->index_buffer_id == 0 ||
+      (draw->vertex_decl_id == 0 && draw->fvf == 0)) {
+    dx9mt_logf(
+        "backend",
+        "draw packet missing state ids: rt=%u vb=%u ib=%u decl=%u fvf=0x%08x seq=%u",
+        draw->render_target_id, draw->vertex_buffer_id, draw->index_buffer_id,
+        draw->vertex_decl_id, draw->fvf, sequence);
+    return 0;
+  }
+  return dx9mt_backend_validate_constant_delta(&draw->constants_vs,
+                                               draw->constants_vs_start,
+                                               "constants_vs", sequence) &&
+         dx9mt_backend_validate_constant_delta(&draw->constants_ps,
+                                               draw->constants_ps_start,
+                                               "constants_ps", sequence) &&
+         (draw->vertex_data.size == 0 ||
+          dx9mt_backend_validate_upload_ref(&draw->vertex_data, "vertex_data",
+                                            sequence)) &&
+         (draw->index_data.size == 0 ||
+          dx9mt_backend_validate_upload_ref(&draw->index_data, "index_data",
+                                            sequence)) &&
+         dx9mt_backend_validate_buffer_update(&draw->vertex_update,
+                                              draw->vertex_data_size,
+                                              "vertex_update", sequence) &&
+         dx9mt_backend_validate_buffer_update(&draw->index_update,
+                                              draw->index_data_size,
+                                              "index_update", sequence) &&
+         (draw->vertex_decl_data.size == 0 ||
+          dx9mt_backend_validate_upload_ref(&draw->vertex_decl_data,
+                                            "vertex_decl_data", sequence)) &&
+         (draw->vs_bytecode.size == 0 ||
+          dx9mt_backend_validate_upload_ref(&draw->vs_bytecode, "vs_bytecode",
+                                            sequence)) &&
+         (draw->ps_bytecode.size == 0 ||
+          dx9mt_backend_validate_upload_ref(&draw->ps_bytecode, "ps_bytecode",
+                                            sequence));
+}
+
+/*
+ * Expands a slim DRAW packet against the current state groups straight
+ * into a command, reading the state blocks where g_draw_state holds them.
+ * A dropped draw still takes its pending texture uploads.
+ */
+static void dx9mt_backend_record_draw(const dx9mt_packet_draw *draw) {
+  const dx9mt_draw_state *state = &g_draw_state;
+  dx9mt_backend_draw_command *command =
+      dx9mt_backend_next_command(DX9MT_METAL_IPC_COMMAND_DRAW);
+  dx9mt_metal_ipc_texture_set textures;
+  dx9mt_metal_ipc_draw dropped;
+  dx9mt_upload_ref dropped_tex_data[DX9MT_MAX_PS_SAMPLERS];
+
+  g_last_draw_state_hash = dx9mt_draw_state_expand_ipc(
+      &g_draw_state, draw, command ? &command->draw : &dropped,
+      command ? command->tex_data : dropped_tex_data);
+  if (!command) {
+    return;
+  }
+  for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
+    const dx9mt_state_texture_stage *stage = &state->texture_stages[s];
+
+    textures.stage[s].id = stage->tex_id;
+    textures.stage[s].generation = stage->tex_generation;
+    textures.stage[s].format = stage->tex_format;
+    textures.stage[s].width = stage->tex_width;
+    textures.stage[s].height = stage->tex_height;
+    textures.stage[s].pitch = stage->tex_pitch;
+  }
+  if (!dx9mt_backend_record_draw_blocks(command, &state->control_vs,
+                                        &state->control_ps, &textures)) {
+    return;
+  }
+
+  command->state_block_hash = g_last_draw_state_hash;
+  command->vertex_decl_id = draw->vertex_decl_id;
+  command->viewport_hash = state->viewport_hash;
+  command->scissor_hash = state->scissor_hash;
+  command->texture_stage_hash = state->texture_stage_hash;
+  command->sampler_state_hash = state->sampler_state_hash;
+  command->stream_binding_hash = draw->stream_binding_hash;
+  command->render_state.depth_stencil = state->depth_stencil;
+  command->render_state.blend = state->blend;
+  command->render_state.raster = state->raster;
+  command->render_state.tss0_combiner = state->texture_stages[0].combiner;
+  memcpy(command->samplers.stage, state->samplers,
+         sizeof(command->samplers.stage));
+  command->constants_vs = draw->constants_vs;
+  command->constants_ps = draw->constants_ps;
+  command->constants_vs_start = draw->constants_vs_start;
+  command->constants_ps_start = draw->constants_ps_start;
+  command->vertex_data = draw->vertex_data;
+  command->vertex_data_size = draw->vertex_data_size;
+  command->index_data = draw->index_data;
+  command->index_data_size = draw->index_data_size;
+  command->vertex_decl_data = draw->vertex_decl_data;
+  command->vertex_decl_count = draw->vertex_decl_count;
+  command->vs_bytecode = draw->vs_bytecode;
+  command->vs_bytecode_dwords = draw->vs_bytecode_dwords;
+  command->ps_bytecode = draw->ps_bytecode;
+  command->ps_bytecode_dwords = draw->ps_bytecode_dwords;
+}
+
 static void dx9mt_backend_record_stretch_rect_command(
     const dx9mt_packet_stretch_rect *stretch_packet) {
   dx9mt_backend_draw_command *command;
+  dx9mt_metal_ipc_draw *d;
 
   if (!stretch_packet) {
     return;
   }
 
-  ++g_frame_replay_state->draw_total;
-  if (g_frame_replay_state->draw_stored >=
-      DX9MT_BACKEND_MAX_DRAW_COMMANDS_PER_FRAME) {
-    ++g_frame_replay_state->draw_dropped;
+  command = dx9mt_backend_next_command(DX9MT_METAL_IPC_COMMAND_STRETCH_RECT);
+  if (!command) {
     return;
   }
-
-  command = &g_frame_replay_state->draws[g_frame_replay_state->draw_stored++];
-  memset(command, 0, sizeof(*command));
-  command->command_type = DX9MT_METAL_IPC_COMMAND_STRETCH_RECT;
-  command->render_target_id = stretch_packet->dst_surface_id;
-  command->render_target_texture_id = stretch_packet->dst_texture_id;
-  command->render_target_width = stretch_packet->dst_width;
-  command->render_target_height = stretch_packet->dst_height;
-  command->render_target_format = stretch_packet->dst_format;
-  command->src_surface_id = stretch_packet->src_surface_id;
-  command->src_texture_id = stretch_packet->src_texture_id;
-  command->src_width = stretch_packet->src_width;
-  command->src_height = stretch_packet->src_height;
-  command->src_format = stretch_packet->src_format;
-  command->src_left = stretch_packet->src_left;
-  command->src_top = stretch_packet->src_top;
-  command->src_right = stretch_packet->src_right;
-  command->src_bottom = stretch_packet->src_bottom;
-  command->dst_left = stretch_packet->dst_left;
-  command->dst_top = stretch_packet->dst_top;
-  command->dst_right = stretch_packet->dst_right;
-  command->dst_bottom = stretch_packet->dst_bottom;
-  command->stretch_filter = stretch_packet->filter;
+  d = &command->draw;
+  d->render_target_id = stretch_packet->dst_surface_id;
+  d->render_target_texture_id = stretch_packet->dst_texture_id;
+  d->render_target_width = stretch_packet->dst_width;
+  d->render_target_height = stretch_packet->dst_height;
+  d->render_target_format = stretch_packet->dst_format;
+  d->src_surface_id = stretch_packet->src_surface_id;
+  d->src_texture_id = stretch_packet->src_texture_id;
+  d->src_width = stretch_packet->src_width;
+  d->src_height = stretch_packet->src_height;
+  d->src_format = stretch_packet->src_format;
+  d->src_left = stretch_packet->src_left;
+  d->src_top = stretch_packet->src_top;
+  d->src_right = stretch_packet->src_right;
+  d->src_bottom = stretch_packet->src_bottom;
+  d->dst_left = stretch_packet->dst_left;
+  d->dst_top = stretch_packet->dst_top;
+  d->dst_right = stretch_packet->dst_right;
+  d->dst_bottom = stretch_packet->dst_bottom;
+  d->stretch_filter = stretch_packet->filter;
 }
 
-int dx9mt_backend_bridge_init(const dx9mt_backend_init_desc *desc) {
-  if (!desc) {
-    return -1;
+/*
+ * Clears are replay commands like draws, so the viewer sees them in order
+ * against the target that was bound. The rect is always filled in; rect
+ * 0,0,width,height is a whole-target clear.
+ */
+static void dx9mt_backend_record_clear_command(
+    const dx9mt_packet_clear *clear_packet) {
+  dx9mt_backend_draw_command *command;
+  dx9mt_metal_ipc_draw *d;
+
+  command = dx9mt_backend_next_command(DX9MT_METAL_IPC_COMMAND_CLEAR);
+  if (!command) {
+    return;
   }
+  d = &command->draw;
+  d->render_target_id = clear_packet->render_target_id;
+  d->depth_stencil_id = clear_packet->depth_stencil_id;
+  d->render_target_texture_id = clear_packet->render_target_texture_id;
+  d->render_target_width = clear_packet->render_target_width;
+  d->render_target_height = clear_packet->render_target_height;
+  d->render_target_format = clear_packet->render_target_format;
+  if (clear_packet->rect_count == 0) {
+    d->dst_right = (int32_t)clear_packet->render_target_width;
+    d->dst_bottom = (int32_t)clear_packet->render_target_height;
+  } else {
+    d->dst_left = clear_packet->rect_left;
+    d->dst_top = clear_packet->rect_top;
+    d->dst_right = clear_packet->rect_right;
+    d->dst_bottom = clear_packet->rect_bottom;
+  }
+  d->clear_flags = clear_packet->flags;
+  d->clear_color_argb = clear_packet->color;
+  d->clear_z = clear_packet->z;
+  d->clear_stencil = clear_packet->stencil;
+}
 
-  dx9mt_logf("backend", "bridge init: protocol=%u ring=%u upload_slots=%u upload_bytes=%u",
-             desc->protocol_version, desc->ring_capacity_bytes,
-             desc->upload_desc.slot_count, desc->upload_desc.bytes_per_slot);
+static const void *dx9mt_backend_upload_resolve(const dx9mt_upload_ref *ref) {
+  dx9mt_backend_upload_resolve_fn resolve =
+      g_upload_resolve ? g_upload_resolve : g_default_upload_resolve;
 
-  g_backend_ready = 1;
-  g_last_frame_id = 0;
-  g_last_packet_sequence = 0;
-  g_have_present_target = 0;
-  memset(&g_present_target, 0, sizeof(g_present_target));
-  g_frame_open = 0;
-  g_soft_present = -1;
-  g_metal_present = -1;
-  g_upload_desc = desc->upload_desc;
-  g_last_replay_hash = 0;
-  memset(&g_current_frame_snapshot, 0, sizeof(g_current_frame_snapshot));
-  memset(&g_last_presented_snapshot, 0, sizeof(g_last_presented_snapshot));
-  dx9mt_backend_reset_frame_replay_state(0);
-  dx9mt_backend_reset_frame_stats();
+  return resolve ? resolve(ref) : NULL;
+}
 
-#if defined(__APPLE__) && !defined(DX9MT_NO_METAL)
-  if (dx9mt_backend_metal_present_enabled()) {
-    if (dx9mt_metal_init() == 0) {
-      dx9mt_logf("backend", "metal presenter initialized");
-    } else {
-      dx9mt_logf("backend", "metal presenter init failed, falling back to no-op");
-    }
-  }
-#endif
+static void dx9mt_backend_ipc_close(void);
+
+/* Caller has filled in g_metal_ipc_ptr and g_metal_ipc_map_bytes. */
+static void dx9mt_backend_ipc_mapped(const char *path) {
+  /* The viewer may have announced its caps before we mapped the file. */
+  uint32_t viewer_caps =
+      __atomic_load_n(&g_metal_ipc_ptr->viewer_caps, __ATOMIC_ACQUIRE);
+  uint32_t viewer_resync =
+      __atomic_load_n(&g_metal_ipc_ptr->viewer_resync, __ATOMIC_ACQUIRE);
+
+  memset((void *)g_metal_ipc_ptr, 0, sizeof(dx9mt_metal_ipc_header));
+  if (g_ipc_history) {
+    g_ipc_history->valid = 0;
+  }
+  g_ipc_ring_active = 0;
+  g_metal_ipc_ptr->magic = DX9MT_METAL_IPC_MAGIC;
+  g_metal_ipc_ptr->viewer_caps = viewer_caps;
+  g_metal_ipc_ptr->viewer_resync = viewer_resync;
+  dx9mt_logf("backend",
+             "metal IPC mapped at %s bytes=%u zero_copy=%d viewer_caps=0x%08x",
+             path, g_metal_ipc_map_bytes, g_metal_ipc_zero_copy, viewer_caps);
+}
 
-#ifdef _WIN32
+/* Encodings for the next IPC frame: what both sides support. */
+static uint32_t dx9mt_backend_ipc_frame_caps(void) {
+  uint32_t viewer_caps =
+      __atomic_load_n(&g_metal_ipc_ptr->viewer_caps, __ATOMIC_ACQUIRE);
+  uint32_t caps = DX9MT_BACKEND_IPC_CAPS;
+
+  if (viewer_caps & DX9MT_METAL_IPC_CAPS_VALID) {
+    caps &= viewer_caps;
+  }
+  if (!g_metal_ipc_zero_copy) {
+    caps &= ~(uint32_t)DX9MT_METAL_IPC_CAP_ZERO_COPY;
+  }
+  if (!g_ipc_static_frames) {
+    caps &= ~(uint32_t)DX9MT_METAL_IPC_CAP_REPEAT_FRAME;
+  }
+  if (!g_ipc_draw_delta) {
+    caps &= ~(uint32_t)DX9MT_METAL_IPC_CAP_DRAW_DELTA;
+  }
+  /* A viewer that never announced itself may only read the region. */
+  if (!g_ipc_frame_ring || !(viewer_caps & DX9MT_METAL_IPC_CAPS_VALID)) {
+    caps &= ~(uint32_t)DX9MT_METAL_IPC_CAP_FRAME_RING;
+  }
   /*
-   * Open the shared-memory IPC file for the native Metal viewer.
-   * The file is pre-created by `make run` before Wine starts.
-   * If the file doesn't exist, IPC is silently disabled -- the viewer
-   * wasn't launched, so there's nothing to render to.
+   * Ring slots are rendered in place, so their payloads must be in the
+   * slot; zero-copy frames need the single region and the viewer's
+   * snapshot (DX9MT_BACKEND_IPC_RING=0).
    */
-  g_metal_ipc_sequence = 0;
-  g_metal_ipc_file = CreateFileA(
-      DX9MT_METAL_IPC_WIN_PATH, GENERIC_READ | GENERIC_WRITE,
-      FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
-  if (g_metal_ipc_file != INVALID_HANDLE_VALUE) {
-    g_metal_ipc_mapping = CreateFileMappingA(g_metal_ipc_file, NULL,
-                                             PAGE_READWRITE, 0,
-                                             DX9MT_METAL_IPC_SIZE, NULL);
-    if (g_metal_ipc_mapping) {
+  if (caps & DX9MT_METAL_IPC_CAP_FRAME_RING) {
+    caps &= ~(uint32_t)DX9MT_METAL_IPC_CAP_ZERO_COPY;
+  }
+  return caps;
+}
+
+/* A viewer without ordered clears only sees the header clear fields. */
+static int dx9mt_backend_ipc_keeps_command(const dx9mt_backend_draw_command *cmd,
+                                           uint32_t caps) {
+  return cmd->draw.command_type != DX9MT_METAL_IPC_COMMAND_CLEAR ||
+         (caps & DX9MT_METAL_IPC_CAP_ORDERED_CLEAR) != 0;
+}
+
+/* Textures, shader bytecode and buffer-store patches the viewer caches. */
+static int
+dx9mt_backend_command_uploads_resources(const dx9mt_backend_draw_command *cmd) {
+  for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
+    if (cmd->tex_data[s].size > 0) {
+      return 1;
+    }
+  }
+  return cmd->vs_bytecode.size > 0 || cmd->ps_bytecode.size > 0 ||
+         (cmd->draw.vertex_update.generation != 0 &&
+          cmd->vertex_data_size > 0) ||
+         (cmd->draw.index_update.generation != 0 && cmd->index_data_size > 0);
+}
+
+static dx9mt_backend_ipc_history *dx9mt_backend_ipc_history_ensure(void) {
+  if (!g_ipc_history) {
+    g_ipc_history =
+        (dx9mt_backend_ipc_history *)calloc(1, sizeof(*g_ipc_history));
+    if (!g_ipc_history) {
+      dx9mt_logf("backend", "IPC history alloc failed");
+    }
+  }
+  return g_ipc_history;
+}
+
+/*
+ * Grows the per-entry arrays to hold `entries`. Returns 0 when allocation
+ * fails; the arrays keep their contents and capacity.
+ */
+static int dx9mt_backend_ipc_history_reserve(dx9mt_backend_ipc_history *history,
+                                             uint32_t entries) {
+  uint32_t capacity = history->capacity ? history->capacity
+                                        : DX9MT_BACKEND_IPC_HISTORY_MIN_ENTRIES;
+  unsigned char *changed;
+  int grown;
+
+  if (entries <= history->capacity) {
+    return 1;
+  }
+  while (capacity < entries) {
+    capacity *= 2u;
+  }
+  changed = (unsigned char *)realloc(history->changed, capacity);
+  grown = changed != NULL;
+  if (changed) {
+    history->changed = changed;
+  }
+  for (uint32_t i = 0; i < 2u; ++i) {
+    dx9mt_backend_ipc_constant_key *keys =
+        (dx9mt_backend_ipc_constant_key *)realloc(
+            history->logs[i].keys, (size_t)capacity * sizeof(*keys));
+
+    if (keys) {
+      history->logs[i].keys = keys;
+    } else {
+      grown = 0;
+    }
+  }
+  if (!grown) {
+    dx9mt_logf("backend", "IPC history alloc failed (%u entries)", capacity);
+    return 0;
+  }
+  history->capacity = capacity;
+  return 1;
+}
+
+/*
+ * Grows the plan to hold `draws` entries. Returns 0 when allocation fails;
+ * the frame is then serialized on one thread.
+ */
+static int dx9mt_backend_ipc_plan_reserve(uint32_t draws) {
+  uint32_t capacity = g_ipc_plan_capacity
+                          ? g_ipc_plan_capacity
+                          : DX9MT_BACKEND_IPC_PARALLEL_MIN_DRAWS;
+  dx9mt_backend_ipc_draw_plan *plan;
+
+  if (draws <= g_ipc_plan_capacity) {
+    return 1;
+  }
+  while (capacity < draws) {
+    capacity *= 2u;
+  }
+  plan = (dx9mt_backend_ipc_draw_plan *)realloc(
+      g_ipc_plan, (size_t)capacity * sizeof(*plan));
+  if (!plan) {
+    dx9mt_logf("backend", "IPC plan alloc failed (%u entries)", capacity);
+    return 0;
+  }
+  g_ipc_plan = plan;
+  g_ipc_plan_capacity = capacity;
+  return 1;
+}
+
+static void *dx9mt_backend_ipc_states_alloc(size_t bytes) {
+#if defined(_WIN32)
+  return VirtualAlloc(NULL, bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+  return calloc(1, bytes);
+#endif
+}
+
+static void dx9mt_backend_ipc_states_free(void *memory) {
+  if (!memory) {
+    return;
+  }
+#if defined(_WIN32)
+  VirtualFree(memory, 0, MEM_RELEASE);
+#else
+  free(memory);
+#endif
+}
+
+/* Slot for `block` in a table of `capacity` blocks: its own or a free one. */
+static uint32_t dx9mt_backend_ipc_state_probe(const uint32_t *slots,
+                                              uint32_t capacity,
+                                              uint32_t epoch,
+                                              const unsigned char *blocks,
+                                              uint32_t bytes,
+                                              const void *block) {
+  uint32_t mask = capacity * 2u - 1u;
+  uint32_t slot = dx9mt_backend_hash_words(2166136261u, block, bytes) & mask;
+
+  /* At most half the slots are filled, so the probe ends. */
+  while ((slots[slot] >> 16) == epoch &&
+         memcmp(blocks + (size_t)(slots[slot] & 0xFFFFu) * bytes, block,
+                bytes) != 0) {
+    slot = (slot + 1u) & mask;
+  }
+  return slot;
+}
+
+/*
+ * Doubles a group's table and rehashes the blocks it holds. Returns 0,
+ * leaving the table as it was, at MAX_BLOCKS or when allocation fails.
+ */
+static int dx9mt_backend_ipc_states_grow(dx9mt_backend_ipc_states *states,
+                                         uint32_t group) {
+  uint32_t bytes = dx9mt_metal_ipc_state_entry_bytes(group);
+  uint32_t capacity = states->capacity[group]
+                          ? states->capacity[group] * 2u
+                          : DX9MT_BACKEND_IPC_STATE_MIN_BLOCKS;
+  unsigned char *blocks;
+  uint32_t *slots;
+  uint32_t i;
+
+  if (capacity > DX9MT_BACKEND_IPC_STATE_MAX_BLOCKS) {
+    return 0;
+  }
+  blocks = (unsigned char *)dx9mt_backend_ipc_states_alloc((size_t)capacity *
+                                                            bytes);
+  slots = (uint32_t *)dx9mt_backend_ipc_states_alloc((size_t)capacity * 2u *
+                                                      sizeof(*slots));
+  if (!blocks || !slots) {
+    dx9mt_logf("backend", "IPC state table %u alloc failed (%u blocks)",
+               group, capacity);
+    dx9mt_backend_ipc_states_free(blocks);
+    dx9mt_backend_ipc_states_free(slots);
+    return 0;
+  }
+  if (states->count[group] > 0) {
+    memcpy(blocks, states->blocks[group],
+           (size_t)states->count[group] * bytes);
+  }
+  for (i = 0; i < states->count[group]; ++i) {
+    const unsigned char *block = blocks + (size_t)i * bytes;
+
+    slots[dx9mt_backend_ipc_state_probe(slots, capacity, states->epoch, blocks,
+                                        bytes, block)] =
+        (states->epoch << 16) | i;
+  }
+  dx9mt_backend_ipc_states_free(states->blocks[group]);
+  dx9mt_backend_ipc_states_free(states->slots[group]);
+  states->blocks[group] = blocks;
+  states->slots[group] = slots;
+  states->capacity[group] = capacity;
+  return 1;
+}
+
+/* The state tables, each at its first size; NULL when one is missing. */
+static dx9mt_backend_ipc_states *dx9mt_backend_ipc_states_ensure(void) {
+  uint32_t g;
+
+  if (!g_ipc_states) {
+    g_ipc_states = (dx9mt_backend_ipc_states *)calloc(1, sizeof(*g_ipc_states));
+    if (!g_ipc_states) {
+      dx9mt_logf("backend", "IPC state tables alloc failed");
+      return NULL;
+    }
+  }
+  for (g = 0; g < DX9MT_METAL_IPC_STATE_GROUPS; ++g) {
+    if (g_ipc_states->capacity[g] == 0 &&
+        !dx9mt_backend_ipc_states_grow(g_ipc_states, g)) {
+      return NULL;
+    }
+  }
+  return g_ipc_states;
+}
+
+/* Empties every table for a full frame. */
+static void dx9mt_backend_ipc_states_reset(dx9mt_backend_ipc_states *states) {
+  uint32_t g;
+
+  if (++states->epoch > 0xFFFFu) {
+    for (g = 0; g < DX9MT_METAL_IPC_STATE_GROUPS; ++g) {
+      memset(states->slots[g], 0,
+             (size_t)states->capacity[g] * 2u * sizeof(*states->slots[g]));
+    }
+    states->epoch = 1;
+  }
+  memset(states->count, 0, sizeof(states->count));
+  memset(states->published, 0, sizeof(states->published));
+  memset(states->table_offset, 0, sizeof(states->table_offset));
+}
+
+/*
+ * Index of `block` in the group's table, appending it when it is new and
+ * growing the table when it is full. Returns 0 when it cannot grow, which
+ * only a run of delta frames past MAX_BLOCKS (or a failed allocation) can
+ * reach.
+ */
+static int dx9mt_backend_ipc_intern_state(dx9mt_backend_ipc_states *states,
+                                          uint32_t group, const void *block,
+                                          uint16_t *out_index) {
+  uint32_t bytes = dx9mt_metal_ipc_state_entry_bytes(group);
+  uint32_t slot = dx9mt_backend_ipc_state_probe(
+      states->slots[group], states->capacity[group], states->epoch,
+      states->blocks[group], bytes, block);
+  uint32_t index;
+
+  if ((states->slots[group][slot] >> 16) == states->epoch) {
+    *out_index = (uint16_t)(states->slots[group][slot] & 0xFFFFu);
+    return 1;
+  }
+  if (states->count[group] == states->capacity[group]) {
+    if (!dx9mt_backend_ipc_states_grow(states, group)) {
+      return 0;
+    }
+    slot = dx9mt_backend_ipc_state_probe(
+        states->slots[group], states->capacity[group], states->epoch,
+        states->blocks[group], bytes, block);
+  }
+  index = states->count[group]++;
+  memcpy(states->blocks[group] + (size_t)index * bytes, block, bytes);
+  states->slots[group][slot] = (states->epoch << 16) | index;
+  *out_index = (uint16_t)index;
+  return 1;
+}
+
+/*
+ * The IPC index of the last replay block interned per replay group while
+ * serializing a frame. Draws keep a block's index until it changes, so
+ * most of them reuse the IPC index without hashing the block.
+ */
+typedef struct dx9mt_backend_ipc_block_memo {
+  int valid[DX9MT_BACKEND_REPLAY_GROUPS];
+  uint32_t block[DX9MT_BACKEND_REPLAY_GROUPS];
+  uint16_t index[DX9MT_BACKEND_REPLAY_GROUPS];
+} dx9mt_backend_ipc_block_memo;
+
+static int dx9mt_backend_ipc_intern_draw_states(
+    const dx9mt_backend_frame_replay_state *replay,
+    dx9mt_backend_ipc_block_memo *memo, const dx9mt_backend_draw_command *cmd,
+    uint16_t *state_index) {
+  const void *blocks[DX9MT_BACKEND_REPLAY_FIRST_GROUP];
+  uint32_t g;
+
+  blocks[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL] =
+      &cmd->render_state.depth_stencil;
+  blocks[DX9MT_METAL_IPC_STATE_BLEND] = &cmd->render_state.blend;
+  blocks[DX9MT_METAL_IPC_STATE_RASTER] = &cmd->render_state.raster;
+  blocks[DX9MT_METAL_IPC_STATE_SAMPLERS] = &cmd->samplers;
+  for (g = 0; g < DX9MT_BACKEND_REPLAY_FIRST_GROUP; ++g) {
+    if (!dx9mt_backend_ipc_intern_state(g_ipc_states, g, blocks[g],
+                                        &state_index[g])) {
+      return 0;
+    }
+  }
+  for (g = 0; g < DX9MT_BACKEND_REPLAY_GROUPS; ++g) {
+    const dx9mt_backend_block_table *table = &replay->tables[g];
+    uint32_t group = DX9MT_BACKEND_REPLAY_FIRST_GROUP + g;
+
+    if (!memo->valid[g] || memo->block[g] != cmd->block[g]) {
+      if (!dx9mt_backend_ipc_intern_state(
+              g_ipc_states, group,
+              table->blocks + (size_t)cmd->block[g] *
+                                  dx9mt_metal_ipc_state_entry_bytes(group),
+              &memo->index[g])) {
+        return 0;
+      }
+      memo->valid[g] = 1;
+      memo->block[g] = cmd->block[g];
+    }
+    state_index[group] = memo->index[g];
+  }
+  return 1;
+}
+
+/*
+ * Appends a constant delta's bytes to `log` and stores their count in
+ * *out_size, 0 when the delta is empty. Returns 0 when the log cannot grow.
+ */
+static int dx9mt_backend_ipc_log_constants(dx9mt_backend_ipc_constant_log *log,
+                                           const dx9mt_upload_ref *delta,
+                                           uint32_t *out_size) {
+  const void *data = dx9mt_backend_upload_resolve(delta);
+
+  *out_size = 0;
+  if (!data || delta->size == 0) {
+    return 1;
+  }
+  if (delta->size > log->capacity - log->used) {
+    uint32_t capacity = log->capacity
+                            ? log->capacity
+                            : DX9MT_BACKEND_IPC_HISTORY_MIN_CONSTANT_BYTES;
+    unsigned char *bytes;
+
+    while (delta->size > capacity - log->used) {
+      capacity *= 2u;
+    }
+    bytes = (unsigned char *)realloc(log->bytes, capacity);
+    if (!bytes) {
+      dx9mt_logf("backend", "IPC constant log alloc failed (%u bytes)",
+                 capacity);
+      return 0;
+    }
+    log->bytes = bytes;
+    log->capacity = capacity;
+  }
+  memcpy(log->bytes + log->used, data, delta->size);
+  log->used += delta->size;
+  *out_size = delta->size;
+  return 1;
+}
+
+/* Whether a published payload holds the bytes `ref` would be staged as. */
+static int dx9mt_backend_ipc_same_payload(const unsigned char *bulk,
+                                          uint32_t offset, uint32_t size,
+                                          const dx9mt_upload_ref *ref,
+                                          uint32_t ref_size) {
+  const void *data =
+      ref_size > 0 ? dx9mt_backend_upload_resolve(ref) : NULL;
+
+  if (!data) {
+    return size == 0;
+  }
+  return size == ref_size && memcmp(bulk + offset, data, size) == 0;
+}
+
+/*
+ * The published block each replay group was last compared with while
+ * keying a frame, and whether it matched. Draws keep a block until it
+ * changes, so most of them reuse the answer.
+ */
+typedef struct dx9mt_backend_ipc_compare_memo {
+  int valid[DX9MT_BACKEND_REPLAY_GROUPS];
+  uint32_t block[DX9MT_BACKEND_REPLAY_GROUPS];
+  uint16_t index[DX9MT_BACKEND_REPLAY_GROUPS];
+  int same[DX9MT_BACKEND_REPLAY_GROUPS];
+} dx9mt_backend_ipc_compare_memo;
+
+/* Whether the published blocks at `state_index` hold the command's state. */
+static int dx9mt_backend_ipc_same_states(
+    const dx9mt_backend_frame_replay_state *replay,
+    dx9mt_backend_ipc_compare_memo *memo,
+    const dx9mt_backend_draw_command *cmd, const uint16_t *state_index) {
+  const dx9mt_backend_ipc_states *states = g_ipc_states;
+  const void *blocks[DX9MT_BACKEND_REPLAY_FIRST_GROUP];
+  uint32_t g;
+
+  blocks[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL] =
+      &cmd->render_state.depth_stencil;
+  blocks[DX9MT_METAL_IPC_STATE_BLEND] = &cmd->render_state.blend;
+  blocks[DX9MT_METAL_IPC_STATE_RASTER] = &cmd->render_state.raster;
+  blocks[DX9MT_METAL_IPC_STATE_SAMPLERS] = &cmd->samplers;
+  for (g = 0; g < DX9MT_BACKEND_REPLAY_FIRST_GROUP; ++g) {
+    uint32_t bytes = dx9mt_metal_ipc_state_entry_bytes(g);
+
+    if (state_index[g] >= states->count[g] ||
+        memcmp(states->blocks[g] + (size_t)state_index[g] * bytes, blocks[g],
+               bytes) != 0) {
+      return 0;
+    }
+  }
+  for (g = 0; g < DX9MT_BACKEND_REPLAY_GROUPS; ++g) {
+    uint32_t group = DX9MT_BACKEND_REPLAY_FIRST_GROUP + g;
+    uint32_t bytes = dx9mt_metal_ipc_state_entry_bytes(group);
+    uint16_t index = state_index[group];
+
+    if (!memo->valid[g] || memo->block[g] != cmd->block[g] ||
+        memo->index[g] != index) {
+      memo->valid[g] = 1;
+      memo->block[g] = cmd->block[g];
+      memo->index[g] = index;
+      memo->same[g] =
+          index < states->count[group] &&
+          memcmp(states->blocks[group] + (size_t)index * bytes,
+                 replay->tables[g].blocks + (size_t)cmd->block[g] * bytes,
+                 bytes) == 0;
+    }
+    if (!memo->same[g]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Whether the published entry draws what the command would, constants
+ * aside: the fields recorded with the command, its state blocks and its
+ * per-draw payload bytes. Resources are compared by id and generation;
+ * the caller counts a command that uploads one as changed, so the entry
+ * must not carry an upload either.
+ */
+static int dx9mt_backend_ipc_same_entry(
+    const dx9mt_backend_frame_replay_state *replay,
+    dx9mt_backend_ipc_compare_memo *memo,
+    const dx9mt_backend_draw_command *cmd, const dx9mt_metal_ipc_draw *entry,
+    const unsigned char *bulk) {
+  if (memcmp(&cmd->draw, entry, offsetof(dx9mt_metal_ipc_draw, state_index)) !=
+          0 ||
+      entry->vs_bytecode_bulk_size != 0 || entry->ps_bytecode_bulk_size != 0) {
+    return 0;
+  }
+  for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
+    if (entry->tex_bulk_size[s] != 0) {
+      return 0;
+    }
+  }
+  if (!dx9mt_backend_ipc_same_payload(bulk, entry->vb_bulk_offset,
+                                      entry->vb_bulk_size, &cmd->vertex_data,
+                                      cmd->vertex_data_size) ||
+      !dx9mt_backend_ipc_same_payload(bulk, entry->ib_bulk_offset,
+                                      entry->ib_bulk_size, &cmd->index_data,
+                                      cmd->index_data_size) ||
+      !dx9mt_backend_ipc_same_payload(
+          bulk, entry->decl_bulk_offset, entry->decl_count * 8u,
+          &cmd->vertex_decl_data, cmd->vertex_decl_count * 8u)) {
+    return 0;
+  }
+  return cmd->draw.command_type != DX9MT_METAL_IPC_COMMAND_DRAW ||
+         dx9mt_backend_ipc_same_states(replay, memo, cmd, entry->state_index);
+}
+
+/* Whether a constant delta matches the published entry's, bytes and all. */
+static int dx9mt_backend_ipc_same_constants(uint32_t start, uint32_t size,
+                                            const unsigned char *bytes,
+                                            uint32_t old_start,
+                                            uint32_t old_size,
+                                            const unsigned char *old_bytes) {
+  return size == old_size && (size == 0 || (start == old_start &&
+                                            memcmp(bytes, old_bytes, size) ==
+                                                0));
+}
+
+/*
+ * Compares the first draw_count kept commands with the published table
+ * entry by entry, marks the ones that differ in history->changed and
+ * stores how many do in *out_changes (all of them when the frames are not
+ * comparable, without reading the published one). Constant deltas are
+ * logged for the next present either way. An entry's constant blocks are
+ * built from every delta up to it, so once one delta differs, every later
+ * draw counts as changed. Returns 0 when the history cannot grow.
+ */
+static int
+dx9mt_backend_ipc_key_draws(const dx9mt_backend_frame_replay_state *replay,
+                            dx9mt_backend_ipc_history *history, uint32_t caps,
+                            uint32_t draw_count, int comparable,
+                            uint32_t *out_changes, int *out_uploads) {
+  const dx9mt_backend_ipc_constant_log *published =
+      &history->logs[history->published];
+  dx9mt_backend_ipc_constant_log *next =
+      &history->logs[history->published ^ 1u];
+  const dx9mt_metal_ipc_draw *entries = NULL;
+  const unsigned char *bulk = NULL;
+  dx9mt_backend_ipc_compare_memo memo;
+  uint32_t cursor = 0;
+  int vs_same = comparable;
+  int ps_same = comparable;
+  uint32_t i;
+  uint32_t n;
+
+  *out_changes = 0;
+  *out_uploads = 0;
+  if (!dx9mt_backend_ipc_history_reserve(history, draw_count)) {
+    return 0;
+  }
+  if (comparable) {
+    entries = (const dx9mt_metal_ipc_draw *)((const unsigned char *)
+                                                 history->frame +
+                                             sizeof(dx9mt_metal_ipc_header));
+    bulk = (const unsigned char *)history->frame + history->bulk_offset;
+  }
+  memset(&memo, 0, sizeof(memo));
+  next->used = 0;
+  for (i = 0, n = 0; i < replay->draw_stored && n < draw_count; ++i) {
+    const dx9mt_backend_draw_command *cmd =
+        dx9mt_backend_replay_command(replay, i);
+    dx9mt_backend_ipc_constant_key *key;
+    int drawn;
+    int uploads;
+    int same;
+
+    if (!dx9mt_backend_ipc_keeps_command(cmd, caps)) {
+      continue;
+    }
+    drawn = cmd->draw.command_type == DX9MT_METAL_IPC_COMMAND_DRAW;
+    key = &next->keys[n];
+    memset(key, 0, sizeof(*key));
+    if (drawn) {
+      uint32_t at = next->used;
+
+      key->vs_start = cmd->constants_vs_start;
+      key->ps_start = cmd->constants_ps_start;
+      if (!dx9mt_backend_ipc_log_constants(next, &cmd->constants_vs,
+                                           &key->vs_size) ||
+          !dx9mt_backend_ipc_log_constants(next, &cmd->constants_ps,
+                                           &key->ps_size)) {
+        return 0;
+      }
+      if (comparable) {
+        const dx9mt_backend_ipc_constant_key *old = &published->keys[n];
+
+        vs_same = vs_same && dx9mt_backend_ipc_same_constants(
+                                 key->vs_start, key->vs_size, next->bytes + at,
+                                 old->vs_start, old->vs_size,
+                                 published->bytes + cursor);
+        ps_same = ps_same &&
+                  dx9mt_backend_ipc_same_constants(
+                      key->ps_start, key->ps_size,
+                      next->bytes + at + key->vs_size, old->ps_start,
+                      old->ps_size, published->bytes + cursor + old->vs_size);
+      }
+    }
+    if (comparable) {
+      cursor += published->keys[n].vs_size + published->keys[n].ps_size;
+    }
+    uploads = dx9mt_backend_command_uploads_resources(cmd);
+    *out_uploads |= uploads;
+    same = comparable && !uploads && (!drawn || (vs_same && ps_same)) &&
+           dx9mt_backend_ipc_same_entry(replay, &memo, cmd, &entries[n], bulk);
+    history->changed[n] = (unsigned char)!same;
+    *out_changes += (uint32_t)!same;
+    ++n;
+  }
+  return 1;
+}
+
+#ifdef _WIN32
+/*
+ * Open the shared-memory IPC file for the native Metal viewer.
+ * The file is pre-created by `make run` before Wine starts.
+ * If the file doesn't exist, IPC is silently disabled -- the viewer
+ * wasn't launched, so there's nothing to render to.
+ */
+static void dx9mt_backend_ipc_open(void) {
+  dx9mt_backend_ipc_close();
+  g_metal_ipc_sequence = 0;
+  g_metal_ipc_zero_copy = 0;
+  g_metal_ipc_file = CreateFileA(
+      DX9MT_METAL_IPC_WIN_PATH, GENERIC_READ | GENERIC_WRITE,
+      FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+  if (g_metal_ipc_file != INVALID_HANDLE_VALUE) {
+    LARGE_INTEGER file_size;
+    DWORD map_bytes = DX9MT_METAL_IPC_SIZE;
+
+    /*
+     * A file large enough for the upload arena enables zero-copy uploads;
+     * an old-size file keeps the copy-everything path.
+     */
+    if (GetFileSizeEx(g_metal_ipc_file, &file_size) &&
+        file_size.QuadPart >= (LONGLONG)DX9MT_METAL_IPC_ZERO_COPY_SIZE &&
+        dx9mt_backend_ipc_zero_copy_enabled()) {
+      map_bytes = DX9MT_METAL_IPC_ZERO_COPY_SIZE;
+      g_metal_ipc_zero_copy = 1;
+    }
+    g_metal_ipc_mapping = CreateFileMappingA(g_metal_ipc_file, NULL,
+                                             PAGE_READWRITE, 0, map_bytes,
+                                             NULL);
+    if (g_metal_ipc_mapping) {
       g_metal_ipc_ptr = (dx9mt_metal_frame_data *)MapViewOfFile(
-          g_metal_ipc_mapping, FILE_MAP_ALL_ACCESS, 0, 0,
-          DX9MT_METAL_IPC_SIZE);
+          g_metal_ipc_mapping, FILE_MAP_ALL_ACCESS, 0, 0, map_bytes);
       if (g_metal_ipc_ptr) {
-        memset((void *)g_metal_ipc_ptr, 0, sizeof(dx9mt_metal_ipc_header));
-        g_metal_ipc_ptr->magic = DX9MT_METAL_IPC_MAGIC;
-        dx9mt_logf("backend", "metal IPC mapped at %s",
-                   DX9MT_METAL_IPC_WIN_PATH);
+        g_metal_ipc_map_bytes = (uint32_t)map_bytes;
+        dx9mt_backend_ipc_mapped(DX9MT_METAL_IPC_WIN_PATH);
       }
     }
     if (!g_metal_ipc_ptr) {
       dx9mt_logf("backend", "metal IPC mapping failed");
+      g_metal_ipc_zero_copy = 0;
       if (g_metal_ipc_mapping) {
         CloseHandle(g_metal_ipc_mapping);
         g_metal_ipc_mapping = NULL;
@@ -937,17 +2074,169 @@ int dx9mt_backend_bridge_init(const dx9mt_backend_init_desc *desc) {
                "metal IPC file not found (viewer not running?): %s",
                DX9MT_METAL_IPC_WIN_PATH);
   }
+}
+
+static void dx9mt_backend_ipc_close(void) {
+  if (g_metal_ipc_ptr) {
+    UnmapViewOfFile(g_metal_ipc_ptr);
+    g_metal_ipc_ptr = NULL;
+  }
+  if (g_metal_ipc_mapping) {
+    CloseHandle(g_metal_ipc_mapping);
+    g_metal_ipc_mapping = NULL;
+  }
+  if (g_metal_ipc_file != INVALID_HANDLE_VALUE) {
+    CloseHandle(g_metal_ipc_file);
+    g_metal_ipc_file = INVALID_HANDLE_VALUE;
+  }
+}
+#else
+/*
+ * Natively the frame is written only when DX9MT_BACKEND_IPC_PATH names a
+ * file (created and sized on demand), so headless capture replay pays the
+ * same serialization cost as the PE build. Zero-copy needs the frontend's
+ * arena inside the mapping and stays off.
+ */
+static void dx9mt_backend_ipc_open(void) {
+  dx9mt_backend_ipc_close();
+  const char *path = getenv("DX9MT_BACKEND_IPC_PATH");
+  struct stat st;
+  void *map;
+
+  g_metal_ipc_sequence = 0;
+  g_metal_ipc_zero_copy = 0;
+  if (!path || !*path) {
+    return;
+  }
+  g_metal_ipc_fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (g_metal_ipc_fd < 0) {
+    dx9mt_logf("backend", "metal IPC open failed: %s", path);
+    return;
+  }
+  if (fstat(g_metal_ipc_fd, &st) != 0 ||
+      (st.st_size < (off_t)DX9MT_METAL_IPC_SIZE &&
+       ftruncate(g_metal_ipc_fd, (off_t)DX9MT_METAL_IPC_SIZE) != 0)) {
+    dx9mt_logf("backend", "metal IPC resize failed: %s", path);
+    close(g_metal_ipc_fd);
+    g_metal_ipc_fd = -1;
+    return;
+  }
+  map = mmap(NULL, DX9MT_METAL_IPC_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+             g_metal_ipc_fd, 0);
+  if (map == MAP_FAILED) {
+    dx9mt_logf("backend", "metal IPC mapping failed: %s", path);
+    close(g_metal_ipc_fd);
+    g_metal_ipc_fd = -1;
+    return;
+  }
+  g_metal_ipc_ptr = (dx9mt_metal_frame_data *)map;
+  g_metal_ipc_map_bytes = DX9MT_METAL_IPC_SIZE;
+  dx9mt_backend_ipc_mapped(path);
+}
+
+static void dx9mt_backend_ipc_close(void) {
+  if (g_metal_ipc_ptr) {
+    munmap((void *)g_metal_ipc_ptr, g_metal_ipc_map_bytes);
+    g_metal_ipc_ptr = NULL;
+  }
+  if (g_metal_ipc_fd >= 0) {
+    close(g_metal_ipc_fd);
+    g_metal_ipc_fd = -1;
+  }
+}
+#endif
+
+static int dx9mt_backend_parse_packets_counted(
+    const dx9mt_packet_header *packets, uint32_t packet_bytes);
+static void dx9mt_backend_start_present_thread(uint32_t frames);
+static void dx9mt_backend_start_ipc_workers(uint32_t threads);
+
+int dx9mt_backend_bridge_init(const dx9mt_backend_init_desc *desc) {
+  uint32_t packet_thread_mode;
+
+  if (!desc) {
+    return -1;
+  }
+  if (desc->protocol_version != DX9MT_PROTOCOL_VERSION) {
+    dx9mt_logf("backend", "bridge init: protocol %u unsupported (want %u)",
+               desc->protocol_version, DX9MT_PROTOCOL_VERSION);
+    return -1;
+  }
+
+  g_protocol_caps = desc->capabilities & DX9MT_BACKEND_PROTOCOL_CAPS;
+  packet_thread_mode = (g_protocol_caps & DX9MT_PROTOCOL_CAP_PACKET_THREAD)
+                           ? desc->packet_thread_mode
+                           : DX9MT_BACKEND_PACKET_THREAD_OFF;
+  dx9mt_logf("backend", "bridge init: protocol=%u caps=0x%08x/0x%08x ring=%u upload_slots=%u upload_bytes=%u packet_thread=%u",
+             desc->protocol_version, g_protocol_caps, desc->capabilities,
+             desc->ring_capacity_bytes, desc->upload_desc.slot_count,
+             desc->upload_desc.bytes_per_slot, packet_thread_mode);
+
+  dx9mt_packet_thread_stop();
+  dx9mt_present_thread_stop();
+  dx9mt_worker_pool_stop();
+
+  g_backend_ready = 1;
+  g_last_frame_id = 0;
+  g_last_packet_sequence = 0;
+  g_have_present_target = 0;
+  memset(&g_present_target, 0, sizeof(g_present_target));
+  g_frame_open = 0;
+  g_soft_present = -1;
+  g_metal_present = -1;
+  g_upload_desc = desc->upload_desc;
+  g_last_replay_hash = 0;
+  g_submit_errors = 0;
+  g_ipc_static_frames =
+      dx9mt_backend_ipc_encoding_enabled("DX9MT_BACKEND_STATIC_FRAMES");
+  g_ipc_draw_delta =
+      dx9mt_backend_ipc_encoding_enabled("DX9MT_BACKEND_IPC_DELTA");
+  g_ipc_frame_ring =
+      dx9mt_backend_ipc_encoding_enabled("DX9MT_BACKEND_IPC_RING");
+  memset(&g_ipc_stats, 0, sizeof(g_ipc_stats));
+  memset(&g_current_frame_snapshot, 0, sizeof(g_current_frame_snapshot));
+  memset(&g_last_presented_snapshot, 0, sizeof(g_last_presented_snapshot));
+  g_replay_index = 0;
+  dx9mt_backend_reset_frame_replay_state(0);
+  dx9mt_backend_reset_frame_stats();
+
+#if defined(__APPLE__) && !defined(DX9MT_NO_METAL)
+  if (dx9mt_backend_metal_present_enabled()) {
+    if (dx9mt_metal_init() == 0) {
+      dx9mt_logf("backend", "metal presenter initialized");
+    } else {
+      dx9mt_logf("backend", "metal presenter init failed, falling back to no-op");
+    }
+  }
 #endif
 
+  dx9mt_backend_ipc_open();
+  dx9mt_backend_start_present_thread(dx9mt_backend_frames_in_flight_config());
+  dx9mt_backend_start_ipc_workers(dx9mt_backend_ipc_threads_config());
+
+  if (packet_thread_mode != DX9MT_BACKEND_PACKET_THREAD_OFF &&
+      dx9mt_packet_thread_start(packet_thread_mode,
+                                desc->ring_capacity_bytes,
+                                dx9mt_backend_parse_packets_counted) != 0) {
+    dx9mt_logf("backend", "packet thread unavailable, parsing inline");
+  }
+
   return 0;
 }
 
+uint32_t dx9mt_backend_bridge_capabilities(void) {
+  return g_protocol_caps;
+}
+
 int dx9mt_backend_bridge_update_present_target(
     const dx9mt_backend_present_target_desc *desc) {
   if (!g_backend_ready) {
     dx9mt_logf("backend", "update_present_target called before init");
     return -1;
   }
+  dx9mt_packet_thread_drain();
+  /* Queued frames serialize with the target size they were presented at. */
+  dx9mt_present_thread_drain();
   if (!desc || desc->width == 0 || desc->height == 0 || desc->target_id == 0) {
     dx9mt_logf(
         "backend",
@@ -958,255 +2247,1307 @@ int dx9mt_backend_bridge_update_present_target(
     return -1;
   }
 
-  g_present_target = *desc;
-  g_have_present_target = 1;
+  g_present_target = *desc;
+  g_have_present_target = 1;
+
+  dx9mt_logf(
+      "backend",
+      "present target updated: target=%llu hwnd=0x%llx size=%ux%u fmt=%u windowed=%u",
+      (unsigned long long)g_present_target.target_id,
+      (unsigned long long)g_present_target.window_handle, g_present_target.width,
+      g_present_target.height, g_present_target.format, g_present_target.windowed);
+
+#if defined(__APPLE__) && !defined(DX9MT_NO_METAL)
+  if (dx9mt_metal_is_available()) {
+    if (dx9mt_metal_update_target(g_present_target.width,
+                                  g_present_target.height,
+                                  g_present_target.target_id) != 0) {
+      dx9mt_logf("backend", "metal target update failed for %ux%u",
+                 g_present_target.width, g_present_target.height);
+    }
+  }
+#endif
+
+  return 0;
+}
+
+static int dx9mt_backend_begin_frame(uint32_t frame_id);
+
+/*
+ * Applies one packet whose header already passed framing checks. A non-zero
+ * return rejects only this packet; the caller keeps parsing the batch.
+ */
+static int dx9mt_backend_dispatch_packet(const dx9mt_packet_header *header) {
+  if (header->type == DX9MT_PACKET_INIT) {
+    const dx9mt_packet_init *init_packet = (const dx9mt_packet_init *)header;
+    if (!dx9mt_backend_packet_fits(header, sizeof(*init_packet))) {
+      return -1;
+    }
+    if (init_packet->protocol_version != DX9MT_PROTOCOL_VERSION ||
+        (init_packet->capabilities & ~g_protocol_caps) != 0) {
+      dx9mt_logf("backend",
+                 "init packet disagrees with bridge init: protocol=%u caps=0x%08x agreed=0x%08x",
+                 init_packet->protocol_version, init_packet->capabilities,
+                 g_protocol_caps);
+      return -1;
+    }
+  } else if (header->type == DX9MT_PACKET_DRAW_INDEXED) {
+    const dx9mt_packet_draw_indexed *draw_packet =
+        (const dx9mt_packet_draw_indexed *)header;
+    if (header->size < sizeof(*draw_packet)) {
+      dx9mt_logf("backend", "draw packet too small: size=%u expected=%u",
+                 header->size, (unsigned)sizeof(*draw_packet));
+      return -1;
+    }
+    if (draw_packet->render_target_id == 0 ||
+        draw_packet->vertex_buffer_id == 0 ||
+        draw_packet->index_buffer_id == 0 ||
+        (draw_packet->vertex_decl_id == 0 && draw_packet->fvf == 0)) {
+      dx9mt_logf(
+          "backend",
+          "draw packet missing state ids: rt=%u vb=%u ib=%u decl=%u fvf=0x%08x seq=%u",
+          draw_packet->render_target_id, draw_packet->vertex_buffer_id,
+          draw_packet->index_buffer_id, draw_packet->vertex_decl_id,
+          draw_packet->fvf, header->sequence);
+      return -1;
+    }
+    if (!dx9mt_backend_validate_constant_delta(
+            &draw_packet->constants_vs, draw_packet->constants_vs_start,
+            "constants_vs", header->sequence) ||
+        !dx9mt_backend_validate_constant_delta(
+            &draw_packet->constants_ps, draw_packet->constants_ps_start,
+            "constants_ps", header->sequence)) {
+      return -1;
+    }
+    if (draw_packet->vertex_data.size > 0 &&
+        !dx9mt_backend_validate_upload_ref(&draw_packet->vertex_data,
+                                           "vertex_data",
+                                           header->sequence)) {
+      return -1;
+    }
+    if (draw_packet->index_data.size > 0 &&
+        !dx9mt_backend_validate_upload_ref(&draw_packet->index_data,
+                                           "index_data",
+                                           header->sequence)) {
+      return -1;
+    }
+    if (!dx9mt_backend_validate_buffer_update(&draw_packet->vertex_update,
+                                              draw_packet->vertex_data_size,
+                                              "vertex_update",
+                                              header->sequence) ||
+        !dx9mt_backend_validate_buffer_update(&draw_packet->index_update,
+                                              draw_packet->index_data_size,
+                                              "index_update",
+                                              header->sequence)) {
+      return -1;
+    }
+    if (draw_packet->vertex_decl_data.size > 0 &&
+        !dx9mt_backend_validate_upload_ref(&draw_packet->vertex_decl_data,
+                                           "vertex_decl_data",
+                                           header->sequence)) {
+      return -1;
+    }
+    if (draw_packet->vs_bytecode.size > 0 &&
+        !dx9mt_backend_validate_upload_ref(&draw_packet->vs_bytecode,
+                                           "vs_bytecode",
+                                           header->sequence)) {
+      return -1;
+    }
+    if (draw_packet->ps_bytecode.size > 0 &&
+        !dx9mt_backend_validate_upload_ref(&draw_packet->ps_bytecode,
+                                           "ps_bytecode",
+                                           header->sequence)) {
+      return -1;
+    }
+    for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
+      if (draw_packet->tex_data[s].size > 0 &&
+          !dx9mt_backend_validate_upload_ref(&draw_packet->tex_data[s],
+                                             "tex_data",
+                                             header->sequence)) {
+        return -1;
+      }
+    }
+    g_last_draw_state_hash = draw_packet->state_block_hash;
+    g_last_draw_primitive_type = draw_packet->primitive_type;
+    g_last_draw_primitive_count = draw_packet->primitive_count;
+    dx9mt_backend_record_draw_command(draw_packet);
+    ++g_frame_draw_indexed_count;
+  } else if (header->type == DX9MT_PACKET_CLEAR) {
+    const dx9mt_packet_clear *clear_packet =
+        (const dx9mt_packet_clear *)header;
+    if (header->size < sizeof(*clear_packet)) {
+      dx9mt_logf("backend",
+                 "clear packet too small: size=%u expected=%u",
+                 header->size, (unsigned)sizeof(*clear_packet));
+      return -1;
+    }
+    ++g_frame_clear_count;
+    g_last_clear_color = clear_packet->color;
+    g_last_clear_flags = clear_packet->flags;
+    g_last_clear_z = clear_packet->z;
+    g_last_clear_stencil = clear_packet->stencil;
+    g_frame_replay_state->have_clear = 1;
+    dx9mt_backend_record_clear_command(clear_packet);
+  } else if (header->type == DX9MT_PACKET_BEGIN_FRAME) {
+    /*
+     * BEGIN_FRAME now arrives through the packet stream (not as a
+     * side-channel direct call). Dispatch to the same begin_frame
+     * logic so frame state is reset consistently whether packets
+     * arrive via submit_packets or the direct API.
+     */
+    const dx9mt_packet_begin_frame *bf_packet =
+        (const dx9mt_packet_begin_frame *)header;
+    if (header->size < sizeof(*bf_packet)) {
+      dx9mt_logf("backend",
+                 "begin_frame packet too small: size=%u expected=%u",
+                 header->size, (unsigned)sizeof(*bf_packet));
+      return -1;
+    }
+    dx9mt_backend_begin_frame(bf_packet->frame_id);
+  } else if (header->type == DX9MT_PACKET_PRESENT) {
+    const dx9mt_packet_present *present_packet =
+        (const dx9mt_packet_present *)header;
+    if (header->size < sizeof(*present_packet)) {
+      dx9mt_logf("backend",
+                 "present packet too small: size=%u expected=%u",
+                 header->size, (unsigned)sizeof(*present_packet));
+      return -1;
+    }
+    g_frame_replay_state->have_present_packet = 1;
+    g_frame_replay_state->present_packet_frame_id = present_packet->frame_id;
+    g_frame_replay_state->present_render_target_id =
+        present_packet->render_target_id;
+  } else if (header->type == DX9MT_PACKET_STRETCH_RECT) {
+    const dx9mt_packet_stretch_rect *stretch_packet =
+        (const dx9mt_packet_stretch_rect *)header;
+    if (header->size < sizeof(*stretch_packet)) {
+      dx9mt_logf("backend",
+                 "stretch_rect packet too small: size=%u expected=%u",
+                 header->size, (unsigned)sizeof(*stretch_packet));
+      return -1;
+    }
+    dx9mt_backend_record_stretch_rect_command(stretch_packet);
+  } else if (header->type >= DX9MT_PACKET_STATE_DEPTH_STENCIL &&
+             header->type <= DX9MT_PACKET_STATE_SHADER_CONTROL) {
+    if (dx9mt_backend_apply_state_packet(header) != 0) {
+      return -1;
+    }
+  } else if (header->type == DX9MT_PACKET_DRAW) {
+    const dx9mt_packet_draw *draw = (const dx9mt_packet_draw *)header;
+    if (!dx9mt_backend_packet_fits(header, sizeof(*draw)) ||
+        !dx9mt_backend_validate_draw_packet(draw, header->sequence)) {
+      return -1;
+    }
+    g_last_draw_primitive_type = draw->primitive_type;
+    g_last_draw_primitive_count = draw->primitive_count;
+    dx9mt_backend_record_draw(draw);
+    ++g_frame_draw_indexed_count;
+  }
+  return 0;
+}
+
+/* Runs on the packet thread when one is active, else on the caller. */
+static int dx9mt_backend_parse_packets(const dx9mt_packet_header *packets,
+                                       uint32_t packet_bytes) {
+  uint32_t offset = 0;
+  uint32_t packet_count = 0;
+  int result = 0;
+
+  while (offset + sizeof(dx9mt_packet_header) <= packet_bytes) {
+    const dx9mt_packet_header *header;
+
+    header = (const dx9mt_packet_header *)((const unsigned char *)packets + offset);
+    if (header->size < sizeof(dx9mt_packet_header) ||
+        offset + header->size > packet_bytes) {
+      dx9mt_logf("backend",
+                 "packet parse error: offset=%u size=%u total=%u",
+                 offset, header->size, packet_bytes);
+      return -1;
+    }
+    if (header->type <= DX9MT_PACKET_INVALID ||
+        header->type > DX9MT_PACKET_DRAW) {
+      dx9mt_logf("backend", "unsupported packet type=%u size=%u seq=%u",
+                 header->type, header->size, header->sequence);
+      return -1;
+    }
+    if (header->sequence == 0 ||
+        (g_last_packet_sequence != 0 &&
+         header->sequence <= g_last_packet_sequence)) {
+      dx9mt_logf(
+          "backend",
+          "packet sequence out of order: current=%u last=%u type=%u size=%u",
+          header->sequence, g_last_packet_sequence, header->type, header->size);
+      return -1;
+    }
+    g_last_packet_sequence = header->sequence;
+
+    ++packet_count;
+    ++g_frame_packet_count;
+
+    if (dx9mt_backend_dispatch_packet(header) != 0) {
+      result = -1;
+    }
+
+    if (dx9mt_backend_trace_packets_enabled()) {
+      dx9mt_logf("backend", "packet #%u type=%s(%u) size=%u seq=%u",
+                 packet_count, dx9mt_packet_type_name(header->type), header->type,
+                 header->size, header->sequence);
+    }
+
+    offset += header->size;
+  }
+
+  if (offset != packet_bytes) {
+    dx9mt_logf("backend", "packet tail mismatch: parsed=%u total=%u", offset,
+               packet_bytes);
+    return -1;
+  }
+
+  return result;
+}
+
+static int dx9mt_backend_parse_packets_counted(
+    const dx9mt_packet_header *packets, uint32_t packet_bytes) {
+  int result = dx9mt_backend_parse_packets(packets, packet_bytes);
+  if (result != 0) {
+    __atomic_add_fetch(&g_submit_errors, 1u, __ATOMIC_RELAXED);
+  }
+  return result;
+}
+
+int dx9mt_backend_bridge_submit_packets(const dx9mt_packet_header *packets,
+                                        uint32_t packet_bytes) {
+  if (!g_backend_ready) {
+    dx9mt_logf("backend", "submit_packets called before init");
+    return -1;
+  }
+
+  if (!packets || packet_bytes == 0) {
+    return 0;
+  }
+
+  if (dx9mt_packet_thread_running()) {
+    dx9mt_packet_thread_submit(packets, packet_bytes);
+    return 0;
+  }
+  return dx9mt_backend_parse_packets_counted(packets, packet_bytes);
+}
+
+static int dx9mt_backend_begin_frame(uint32_t frame_id) {
+  if (!g_backend_ready) {
+    return -1;
+  }
+
+  if (g_frame_open && frame_id != g_last_frame_id) {
+    dx9mt_logf("backend",
+               "begin_frame out of order: incoming=%u previous_open=%u",
+               frame_id, g_last_frame_id);
+  }
+  g_frame_open = 1;
+
+  /*
+   * Only reset draw accumulation when frame_id changes. FNV (and many D3D9
+   * titles) call BeginScene/EndScene multiple times per visual frame for
+   * multi-pass rendering (shadow maps, scene, post-process, HUD). All passes
+   * share the same frame_id, so we accumulate draws across all passes and
+   * only flush on Present.
+   */
+  if (frame_id != g_last_frame_id) {
+    dx9mt_backend_reset_frame_stats();
+    memset(&g_current_frame_snapshot, 0, sizeof(g_current_frame_snapshot));
+    g_current_frame_snapshot.frame_id = frame_id;
+    dx9mt_backend_reset_frame_replay_state(frame_id);
+    g_last_frame_id = frame_id;
+  }
+
+  if (dx9mt_backend_should_log_frame(frame_id)) {
+    dx9mt_logf("backend", "begin_frame=%u", frame_id);
+  }
+  return 0;
+}
+
+int dx9mt_backend_bridge_begin_frame(uint32_t frame_id) {
+  dx9mt_packet_thread_drain();
+  return dx9mt_backend_begin_frame(frame_id);
+}
+
+/*
+ * Bulk staging for one IPC frame. Payloads inside this frame's range of the
+ * zero-copy upload arena are referenced in place; everything else is copied
+ * into the bulk region after the reserved arena prefix.
+ */
+typedef struct dx9mt_backend_ipc_bulk {
+  unsigned char *base;
+  uint32_t offset;
+  uint32_t used;
+  const unsigned char *arena_lo;
+  const unsigned char *arena_hi;
+  int arena_slot; /* -1: nothing in the arena, -2: spans slots */
+  int overflow;   /* a payload or state block did not fit */
+  int defer_payloads; /* sizing pass: reserve room, copy nothing */
+  uint32_t copied_bytes;
+  uint32_t referenced_bytes;
+} dx9mt_backend_ipc_bulk;
+
+static void dx9mt_backend_ipc_arena_extend(dx9mt_backend_ipc_bulk *bulk,
+                                           const void *data, uint32_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  const unsigned char *arena =
+      (const unsigned char *)g_metal_ipc_ptr + DX9MT_METAL_IPC_ARENA_OFFSET;
+  const unsigned char *slot_end;
+  int slot;
+
+  if (!g_metal_ipc_zero_copy || !bytes || size == 0 || bulk->arena_slot == -2) {
+    return;
+  }
+  if (bytes < arena || bytes >= arena + DX9MT_METAL_IPC_ARENA_BYTES) {
+    return;
+  }
+  slot = (int)((size_t)(bytes - arena) / DX9MT_METAL_IPC_ARENA_SLOT_BYTES);
+  slot_end = arena + (size_t)(slot + 1) * DX9MT_METAL_IPC_ARENA_SLOT_BYTES;
+  if (size > (size_t)(slot_end - bytes)) {
+    return;
+  }
+
+  /*
+   * One frame writes one upload slot. Refs from several slots would make the
+   * spliced range arbitrarily large, so such a frame copies everything.
+   */
+  if (bulk->arena_slot == -1) {
+    bulk->arena_slot = slot;
+    bulk->arena_lo = bytes;
+    bulk->arena_hi = bytes + size;
+  } else if (bulk->arena_slot != slot) {
+    bulk->arena_slot = -2;
+  } else {
+    if (bytes < bulk->arena_lo) {
+      bulk->arena_lo = bytes;
+    }
+    if (bytes + size > bulk->arena_hi) {
+      bulk->arena_hi = bytes + size;
+    }
+  }
+}
+
+static void dx9mt_backend_ipc_arena_scan(dx9mt_backend_ipc_bulk *bulk,
+                                         const dx9mt_backend_draw_command *cmd) {
+  dx9mt_backend_ipc_arena_extend(
+      bulk, dx9mt_backend_upload_resolve(&cmd->vertex_data),
+      cmd->vertex_data_size);
+  dx9mt_backend_ipc_arena_extend(
+      bulk, dx9mt_backend_upload_resolve(&cmd->index_data),
+      cmd->index_data_size);
+  dx9mt_backend_ipc_arena_extend(
+      bulk, dx9mt_backend_upload_resolve(&cmd->vertex_decl_data),
+      cmd->vertex_decl_count * 8u);
+  for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
+    dx9mt_backend_ipc_arena_extend(
+        bulk, dx9mt_backend_upload_resolve(&cmd->tex_data[s]),
+        cmd->tex_data[s].size);
+  }
+  dx9mt_backend_ipc_arena_extend(
+      bulk, dx9mt_backend_upload_resolve(&cmd->vs_bytecode),
+      cmd->vs_bytecode.size);
+  dx9mt_backend_ipc_arena_extend(
+      bulk, dx9mt_backend_upload_resolve(&cmd->ps_bytecode),
+      cmd->ps_bytecode.size);
+}
+
+/*
+ * Place one payload in the frame and return its offset relative to
+ * bulk_data_offset. Returns 0 (offset untouched) when there is no data or
+ * the bulk region is full. With defer_payloads set the room is reserved
+ * and counted but the bytes are left for the fill pass.
+ */
+static int dx9mt_backend_ipc_stage(dx9mt_backend_ipc_bulk *bulk,
+                                   const void *data, uint32_t size,
+                                   uint32_t *out_rel) {
+  const unsigned char *bytes = (const unsigned char *)data;
+
+  if (!bytes || size == 0) {
+    return 0;
+  }
+  if (bulk->arena_lo && bytes >= bulk->arena_lo && bytes < bulk->arena_hi &&
+      size <= (size_t)(bulk->arena_hi - bytes)) {
+    *out_rel = (uint32_t)(bytes - bulk->arena_lo);
+    bulk->referenced_bytes += size;
+    return 1;
+  }
+  if (bulk->offset + bulk->used + size > g_ipc_frame_bytes) {
+    bulk->overflow = 1;
+    return 0;
+  }
+  *out_rel = bulk->used;
+  if (!bulk->defer_payloads) {
+    memcpy(bulk->base + bulk->offset + bulk->used, bytes, size);
+  }
+  bulk->used += (size + 15u) & ~15u;
+  bulk->copied_bytes += size;
+  return 1;
+}
+
+/*
+ * Running float constant block for one shader stage while serializing a
+ * frame. Deltas are applied in draw order and each distinct block is
+ * written to bulk once; draws that changed nothing share its offset.
+ */
+typedef struct dx9mt_backend_constant_view {
+  unsigned char block[DX9MT_SHADER_FLOAT_CONSTANT_BLOCK_BYTES];
+  uint32_t bulk_offset;
+  int have_block;
+  int staged;
+} dx9mt_backend_constant_view;
+
+static void dx9mt_backend_constant_view_apply(
+    dx9mt_backend_constant_view *view, const dx9mt_upload_ref *delta,
+    uint32_t start_register) {
+  const void *data = dx9mt_backend_upload_resolve(delta);
+
+  if (data && delta->size > 0) {
+    memcpy(view->block + start_register * 16u, data, delta->size);
+    view->have_block = 1;
+    view->staged = 0;
+  }
+}
+
+static void dx9mt_backend_ipc_stage_constants(
+    dx9mt_backend_ipc_bulk *bulk, dx9mt_backend_constant_view *view,
+    const dx9mt_upload_ref *delta, uint32_t start_register,
+    uint32_t *out_rel, uint32_t *out_size) {
+  dx9mt_backend_constant_view_apply(view, delta, start_register);
+  if (!view->have_block) {
+    return;
+  }
+  if (!view->staged) {
+    int defer = bulk->defer_payloads;
+
+    /* Later deltas overwrite the block, so it is copied even when sizing. */
+    bulk->defer_payloads = 0;
+    view->staged = dx9mt_backend_ipc_stage(bulk, view->block,
+                                           sizeof(view->block),
+                                           &view->bulk_offset);
+    bulk->defer_payloads = defer;
+    if (!view->staged) {
+      return;
+    }
+  }
+  *out_rel = view->bulk_offset;
+  *out_size = (uint32_t)sizeof(view->block);
+}
+
+/*
+ * Stages one entry's payloads into bulk and points the entry at them. The
+ * order is the bulk layout, so every caller goes through here:
+ *   serial   constant views and memo set, plan NULL
+ *   sizing   views and memo set, plan filled in; payloads only reserved
+ *   fill     views NULL; constants and states come from the sizing plan
+ */
+static void dx9mt_backend_ipc_stage_payloads(
+    dx9mt_backend_ipc_bulk *bulk, dx9mt_backend_constant_view *vs_constants,
+    dx9mt_backend_constant_view *ps_constants,
+    const dx9mt_backend_frame_replay_state *replay,
+    dx9mt_backend_ipc_block_memo *memo, dx9mt_backend_ipc_draw_plan *plan,
+    const dx9mt_backend_draw_command *cmd, dx9mt_metal_ipc_draw *d) {
+  const void *data;
+
+  /* VB/IB data, vertex declaration, constants, texture uploads and
+   * shader bytecode: referenced in place when they already live in the
+   * zero-copy arena, copied into the bulk region otherwise. */
+  data = dx9mt_backend_upload_resolve(&cmd->vertex_data);
+  if (cmd->vertex_data_size > 0 &&
+      dx9mt_backend_ipc_stage(bulk, data, cmd->vertex_data_size,
+                              &d->vb_bulk_offset)) {
+    d->vb_bulk_size = cmd->vertex_data_size;
+  }
+
+  data = dx9mt_backend_upload_resolve(&cmd->index_data);
+  if (cmd->index_data_size > 0 &&
+      dx9mt_backend_ipc_stage(bulk, data, cmd->index_data_size,
+                              &d->ib_bulk_offset)) {
+    d->ib_bulk_size = cmd->index_data_size;
+  }
+
+  data = dx9mt_backend_upload_resolve(&cmd->vertex_decl_data);
+  if (cmd->vertex_decl_count > 0 &&
+      dx9mt_backend_ipc_stage(bulk, data, cmd->vertex_decl_count * 8u,
+                              &d->decl_bulk_offset)) {
+    d->decl_count = cmd->vertex_decl_count;
+  }
+
+  if (cmd->draw.command_type == DX9MT_METAL_IPC_COMMAND_DRAW && !vs_constants) {
+    d->vs_constants_bulk_offset = plan->vs_constants_bulk_offset;
+    d->vs_constants_size = plan->vs_constants_size;
+    d->ps_constants_bulk_offset = plan->ps_constants_bulk_offset;
+    d->ps_constants_size = plan->ps_constants_size;
+    memcpy(d->state_index, plan->state_index, sizeof(d->state_index));
+    bulk->used += plan->constants_bytes;
+  } else if (cmd->draw.command_type == DX9MT_METAL_IPC_COMMAND_DRAW) {
+    uint32_t used = bulk->used;
+
+    if (!dx9mt_backend_ipc_intern_draw_states(replay, memo, cmd,
+                                              d->state_index)) {
+      bulk->overflow = 1;
+    }
+    dx9mt_backend_ipc_stage_constants(
+        bulk, vs_constants, &cmd->constants_vs, cmd->constants_vs_start,
+        &d->vs_constants_bulk_offset, &d->vs_constants_size);
+    dx9mt_backend_ipc_stage_constants(
+        bulk, ps_constants, &cmd->constants_ps, cmd->constants_ps_start,
+        &d->ps_constants_bulk_offset, &d->ps_constants_size);
+    if (plan) {
+      plan->constants_bytes = bulk->used - used;
+      plan->vs_constants_bulk_offset = d->vs_constants_bulk_offset;
+      plan->vs_constants_size = d->vs_constants_size;
+      plan->ps_constants_bulk_offset = d->ps_constants_bulk_offset;
+      plan->ps_constants_size = d->ps_constants_size;
+      memcpy(plan->state_index, d->state_index, sizeof(plan->state_index));
+    }
+  }
+
+  for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
+    data = dx9mt_backend_upload_resolve(&cmd->tex_data[s]);
+    if (dx9mt_backend_ipc_stage(bulk, data, cmd->tex_data[s].size,
+                                &d->tex_bulk_offset[s])) {
+      d->tex_bulk_size[s] = cmd->tex_data[s].size;
+    }
+  }
+
+  data = dx9mt_backend_upload_resolve(&cmd->vs_bytecode);
+  if (dx9mt_backend_ipc_stage(bulk, data, cmd->vs_bytecode.size,
+                              &d->vs_bytecode_bulk_offset)) {
+    d->vs_bytecode_bulk_size = cmd->vs_bytecode.size;
+  }
+  data = dx9mt_backend_upload_resolve(&cmd->ps_bytecode);
+  if (dx9mt_backend_ipc_stage(bulk, data, cmd->ps_bytecode.size,
+                              &d->ps_bytecode_bulk_offset)) {
+    d->ps_bytecode_bulk_size = cmd->ps_bytecode.size;
+  }
+}
+
+/* Fills one table entry, staging its payloads into bulk. */
+static void
+dx9mt_backend_ipc_fill_draw(dx9mt_backend_ipc_bulk *bulk,
+                            dx9mt_backend_constant_view *vs_constants,
+                            dx9mt_backend_constant_view *ps_constants,
+                            const dx9mt_backend_frame_replay_state *replay,
+                            dx9mt_backend_ipc_block_memo *memo,
+                            const dx9mt_backend_draw_command *cmd,
+                            dx9mt_metal_ipc_draw *d) {
+  *d = cmd->draw;
+  dx9mt_backend_ipc_stage_payloads(bulk, vs_constants, ps_constants, replay,
+                                   memo, NULL, cmd, d);
+}
+
+/*
+ * Copies each state table that gained blocks since it was published to
+ * the end of bulk, where the header will point. Tables that did not grow
+ * stay where the published frame has them. Returns 0 when one did not
+ * fit; that table keeps its published length.
+ */
+static int dx9mt_backend_ipc_stage_states(dx9mt_backend_ipc_bulk *bulk) {
+  dx9mt_backend_ipc_states *states = g_ipc_states;
+  int staged = 1;
+  uint32_t g;
+
+  for (g = 0; g < DX9MT_METAL_IPC_STATE_GROUPS; ++g) {
+    if (states->count[g] == states->published[g]) {
+      continue;
+    }
+    if (dx9mt_backend_ipc_stage(
+            bulk, states->blocks[g],
+            states->count[g] * dx9mt_metal_ipc_state_entry_bytes(g),
+            &states->table_offset[g])) {
+      states->published[g] = states->count[g];
+    } else {
+      staged = 0;
+    }
+  }
+  return staged;
+}
+
+/* A sized full frame handed to the worker pool. */
+typedef struct dx9mt_backend_ipc_fill_job {
+  const dx9mt_backend_frame_replay_state *replay;
+  const dx9mt_backend_ipc_bulk *bulk; /* after the sizing pass */
+  dx9mt_metal_ipc_draw *draws;
+  uint32_t draw_count;
+} dx9mt_backend_ipc_fill_job;
+
+/* Bytes the fill pass writes for draws before `n`: entries plus payloads. */
+static uint64_t
+dx9mt_backend_ipc_fill_cost(const dx9mt_backend_ipc_fill_job *job,
+                            uint32_t n) {
+  uint32_t used =
+      n < job->draw_count ? g_ipc_plan[n].bulk_used : job->bulk->used;
+
+  return (uint64_t)(used - g_ipc_plan[0].bulk_used) +
+         (uint64_t)n * sizeof(dx9mt_metal_ipc_draw);
+}
+
+/* First draw of `share`, splitting the frame's bytes evenly. */
+static uint32_t
+dx9mt_backend_ipc_fill_split(const dx9mt_backend_ipc_fill_job *job,
+                             uint32_t share, uint32_t shares) {
+  uint64_t target =
+      dx9mt_backend_ipc_fill_cost(job, job->draw_count) * share / shares;
+  uint32_t lo = 0;
+  uint32_t hi = job->draw_count;
+
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2u;
+
+    if (dx9mt_backend_ipc_fill_cost(job, mid) < target) {
+      lo = mid + 1u;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Worker pool share: entries and payloads of one draw range. */
+static void dx9mt_backend_ipc_fill_range(void *context, uint32_t index,
+                                         uint32_t count) {
+  const dx9mt_backend_ipc_fill_job *job =
+      (const dx9mt_backend_ipc_fill_job *)context;
+  uint32_t end = index + 1u == count
+                     ? job->draw_count
+                     : dx9mt_backend_ipc_fill_split(job, index + 1u, count);
+  dx9mt_backend_ipc_bulk bulk = *job->bulk;
+  uint32_t n;
+
+  bulk.defer_payloads = 0;
+  for (n = dx9mt_backend_ipc_fill_split(job, index, count); n < end; ++n) {
+    dx9mt_backend_ipc_draw_plan *plan = &g_ipc_plan[n];
+    const dx9mt_backend_draw_command *cmd =
+        dx9mt_backend_replay_command(job->replay, plan->command);
+
+    /* Same offsets and fit checks as the sizing pass made. */
+    bulk.used = plan->bulk_used;
+    job->draws[n] = cmd->draw;
+    dx9mt_backend_ipc_stage_payloads(&bulk, NULL, NULL, job->replay, NULL,
+                                     plan, cmd, &job->draws[n]);
+  }
+}
+
+/*
+ * Splits a full frame across the worker pool. Returns 0, having written
+ * nothing, when the frame is serialized on this thread instead.
+ */
+static int dx9mt_backend_ipc_fill_parallel(
+    const dx9mt_backend_frame_replay_state *replay, uint32_t caps,
+    uint32_t draw_count, dx9mt_backend_ipc_bulk *bulk,
+    dx9mt_backend_constant_view *vs_constants,
+    dx9mt_backend_constant_view *ps_constants,
+    dx9mt_backend_ipc_block_memo *memo, dx9mt_metal_ipc_draw *draws) {
+  uint32_t command_count = replay->draw_stored;
+  dx9mt_backend_ipc_fill_job job;
+  dx9mt_metal_ipc_draw scratch;
+  uint32_t i;
+  uint32_t n;
+
+  if (draw_count < DX9MT_BACKEND_IPC_PARALLEL_MIN_DRAWS ||
+      dx9mt_worker_pool_size() <= 1 ||
+      !dx9mt_backend_ipc_plan_reserve(draw_count)) {
+    return 0;
+  }
+
+  bulk->defer_payloads = 1;
+  for (i = 0, n = 0; i < command_count && n < draw_count; ++i) {
+    const dx9mt_backend_draw_command *cmd =
+        dx9mt_backend_replay_command(replay, i);
+
+    if (dx9mt_backend_ipc_keeps_command(cmd, caps)) {
+      g_ipc_plan[n].command = i;
+      g_ipc_plan[n].bulk_used = bulk->used;
+      /* Staged like the entry itself, so the plan matches it. */
+      scratch = cmd->draw;
+      dx9mt_backend_ipc_stage_payloads(bulk, vs_constants, ps_constants,
+                                       replay, memo, &g_ipc_plan[n], cmd,
+                                       &scratch);
+      ++n;
+    }
+  }
+  bulk->defer_payloads = 0;
+
+  job.replay = replay;
+  job.bulk = bulk;
+  job.draws = draws;
+  job.draw_count = n;
+  dx9mt_worker_pool_run(dx9mt_backend_ipc_fill_range, &job);
+  return 1;
+}
+
+/*
+ * Entering ring mode: no slot holds a frame yet. Leaving it: the region
+ * at offset 0 no longer holds the last published frame, so the next
+ * frame there is written in full.
+ */
+static void dx9mt_backend_ipc_ring_switch(int ring) {
+  uint32_t i;
+
+  if (ring) {
+    __atomic_store_n(&g_metal_ipc_ptr->ring_latest, 0u, __ATOMIC_RELAXED);
+    for (i = 0; i < DX9MT_METAL_IPC_RING_SLOTS; ++i) {
+      __atomic_store_n(&g_metal_ipc_ptr->ring_state[i],
+                       DX9MT_METAL_IPC_SLOT_FREE, __ATOMIC_RELEASE);
+    }
+  }
+  if (g_ipc_history) {
+    g_ipc_history->valid = 0;
+  }
+  g_ipc_ring_active = ring;
+}
+
+/*
+ * Takes a slot the viewer does not hold for the next frame: a free one or
+ * a READY one older than ring_latest. With one viewer at most one slot is
+ * READING and ring_latest is another, so one is always left.
+ */
+static int dx9mt_backend_ipc_ring_claim(void) {
+  uint32_t latest =
+      __atomic_load_n(&g_metal_ipc_ptr->ring_latest, __ATOMIC_RELAXED);
+  uint32_t i;
+
+  for (i = 1; i <= DX9MT_METAL_IPC_RING_SLOTS; ++i) {
+    uint32_t slot = (latest + i) % DX9MT_METAL_IPC_RING_SLOTS;
+    uint32_t expected = DX9MT_METAL_IPC_SLOT_FREE;
+
+    if (__atomic_compare_exchange_n(&g_metal_ipc_ptr->ring_state[slot],
+                                    &expected, DX9MT_METAL_IPC_SLOT_WRITING,
+                                    0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      g_ipc_ring_slot = slot;
+      return 1;
+    }
+    expected = DX9MT_METAL_IPC_SLOT_READY;
+    if (slot != latest &&
+        __atomic_compare_exchange_n(&g_metal_ipc_ptr->ring_state[slot],
+                                    &expected, DX9MT_METAL_IPC_SLOT_WRITING,
+                                    0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      g_ipc_ring_slot = slot;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Takes back ring_latest, which holds the published frame, so a delta can
+ * patch it in place. Returns 0 while the viewer is reading it.
+ */
+static int dx9mt_backend_ipc_ring_claim_latest(void) {
+  uint32_t latest =
+      __atomic_load_n(&g_metal_ipc_ptr->ring_latest, __ATOMIC_RELAXED);
+  uint32_t expected = DX9MT_METAL_IPC_SLOT_READY;
+
+  if (!__atomic_compare_exchange_n(&g_metal_ipc_ptr->ring_state[latest],
+                                   &expected, DX9MT_METAL_IPC_SLOT_WRITING, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    return 0;
+  }
+  g_ipc_ring_slot = latest;
+  return 1;
+}
+
+/* The slot's frame is whole: make it the latest, then move the sequence. */
+static void dx9mt_backend_ipc_ring_publish(uint32_t caps) {
+  __atomic_store_n(&g_metal_ipc_ptr->ring_state[g_ipc_ring_slot],
+                   DX9MT_METAL_IPC_SLOT_READY, __ATOMIC_RELEASE);
+  __atomic_store_n(&g_metal_ipc_ptr->ring_latest, g_ipc_ring_slot,
+                   __ATOMIC_RELEASE);
+  g_metal_ipc_ptr->backend_caps = caps;
+  __atomic_store_n(&g_metal_ipc_ptr->sequence, g_metal_ipc_sequence,
+                   __ATOMIC_RELEASE);
+  g_ipc_stats.ring_slot = g_ipc_ring_slot;
+}
+
+/*
+ * Header fields shared by full and delta frames, then the sequence. The
+ * caller has set the delta fields (base_sequence, change list) already.
+ */
+static void dx9mt_backend_ipc_publish(
+    const dx9mt_backend_frame_replay_state *replay, uint32_t frame_id,
+    const dx9mt_backend_frame_snapshot *snapshot, uint32_t caps,
+    uint32_t draw_count, const dx9mt_backend_ipc_bulk *bulk,
+    uint32_t changed_draws, uint32_t written_bytes) {
+  unsigned char *ipc_base = (unsigned char *)g_metal_ipc_ptr;
+
+  g_ipc_frame->magic = DX9MT_METAL_IPC_MAGIC;
+  g_ipc_frame->width = g_present_target.width;
+  g_ipc_frame->height = g_present_target.height;
+  g_ipc_frame->have_clear = replay->have_clear;
+  g_ipc_frame->clear_color_argb = snapshot->last_clear_color;
+  g_ipc_frame->clear_flags = snapshot->last_clear_flags;
+  g_ipc_frame->clear_z = snapshot->last_clear_z;
+  g_ipc_frame->clear_stencil = snapshot->last_clear_stencil;
+  g_ipc_frame->draw_count = draw_count;
+  g_ipc_frame->replay_hash = snapshot->replay_hash;
+  g_ipc_frame->frame_id = frame_id;
+  g_ipc_frame->present_render_target_id =
+      replay->present_render_target_id;
+  g_ipc_frame->bulk_data_offset = bulk->offset;
+  g_ipc_frame->bulk_data_used = bulk->used;
+  g_ipc_frame->arena_data_offset =
+      bulk->arena_lo ? (uint32_t)(bulk->arena_lo - ipc_base) : 0u;
+  g_ipc_frame->arena_data_size =
+      (uint32_t)(bulk->arena_hi - bulk->arena_lo);
+  g_ipc_frame->backend_caps = caps;
+  g_ipc_stats.state_blocks = 0;
+  g_ipc_stats.state_bytes = 0;
+  for (uint32_t g = 0; g < DX9MT_METAL_IPC_STATE_GROUPS; ++g) {
+    g_ipc_frame->state_table_offset[g] = g_ipc_states->table_offset[g];
+    g_ipc_frame->state_table_count[g] = g_ipc_states->published[g];
+    g_ipc_stats.state_blocks += g_ipc_states->published[g];
+    g_ipc_stats.state_bytes +=
+        g_ipc_states->published[g] * dx9mt_metal_ipc_state_entry_bytes(g);
+  }
+  if (dx9mt_backend_should_log_frame(frame_id)) {
+    dx9mt_logf("backend",
+               "ipc frame=%u base=%u changed=%u/%u bulk_copied=%u "
+               "zero_copy=%u arena=%u+%u state_blocks=%u",
+               frame_id, g_ipc_frame->base_sequence, changed_draws,
+               draw_count, bulk->copied_bytes, bulk->referenced_bytes,
+               g_ipc_frame->arena_data_offset,
+               g_ipc_frame->arena_data_size, g_ipc_stats.state_blocks);
+  }
+  /* Write sequence last -- the viewer polls this field. */
+  __atomic_store_n(&g_ipc_frame->sequence, ++g_metal_ipc_sequence,
+                   __ATOMIC_RELEASE);
+  if (caps & DX9MT_METAL_IPC_CAP_FRAME_RING) {
+    dx9mt_backend_ipc_ring_publish(caps);
+  }
+  ++g_ipc_stats.frames;
+  g_ipc_stats.draw_count = draw_count;
+  g_ipc_stats.changed_draws = changed_draws;
+  g_ipc_stats.frame_bytes = written_bytes;
+  g_ipc_stats.copied_bytes = bulk->copied_bytes;
+  g_ipc_stats.referenced_bytes = bulk->referenced_bytes;
+  g_ipc_stats.caps = caps;
+}
+
+static void dx9mt_backend_ipc_write_full(
+    const dx9mt_backend_frame_replay_state *replay, uint32_t frame_id,
+    const dx9mt_backend_frame_snapshot *snapshot, uint32_t caps,
+    uint32_t draw_count, dx9mt_backend_ipc_bulk *bulk) {
+  unsigned char *ipc_base = (unsigned char *)g_ipc_frame;
+  uint32_t command_count = replay->draw_stored;
+  dx9mt_backend_constant_view vs_constants;
+  dx9mt_backend_constant_view ps_constants;
+  dx9mt_backend_ipc_block_memo memo;
+  dx9mt_metal_ipc_draw *ipc_draws;
+  uint32_t bulk_offset;
+  uint32_t i;
+  uint32_t n;
+
+  /*
+   * Mark the shared frame as in-progress before mutating any IPC-visible
+   * fields. The viewer ignores sequence 0 and retries if the sequence
+   * changes while it snapshots the frame.
+   */
+  __atomic_store_n(&g_ipc_frame->sequence, 0, __ATOMIC_RELEASE);
+
+  bulk_offset = (uint32_t)(sizeof(dx9mt_metal_ipc_header) +
+                           draw_count * sizeof(dx9mt_metal_ipc_draw));
+  /* Align bulk data to 16 bytes */
+  bulk_offset = (bulk_offset + 15u) & ~15u;
+
+  memset(bulk, 0, sizeof(*bulk));
+  bulk->base = ipc_base;
+  bulk->offset = bulk_offset;
+  bulk->arena_slot = (caps & DX9MT_METAL_IPC_CAP_ZERO_COPY) != 0 ? -1 : -2;
+  for (i = 0, n = 0; i < command_count && n < draw_count; ++i) {
+    const dx9mt_backend_draw_command *cmd =
+        dx9mt_backend_replay_command(replay, i);
+    if (dx9mt_backend_ipc_keeps_command(cmd, caps)) {
+      dx9mt_backend_ipc_arena_scan(bulk, cmd);
+      ++n;
+    }
+  }
+  if (bulk->arena_slot < 0) {
+    bulk->arena_lo = NULL;
+    bulk->arena_hi = NULL;
+  }
+  /* The arena range is spliced in at the start of the bulk range. */
+  bulk->used = (uint32_t)((bulk->arena_hi - bulk->arena_lo + 15) & ~15);
+
+  ipc_draws =
+      (dx9mt_metal_ipc_draw *)(ipc_base + sizeof(dx9mt_metal_ipc_header));
+  memset(&vs_constants, 0, sizeof(vs_constants));
+  memset(&ps_constants, 0, sizeof(ps_constants));
+  memset(&memo, 0, sizeof(memo));
+  dx9mt_backend_ipc_states_reset(g_ipc_states);
+
+  g_ipc_stats.threads = 1;
+  if (dx9mt_backend_ipc_fill_parallel(replay, caps, draw_count, bulk,
+                                      &vs_constants, &ps_constants, &memo,
+                                      ipc_draws)) {
+    g_ipc_stats.threads = dx9mt_worker_pool_size();
+  } else {
+    for (i = 0, n = 0; i < command_count && n < draw_count; ++i) {
+      const dx9mt_backend_draw_command *cmd =
+          dx9mt_backend_replay_command(replay, i);
+
+      if (dx9mt_backend_ipc_keeps_command(cmd, caps)) {
+        dx9mt_backend_ipc_fill_draw(bulk, &vs_constants, &ps_constants,
+                                    replay, &memo, cmd, &ipc_draws[n++]);
+      }
+    }
+  }
+  /* A table that does not fit leaves its draws unresolvable; the viewer
+   * skips them like draws whose payloads were left out. */
+  dx9mt_backend_ipc_stage_states(bulk);
+
+  g_ipc_frame->base_sequence = 0;
+  g_ipc_frame->change_count = 0;
+  g_ipc_frame->change_list_offset = 0;
+  g_ipc_frame->bulk_delta_offset = 0;
+  dx9mt_backend_ipc_publish(replay, frame_id, snapshot, caps, draw_count, bulk,
+                            draw_count, bulk_offset + bulk->used);
+}
 
-  dx9mt_logf(
-      "backend",
-      "present target updated: target=%llu hwnd=0x%llx size=%ux%u fmt=%u windowed=%u",
-      (unsigned long long)g_present_target.target_id,
-      (unsigned long long)g_present_target.window_handle, g_present_target.width,
-      g_present_target.height, g_present_target.format, g_present_target.windowed);
+/*
+ * Rewrites only the table entries whose keys changed and appends their
+ * payloads, plus the list of their indices and any state table that grew,
+ * after the published bulk data that unchanged entries keep pointing at.
+ * The file still holds a whole frame afterwards. Returns 0 when the
+ * appended data does not fit; the table is then partly patched and the
+ * caller must write the frame in full.
+ */
+static int dx9mt_backend_ipc_write_delta(
+    const dx9mt_backend_frame_replay_state *replay, uint32_t frame_id,
+    const dx9mt_backend_frame_snapshot *snapshot, uint32_t caps,
+    uint32_t draw_count, uint32_t changes, dx9mt_backend_ipc_bulk *bulk) {
+  const dx9mt_backend_ipc_history *history = g_ipc_history;
+  unsigned char *ipc_base = (unsigned char *)g_ipc_frame;
+  uint32_t command_count = replay->draw_stored;
+  dx9mt_backend_constant_view vs_constants;
+  dx9mt_backend_constant_view ps_constants;
+  dx9mt_backend_ipc_block_memo memo;
+  dx9mt_metal_ipc_draw *ipc_draws;
+  uint32_t *change_list;
+  uint32_t change_list_offset;
+  uint32_t delta_offset;
+  uint32_t changed = 0;
+  uint32_t i;
+  uint32_t n;
+
+  __atomic_store_n(&g_ipc_frame->sequence, 0, __ATOMIC_RELEASE);
+
+  memset(bulk, 0, sizeof(*bulk));
+  bulk->base = ipc_base;
+  bulk->offset = history->bulk_offset;
+  bulk->used = history->bulk_used;
+  bulk->arena_slot = -2;
+  delta_offset = bulk->used;
+  change_list_offset = bulk->used;
+  if (bulk->offset + bulk->used + changes * 4u > g_ipc_frame_bytes) {
+    return 0;
+  }
+  change_list = (uint32_t *)(ipc_base + bulk->offset + change_list_offset);
+  bulk->used += (changes * 4u + 15u) & ~15u;
 
-#if defined(__APPLE__) && !defined(DX9MT_NO_METAL)
-  if (dx9mt_metal_is_available()) {
-    if (dx9mt_metal_update_target(g_present_target.width,
-                                  g_present_target.height,
-                                  g_present_target.target_id) != 0) {
-      dx9mt_logf("backend", "metal target update failed for %ux%u",
-                 g_present_target.width, g_present_target.height);
+  ipc_draws =
+      (dx9mt_metal_ipc_draw *)(ipc_base + sizeof(dx9mt_metal_ipc_header));
+  memset(&vs_constants, 0, sizeof(vs_constants));
+  memset(&ps_constants, 0, sizeof(ps_constants));
+  memset(&memo, 0, sizeof(memo));
+
+  for (i = 0, n = 0; i < command_count && n < draw_count; ++i) {
+    const dx9mt_backend_draw_command *cmd =
+        dx9mt_backend_replay_command(replay, i);
+
+    if (!dx9mt_backend_ipc_keeps_command(cmd, caps)) {
+      continue;
     }
+    if (!history->changed[n]) {
+      /* The entry stays; the constant views still move past it. */
+      if (cmd->draw.command_type == DX9MT_METAL_IPC_COMMAND_DRAW) {
+        dx9mt_backend_constant_view_apply(&vs_constants, &cmd->constants_vs,
+                                          cmd->constants_vs_start);
+        dx9mt_backend_constant_view_apply(&ps_constants, &cmd->constants_ps,
+                                          cmd->constants_ps_start);
+      }
+      ++n;
+      continue;
+    }
+    dx9mt_backend_ipc_fill_draw(bulk, &vs_constants, &ps_constants, replay,
+                                &memo, cmd, &ipc_draws[n]);
+    change_list[changed++] = n++;
+  }
+  if (bulk->overflow || !dx9mt_backend_ipc_stage_states(bulk)) {
+    return 0;
   }
-#endif
 
-  return 0;
+  g_ipc_stats.threads = 1;
+  g_ipc_frame->base_sequence = g_metal_ipc_sequence;
+  g_ipc_frame->change_count = changed;
+  g_ipc_frame->change_list_offset = change_list_offset;
+  g_ipc_frame->bulk_delta_offset = delta_offset;
+  dx9mt_backend_ipc_publish(
+      replay, frame_id, snapshot, caps, draw_count, bulk, changed,
+      (uint32_t)(sizeof(dx9mt_metal_ipc_header) +
+                 changed * sizeof(dx9mt_metal_ipc_draw)) +
+          (bulk->used - delta_offset));
+  return 1;
 }
 
-int dx9mt_backend_bridge_submit_packets(const dx9mt_packet_header *packets,
-                                        uint32_t packet_bytes) {
-  uint32_t offset = 0;
-  uint32_t packet_count = 0;
+static uint32_t dx9mt_backend_ipc_globals_hash(
+    const dx9mt_backend_frame_replay_state *replay, uint32_t caps,
+    uint32_t draw_count, const dx9mt_backend_frame_snapshot *snapshot) {
+  uint32_t hash = 2166136261u;
 
-  if (!g_backend_ready) {
-    dx9mt_logf("backend", "submit_packets called before init");
-    return -1;
+  hash = dx9mt_backend_hash_u32(
+      hash, caps & ~(uint32_t)DX9MT_METAL_IPC_CAP_ZERO_COPY);
+  hash = dx9mt_backend_hash_u32(hash, draw_count);
+  hash = dx9mt_backend_hash_u32(hash, g_present_target.width);
+  hash = dx9mt_backend_hash_u32(hash, g_present_target.height);
+  hash = dx9mt_backend_hash_u32(hash,
+                                (uint32_t)replay->have_clear);
+  hash = dx9mt_backend_hash_u32(hash,
+                                replay->present_render_target_id);
+  hash = dx9mt_backend_hash_u32(hash, snapshot->last_clear_color);
+  hash = dx9mt_backend_hash_u32(hash, snapshot->last_clear_flags);
+  hash = dx9mt_backend_hash_words(hash, &snapshot->last_clear_z,
+                                  sizeof(snapshot->last_clear_z));
+  hash = dx9mt_backend_hash_u32(hash, snapshot->last_clear_stencil);
+  return hash;
+}
+
+static void dx9mt_backend_ipc_target_slot(void) {
+  g_ipc_frame = (dx9mt_metal_ipc_header *)dx9mt_metal_ipc_ring_slot(
+      g_metal_ipc_ptr, g_ipc_ring_slot);
+  g_ipc_frame_bytes = DX9MT_METAL_IPC_RING_SLOT_BYTES;
+}
+
+/*
+ * Points g_ipc_frame at the region, or at a claimed ring slot when the
+ * frame uses the ring. Returns 0, counting the frame as skipped, when no
+ * slot is free.
+ */
+static int dx9mt_backend_ipc_target(uint32_t caps) {
+  if (!(caps & DX9MT_METAL_IPC_CAP_FRAME_RING)) {
+    g_ipc_frame = g_metal_ipc_ptr;
+    g_ipc_frame_bytes = DX9MT_METAL_IPC_SIZE;
+    return 1;
+  }
+  if (!dx9mt_backend_ipc_ring_claim()) {
+    ++g_ipc_stats.ring_skipped;
+    return 0;
   }
+  dx9mt_backend_ipc_target_slot();
+  return 1;
+}
 
-  if (!packets || packet_bytes == 0) {
+/*
+ * Points g_ipc_frame at the published frame for a delta to patch: the
+ * region, or the ring slot holding it. Returns 0 when the viewer is
+ * reading that slot; the frame then goes to another slot in full.
+ */
+static int dx9mt_backend_ipc_delta_target(uint32_t caps) {
+  if (!(caps & DX9MT_METAL_IPC_CAP_FRAME_RING)) {
+    return dx9mt_backend_ipc_target(caps);
+  }
+  if (!dx9mt_backend_ipc_ring_claim_latest()) {
     return 0;
   }
+  dx9mt_backend_ipc_target_slot();
+  return 1;
+}
 
-  while (offset + sizeof(dx9mt_packet_header) <= packet_bytes) {
-    const dx9mt_packet_header *header;
+/*
+ * Writes the presented frame to the IPC file in the cheapest form the
+ * viewer accepts:
+ *   repeat  nothing drawn differs from the published frame and nothing is
+ *           uploaded; only repeat_count moves
+ *   delta   same table length; only changed entries and their payloads
+ *   full    everything else
+ * Repeats and deltas need a published frame with no payload left in the
+ * upload arena, because the frontend reuses those slots. So a full frame
+ * the next present is likely to build on is written without ZERO_COPY.
+ * With the frame ring, a delta patches the slot holding the published
+ * frame, and a full frame gets a slot of its own.
+ */
+static const char *
+dx9mt_backend_ipc_write_frame(const dx9mt_backend_frame_replay_state *replay,
+                              uint32_t frame_id,
+                              const dx9mt_backend_frame_snapshot *snapshot) {
+  dx9mt_backend_ipc_history *history = NULL;
+  dx9mt_backend_ipc_bulk bulk;
+  uint32_t command_count = replay->draw_stored;
+  uint32_t caps = dx9mt_backend_ipc_frame_caps();
+  int ring = (caps & DX9MT_METAL_IPC_CAP_FRAME_RING) != 0;
+  uint32_t max_draws = DX9MT_METAL_IPC_MAX_DRAWS_IN(
+      ring ? DX9MT_METAL_IPC_RING_SLOT_BYTES : DX9MT_METAL_IPC_SIZE);
+  uint32_t draw_count = 0;
+  uint32_t globals;
+  uint32_t changes;
+  int comparable;
+  int uploads;
+  uint32_t i;
 
-    header = (const dx9mt_packet_header *)((const unsigned char *)packets + offset);
-    if (header->size < sizeof(dx9mt_packet_header) ||
-        offset + header->size > packet_bytes) {
-      dx9mt_logf("backend",
-                 "packet parse error: offset=%u size=%u total=%u",
-                 offset, header->size, packet_bytes);
-      return -1;
+  for (i = 0; i < command_count; ++i) {
+    if (dx9mt_backend_ipc_keeps_command(
+            dx9mt_backend_replay_command(replay, i), caps)) {
+      ++draw_count;
     }
-    if (header->type <= DX9MT_PACKET_INVALID ||
-        header->type > DX9MT_PACKET_STRETCH_RECT) {
-      dx9mt_logf("backend", "unsupported packet type=%u size=%u seq=%u",
-                 header->type, header->size, header->sequence);
-      return -1;
+  }
+  g_ipc_stats.draws_dropped = replay->draw_dropped;
+  if (draw_count > max_draws) {
+    g_ipc_stats.draws_dropped += draw_count - max_draws;
+    draw_count = max_draws;
+  }
+  if (ring != g_ipc_ring_active) {
+    dx9mt_backend_ipc_ring_switch(ring);
+  }
+  /* Draw entries only index state blocks; without tables, nothing draws. */
+  if (!dx9mt_backend_ipc_states_ensure()) {
+    return "metal-ipc-skipped";
+  }
+
+  if (caps & (DX9MT_METAL_IPC_CAP_REPEAT_FRAME |
+              DX9MT_METAL_IPC_CAP_DRAW_DELTA)) {
+    history = dx9mt_backend_ipc_history_ensure();
+  }
+  if (history) {
+    comparable = history->valid && history->self_contained &&
+                 history->draw_count == draw_count;
+    if (!dx9mt_backend_ipc_key_draws(replay, history, caps, draw_count,
+                                     comparable, &changes, &uploads)) {
+      history->valid = 0;
+      history = NULL;
     }
-    if (header->sequence == 0 ||
-        (g_last_packet_sequence != 0 &&
-         header->sequence <= g_last_packet_sequence)) {
-      dx9mt_logf(
-          "backend",
-          "packet sequence out of order: current=%u last=%u type=%u size=%u",
-          header->sequence, g_last_packet_sequence, header->type, header->size);
-      return -1;
+  }
+  if (!history) {
+    if (g_ipc_history) {
+      g_ipc_history->valid = 0;
     }
-    g_last_packet_sequence = header->sequence;
-
-    ++packet_count;
-    ++g_frame_packet_count;
-
-    if (header->type == DX9MT_PACKET_DRAW_INDEXED) {
-      const dx9mt_packet_draw_indexed *draw_packet =
-          (const dx9mt_packet_draw_indexed *)header;
-      if (header->size < sizeof(*draw_packet)) {
-        dx9mt_logf("backend", "draw packet too small: size=%u expected=%u",
-                   header->size, (unsigned)sizeof(*draw_packet));
-        return -1;
-      }
-      if (draw_packet->render_target_id == 0 ||
-          draw_packet->vertex_buffer_id == 0 ||
-          draw_packet->index_buffer_id == 0 ||
-          (draw_packet->vertex_decl_id == 0 && draw_packet->fvf == 0)) {
-        dx9mt_logf(
-            "backend",
-            "draw packet missing state ids: rt=%u vb=%u ib=%u decl=%u fvf=0x%08x seq=%u",
-            draw_packet->render_target_id, draw_packet->vertex_buffer_id,
-            draw_packet->index_buffer_id, draw_packet->vertex_decl_id,
-            draw_packet->fvf, header->sequence);
-        return -1;
-      }
-      if (!dx9mt_backend_validate_upload_ref(&draw_packet->constants_vs,
-                                             "constants_vs",
-                                             header->sequence) ||
-          !dx9mt_backend_validate_upload_ref(&draw_packet->constants_ps,
-                                             "constants_ps",
-                                             header->sequence)) {
-        return -1;
-      }
-      if (draw_packet->vertex_data.size > 0 &&
-          !dx9mt_backend_validate_upload_ref(&draw_packet->vertex_data,
-                                             "vertex_data",
-                                             header->sequence)) {
-        return -1;
-      }
-      if (draw_packet->index_data.size > 0 &&
-          !dx9mt_backend_validate_upload_ref(&draw_packet->index_data,
-                                             "index_data",
-                                             header->sequence)) {
-        return -1;
-      }
-      if (draw_packet->vertex_decl_data.size > 0 &&
-          !dx9mt_backend_validate_upload_ref(&draw_packet->vertex_decl_data,
-                                             "vertex_decl_data",
-                                             header->sequence)) {
-        return -1;
-      }
-      if (draw_packet->vs_bytecode.size > 0 &&
-          !dx9mt_backend_validate_upload_ref(&draw_packet->vs_bytecode,
-                                             "vs_bytecode",
-                                             header->sequence)) {
-        return -1;
-      }
-      if (draw_packet->ps_bytecode.size > 0 &&
-          !dx9mt_backend_validate_upload_ref(&draw_packet->ps_bytecode,
-                                             "ps_bytecode",
-                                             header->sequence)) {
-        return -1;
-      }
-      for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
-        if (draw_packet->tex_data[s].size > 0 &&
-            !dx9mt_backend_validate_upload_ref(&draw_packet->tex_data[s],
-                                               "tex_data",
-                                               header->sequence)) {
-          return -1;
-        }
-      }
-      g_last_draw_state_hash = draw_packet->state_block_hash;
-      g_last_draw_primitive_type = draw_packet->primitive_type;
-      g_last_draw_primitive_count = draw_packet->primitive_count;
-      dx9mt_backend_record_draw_command(draw_packet);
-      ++g_frame_draw_indexed_count;
-    } else if (header->type == DX9MT_PACKET_CLEAR) {
-      const dx9mt_packet_clear *clear_packet =
-          (const dx9mt_packet_clear *)header;
-      if (header->size < sizeof(*clear_packet)) {
-        dx9mt_logf("backend",
-                   "clear packet too small: size=%u expected=%u",
-                   header->size, (unsigned)sizeof(*clear_packet));
-        return -1;
-      }
-      ++g_frame_clear_count;
-      g_last_clear_color = clear_packet->color;
-      g_last_clear_flags = clear_packet->flags;
-      g_last_clear_z = clear_packet->z;
-      g_last_clear_stencil = clear_packet->stencil;
-      g_frame_replay_state->have_clear = 1;
-      g_frame_replay_state->last_clear_packet = *clear_packet;
-    } else if (header->type == DX9MT_PACKET_BEGIN_FRAME) {
-      /*
-       * BEGIN_FRAME now arrives through the packet stream (not as a
-       * side-channel direct call). Dispatch to the same begin_frame
-       * logic so frame state is reset consistently whether packets
-       * arrive via submit_packets or the direct API.
-       */
-      const dx9mt_packet_begin_frame *bf_packet =
-          (const dx9mt_packet_begin_frame *)header;
-      if (header->size < sizeof(*bf_packet)) {
-        dx9mt_logf("backend",
-                   "begin_frame packet too small: size=%u expected=%u",
-                   header->size, (unsigned)sizeof(*bf_packet));
-        return -1;
-      }
-      dx9mt_backend_bridge_begin_frame(bf_packet->frame_id);
-    } else if (header->type == DX9MT_PACKET_PRESENT) {
-      const dx9mt_packet_present *present_packet =
-          (const dx9mt_packet_present *)header;
-      if (header->size < sizeof(*present_packet)) {
-        dx9mt_logf("backend",
-                   "present packet too small: size=%u expected=%u",
-                   header->size, (unsigned)sizeof(*present_packet));
-        return -1;
-      }
-      g_frame_replay_state->have_present_packet = 1;
-      g_frame_replay_state->present_packet_frame_id = present_packet->frame_id;
-      g_frame_replay_state->present_render_target_id =
-          present_packet->render_target_id;
-    } else if (header->type == DX9MT_PACKET_STRETCH_RECT) {
-      const dx9mt_packet_stretch_rect *stretch_packet =
-          (const dx9mt_packet_stretch_rect *)header;
-      if (header->size < sizeof(*stretch_packet)) {
-        dx9mt_logf("backend",
-                   "stretch_rect packet too small: size=%u expected=%u",
-                   header->size, (unsigned)sizeof(*stretch_packet));
-        return -1;
-      }
-      dx9mt_backend_record_stretch_rect_command(stretch_packet);
+    if (!dx9mt_backend_ipc_target(caps)) {
+      return "metal-ipc-skipped";
     }
-
-    if (dx9mt_backend_trace_packets_enabled()) {
-      dx9mt_logf("backend", "packet #%u type=%s(%u) size=%u seq=%u",
-                 packet_count, dx9mt_packet_type_name(header->type), header->type,
-                 header->size, header->sequence);
+    dx9mt_backend_ipc_write_full(replay, frame_id, snapshot, caps, draw_count,
+                                 &bulk);
+    return "metal-ipc";
+  }
+
+  globals = dx9mt_backend_ipc_globals_hash(replay, caps, draw_count, snapshot);
+  if (comparable && changes == 0 && !uploads &&
+      globals == history->globals_hash &&
+      (caps & DX9MT_METAL_IPC_CAP_REPEAT_FRAME)) {
+    __atomic_add_fetch(&g_metal_ipc_ptr->repeat_count, 1u, __ATOMIC_RELEASE);
+    ++g_ipc_stats.repeated_frames;
+    g_ipc_stats.changed_draws = 0;
+    g_ipc_stats.frame_bytes = 0;
+    g_ipc_stats.copied_bytes = 0;
+    g_ipc_stats.referenced_bytes = 0;
+    return "metal-ipc-repeat";
+  }
+
+  if (comparable && (caps & DX9MT_METAL_IPC_CAP_DRAW_DELTA) &&
+      history->bulk_used <= (g_ipc_frame_bytes - history->bulk_offset) / 2u &&
+      dx9mt_backend_ipc_delta_target(caps)) {
+    if (dx9mt_backend_ipc_write_delta(replay, frame_id, snapshot, caps,
+                                      draw_count, changes, &bulk)) {
+      history->published ^= 1u;
+      history->globals_hash = globals;
+      history->bulk_used = bulk.used;
+      return "metal-ipc-delta";
     }
+    /* The partly patched frame is rewritten in full where it is. */
+  } else if (!dx9mt_backend_ipc_target(caps)) {
+    return "metal-ipc-skipped";
+  }
+
+  if (history->valid && history->draw_count == draw_count &&
+      ((caps & DX9MT_METAL_IPC_CAP_DRAW_DELTA) || changes == 0)) {
+    caps &= ~(uint32_t)DX9MT_METAL_IPC_CAP_ZERO_COPY;
+  }
+  dx9mt_backend_ipc_write_full(replay, frame_id, snapshot, caps, draw_count,
+                               &bulk);
+  history->published ^= 1u;
+  history->valid = 1;
+  history->frame = g_ipc_frame;
+  history->self_contained = bulk.arena_lo == NULL;
+  history->draw_count = draw_count;
+  history->globals_hash = globals;
+  history->bulk_offset = bulk.offset;
+  history->bulk_used = bulk.used;
+  return "metal-ipc";
+}
 
-    offset += header->size;
-  }
+/* Runs on the present worker; `job` was filled by queue_present. */
+static void dx9mt_backend_serialize_present(uint32_t job) {
+  const dx9mt_backend_present_job *present = &g_present_jobs[job];
 
-  if (offset != packet_bytes) {
-    dx9mt_logf("backend", "packet tail mismatch: parsed=%u total=%u", offset,
-               packet_bytes);
-    return -1;
-  }
+  dx9mt_backend_ipc_write_frame(present->replay, present->frame_id,
+                                &present->snapshot);
+  __atomic_add_fetch(&g_completed_fence, 1u, __ATOMIC_RELEASE);
+}
 
-  return 0;
+/*
+ * Hands the frame's replay state to the present worker, waiting first if
+ * g_frames_in_flight frames are still queued, then moves recording to the
+ * next pool state. That state's frame was serialized before the wait
+ * returned: at most g_frames_in_flight of the other pool states are
+ * queued now.
+ */
+static void
+dx9mt_backend_queue_present(uint32_t frame_id,
+                            const dx9mt_backend_frame_snapshot *snapshot) {
+  dx9mt_backend_present_job *job =
+      &g_present_jobs[dx9mt_present_thread_acquire()];
+
+  job->frame_id = frame_id;
+  job->snapshot = *snapshot;
+  job->replay = g_frame_replay_state;
+  dx9mt_present_thread_submit();
+  g_replay_index = (g_replay_index + 1u) % (g_frames_in_flight + 1u);
+  dx9mt_backend_reset_frame_replay_state(frame_id);
 }
 
-int dx9mt_backend_bridge_begin_frame(uint32_t frame_id) {
-  if (!g_backend_ready) {
-    return -1;
-  }
+/*
+ * Async present serializes into IPC, so it needs IPC mapped and one replay
+ * state per frame in flight plus the one being recorded.
+ */
+static void dx9mt_backend_start_present_thread(uint32_t frames) {
+  uint32_t i;
 
-  if (g_frame_open && frame_id != g_last_frame_id) {
-    dx9mt_logf("backend",
-               "begin_frame out of order: incoming=%u previous_open=%u",
-               frame_id, g_last_frame_id);
+  g_frames_in_flight = 0;
+  if (frames == 0) {
+    return;
   }
-  g_frame_open = 1;
-
-  /*
-   * Only reset draw accumulation when frame_id changes. FNV (and many D3D9
-   * titles) call BeginScene/EndScene multiple times per visual frame for
-   * multi-pass rendering (shadow maps, scene, post-process, HUD). All passes
-   * share the same frame_id, so we accumulate draws across all passes and
-   * only flush on Present.
-   */
-  if (frame_id != g_last_frame_id) {
-    dx9mt_backend_reset_frame_stats();
-    memset(&g_current_frame_snapshot, 0, sizeof(g_current_frame_snapshot));
-    g_current_frame_snapshot.frame_id = frame_id;
-    dx9mt_backend_reset_frame_replay_state(frame_id);
-    g_last_frame_id = frame_id;
+  if (!g_metal_ipc_ptr) {
+    dx9mt_logf("backend", "async present needs IPC, presenting inline");
+    return;
+  }
+  for (i = 0; i <= frames; ++i) {
+    if (!g_replay_pool[i] &&
+        !(g_replay_pool[i] = dx9mt_backend_replay_alloc())) {
+      return;
+    }
+  }
+  if (dx9mt_present_thread_start(frames, dx9mt_backend_serialize_present) !=
+      0) {
+    dx9mt_logf("backend", "present thread unavailable, presenting inline");
+    return;
   }
+  g_frames_in_flight = frames;
+}
 
-  if (dx9mt_backend_should_log_frame(frame_id)) {
-    dx9mt_logf("backend", "begin_frame=%u", frame_id);
+/* Full IPC frames are only split across threads with IPC mapped. */
+static void dx9mt_backend_start_ipc_workers(uint32_t threads) {
+  if (threads <= 1 || !g_metal_ipc_ptr) {
+    return;
   }
-  return 0;
+  if (dx9mt_worker_pool_start(threads) != 0) {
+    dx9mt_logf("backend", "IPC workers unavailable, serializing on one thread");
+    return;
+  }
+  dx9mt_logf("backend", "IPC serializer threads=%u", dx9mt_worker_pool_size());
 }
 
-int dx9mt_backend_bridge_present(uint32_t frame_id) {
+/* *out_queued is set when the frame went to the present worker. */
+static int dx9mt_backend_present_frame(uint32_t frame_id, int *out_queued) {
+  int queued = 0;
   int soft_presented;
   const char *present_mode = "no-op";
   dx9mt_backend_frame_snapshot snapshot;
@@ -1235,11 +3576,14 @@ int dx9mt_backend_bridge_present(uint32_t frame_id) {
                g_frame_replay_state->present_packet_frame_id, frame_id);
     return -1;
   }
-  if (g_frame_draw_indexed_count != g_frame_replay_state->draw_total) {
+  /* Clears are recorded as replay commands alongside the draws. */
+  if (g_frame_draw_indexed_count + g_frame_clear_count !=
+      g_frame_replay_state->draw_total) {
     dx9mt_logf("backend",
-               "draw count mismatch: counter=%u replay_total=%u frame=%u",
-               g_frame_draw_indexed_count, g_frame_replay_state->draw_total,
-               frame_id);
+               "draw count mismatch: counter=%u clears=%u replay_total=%u "
+               "frame=%u",
+               g_frame_draw_indexed_count, g_frame_clear_count,
+               g_frame_replay_state->draw_total, frame_id);
   }
 
   g_frame_open = 0;
@@ -1275,246 +3619,13 @@ int dx9mt_backend_bridge_present(uint32_t frame_id) {
     }
   }
 
-#ifdef _WIN32
-  if (g_metal_ipc_ptr) {
-    unsigned char *ipc_base = (unsigned char *)g_metal_ipc_ptr;
-    uint32_t draw_count = g_frame_replay_state->draw_stored;
-    uint32_t bulk_offset;
-    uint32_t bulk_used = 0;
-    dx9mt_metal_ipc_draw *ipc_draws;
-    uint32_t i;
-
-    if (draw_count > DX9MT_METAL_IPC_MAX_DRAWS) {
-      draw_count = DX9MT_METAL_IPC_MAX_DRAWS;
-    }
-
-    /*
-     * Mark the shared frame as in-progress before mutating any IPC-visible
-     * fields. The viewer ignores sequence 0 and retries if the sequence
-     * changes while it snapshots the frame.
-     */
-    __atomic_store_n(&g_metal_ipc_ptr->sequence, 0, __ATOMIC_RELEASE);
-
-    bulk_offset = (uint32_t)(sizeof(dx9mt_metal_ipc_header) +
-                             draw_count * sizeof(dx9mt_metal_ipc_draw));
-    /* Align bulk data to 16 bytes */
-    bulk_offset = (bulk_offset + 15u) & ~15u;
-
-    ipc_draws =
-        (dx9mt_metal_ipc_draw *)(ipc_base + sizeof(dx9mt_metal_ipc_header));
-
-    for (i = 0; i < draw_count; ++i) {
-      const dx9mt_backend_draw_command *cmd = &g_frame_replay_state->draws[i];
-      dx9mt_metal_ipc_draw *d = &ipc_draws[i];
-      const void *data;
-
-      memset(d, 0, sizeof(*d));
-      d->command_type = cmd->command_type;
-      d->primitive_type = cmd->primitive_type;
-      d->base_vertex = cmd->base_vertex;
-      d->min_vertex_index = cmd->min_vertex_index;
-      d->num_vertices = cmd->num_vertices;
-      d->start_index = cmd->start_index;
-      d->primitive_count = cmd->primitive_count;
-      d->render_target_id = cmd->render_target_id;
-      d->render_target_texture_id = cmd->render_target_texture_id;
-      d->render_target_width = cmd->render_target_width;
-      d->render_target_height = cmd->render_target_height;
-      d->render_target_format = cmd->render_target_format;
-      d->src_surface_id = cmd->src_surface_id;
-      d->src_texture_id = cmd->src_texture_id;
-      d->src_width = cmd->src_width;
-      d->src_height = cmd->src_height;
-      d->src_format = cmd->src_format;
-      d->src_left = cmd->src_left;
-      d->src_top = cmd->src_top;
-      d->src_right = cmd->src_right;
-      d->src_bottom = cmd->src_bottom;
-      d->dst_left = cmd->dst_left;
-      d->dst_top = cmd->dst_top;
-      d->dst_right = cmd->dst_right;
-      d->dst_bottom = cmd->dst_bottom;
-      d->stretch_filter = cmd->stretch_filter;
-      d->viewport_x = cmd->viewport_x;
-      d->viewport_y = cmd->viewport_y;
-      d->viewport_width = cmd->viewport_width;
-      d->viewport_height = cmd->viewport_height;
-      d->viewport_min_z = cmd->viewport_min_z;
-      d->viewport_max_z = cmd->viewport_max_z;
-      d->scissor_left = cmd->scissor_left;
-      d->scissor_top = cmd->scissor_top;
-      d->scissor_right = cmd->scissor_right;
-      d->scissor_bottom = cmd->scissor_bottom;
-      d->fvf = cmd->fvf;
-      d->pixel_shader_id = cmd->pixel_shader_id;
-      d->stream0_offset = cmd->stream0_offset;
-      d->stream0_stride = cmd->stream0_stride;
-      d->index_format = cmd->index_format;
-      for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
-        d->tex_id[s] = cmd->tex_id[s];
-        d->tex_generation[s] = cmd->tex_generation[s];
-        d->tex_format[s] = cmd->tex_format[s];
-        d->tex_width[s] = cmd->tex_width[s];
-        d->tex_height[s] = cmd->tex_height[s];
-        d->tex_pitch[s] = cmd->tex_pitch[s];
-        d->sampler_min_filter[s] = cmd->sampler_min_filter[s];
-        d->sampler_mag_filter[s] = cmd->sampler_mag_filter[s];
-        d->sampler_mip_filter[s] = cmd->sampler_mip_filter[s];
-        d->sampler_address_u[s] = cmd->sampler_address_u[s];
-        d->sampler_address_v[s] = cmd->sampler_address_v[s];
-        d->sampler_address_w[s] = cmd->sampler_address_w[s];
-      }
-      d->tss0_color_op = cmd->tss0_color_op;
-      d->tss0_color_arg1 = cmd->tss0_color_arg1;
-      d->tss0_color_arg2 = cmd->tss0_color_arg2;
-      d->tss0_alpha_op = cmd->tss0_alpha_op;
-      d->tss0_alpha_arg1 = cmd->tss0_alpha_arg1;
-      d->tss0_alpha_arg2 = cmd->tss0_alpha_arg2;
-      d->rs_texture_factor = cmd->rs_texture_factor;
-      d->rs_alpha_blend_enable = cmd->rs_alpha_blend_enable;
-      d->rs_src_blend = cmd->rs_src_blend;
-      d->rs_dest_blend = cmd->rs_dest_blend;
-      d->rs_alpha_test_enable = cmd->rs_alpha_test_enable;
-      d->rs_alpha_ref = cmd->rs_alpha_ref;
-      d->rs_alpha_func = cmd->rs_alpha_func;
-      d->rs_zenable = cmd->rs_zenable;
-      d->rs_zwriteenable = cmd->rs_zwriteenable;
-      d->rs_zfunc = cmd->rs_zfunc;
-      d->rs_stencilenable = cmd->rs_stencilenable;
-      d->rs_stencilfunc = cmd->rs_stencilfunc;
-      d->rs_stencilref = cmd->rs_stencilref;
-      d->rs_stencilmask = cmd->rs_stencilmask;
-      d->rs_stencilwritemask = cmd->rs_stencilwritemask;
-      d->rs_cull_mode = cmd->rs_cull_mode;
-      d->rs_scissortestenable = cmd->rs_scissortestenable;
-      d->rs_blendop = cmd->rs_blendop;
-      d->rs_colorwriteenable = cmd->rs_colorwriteenable;
-      d->rs_stencilpass = cmd->rs_stencilpass;
-      d->rs_stencilfail = cmd->rs_stencilfail;
-      d->rs_stencilzfail = cmd->rs_stencilzfail;
-      d->rs_fogenable = cmd->rs_fogenable;
-      d->rs_fogcolor = cmd->rs_fogcolor;
-      d->rs_fogstart = cmd->rs_fogstart;
-      d->rs_fogend = cmd->rs_fogend;
-      d->rs_fogdensity = cmd->rs_fogdensity;
-      d->rs_fogtablemode = cmd->rs_fogtablemode;
-
-      /* Copy VB data into bulk region */
-      data = dx9mt_frontend_upload_resolve(&cmd->vertex_data);
-      if (data && cmd->vertex_data_size > 0 &&
-          bulk_offset + bulk_used + cmd->vertex_data_size <=
-              DX9MT_METAL_IPC_SIZE) {
-        d->vb_bulk_offset = bulk_used;
-        d->vb_bulk_size = cmd->vertex_data_size;
-        memcpy(ipc_base + bulk_offset + bulk_used, data, cmd->vertex_data_size);
-        bulk_used += (cmd->vertex_data_size + 15u) & ~15u;
-      }
-
-      /* Copy IB data into bulk region */
-      data = dx9mt_frontend_upload_resolve(&cmd->index_data);
-      if (data && cmd->index_data_size > 0 &&
-          bulk_offset + bulk_used + cmd->index_data_size <=
-              DX9MT_METAL_IPC_SIZE) {
-        d->ib_bulk_offset = bulk_used;
-        d->ib_bulk_size = cmd->index_data_size;
-        memcpy(ipc_base + bulk_offset + bulk_used, data, cmd->index_data_size);
-        bulk_used += (cmd->index_data_size + 15u) & ~15u;
-      }
-
-      /* Copy vertex declaration into bulk region */
-      data = dx9mt_frontend_upload_resolve(&cmd->vertex_decl_data);
-      if (data && cmd->vertex_decl_count > 0) {
-        uint32_t decl_bytes = cmd->vertex_decl_count * 8u;
-        if (bulk_offset + bulk_used + decl_bytes <= DX9MT_METAL_IPC_SIZE) {
-          d->decl_bulk_offset = bulk_used;
-          d->decl_count = cmd->vertex_decl_count;
-          memcpy(ipc_base + bulk_offset + bulk_used, data, decl_bytes);
-          bulk_used += (decl_bytes + 15u) & ~15u;
-        }
-      }
-
-      /* Copy VS float constants into bulk region */
-      data = dx9mt_frontend_upload_resolve(&cmd->constants_vs);
-      if (data && cmd->constants_vs.size > 0 &&
-          bulk_offset + bulk_used + cmd->constants_vs.size <=
-              DX9MT_METAL_IPC_SIZE) {
-        d->vs_constants_bulk_offset = bulk_used;
-        d->vs_constants_size = cmd->constants_vs.size;
-        memcpy(ipc_base + bulk_offset + bulk_used, data,
-               cmd->constants_vs.size);
-        bulk_used += (cmd->constants_vs.size + 15u) & ~15u;
-      }
-
-      /* Copy PS float constants into bulk region */
-      data = dx9mt_frontend_upload_resolve(&cmd->constants_ps);
-      if (data && cmd->constants_ps.size > 0 &&
-          bulk_offset + bulk_used + cmd->constants_ps.size <=
-              DX9MT_METAL_IPC_SIZE) {
-        d->ps_constants_bulk_offset = bulk_used;
-        d->ps_constants_size = cmd->constants_ps.size;
-        memcpy(ipc_base + bulk_offset + bulk_used, data,
-               cmd->constants_ps.size);
-        bulk_used += (cmd->constants_ps.size + 15u) & ~15u;
-      }
-
-      /* Copy per-stage texture uploads when present (texture cache updates). */
-      for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
-        data = dx9mt_frontend_upload_resolve(&cmd->tex_data[s]);
-        if (data && cmd->tex_data[s].size > 0 &&
-            bulk_offset + bulk_used + cmd->tex_data[s].size <=
-                DX9MT_METAL_IPC_SIZE) {
-          d->tex_bulk_offset[s] = bulk_used;
-          d->tex_bulk_size[s] = cmd->tex_data[s].size;
-          memcpy(ipc_base + bulk_offset + bulk_used, data,
-                 cmd->tex_data[s].size);
-          bulk_used += (cmd->tex_data[s].size + 15u) & ~15u;
-        }
-      }
-
-      /* Copy VS/PS shader bytecode for translation. */
-      d->vertex_shader_id = cmd->vertex_shader_id;
-      data = dx9mt_frontend_upload_resolve(&cmd->vs_bytecode);
-      if (data && cmd->vs_bytecode.size > 0 &&
-          bulk_offset + bulk_used + cmd->vs_bytecode.size <=
-              DX9MT_METAL_IPC_SIZE) {
-        d->vs_bytecode_bulk_offset = bulk_used;
-        d->vs_bytecode_bulk_size = cmd->vs_bytecode.size;
-        memcpy(ipc_base + bulk_offset + bulk_used, data,
-               cmd->vs_bytecode.size);
-        bulk_used += (cmd->vs_bytecode.size + 15u) & ~15u;
-      }
-      data = dx9mt_frontend_upload_resolve(&cmd->ps_bytecode);
-      if (data && cmd->ps_bytecode.size > 0 &&
-          bulk_offset + bulk_used + cmd->ps_bytecode.size <=
-              DX9MT_METAL_IPC_SIZE) {
-        d->ps_bytecode_bulk_offset = bulk_used;
-        d->ps_bytecode_bulk_size = cmd->ps_bytecode.size;
-        memcpy(ipc_base + bulk_offset + bulk_used, data,
-               cmd->ps_bytecode.size);
-        bulk_used += (cmd->ps_bytecode.size + 15u) & ~15u;
-      }
-    }
-
-    g_metal_ipc_ptr->width = g_present_target.width;
-    g_metal_ipc_ptr->height = g_present_target.height;
-    g_metal_ipc_ptr->have_clear = g_frame_replay_state->have_clear;
-    g_metal_ipc_ptr->clear_color_argb = snapshot.last_clear_color;
-    g_metal_ipc_ptr->clear_flags = snapshot.last_clear_flags;
-    g_metal_ipc_ptr->clear_z = snapshot.last_clear_z;
-    g_metal_ipc_ptr->clear_stencil = snapshot.last_clear_stencil;
-    g_metal_ipc_ptr->draw_count = draw_count;
-    g_metal_ipc_ptr->replay_hash = snapshot.replay_hash;
-    g_metal_ipc_ptr->frame_id = frame_id;
-    g_metal_ipc_ptr->present_render_target_id =
-        g_frame_replay_state->present_render_target_id;
-    g_metal_ipc_ptr->bulk_data_offset = bulk_offset;
-    g_metal_ipc_ptr->bulk_data_used = bulk_used;
-    /* Write sequence last -- the viewer polls this field. */
-    __atomic_store_n(&g_metal_ipc_ptr->sequence, ++g_metal_ipc_sequence,
-                     __ATOMIC_RELEASE);
-    present_mode = "metal-ipc";
+  if (g_metal_ipc_ptr && dx9mt_present_thread_running()) {
+    queued = 1;
+    present_mode = "metal-ipc-queued";
+  } else if (g_metal_ipc_ptr) {
+    present_mode = dx9mt_backend_ipc_write_frame(g_frame_replay_state,
+                                                 frame_id, &snapshot);
   }
-#endif
   if (dx9mt_backend_should_log_frame(frame_id)) {
     dx9mt_logf(
         "backend",
@@ -1528,35 +3639,82 @@ int dx9mt_backend_bridge_present(uint32_t frame_id) {
         snapshot.replay_hash,
         g_frame_replay_state->draw_stored, g_frame_replay_state->draw_dropped);
   }
-  g_frame_replay_state->have_present_packet = 0;
+  if (queued) {
+    dx9mt_backend_queue_present(frame_id, &snapshot);
+    *out_queued = 1;
+  } else {
+    g_frame_replay_state->have_present_packet = 0;
+  }
   return 0;
 }
 
+int dx9mt_backend_bridge_present(uint32_t frame_id) {
+  int queued = 0;
+  int result;
+
+  /* The frame's packets must be recorded before IPC assembly reads them. */
+  dx9mt_packet_thread_drain();
+  result = dx9mt_backend_present_frame(frame_id, &queued);
+  if (queued) {
+    /* The worker retires the frame once it has serialized it. */
+    return result;
+  }
+
+  /*
+   * Every upload ref for this frame has been copied out (or the frame was
+   * dropped) by now, so retire it even when present failed; otherwise the
+   * frontend would wait on a slot nothing will ever release. Queued frames
+   * retire first, so the fence keeps counting presents in order.
+   */
+  dx9mt_present_thread_drain();
+  __atomic_add_fetch(&g_completed_fence, 1u, __ATOMIC_RELEASE);
+  return result;
+}
+
+uint32_t dx9mt_backend_bridge_completed_fence(void) {
+  return __atomic_load_n(&g_completed_fence, __ATOMIC_ACQUIRE);
+}
+
+uint32_t dx9mt_backend_bridge_viewer_resync(void) {
+  if (!g_metal_ipc_ptr) {
+    return 0;
+  }
+  return __atomic_load_n(&g_metal_ipc_ptr->viewer_resync, __ATOMIC_ACQUIRE);
+}
+
+void *dx9mt_backend_bridge_ipc_upload_slot(uint32_t slot, uint32_t *out_bytes) {
+  if (out_bytes) {
+    *out_bytes = 0;
+  }
+  if (g_metal_ipc_ptr && g_metal_ipc_zero_copy &&
+      slot < DX9MT_UPLOAD_ARENA_MAX_SLOTS) {
+    if (out_bytes) {
+      *out_bytes = DX9MT_METAL_IPC_ARENA_SLOT_BYTES;
+    }
+    return (unsigned char *)g_metal_ipc_ptr + DX9MT_METAL_IPC_ARENA_OFFSET +
+           (size_t)slot * DX9MT_METAL_IPC_ARENA_SLOT_BYTES;
+  }
+  return NULL;
+}
+
 void dx9mt_backend_bridge_shutdown(void) {
   if (!g_backend_ready) {
     return;
   }
 
+  dx9mt_packet_thread_stop();
+  dx9mt_present_thread_stop();
+  dx9mt_worker_pool_stop();
+  g_frames_in_flight = 0;
+
 #if defined(__APPLE__) && !defined(DX9MT_NO_METAL)
   if (dx9mt_metal_is_available()) {
     dx9mt_metal_shutdown();
   }
 #endif
 
-#ifdef _WIN32
-  if (g_metal_ipc_ptr) {
-    UnmapViewOfFile(g_metal_ipc_ptr);
-    g_metal_ipc_ptr = NULL;
-  }
-  if (g_metal_ipc_mapping) {
-    CloseHandle(g_metal_ipc_mapping);
-    g_metal_ipc_mapping = NULL;
-  }
-  if (g_metal_ipc_file != INVALID_HANDLE_VALUE) {
-    CloseHandle(g_metal_ipc_file);
-    g_metal_ipc_file = INVALID_HANDLE_VALUE;
-  }
-#endif
+  dx9mt_backend_ipc_close();
+  g_metal_ipc_zero_copy = 0;
 
   dx9mt_logf("backend", "shutdown, last_frame=%u", g_last_frame_id);
   g_backend_ready = 0;
@@ -1565,9 +3723,38 @@ void dx9mt_backend_bridge_shutdown(void) {
   g_frame_open = 0;
   memset(&g_upload_desc, 0, sizeof(g_upload_desc));
   g_last_replay_hash = 0;
+  g_replay_index = 0;
   dx9mt_backend_reset_frame_replay_state(0);
 }
 
 uint32_t dx9mt_backend_bridge_debug_get_last_replay_hash(void) {
   return g_last_replay_hash;
 }
+
+uint32_t dx9mt_backend_bridge_debug_get_submit_errors(void) {
+  return __atomic_load_n(&g_submit_errors, __ATOMIC_RELAXED);
+}
+
+void dx9mt_backend_bridge_set_upload_resolver(
+    dx9mt_backend_upload_resolve_fn resolve) {
+  g_upload_resolve = resolve;
+}
+
+void dx9mt_backend_bridge_debug_get_ipc_stats(
+    dx9mt_backend_ipc_stats *out_stats) {
+  if (out_stats) {
+    *out_stats = g_ipc_stats;
+  }
+}
+
+void dx9mt_backend_bridge_debug_get_present_stats(
+    dx9mt_backend_present_stats *out_stats) {
+  if (!out_stats) {
+    return;
+  }
+  if (!dx9mt_present_thread_running()) {
+    memset(out_stats, 0, sizeof(*out_stats));
+    return;
+  }
+  dx9mt_present_thread_get_stats(out_stats);
+}
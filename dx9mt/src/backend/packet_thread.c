@@ -0,0 +1,305 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "packet_thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "dx9mt/backend_bridge.h"
+#include "dx9mt/log.h"
+#include "dx9mt/spsc_ring.h"
+#include "thread_signal.h"
+
+/* Busy-wait iterations before a waiter yields (SPIN) or sleeps (BLOCK). */
+#define DX9MT_PACKET_THREAD_SPIN_LIMIT 256u
+#define DX9MT_PACKET_THREAD_MIN_CAPACITY (128u << 10)
+
+typedef struct dx9mt_packet_thread {
+  dx9mt_spsc_ring ring;
+  void *storage;
+  uint32_t mode;
+  uint32_t stop;
+  dx9mt_packet_thread_consume_fn consume;
+  dx9mt_thread_signal work;  /* producer -> worker: records queued */
+  dx9mt_thread_signal space; /* worker -> producer: records consumed */
+  uint64_t submitted;        /* producer-owned record count */
+  uint64_t consumed;         /* worker-owned, read by the producer */
+  dx9mt_packet_thread_stats stats;
+#ifdef _WIN32
+  HANDLE thread;
+#else
+  pthread_t thread;
+#endif
+} dx9mt_packet_thread;
+
+static dx9mt_packet_thread g_packet_thread;
+static int g_packet_thread_running;
+
+/* Spin, then yield (SPIN) or sleep on `signal` (BLOCK) until ready. */
+static uint32_t dx9mt_packet_thread_wait(dx9mt_thread_signal *signal,
+                                         dx9mt_thread_ready_fn ready,
+                                         const void *context) {
+  uint32_t spins = 0;
+  uint32_t sleeps = 0;
+
+  while (!ready(context)) {
+    if (spins < DX9MT_PACKET_THREAD_SPIN_LIMIT) {
+      ++spins;
+      dx9mt_cpu_relax();
+    } else if (g_packet_thread.mode == DX9MT_BACKEND_PACKET_THREAD_SPIN) {
+      dx9mt_thread_yield();
+    } else {
+      sleeps += (uint32_t)dx9mt_thread_signal_sleep(signal, ready, context);
+    }
+  }
+  return sleeps;
+}
+
+static int dx9mt_packet_thread_has_work(const void *context) {
+  (void)context;
+  return !dx9mt_spsc_ring_empty(&g_packet_thread.ring) ||
+         __atomic_load_n(&g_packet_thread.stop, __ATOMIC_ACQUIRE);
+}
+
+static int dx9mt_packet_thread_idle(const void *context) {
+  (void)context;
+  return __atomic_load_n(&g_packet_thread.consumed, __ATOMIC_ACQUIRE) ==
+         g_packet_thread.submitted;
+}
+
+static int dx9mt_packet_thread_has_space(const void *context) {
+  uint32_t span = *(const uint32_t *)context;
+  const dx9mt_spsc_ring *ring = &g_packet_thread.ring;
+  uint32_t used = ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  uint32_t contiguous = ring->capacity - (ring->head & (ring->capacity - 1u));
+
+  /* Same test as try_push: a record that would wrap also needs the pad. */
+  return ring->capacity - used >=
+         (span > contiguous ? contiguous + span : span);
+}
+
+static void dx9mt_packet_thread_consume_all(void) {
+  const void *record;
+  uint32_t bytes = 0;
+
+  while ((record = dx9mt_spsc_ring_peek(&g_packet_thread.ring, &bytes)) !=
+         NULL) {
+    if (g_packet_thread.consume((const dx9mt_packet_header *)record, bytes) !=
+        0) {
+      ++g_packet_thread.stats.consume_errors;
+    }
+    g_packet_thread.stats.bytes += bytes;
+    ++g_packet_thread.stats.records;
+    dx9mt_spsc_ring_pop(&g_packet_thread.ring);
+    __atomic_store_n(&g_packet_thread.consumed, g_packet_thread.consumed + 1u,
+                     __ATOMIC_RELEASE);
+    dx9mt_thread_signal_wake(&g_packet_thread.space);
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI dx9mt_packet_thread_main(LPVOID param)
+#else
+static void *dx9mt_packet_thread_main(void *param)
+#endif
+{
+  (void)param;
+  for (;;) {
+    dx9mt_packet_thread_consume_all();
+    if (__atomic_load_n(&g_packet_thread.stop, __ATOMIC_ACQUIRE) &&
+        dx9mt_spsc_ring_empty(&g_packet_thread.ring)) {
+      break;
+    }
+    g_packet_thread.stats.consumer_sleeps += dx9mt_packet_thread_wait(
+        &g_packet_thread.work, dx9mt_packet_thread_has_work, NULL);
+  }
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+static void dx9mt_packet_thread_release_storage(void) {
+  if (!g_packet_thread.storage) {
+    return;
+  }
+#ifdef _WIN32
+  VirtualFree(g_packet_thread.storage, 0, MEM_RELEASE);
+#else
+  free(g_packet_thread.storage);
+#endif
+  g_packet_thread.storage = NULL;
+}
+
+int dx9mt_packet_thread_start(uint32_t mode, uint32_t capacity,
+                              dx9mt_packet_thread_consume_fn consume) {
+  uint32_t ring_bytes = DX9MT_PACKET_THREAD_MIN_CAPACITY;
+
+  if (g_packet_thread_running || !consume ||
+      (mode != DX9MT_BACKEND_PACKET_THREAD_BLOCK &&
+       mode != DX9MT_BACKEND_PACKET_THREAD_SPIN)) {
+    return -1;
+  }
+  while (ring_bytes <= capacity / 2u && ring_bytes < (1u << 30)) {
+    ring_bytes <<= 1;
+  }
+
+  memset(&g_packet_thread, 0, sizeof(g_packet_thread));
+  g_packet_thread.mode = mode;
+  g_packet_thread.consume = consume;
+#ifdef _WIN32
+  g_packet_thread.storage =
+      VirtualAlloc(NULL, ring_bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+  g_packet_thread.storage = malloc(ring_bytes);
+#endif
+  if (!g_packet_thread.storage ||
+      !dx9mt_spsc_ring_init(&g_packet_thread.ring, g_packet_thread.storage,
+                            ring_bytes)) {
+    dx9mt_logf("backend", "packet thread ring alloc failed (%u bytes)",
+               ring_bytes);
+    dx9mt_packet_thread_release_storage();
+    return -1;
+  }
+  if (!dx9mt_thread_signal_init(&g_packet_thread.work)) {
+    dx9mt_packet_thread_release_storage();
+    return -1;
+  }
+  if (!dx9mt_thread_signal_init(&g_packet_thread.space)) {
+    dx9mt_thread_signal_destroy(&g_packet_thread.work);
+    dx9mt_packet_thread_release_storage();
+    return -1;
+  }
+
+#ifdef _WIN32
+  g_packet_thread.thread =
+      CreateThread(NULL, 0, dx9mt_packet_thread_main, NULL, 0, NULL);
+  if (!g_packet_thread.thread) {
+#else
+  if (pthread_create(&g_packet_thread.thread, NULL, dx9mt_packet_thread_main,
+                     NULL) != 0) {
+#endif
+    dx9mt_logf("backend", "packet thread create failed");
+    dx9mt_thread_signal_destroy(&g_packet_thread.space);
+    dx9mt_thread_signal_destroy(&g_packet_thread.work);
+    dx9mt_packet_thread_release_storage();
+    return -1;
+  }
+
+  g_packet_thread_running = 1;
+  dx9mt_logf("backend", "packet thread started: mode=%s ring=%u max_record=%u",
+             mode == DX9MT_BACKEND_PACKET_THREAD_SPIN ? "spin" : "block",
+             ring_bytes, dx9mt_spsc_ring_max_record(&g_packet_thread.ring));
+  return 0;
+}
+
+int dx9mt_packet_thread_running(void) { return g_packet_thread_running; }
+
+static void dx9mt_packet_thread_push_record(const void *data, uint32_t bytes) {
+  uint32_t span = DX9MT_SPSC_RING_RECORD_HEADER_BYTES + ((bytes + 7u) & ~7u);
+
+  if (!dx9mt_spsc_ring_try_push(&g_packet_thread.ring, data, bytes)) {
+    ++g_packet_thread.stats.producer_stalls;
+    do {
+      dx9mt_packet_thread_wait(&g_packet_thread.space,
+                               dx9mt_packet_thread_has_space, &span);
+    } while (!dx9mt_spsc_ring_try_push(&g_packet_thread.ring, data, bytes));
+  }
+  ++g_packet_thread.submitted;
+  dx9mt_thread_signal_wake(&g_packet_thread.work);
+}
+
+void dx9mt_packet_thread_submit(const dx9mt_packet_header *packets,
+                                uint32_t packet_bytes) {
+  const unsigned char *bytes = (const unsigned char *)packets;
+  uint32_t max_record;
+  uint32_t offset = 0;
+
+  if (!g_packet_thread_running || !packets) {
+    return;
+  }
+
+  max_record = dx9mt_spsc_ring_max_record(&g_packet_thread.ring);
+  while (offset < packet_bytes) {
+    uint32_t chunk = 0;
+
+    while (offset + chunk + sizeof(dx9mt_packet_header) <= packet_bytes) {
+      const dx9mt_packet_header *header =
+          (const dx9mt_packet_header *)(bytes + offset + chunk);
+      if (header->size < sizeof(dx9mt_packet_header) ||
+          header->size > packet_bytes - offset - chunk ||
+          chunk + header->size > max_record) {
+        break;
+      }
+      chunk += header->size;
+    }
+    if (chunk == 0) {
+      /* Malformed framing: forward it so the worker logs and rejects it. */
+      chunk = packet_bytes - offset;
+      if (chunk > max_record) {
+        chunk = max_record;
+      }
+    }
+    dx9mt_packet_thread_push_record(bytes + offset, chunk);
+    offset += chunk;
+  }
+}
+
+void dx9mt_packet_thread_drain(void) {
+  if (!g_packet_thread_running) {
+    return;
+  }
+  ++g_packet_thread.stats.drains;
+  dx9mt_packet_thread_wait(&g_packet_thread.space, dx9mt_packet_thread_idle,
+                           NULL);
+}
+
+void dx9mt_packet_thread_stop(void) {
+  if (!g_packet_thread_running) {
+    return;
+  }
+
+  dx9mt_packet_thread_drain();
+  __atomic_store_n(&g_packet_thread.stop, 1, __ATOMIC_RELEASE);
+  dx9mt_thread_signal_wake(&g_packet_thread.work);
+#ifdef _WIN32
+  WaitForSingleObject(g_packet_thread.thread, INFINITE);
+  CloseHandle(g_packet_thread.thread);
+  g_packet_thread.thread = NULL;
+#else
+  pthread_join(g_packet_thread.thread, NULL);
+#endif
+  g_packet_thread_running = 0;
+
+  dx9mt_logf("backend",
+             "packet thread stopped: records=%llu bytes=%llu stalls=%u "
+             "sleeps=%u drains=%u errors=%u",
+             (unsigned long long)g_packet_thread.stats.records,
+             (unsigned long long)g_packet_thread.stats.bytes,
+             g_packet_thread.stats.producer_stalls,
+             g_packet_thread.stats.consumer_sleeps,
+             g_packet_thread.stats.drains,
+             g_packet_thread.stats.consume_errors);
+  dx9mt_thread_signal_destroy(&g_packet_thread.space);
+  dx9mt_thread_signal_destroy(&g_packet_thread.work);
+  dx9mt_packet_thread_release_storage();
+}
+
+void dx9mt_packet_thread_get_stats(dx9mt_packet_thread_stats *out_stats) {
+  if (out_stats) {
+    /* Worker-written counters are only stable after a drain. */
+    *out_stats = g_packet_thread.stats;
+  }
+}
@@ -0,0 +1,43 @@
+#ifndef DX9MT_PACKET_THREAD_H
+#define DX9MT_PACKET_THREAD_H
+
+#include <stdint.h>
+
+#include "dx9mt/packets.h"
+
+typedef int (*dx9mt_packet_thread_consume_fn)(
+    const dx9mt_packet_header *packets, uint32_t packet_bytes);
+
+typedef struct dx9mt_packet_thread_stats {
+  uint64_t records;
+  uint64_t bytes;
+  uint32_t producer_stalls; /* submits that waited for ring space */
+  uint32_t consumer_sleeps; /* times the worker slept for work */
+  uint32_t drains;
+  uint32_t consume_errors;
+} dx9mt_packet_thread_stats;
+
+/*
+ * Backend packet worker: the producer (game render thread) copies packet
+ * batches into an SPSC ring and the worker calls `consume` on each one, in
+ * submission order. One producer thread only.
+ *
+ * `mode` is a dx9mt_backend_packet_thread_mode other than OFF.
+ */
+int dx9mt_packet_thread_start(uint32_t mode, uint32_t capacity,
+                              dx9mt_packet_thread_consume_fn consume);
+int dx9mt_packet_thread_running(void);
+
+/* Queues whole packets, split into ring records at packet boundaries. */
+void dx9mt_packet_thread_submit(const dx9mt_packet_header *packets,
+                                uint32_t packet_bytes);
+
+/* Returns once every queued packet has been consumed. Producer only. */
+void dx9mt_packet_thread_drain(void);
+
+/* Drains, stops and joins the worker. */
+void dx9mt_packet_thread_stop(void);
+
+void dx9mt_packet_thread_get_stats(dx9mt_packet_thread_stats *out_stats);
+
+#endif
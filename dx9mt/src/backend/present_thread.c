@@ -0,0 +1,252 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "present_thread.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include "dx9mt/log.h"
+#include "thread_signal.h"
+
+/* Busy-wait iterations before a waiter sleeps on its signal. */
+#define DX9MT_PRESENT_THREAD_SPIN_LIMIT 256u
+
+typedef struct dx9mt_present_thread {
+  uint32_t depth;
+  uint32_t stop;
+  dx9mt_present_thread_serialize_fn serialize;
+  dx9mt_thread_signal work; /* producer -> worker: job queued */
+  dx9mt_thread_signal done; /* worker -> producer: job serialized */
+  uint32_t submitted;       /* producer-owned job count */
+  uint32_t completed;       /* worker-owned, read by the producer */
+  uint64_t queued_us[DX9MT_BACKEND_MAX_FRAMES_IN_FLIGHT]; /* per job slot */
+  dx9mt_backend_present_stats stats;
+#ifdef _WIN32
+  HANDLE thread;
+#else
+  pthread_t thread;
+#endif
+} dx9mt_present_thread;
+
+static dx9mt_present_thread g_present_thread;
+static int g_present_thread_running;
+
+static uint64_t dx9mt_present_thread_now_us(void) {
+#ifdef _WIN32
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER now;
+
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&now);
+  return (uint64_t)(now.QuadPart / frequency.QuadPart) * 1000000ull +
+         (uint64_t)(now.QuadPart % frequency.QuadPart) * 1000000ull /
+             (uint64_t)frequency.QuadPart;
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000ull;
+#endif
+}
+
+static void dx9mt_present_thread_wait(dx9mt_thread_signal *signal,
+                                      dx9mt_thread_ready_fn ready) {
+  uint32_t spins = 0;
+
+  while (!ready(NULL)) {
+    if (spins < DX9MT_PRESENT_THREAD_SPIN_LIMIT) {
+      ++spins;
+      dx9mt_cpu_relax();
+    } else {
+      dx9mt_thread_signal_sleep(signal, ready, NULL);
+    }
+  }
+}
+
+static int dx9mt_present_thread_has_work(const void *context) {
+  (void)context;
+  return __atomic_load_n(&g_present_thread.submitted, __ATOMIC_ACQUIRE) !=
+             g_present_thread.completed ||
+         __atomic_load_n(&g_present_thread.stop, __ATOMIC_ACQUIRE);
+}
+
+static int dx9mt_present_thread_has_slot(const void *context) {
+  (void)context;
+  return g_present_thread.submitted -
+             __atomic_load_n(&g_present_thread.completed, __ATOMIC_ACQUIRE) <
+         g_present_thread.depth;
+}
+
+static int dx9mt_present_thread_idle(const void *context) {
+  (void)context;
+  return __atomic_load_n(&g_present_thread.completed, __ATOMIC_ACQUIRE) ==
+         g_present_thread.submitted;
+}
+
+static void dx9mt_present_thread_serialize_all(void) {
+  dx9mt_backend_present_stats *stats = &g_present_thread.stats;
+
+  while (__atomic_load_n(&g_present_thread.submitted, __ATOMIC_ACQUIRE) !=
+         g_present_thread.completed) {
+    uint32_t job = g_present_thread.completed % g_present_thread.depth;
+    uint64_t latency_us;
+
+    g_present_thread.serialize(job);
+    latency_us =
+        dx9mt_present_thread_now_us() - g_present_thread.queued_us[job];
+    stats->latency_us =
+        latency_us > 0xFFFFFFFFull ? 0xFFFFFFFFu : (uint32_t)latency_us;
+    if (stats->latency_us > stats->latency_max_us) {
+      stats->latency_max_us = stats->latency_us;
+    }
+    stats->latency_total_us += latency_us;
+    ++stats->frames;
+    __atomic_store_n(&g_present_thread.completed,
+                     g_present_thread.completed + 1u, __ATOMIC_RELEASE);
+    dx9mt_thread_signal_wake(&g_present_thread.done);
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI dx9mt_present_thread_main(LPVOID param)
+#else
+static void *dx9mt_present_thread_main(void *param)
+#endif
+{
+  (void)param;
+  for (;;) {
+    dx9mt_present_thread_serialize_all();
+    if (__atomic_load_n(&g_present_thread.stop, __ATOMIC_ACQUIRE) &&
+        dx9mt_present_thread_idle(NULL)) {
+      break;
+    }
+    dx9mt_present_thread_wait(&g_present_thread.work,
+                              dx9mt_present_thread_has_work);
+  }
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+int dx9mt_present_thread_start(uint32_t depth,
+                               dx9mt_present_thread_serialize_fn serialize) {
+  if (g_present_thread_running || !serialize || depth == 0 ||
+      depth > DX9MT_BACKEND_MAX_FRAMES_IN_FLIGHT) {
+    return -1;
+  }
+
+  memset(&g_present_thread, 0, sizeof(g_present_thread));
+  g_present_thread.depth = depth;
+  g_present_thread.serialize = serialize;
+  g_present_thread.stats.frames_in_flight = depth;
+  if (!dx9mt_thread_signal_init(&g_present_thread.work)) {
+    return -1;
+  }
+  if (!dx9mt_thread_signal_init(&g_present_thread.done)) {
+    dx9mt_thread_signal_destroy(&g_present_thread.work);
+    return -1;
+  }
+
+#ifdef _WIN32
+  g_present_thread.thread =
+      CreateThread(NULL, 0, dx9mt_present_thread_main, NULL, 0, NULL);
+  if (!g_present_thread.thread) {
+#else
+  if (pthread_create(&g_present_thread.thread, NULL,
+                     dx9mt_present_thread_main, NULL) != 0) {
+#endif
+    dx9mt_logf("backend", "present thread create failed");
+    dx9mt_thread_signal_destroy(&g_present_thread.done);
+    dx9mt_thread_signal_destroy(&g_present_thread.work);
+    return -1;
+  }
+
+  g_present_thread_running = 1;
+  dx9mt_logf("backend", "present thread started: frames_in_flight=%u", depth);
+  return 0;
+}
+
+int dx9mt_present_thread_running(void) { return g_present_thread_running; }
+
+uint32_t dx9mt_present_thread_acquire(void) {
+  if (!dx9mt_present_thread_has_slot(NULL)) {
+    uint64_t start = dx9mt_present_thread_now_us();
+
+    dx9mt_present_thread_wait(&g_present_thread.done,
+                              dx9mt_present_thread_has_slot);
+    ++g_present_thread.stats.waits;
+    g_present_thread.stats.wait_us += dx9mt_present_thread_now_us() - start;
+  }
+  return g_present_thread.submitted % g_present_thread.depth;
+}
+
+void dx9mt_present_thread_submit(void) {
+  uint32_t job = g_present_thread.submitted % g_present_thread.depth;
+  uint32_t depth;
+
+  g_present_thread.queued_us[job] = dx9mt_present_thread_now_us();
+  __atomic_store_n(&g_present_thread.submitted,
+                   g_present_thread.submitted + 1u, __ATOMIC_RELEASE);
+  depth = g_present_thread.submitted -
+          __atomic_load_n(&g_present_thread.completed, __ATOMIC_ACQUIRE);
+  g_present_thread.stats.queue_depth = depth;
+  ++g_present_thread.stats.depth_histogram[depth];
+  dx9mt_thread_signal_wake(&g_present_thread.work);
+}
+
+void dx9mt_present_thread_drain(void) {
+  if (!g_present_thread_running) {
+    return;
+  }
+  dx9mt_present_thread_wait(&g_present_thread.done, dx9mt_present_thread_idle);
+}
+
+void dx9mt_present_thread_stop(void) {
+  const dx9mt_backend_present_stats *stats = &g_present_thread.stats;
+
+  if (!g_present_thread_running) {
+    return;
+  }
+
+  dx9mt_present_thread_drain();
+  __atomic_store_n(&g_present_thread.stop, 1, __ATOMIC_RELEASE);
+  dx9mt_thread_signal_wake(&g_present_thread.work);
+#ifdef _WIN32
+  WaitForSingleObject(g_present_thread.thread, INFINITE);
+  CloseHandle(g_present_thread.thread);
+  g_present_thread.thread = NULL;
+#else
+  pthread_join(g_present_thread.thread, NULL);
+#endif
+  g_present_thread_running = 0;
+
+  dx9mt_logf("backend",
+             "present thread stopped: frames=%u waits=%u wait_us=%llu "
+             "latency_avg_us=%llu latency_max_us=%u",
+             stats->frames, stats->waits, (unsigned long long)stats->wait_us,
+             (unsigned long long)(stats->frames
+                                      ? stats->latency_total_us / stats->frames
+                                      : 0u),
+             stats->latency_max_us);
+  dx9mt_thread_signal_destroy(&g_present_thread.done);
+  dx9mt_thread_signal_destroy(&g_present_thread.work);
+}
+
+void dx9mt_present_thread_get_stats(dx9mt_backend_present_stats *out_stats) {
+  if (out_stats) {
+    *out_stats = g_present_thread.stats;
+  }
+}
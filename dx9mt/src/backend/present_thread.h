@@ -0,0 +1,37 @@
+#ifndef DX9MT_PRESENT_THREAD_H
+#define DX9MT_PRESENT_THREAD_H
+
+#include <stdint.h>
+
+#include "dx9mt/backend_bridge.h"
+
+/* Serializes the frame queued in job slot `job`. */
+typedef void (*dx9mt_present_thread_serialize_fn)(uint32_t job);
+
+/*
+ * Backend present worker: present() fills a job slot and queues it, and
+ * the worker calls `serialize` on each queued job in submission order. At
+ * most `depth` jobs (1..DX9MT_BACKEND_MAX_FRAMES_IN_FLIGHT) are queued or
+ * being serialized at once. One producer thread only.
+ */
+int dx9mt_present_thread_start(uint32_t depth,
+                               dx9mt_present_thread_serialize_fn serialize);
+int dx9mt_present_thread_running(void);
+
+/*
+ * Returns the job slot for the next frame, first waiting while `depth`
+ * frames are in flight. Call dx9mt_present_thread_submit() once the slot
+ * is filled. Producer only.
+ */
+uint32_t dx9mt_present_thread_acquire(void);
+void dx9mt_present_thread_submit(void);
+
+/* Returns once every queued frame has been serialized. Producer only. */
+void dx9mt_present_thread_drain(void);
+
+/* Drains, stops and joins the worker. */
+void dx9mt_present_thread_stop(void);
+
+void dx9mt_present_thread_get_stats(dx9mt_backend_present_stats *out_stats);
+
+#endif
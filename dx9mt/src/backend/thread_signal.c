@@ -0,0 +1,103 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "thread_signal.h"
+
+#ifndef _WIN32
+#include <sched.h>
+#include <time.h>
+#endif
+
+void dx9mt_cpu_relax(void) {
+#if defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+void dx9mt_thread_yield(void) {
+#ifdef _WIN32
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+int dx9mt_thread_signal_init(dx9mt_thread_signal *signal) {
+  signal->waiting = 0;
+#ifdef _WIN32
+  signal->event = CreateEventA(NULL, FALSE, FALSE, NULL);
+  return signal->event != NULL;
+#else
+  if (pthread_mutex_init(&signal->mutex, NULL) != 0) {
+    return 0;
+  }
+  if (pthread_cond_init(&signal->cond, NULL) != 0) {
+    pthread_mutex_destroy(&signal->mutex);
+    return 0;
+  }
+  return 1;
+#endif
+}
+
+void dx9mt_thread_signal_destroy(dx9mt_thread_signal *signal) {
+#ifdef _WIN32
+  if (signal->event) {
+    CloseHandle(signal->event);
+    signal->event = NULL;
+  }
+#else
+  pthread_cond_destroy(&signal->cond);
+  pthread_mutex_destroy(&signal->mutex);
+#endif
+}
+
+void dx9mt_thread_signal_wake(dx9mt_thread_signal *signal) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (!__atomic_load_n(&signal->waiting, __ATOMIC_RELAXED)) {
+    return;
+  }
+#ifdef _WIN32
+  SetEvent(signal->event);
+#else
+  pthread_mutex_lock(&signal->mutex);
+  pthread_cond_signal(&signal->cond);
+  pthread_mutex_unlock(&signal->mutex);
+#endif
+}
+
+int dx9mt_thread_signal_sleep(dx9mt_thread_signal *signal,
+                                     dx9mt_thread_ready_fn ready,
+                                     const void *context) {
+  int slept = 0;
+#ifdef _WIN32
+  __atomic_store_n(&signal->waiting, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (!ready(context)) {
+    WaitForSingleObject(signal->event, DX9MT_THREAD_SIGNAL_WAIT_MS);
+    slept = 1;
+  }
+  __atomic_store_n(&signal->waiting, 0, __ATOMIC_RELAXED);
+#else
+  struct timespec deadline;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += (long)DX9MT_THREAD_SIGNAL_WAIT_MS * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+  }
+  pthread_mutex_lock(&signal->mutex);
+  __atomic_store_n(&signal->waiting, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (!ready(context)) {
+    pthread_cond_timedwait(&signal->cond, &signal->mutex, &deadline);
+    slept = 1;
+  }
+  __atomic_store_n(&signal->waiting, 0, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&signal->mutex);
+#endif
+  return slept;
+}
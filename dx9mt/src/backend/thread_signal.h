@@ -0,0 +1,47 @@
+#ifndef DX9MT_THREAD_SIGNAL_H
+#define DX9MT_THREAD_SIGNAL_H
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/* Upper bound on one sleep; waiters re-check their condition after it. */
+#define DX9MT_THREAD_SIGNAL_WAIT_MS 50u
+
+/*
+ * Wake-up channel for one waiting side of a backend worker. A waiter
+ * publishes `waiting`, then re-checks its condition before sleeping; a
+ * waker publishes its progress, then checks `waiting`. The seq_cst fences
+ * on both sides guarantee at least one of them sees the other, so no
+ * wake-up is lost.
+ */
+typedef struct dx9mt_thread_signal {
+  uint32_t waiting;
+#ifdef _WIN32
+  HANDLE event;
+#else
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#endif
+} dx9mt_thread_signal;
+
+typedef int (*dx9mt_thread_ready_fn)(const void *context);
+
+void dx9mt_cpu_relax(void);
+void dx9mt_thread_yield(void);
+int dx9mt_thread_signal_init(dx9mt_thread_signal *signal);
+void dx9mt_thread_signal_destroy(dx9mt_thread_signal *signal);
+void dx9mt_thread_signal_wake(dx9mt_thread_signal *signal);
+/* Returns 1 when it actually went to sleep. */
+int dx9mt_thread_signal_sleep(dx9mt_thread_signal *signal,
+                              dx9mt_thread_ready_fn ready,
+                              const void *context);
+
+#endif
@@ -0,0 +1,189 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "worker_pool.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "dx9mt/log.h"
+#include "thread_signal.h"
+
+/* Busy-wait iterations before a waiter sleeps on its signal. */
+#define DX9MT_WORKER_POOL_SPIN_LIMIT 1024u
+
+typedef struct dx9mt_worker_pool_thread {
+  uint32_t index;
+  uint32_t seen; /* last generation this worker ran */
+  dx9mt_thread_signal work;
+#ifdef _WIN32
+  HANDLE thread;
+#else
+  pthread_t thread;
+#endif
+} dx9mt_worker_pool_thread;
+
+typedef struct dx9mt_worker_pool {
+  uint32_t size;
+  uint32_t generation; /* bumped once per run() */
+  uint32_t stop;
+  uint32_t remaining; /* worker shares of the current run still going */
+  dx9mt_worker_pool_fn fn;
+  void *context;
+  dx9mt_thread_signal done;
+  dx9mt_worker_pool_thread threads[DX9MT_WORKER_POOL_MAX_THREADS];
+} dx9mt_worker_pool;
+
+static dx9mt_worker_pool g_worker_pool;
+
+static void dx9mt_worker_pool_wait(dx9mt_thread_signal *signal,
+                                   dx9mt_thread_ready_fn ready,
+                                   const void *context) {
+  uint32_t spins = 0;
+
+  while (!ready(context)) {
+    if (spins < DX9MT_WORKER_POOL_SPIN_LIMIT) {
+      ++spins;
+      dx9mt_cpu_relax();
+    } else {
+      dx9mt_thread_signal_sleep(signal, ready, context);
+    }
+  }
+}
+
+static int dx9mt_worker_pool_has_work(const void *context) {
+  const dx9mt_worker_pool_thread *thread =
+      (const dx9mt_worker_pool_thread *)context;
+
+  return __atomic_load_n(&g_worker_pool.generation, __ATOMIC_ACQUIRE) !=
+             thread->seen ||
+         __atomic_load_n(&g_worker_pool.stop, __ATOMIC_ACQUIRE);
+}
+
+static int dx9mt_worker_pool_idle(const void *context) {
+  (void)context;
+  return __atomic_load_n(&g_worker_pool.remaining, __ATOMIC_ACQUIRE) == 0;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI dx9mt_worker_pool_main(LPVOID param)
+#else
+static void *dx9mt_worker_pool_main(void *param)
+#endif
+{
+  dx9mt_worker_pool_thread *thread = (dx9mt_worker_pool_thread *)param;
+
+  for (;;) {
+    dx9mt_worker_pool_wait(&thread->work, dx9mt_worker_pool_has_work, thread);
+    if (__atomic_load_n(&g_worker_pool.stop, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+    thread->seen = g_worker_pool.generation;
+    g_worker_pool.fn(g_worker_pool.context, thread->index, g_worker_pool.size);
+    if (__atomic_sub_fetch(&g_worker_pool.remaining, 1u, __ATOMIC_ACQ_REL) ==
+        0) {
+      dx9mt_thread_signal_wake(&g_worker_pool.done);
+    }
+  }
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+int dx9mt_worker_pool_start(uint32_t threads) {
+  uint32_t i;
+
+  if (g_worker_pool.size != 0 || threads == 0 ||
+      threads > DX9MT_WORKER_POOL_MAX_THREADS) {
+    return -1;
+  }
+
+  memset(&g_worker_pool, 0, sizeof(g_worker_pool));
+  if (!dx9mt_thread_signal_init(&g_worker_pool.done)) {
+    return -1;
+  }
+  for (i = 1; i < threads; ++i) {
+    dx9mt_worker_pool_thread *thread = &g_worker_pool.threads[i];
+
+    thread->index = i;
+    if (!dx9mt_thread_signal_init(&thread->work)) {
+      break;
+    }
+#ifdef _WIN32
+    thread->thread =
+        CreateThread(NULL, 0, dx9mt_worker_pool_main, thread, 0, NULL);
+    if (!thread->thread) {
+#else
+    if (pthread_create(&thread->thread, NULL, dx9mt_worker_pool_main,
+                       thread) != 0) {
+#endif
+      dx9mt_thread_signal_destroy(&thread->work);
+      break;
+    }
+  }
+  /* Run with the workers that did start. */
+  g_worker_pool.size = i;
+  if (i < threads) {
+    dx9mt_logf("backend", "worker pool: started %u of %u threads", i,
+               threads);
+  }
+  return 0;
+}
+
+uint32_t dx9mt_worker_pool_size(void) { return g_worker_pool.size; }
+
+void dx9mt_worker_pool_run(dx9mt_worker_pool_fn fn, void *context) {
+  uint32_t i;
+
+  if (g_worker_pool.size <= 1) {
+    fn(context, 0, 1);
+    return;
+  }
+
+  g_worker_pool.fn = fn;
+  g_worker_pool.context = context;
+  __atomic_store_n(&g_worker_pool.remaining, g_worker_pool.size - 1u,
+                   __ATOMIC_RELAXED);
+  __atomic_add_fetch(&g_worker_pool.generation, 1u, __ATOMIC_RELEASE);
+  for (i = 1; i < g_worker_pool.size; ++i) {
+    dx9mt_thread_signal_wake(&g_worker_pool.threads[i].work);
+  }
+  fn(context, 0, g_worker_pool.size);
+  dx9mt_worker_pool_wait(&g_worker_pool.done, dx9mt_worker_pool_idle, NULL);
+}
+
+void dx9mt_worker_pool_stop(void) {
+  uint32_t i;
+
+  if (g_worker_pool.size == 0) {
+    return;
+  }
+
+  __atomic_store_n(&g_worker_pool.stop, 1u, __ATOMIC_RELEASE);
+  for (i = 1; i < g_worker_pool.size; ++i) {
+    dx9mt_worker_pool_thread *thread = &g_worker_pool.threads[i];
+
+    dx9mt_thread_signal_wake(&thread->work);
+#ifdef _WIN32
+    WaitForSingleObject(thread->thread, INFINITE);
+    CloseHandle(thread->thread);
+    thread->thread = NULL;
+#else
+    pthread_join(thread->thread, NULL);
+#endif
+    dx9mt_thread_signal_destroy(&thread->work);
+  }
+  dx9mt_thread_signal_destroy(&g_worker_pool.done);
+  g_worker_pool.size = 0;
+}
@@ -0,0 +1,25 @@
+#ifndef DX9MT_WORKER_POOL_H
+#define DX9MT_WORKER_POOL_H
+
+#include <stdint.h>
+
+/* Threads in the pool, counting the thread that calls run(). */
+#define DX9MT_WORKER_POOL_MAX_THREADS 8u
+
+/* One share of a job: `index` of `count`, 0 being the calling thread. */
+typedef void (*dx9mt_worker_pool_fn)(void *context, uint32_t index,
+                                     uint32_t count);
+
+/*
+ * Fork-join pool for splitting one job across threads. start() spawns
+ * `threads` - 1 workers (1..DX9MT_WORKER_POOL_MAX_THREADS); run() calls
+ * `fn` once per thread, the caller's share included, and returns when
+ * every share is done. One calling thread at a time.
+ */
+int dx9mt_worker_pool_start(uint32_t threads);
+/* Threads run() splits a job across; 0 while stopped. */
+uint32_t dx9mt_worker_pool_size(void);
+void dx9mt_worker_pool_run(dx9mt_worker_pool_fn fn, void *context);
+void dx9mt_worker_pool_stop(void);
+
+#endif
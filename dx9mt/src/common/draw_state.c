@@ -0,0 +1,322 @@
+#include "dx9mt/draw_state.h"
+
+#include <stddef.h>
+#include <string.h>
+
+static uint32_t dx9mt_draw_state_hash_u32(uint32_t hash, uint32_t value) {
+  hash ^= value;
+  hash *= 16777619u;
+  return hash;
+}
+
+/* State group structs are whole uint32_t/float fields. */
+static uint32_t dx9mt_draw_state_hash_words(uint32_t hash, const void *data,
+                                            uint32_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  uint32_t offset;
+
+  for (offset = 0; offset + 4u <= size; offset += 4u) {
+    uint32_t word;
+    memcpy(&word, bytes + offset, sizeof(word));
+    hash = dx9mt_draw_state_hash_u32(hash, word);
+  }
+  return hash;
+}
+
+static void dx9mt_draw_state_refresh_hashes(dx9mt_draw_state *state) {
+  uint32_t hash;
+  uint32_t s;
+
+  if (state->hashes_valid) {
+    return;
+  }
+  state->viewport_hash = dx9mt_draw_state_hash_words(
+      2166136261u, &state->viewport, offsetof(dx9mt_state_viewport, scissor_left));
+  state->scissor_hash = dx9mt_draw_state_hash_words(
+      2166136261u, &state->viewport.scissor_left,
+      sizeof(state->viewport) - offsetof(dx9mt_state_viewport, scissor_left));
+  state->sampler_state_hash = dx9mt_draw_state_hash_words(
+      2166136261u, state->samplers, sizeof(state->samplers));
+  hash = 2166136261u;
+  for (s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
+    dx9mt_state_texture_stage stage = state->texture_stages[s];
+    memset(&stage.tex_data, 0, sizeof(stage.tex_data));
+    hash = dx9mt_draw_state_hash_words(hash, &stage, sizeof(stage));
+  }
+  state->texture_stage_hash = hash;
+
+  hash = dx9mt_draw_state_hash_words(2166136261u, &state->depth_stencil,
+                                     sizeof(state->depth_stencil));
+  hash = dx9mt_draw_state_hash_words(hash, &state->blend, sizeof(state->blend));
+  hash = dx9mt_draw_state_hash_words(hash, &state->raster,
+                                     sizeof(state->raster));
+  hash = dx9mt_draw_state_hash_u32(hash, state->viewport_hash);
+  hash = dx9mt_draw_state_hash_u32(hash, state->scissor_hash);
+  hash = dx9mt_draw_state_hash_u32(hash, state->sampler_state_hash);
+  hash = dx9mt_draw_state_hash_u32(hash, state->texture_stage_hash);
+  state->state_hash = hash;
+  state->hashes_valid = 1;
+}
+
+void dx9mt_draw_state_reset(dx9mt_draw_state *state) {
+  memset(state, 0, sizeof(*state));
+}
+
+uint32_t dx9mt_draw_state_apply(dx9mt_draw_state *state,
+                                const dx9mt_packet_header *header) {
+  uint32_t group = 0;
+
+  switch (header->type) {
+  case DX9MT_PACKET_STATE_DEPTH_STENCIL: {
+    const dx9mt_packet_state_depth_stencil *packet =
+        (const dx9mt_packet_state_depth_stencil *)header;
+    if (header->size < sizeof(*packet)) {
+      return 0;
+    }
+    state->depth_stencil = packet->state;
+    group = DX9MT_STATE_GROUP_DEPTH_STENCIL;
+    break;
+  }
+  case DX9MT_PACKET_STATE_BLEND: {
+    const dx9mt_packet_state_blend *packet =
+        (const dx9mt_packet_state_blend *)header;
+    if (header->size < sizeof(*packet)) {
+      return 0;
+    }
+    state->blend = packet->state;
+    group = DX9MT_STATE_GROUP_BLEND;
+    break;
+  }
+  case DX9MT_PACKET_STATE_RASTER: {
+    const dx9mt_packet_state_raster *packet =
+        (const dx9mt_packet_state_raster *)header;
+    if (header->size < sizeof(*packet)) {
+      return 0;
+    }
+    state->raster = packet->state;
+    group = DX9MT_STATE_GROUP_RASTER;
+    break;
+  }
+  case DX9MT_PACKET_STATE_VIEWPORT: {
+    const dx9mt_packet_state_viewport *packet =
+        (const dx9mt_packet_state_viewport *)header;
+    if (header->size < sizeof(*packet)) {
+      return 0;
+    }
+    state->viewport = packet->state;
+    group = DX9MT_STATE_GROUP_VIEWPORT;
+    break;
+  }
+  case DX9MT_PACKET_STATE_SAMPLER: {
+    const dx9mt_packet_state_sampler *packet =
+        (const dx9mt_packet_state_sampler *)header;
+    if (header->size < sizeof(*packet) ||
+        packet->stage >= DX9MT_MAX_PS_SAMPLERS) {
+      return 0;
+    }
+    state->samplers[packet->stage] = packet->state;
+    group = DX9MT_STATE_GROUP_SAMPLER0 << packet->stage;
+    break;
+  }
+  case DX9MT_PACKET_STATE_TEXTURE_STAGE: {
+    const dx9mt_packet_state_texture_stage *packet =
+        (const dx9mt_packet_state_texture_stage *)header;
+    if (header->size < sizeof(*packet) ||
+        packet->stage >= DX9MT_MAX_PS_SAMPLERS) {
+      return 0;
+    }
+    state->texture_stages[packet->stage] = packet->state;
+    if (packet->state.tex_data.size > 0) {
+      state->tex_data_pending |= 1u << packet->stage;
+    } else {
+      state->tex_data_pending &= ~(1u << packet->stage);
+    }
+    group = DX9MT_STATE_GROUP_TEXTURE_STAGE0 << packet->stage;
+    break;
+  }
+  case DX9MT_PACKET_STATE_SHADER_CONTROL: {
+    const dx9mt_packet_state_shader_control *packet =
+        (const dx9mt_packet_state_shader_control *)header;
+    if (header->size < sizeof(*packet)) {
+      return 0;
+    }
+    if (packet->shader_stage == DX9MT_SHADER_STAGE_VERTEX) {
+      state->control_vs = packet->constants;
+      group = DX9MT_STATE_GROUP_CONTROL_VS;
+    } else if (packet->shader_stage == DX9MT_SHADER_STAGE_PIXEL) {
+      state->control_ps = packet->constants;
+      group = DX9MT_STATE_GROUP_CONTROL_PS;
+    } else {
+      return 0;
+    }
+    break;
+  }
+  default:
+    return 0;
+  }
+
+  state->present_mask |= group;
+  state->hashes_valid = 0;
+  return group;
+}
+
+static uint32_t dx9mt_draw_state_block_hash(dx9mt_draw_state *state,
+                                            const dx9mt_packet_draw *draw) {
+  uint32_t hash;
+
+  dx9mt_draw_state_refresh_hashes(state);
+  hash = dx9mt_draw_state_hash_u32(state->state_hash, draw->render_target_id);
+  hash = dx9mt_draw_state_hash_u32(hash, draw->depth_stencil_id);
+  hash = dx9mt_draw_state_hash_u32(hash, draw->vertex_buffer_id);
+  hash = dx9mt_draw_state_hash_u32(hash, draw->index_buffer_id);
+  hash = dx9mt_draw_state_hash_u32(hash, draw->vertex_decl_id);
+  hash = dx9mt_draw_state_hash_u32(hash, draw->vertex_shader_id);
+  hash = dx9mt_draw_state_hash_u32(hash, draw->pixel_shader_id);
+  hash = dx9mt_draw_state_hash_u32(hash, draw->fvf);
+  hash = dx9mt_draw_state_hash_u32(hash, draw->stream0_offset);
+  hash = dx9mt_draw_state_hash_u32(hash, draw->stream0_stride);
+  return dx9mt_draw_state_hash_u32(hash, draw->primitive_type);
+}
+
+void dx9mt_draw_state_expand(dx9mt_draw_state *state,
+                             const dx9mt_packet_draw *draw,
+                             dx9mt_packet_draw_indexed *out) {
+  uint32_t hash = dx9mt_draw_state_block_hash(state, draw);
+
+  memset(out, 0, sizeof(*out));
+  out->header.type = DX9MT_PACKET_DRAW_INDEXED;
+  out->header.size = (uint16_t)sizeof(*out);
+  out->header.sequence = draw->header.sequence;
+  out->state_block_hash = hash;
+  out->primitive_type = draw->primitive_type;
+  out->base_vertex = draw->base_vertex;
+  out->min_vertex_index = draw->min_vertex_index;
+  out->num_vertices = draw->num_vertices;
+  out->start_index = draw->start_index;
+  out->primitive_count = draw->primitive_count;
+  out->render_target_id = draw->render_target_id;
+  out->depth_stencil_id = draw->depth_stencil_id;
+  out->render_target_texture_id = draw->render_target_texture_id;
+  out->render_target_width = draw->render_target_width;
+  out->render_target_height = draw->render_target_height;
+  out->render_target_format = draw->render_target_format;
+  out->vertex_buffer_id = draw->vertex_buffer_id;
+  out->index_buffer_id = draw->index_buffer_id;
+  out->vertex_decl_id = draw->vertex_decl_id;
+  out->vertex_shader_id = draw->vertex_shader_id;
+  out->pixel_shader_id = draw->pixel_shader_id;
+  out->fvf = draw->fvf;
+  out->stream0_offset = draw->stream0_offset;
+  out->stream0_stride = draw->stream0_stride;
+  out->viewport_hash = state->viewport_hash;
+  out->scissor_hash = state->scissor_hash;
+  out->texture_stage_hash = state->texture_stage_hash;
+  out->sampler_state_hash = state->sampler_state_hash;
+  out->stream_binding_hash = draw->stream_binding_hash;
+  for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
+    const dx9mt_state_texture_stage *stage = &state->texture_stages[s];
+    out->tex_id[s] = stage->tex_id;
+    out->tex_generation[s] = stage->tex_generation;
+    out->tex_format[s] = stage->tex_format;
+    out->tex_width[s] = stage->tex_width;
+    out->tex_height[s] = stage->tex_height;
+    out->tex_pitch[s] = stage->tex_pitch;
+    if (state->tex_data_pending & (1u << s)) {
+      out->tex_data[s] = stage->tex_data;
+    }
+  }
+  memcpy(out->samplers, state->samplers, sizeof(out->samplers));
+  out->render_state.depth_stencil = state->depth_stencil;
+  out->render_state.blend = state->blend;
+  out->render_state.raster = state->raster;
+  out->render_state.tss0_combiner = state->texture_stages[0].combiner;
+  out->constants_vs = draw->constants_vs;
+  out->constants_ps = draw->constants_ps;
+  out->constants_vs_start = draw->constants_vs_start;
+  out->constants_ps_start = draw->constants_ps_start;
+  out->control_vs = state->control_vs;
+  out->control_ps = state->control_ps;
+  out->viewport_x = state->viewport.x;
+  out->viewport_y = state->viewport.y;
+  out->viewport_width = state->viewport.width;
+  out->viewport_height = state->viewport.height;
+  out->viewport_min_z = state->viewport.min_z;
+  out->viewport_max_z = state->viewport.max_z;
+  out->scissor_left = state->viewport.scissor_left;
+  out->scissor_top = state->viewport.scissor_top;
+  out->scissor_right = state->viewport.scissor_right;
+  out->scissor_bottom = state->viewport.scissor_bottom;
+  out->vertex_data = draw->vertex_data;
+  out->vertex_data_size = draw->vertex_data_size;
+  out->index_data = draw->index_data;
+  out->index_data_size = draw->index_data_size;
+  out->index_format = draw->index_format;
+  out->vertex_decl_data = draw->vertex_decl_data;
+  out->vertex_decl_count = draw->vertex_decl_count;
+  out->vertex_update = draw->vertex_update;
+  out->index_update = draw->index_update;
+  out->vs_bytecode = draw->vs_bytecode;
+  out->vs_bytecode_dwords = draw->vs_bytecode_dwords;
+  out->ps_bytecode = draw->ps_bytecode;
+  out->ps_bytecode_dwords = draw->ps_bytecode_dwords;
+  out->vs_bytecode_hash = draw->vs_bytecode_hash;
+  out->ps_bytecode_hash = draw->ps_bytecode_hash;
+
+  /* Texture uploads ride on the first draw after their stage packet only. */
+  state->tex_data_pending = 0;
+}
+
+uint32_t dx9mt_draw_state_expand_ipc(
+    dx9mt_draw_state *state, const dx9mt_packet_draw *draw,
+    dx9mt_metal_ipc_draw *out,
+    dx9mt_upload_ref tex_data[DX9MT_MAX_PS_SAMPLERS]) {
+  uint32_t hash = dx9mt_draw_state_block_hash(state, draw);
+
+  memset(out, 0, sizeof(*out));
+  out->command_type = DX9MT_METAL_IPC_COMMAND_DRAW;
+  out->primitive_type = draw->primitive_type;
+  out->base_vertex = draw->base_vertex;
+  out->min_vertex_index = draw->min_vertex_index;
+  out->num_vertices = draw->num_vertices;
+  out->start_index = draw->start_index;
+  out->primitive_count = draw->primitive_count;
+  out->render_target_id = draw->render_target_id;
+  out->depth_stencil_id = draw->depth_stencil_id;
+  out->render_target_texture_id = draw->render_target_texture_id;
+  out->render_target_width = draw->render_target_width;
+  out->render_target_height = draw->render_target_height;
+  out->render_target_format = draw->render_target_format;
+  out->vertex_buffer_id = draw->vertex_buffer_id;
+  out->index_buffer_id = draw->index_buffer_id;
+  out->vertex_shader_id = draw->vertex_shader_id;
+  out->pixel_shader_id = draw->pixel_shader_id;
+  out->fvf = draw->fvf;
+  out->stream0_offset = draw->stream0_offset;
+  out->stream0_stride = draw->stream0_stride;
+  out->tss0_combiner = state->texture_stages[0].combiner;
+  out->viewport_x = state->viewport.x;
+  out->viewport_y = state->viewport.y;
+  out->viewport_width = state->viewport.width;
+  out->viewport_height = state->viewport.height;
+  out->viewport_min_z = state->viewport.min_z;
+  out->viewport_max_z = state->viewport.max_z;
+  out->scissor_left = state->viewport.scissor_left;
+  out->scissor_top = state->viewport.scissor_top;
+  out->scissor_right = state->viewport.scissor_right;
+  out->scissor_bottom = state->viewport.scissor_bottom;
+  out->index_format = draw->index_format;
+  out->vertex_update = draw->vertex_update;
+  out->index_update = draw->index_update;
+  out->vs_bytecode_hash = draw->vs_bytecode_hash;
+  out->ps_bytecode_hash = draw->ps_bytecode_hash;
+
+  for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
+    if (state->tex_data_pending & (1u << s)) {
+      tex_data[s] = state->texture_stages[s].tex_data;
+    } else {
+      memset(&tex_data[s], 0, sizeof(tex_data[s]));
+    }
+  }
+  state->tex_data_pending = 0;
+  return hash;
+}
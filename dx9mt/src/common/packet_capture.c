@@ -0,0 +1,313 @@
+#include "dx9mt/packet_capture.h"
+
+#include <string.h>
+
+#include "dx9mt/log.h"
+
+static const unsigned char g_capture_zero_pad[8];
+
+static uint32_t dx9mt_capture_padded(uint32_t bytes) {
+  return (bytes + 7u) & ~7u;
+}
+
+static void dx9mt_capture_fail(dx9mt_packet_capture *capture) {
+  dx9mt_logf("capture", "write failed after %u frames, capture stopped",
+             capture->stats.frames);
+  fclose(capture->file);
+  capture->file = NULL;
+}
+
+/* A record whose payload is `head` followed by `body`. */
+static int dx9mt_capture_write(dx9mt_packet_capture *capture, uint32_t type,
+                               const void *head, uint32_t head_bytes,
+                               const void *body, uint32_t body_bytes) {
+  dx9mt_capture_record record;
+  uint32_t pad;
+
+  if (!capture->file) {
+    return -1;
+  }
+  record.type = type;
+  record.bytes = head_bytes + body_bytes;
+  pad = dx9mt_capture_padded(record.bytes) - record.bytes;
+  if (fwrite(&record, sizeof(record), 1, capture->file) != 1 ||
+      (head_bytes && fwrite(head, head_bytes, 1, capture->file) != 1) ||
+      (body_bytes && fwrite(body, body_bytes, 1, capture->file) != 1) ||
+      (pad && fwrite(g_capture_zero_pad, pad, 1, capture->file) != 1)) {
+    dx9mt_capture_fail(capture);
+    return -1;
+  }
+  return 0;
+}
+
+int dx9mt_packet_capture_open(dx9mt_packet_capture *capture, const char *path,
+                              uint32_t frame_limit,
+                              dx9mt_backend_upload_resolve_fn resolve) {
+  dx9mt_capture_file_header header;
+
+  if (!capture) {
+    return -1;
+  }
+  memset(capture, 0, sizeof(*capture));
+  if (!path || !*path || frame_limit == 0) {
+    return -1;
+  }
+  capture->file = fopen(path, "wb");
+  if (!capture->file) {
+    dx9mt_logf("capture", "cannot open %s", path);
+    return -1;
+  }
+  capture->resolve = resolve;
+  capture->frame_limit = frame_limit;
+
+  memset(&header, 0, sizeof(header));
+  header.magic = DX9MT_CAPTURE_MAGIC;
+  header.version = DX9MT_CAPTURE_VERSION;
+  header.header_bytes = (uint32_t)sizeof(header);
+  header.packet_header_bytes = (uint32_t)sizeof(dx9mt_packet_header);
+  header.draw_bytes = (uint32_t)sizeof(dx9mt_packet_draw);
+  header.draw_indexed_bytes = (uint32_t)sizeof(dx9mt_packet_draw_indexed);
+  header.texture_stage_bytes =
+      (uint32_t)sizeof(dx9mt_packet_state_texture_stage);
+  header.upload_ref_bytes = (uint32_t)sizeof(dx9mt_upload_ref);
+  if (fwrite(&header, sizeof(header), 1, capture->file) != 1) {
+    dx9mt_capture_fail(capture);
+    return -1;
+  }
+  dx9mt_logf("capture", "capturing %u frames to %s", frame_limit, path);
+  return 0;
+}
+
+int dx9mt_packet_capture_active(const dx9mt_packet_capture *capture) {
+  return capture && capture->file != NULL;
+}
+
+void dx9mt_packet_capture_init(dx9mt_packet_capture *capture,
+                               const dx9mt_backend_init_desc *desc) {
+  dx9mt_capture_init record;
+
+  if (!dx9mt_packet_capture_active(capture) || !desc) {
+    return;
+  }
+  memset(&record, 0, sizeof(record));
+  record.protocol_version = desc->protocol_version;
+  record.ring_capacity_bytes = desc->ring_capacity_bytes;
+  record.slot_count = desc->upload_desc.slot_count;
+  record.bytes_per_slot = desc->upload_desc.bytes_per_slot;
+  record.packet_thread_mode = desc->packet_thread_mode;
+  record.capabilities = desc->capabilities;
+  dx9mt_capture_write(capture, DX9MT_CAPTURE_RECORD_INIT, &record,
+                      (uint32_t)sizeof(record), NULL, 0);
+}
+
+void dx9mt_packet_capture_present_target(
+    dx9mt_packet_capture *capture,
+    const dx9mt_backend_present_target_desc *desc) {
+  dx9mt_capture_present_target record;
+
+  if (!dx9mt_packet_capture_active(capture) || !desc) {
+    return;
+  }
+  memset(&record, 0, sizeof(record));
+  record.target_id = desc->target_id;
+  record.window_handle = desc->window_handle;
+  record.width = desc->width;
+  record.height = desc->height;
+  record.format = desc->format;
+  record.windowed = desc->windowed;
+  dx9mt_capture_write(capture, DX9MT_CAPTURE_RECORD_PRESENT_TARGET, &record,
+                      (uint32_t)sizeof(record), NULL, 0);
+}
+
+/* Returns 1 the first time a ref is seen this frame (or the table is full). */
+static int dx9mt_capture_first_use(dx9mt_packet_capture *capture,
+                                   const dx9mt_upload_ref *ref) {
+  uint32_t hash = (ref->offset * 2654435761u) ^ ref->size ^
+                  ((uint32_t)ref->arena_index << 28);
+
+  for (uint32_t probe = 0; probe < 8u; ++probe) {
+    dx9mt_upload_ref *entry =
+        &capture->seen[(hash + probe) & (DX9MT_CAPTURE_SEEN_REFS - 1u)];
+    if (entry->size == 0) {
+      *entry = *ref;
+      return 1;
+    }
+    if (entry->arena_index == ref->arena_index &&
+        entry->offset == ref->offset && entry->size == ref->size) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void dx9mt_capture_ref(dx9mt_packet_capture *capture,
+                              const dx9mt_upload_ref *ref) {
+  dx9mt_capture_upload record;
+  const void *data;
+
+  if (ref->size == 0 || !capture->resolve ||
+      !dx9mt_capture_first_use(capture, ref)) {
+    return;
+  }
+  data = capture->resolve(ref);
+  if (!data) {
+    return;
+  }
+  memset(&record, 0, sizeof(record));
+  record.ref = *ref;
+  if (dx9mt_capture_write(capture, DX9MT_CAPTURE_RECORD_UPLOAD, &record,
+                          (uint32_t)sizeof(record), data, ref->size) == 0) {
+    ++capture->stats.uploads;
+    capture->stats.upload_bytes += ref->size;
+  }
+}
+
+static void dx9mt_capture_draw_refs(
+    dx9mt_packet_capture *capture, const dx9mt_upload_ref *constants_vs,
+    const dx9mt_upload_ref *constants_ps, const dx9mt_upload_ref *vertex_data,
+    const dx9mt_upload_ref *index_data,
+    const dx9mt_upload_ref *vertex_decl_data,
+    const dx9mt_upload_ref *vs_bytecode, const dx9mt_upload_ref *ps_bytecode) {
+  dx9mt_capture_ref(capture, constants_vs);
+  dx9mt_capture_ref(capture, constants_ps);
+  dx9mt_capture_ref(capture, vertex_data);
+  dx9mt_capture_ref(capture, index_data);
+  dx9mt_capture_ref(capture, vertex_decl_data);
+  dx9mt_capture_ref(capture, vs_bytecode);
+  dx9mt_capture_ref(capture, ps_bytecode);
+}
+
+void dx9mt_packet_capture_packets(dx9mt_packet_capture *capture,
+                                  const dx9mt_packet_header *packets,
+                                  uint32_t packet_bytes) {
+  const unsigned char *cursor = (const unsigned char *)packets;
+  const unsigned char *end = cursor + packet_bytes;
+
+  if (!dx9mt_packet_capture_active(capture) || !packets || packet_bytes == 0) {
+    return;
+  }
+
+  /* The batch is copied verbatim; malformed packets just stop the walk. */
+  while ((size_t)(end - cursor) >= sizeof(dx9mt_packet_header)) {
+    const dx9mt_packet_header *header = (const dx9mt_packet_header *)cursor;
+
+    if (header->size < sizeof(*header) ||
+        header->size > (size_t)(end - cursor)) {
+      break;
+    }
+    if (header->type == DX9MT_PACKET_DRAW_INDEXED &&
+        header->size >= sizeof(dx9mt_packet_draw_indexed)) {
+      const dx9mt_packet_draw_indexed *draw =
+          (const dx9mt_packet_draw_indexed *)header;
+      for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
+        dx9mt_capture_ref(capture, &draw->tex_data[s]);
+      }
+      dx9mt_capture_draw_refs(capture, &draw->constants_vs,
+                                 &draw->constants_ps, &draw->vertex_data,
+                                 &draw->index_data, &draw->vertex_decl_data,
+                                 &draw->vs_bytecode, &draw->ps_bytecode);
+    } else if (header->type == DX9MT_PACKET_DRAW &&
+               header->size >= sizeof(dx9mt_packet_draw)) {
+      const dx9mt_packet_draw *draw = (const dx9mt_packet_draw *)header;
+      dx9mt_capture_draw_refs(capture, &draw->constants_vs,
+                                 &draw->constants_ps, &draw->vertex_data,
+                                 &draw->index_data, &draw->vertex_decl_data,
+                                 &draw->vs_bytecode, &draw->ps_bytecode);
+    } else if (header->type == DX9MT_PACKET_STATE_TEXTURE_STAGE &&
+               header->size >= sizeof(dx9mt_packet_state_texture_stage)) {
+      const dx9mt_packet_state_texture_stage *stage =
+          (const dx9mt_packet_state_texture_stage *)header;
+      dx9mt_capture_ref(capture, &stage->state.tex_data);
+    }
+    cursor += header->size;
+  }
+
+  if (dx9mt_capture_write(capture, DX9MT_CAPTURE_RECORD_PACKETS, packets,
+                          packet_bytes, NULL, 0) == 0) {
+    ++capture->stats.batches;
+    capture->stats.packet_bytes += packet_bytes;
+  }
+}
+
+void dx9mt_packet_capture_present(dx9mt_packet_capture *capture,
+                                  uint32_t frame_id, int result,
+                                  uint32_t replay_hash) {
+  dx9mt_capture_present record;
+
+  if (!dx9mt_packet_capture_active(capture)) {
+    return;
+  }
+  memset(&record, 0, sizeof(record));
+  record.frame_id = frame_id;
+  record.result = (int32_t)result;
+  record.replay_hash = replay_hash;
+  if (dx9mt_capture_write(capture, DX9MT_CAPTURE_RECORD_PRESENT, &record,
+                          (uint32_t)sizeof(record), NULL, 0) != 0) {
+    return;
+  }
+  /* Upload slots are recycled across frames: payloads must be rewritten. */
+  memset(capture->seen, 0, sizeof(capture->seen));
+  if (++capture->stats.frames >= capture->frame_limit) {
+    dx9mt_packet_capture_close(capture);
+  }
+}
+
+void dx9mt_packet_capture_close(dx9mt_packet_capture *capture) {
+  if (!dx9mt_packet_capture_active(capture)) {
+    return;
+  }
+  if (dx9mt_capture_write(capture, DX9MT_CAPTURE_RECORD_END, NULL, 0, NULL,
+                          0) != 0) {
+    return;
+  }
+  fclose(capture->file);
+  capture->file = NULL;
+  dx9mt_logf("capture",
+             "done: frames=%u batches=%u packet_bytes=%llu uploads=%u "
+             "upload_bytes=%llu",
+             capture->stats.frames, capture->stats.batches,
+             (unsigned long long)capture->stats.packet_bytes,
+             capture->stats.uploads,
+             (unsigned long long)capture->stats.upload_bytes);
+}
+
+size_t dx9mt_packet_capture_check_header(const void *data, size_t bytes) {
+  dx9mt_capture_file_header header;
+
+  if (!data || bytes < sizeof(header)) {
+    return 0;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != DX9MT_CAPTURE_MAGIC ||
+      header.version != DX9MT_CAPTURE_VERSION ||
+      header.header_bytes < sizeof(header) || header.header_bytes > bytes ||
+      header.packet_header_bytes != sizeof(dx9mt_packet_header) ||
+      header.draw_bytes != sizeof(dx9mt_packet_draw) ||
+      header.draw_indexed_bytes != sizeof(dx9mt_packet_draw_indexed) ||
+      header.texture_stage_bytes !=
+          sizeof(dx9mt_packet_state_texture_stage) ||
+      header.upload_ref_bytes != sizeof(dx9mt_upload_ref)) {
+    return 0;
+  }
+  return header.header_bytes;
+}
+
+const dx9mt_capture_record *dx9mt_packet_capture_next(const void *data,
+                                                      size_t bytes,
+                                                      size_t *cursor) {
+  const unsigned char *base = (const unsigned char *)data;
+  const dx9mt_capture_record *record;
+  size_t span;
+
+  if (!data || !cursor || *cursor > bytes ||
+      bytes - *cursor < sizeof(dx9mt_capture_record)) {
+    return NULL;
+  }
+  record = (const dx9mt_capture_record *)(base + *cursor);
+  span = sizeof(*record) + dx9mt_capture_padded(record->bytes);
+  if (record->bytes > bytes || span > bytes - *cursor) {
+    return NULL;
+  }
+  *cursor += span;
+  return record;
+}
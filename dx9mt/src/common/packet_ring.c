@@ -0,0 +1,105 @@
+#include "dx9mt/packet_ring.h"
+
+#include <string.h>
+
+void dx9mt_packet_ring_init(dx9mt_packet_ring *ring, void *storage,
+                            uint32_t capacity, uint32_t flush_threshold,
+                            dx9mt_packet_ring_sink sink) {
+  if (!ring) {
+    return;
+  }
+  memset(ring, 0, sizeof(*ring));
+  ring->bytes = (unsigned char *)storage;
+  ring->capacity = storage ? capacity : 0;
+  ring->flush_threshold =
+      flush_threshold > ring->capacity ? ring->capacity : flush_threshold;
+  ring->sink = sink;
+}
+
+static int dx9mt_packet_ring_submit(dx9mt_packet_ring *ring,
+                                    const void *packets, uint32_t packet_bytes,
+                                    uint32_t packet_count) {
+  int result;
+
+  if (packet_bytes == 0) {
+    return 0;
+  }
+  result = ring->sink((const dx9mt_packet_header *)packets, packet_bytes);
+  ++ring->stats.flushes;
+  ring->stats.packets += packet_count;
+  ring->stats.bytes += packet_bytes;
+  if (packet_count > ring->stats.max_batch_packets) {
+    ring->stats.max_batch_packets = packet_count;
+  }
+  if (result != 0) {
+    ++ring->stats.failed_flushes;
+  }
+  return result;
+}
+
+int dx9mt_packet_ring_flush(dx9mt_packet_ring *ring) {
+  int result;
+
+  if (!ring || !ring->sink || ring->used == 0) {
+    return 0;
+  }
+  result = dx9mt_packet_ring_submit(ring, ring->bytes, ring->used,
+                                    ring->packet_count);
+  ring->used = 0;
+  ring->packet_count = 0;
+  return result;
+}
+
+static uint32_t dx9mt_packet_ring_count(const dx9mt_packet_header *packets,
+                                        uint32_t packet_bytes) {
+  const unsigned char *bytes = (const unsigned char *)packets;
+  uint32_t offset = 0;
+  uint32_t count = 0;
+
+  while (offset + sizeof(dx9mt_packet_header) <= packet_bytes) {
+    const dx9mt_packet_header *header =
+        (const dx9mt_packet_header *)(bytes + offset);
+    if (header->size < sizeof(dx9mt_packet_header)) {
+      break;
+    }
+    offset += header->size;
+    ++count;
+  }
+  return count;
+}
+
+int dx9mt_packet_ring_append(dx9mt_packet_ring *ring,
+                             const dx9mt_packet_header *packets,
+                             uint32_t packet_bytes) {
+  int result = 0;
+
+  if (!ring || !ring->sink || !packets || packet_bytes == 0) {
+    return 0;
+  }
+
+  if (ring->flush_threshold == 0 || packet_bytes > ring->capacity) {
+    result = dx9mt_packet_ring_flush(ring);
+    if (dx9mt_packet_ring_submit(ring, packets, packet_bytes,
+                                 dx9mt_packet_ring_count(packets,
+                                                         packet_bytes)) != 0) {
+      result = -1;
+    }
+    return result;
+  }
+
+  if (packet_bytes > ring->capacity - ring->used) {
+    ++ring->stats.pressure_flushes;
+    result = dx9mt_packet_ring_flush(ring);
+  }
+  memcpy(ring->bytes + ring->used, packets, packet_bytes);
+  ring->used += packet_bytes;
+  ring->packet_count += dx9mt_packet_ring_count(packets, packet_bytes);
+
+  if (ring->used >= ring->flush_threshold) {
+    ++ring->stats.threshold_flushes;
+    if (dx9mt_packet_ring_flush(ring) != 0) {
+      result = -1;
+    }
+  }
+  return result;
+}
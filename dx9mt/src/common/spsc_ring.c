@@ -0,0 +1,133 @@
+#include "dx9mt/spsc_ring.h"
+
+#include <string.h>
+
+#define DX9MT_SPSC_PAD_RECORD 0xFFFFFFFFu
+
+typedef struct dx9mt_spsc_record_header {
+  uint32_t bytes; /* payload bytes, or DX9MT_SPSC_PAD_RECORD */
+  uint32_t reserved;
+} dx9mt_spsc_record_header;
+
+_Static_assert(sizeof(dx9mt_spsc_record_header) ==
+                   DX9MT_SPSC_RING_RECORD_HEADER_BYTES,
+               "spsc record header size");
+
+static uint32_t dx9mt_spsc_record_span(uint32_t bytes) {
+  return DX9MT_SPSC_RING_RECORD_HEADER_BYTES + ((bytes + 7u) & ~7u);
+}
+
+int dx9mt_spsc_ring_init(dx9mt_spsc_ring *ring, void *storage,
+                         uint32_t capacity) {
+  if (!ring) {
+    return 0;
+  }
+  memset(ring, 0, sizeof(*ring));
+  if (!storage || capacity < 64u || (capacity & (capacity - 1u)) != 0 ||
+      capacity > (1u << 31)) {
+    return 0;
+  }
+  ring->bytes = (unsigned char *)storage;
+  ring->capacity = capacity;
+  return 1;
+}
+
+uint32_t dx9mt_spsc_ring_max_record(const dx9mt_spsc_ring *ring) {
+  /*
+   * A wrapping push needs the tail pad plus the record; on an empty ring
+   * that always fits when the record takes at most half the ring.
+   */
+  return ring && ring->capacity
+             ? ring->capacity / 2u - DX9MT_SPSC_RING_RECORD_HEADER_BYTES
+             : 0;
+}
+
+int dx9mt_spsc_ring_try_push(dx9mt_spsc_ring *ring, const void *data,
+                             uint32_t bytes) {
+  uint32_t mask;
+  uint32_t head;
+  uint32_t tail;
+  uint32_t span;
+  uint32_t pos;
+  uint32_t contiguous;
+  uint32_t needed;
+  dx9mt_spsc_record_header header;
+
+  if (!ring || !ring->capacity || bytes > dx9mt_spsc_ring_max_record(ring)) {
+    return 0;
+  }
+
+  mask = ring->capacity - 1u;
+  head = ring->head; /* producer-owned */
+  tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  span = dx9mt_spsc_record_span(bytes);
+  pos = head & mask;
+  contiguous = ring->capacity - pos;
+  needed = span > contiguous ? contiguous + span : span;
+  if (needed > ring->capacity - (head - tail)) {
+    return 0;
+  }
+
+  if (span > contiguous) {
+    header.bytes = DX9MT_SPSC_PAD_RECORD;
+    header.reserved = 0;
+    memcpy(ring->bytes + pos, &header, sizeof(header));
+    head += contiguous;
+    pos = 0;
+  }
+  header.bytes = bytes;
+  header.reserved = 0;
+  memcpy(ring->bytes + pos, &header, sizeof(header));
+  memcpy(ring->bytes + pos + sizeof(header), data, bytes);
+  __atomic_store_n(&ring->head, head + span, __ATOMIC_RELEASE);
+  return 1;
+}
+
+const void *dx9mt_spsc_ring_peek(dx9mt_spsc_ring *ring, uint32_t *out_bytes) {
+  uint32_t mask;
+  uint32_t head;
+  uint32_t tail;
+  uint32_t pos;
+  dx9mt_spsc_record_header header;
+
+  if (!ring || !ring->capacity) {
+    return NULL;
+  }
+
+  mask = ring->capacity - 1u;
+  head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  tail = ring->tail; /* consumer-owned */
+  if (tail == head) {
+    return NULL;
+  }
+  pos = tail & mask;
+  memcpy(&header, ring->bytes + pos, sizeof(header));
+  if (header.bytes == DX9MT_SPSC_PAD_RECORD) {
+    /* The producer publishes a pad and its record with one head store. */
+    tail += ring->capacity - pos;
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    pos = 0;
+    memcpy(&header, ring->bytes, sizeof(header));
+  }
+
+  ring->consumer_pending = dx9mt_spsc_record_span(header.bytes);
+  if (out_bytes) {
+    *out_bytes = header.bytes;
+  }
+  return ring->bytes + pos + sizeof(header);
+}
+
+void dx9mt_spsc_ring_pop(dx9mt_spsc_ring *ring) {
+  if (!ring || ring->consumer_pending == 0) {
+    return;
+  }
+  __atomic_store_n(&ring->tail, ring->tail + ring->consumer_pending,
+                   __ATOMIC_RELEASE);
+  ring->consumer_pending = 0;
+}
+
+int dx9mt_spsc_ring_empty(const dx9mt_spsc_ring *ring) {
+  return !ring ||
+         __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ==
+             __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
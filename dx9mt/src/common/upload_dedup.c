@@ -0,0 +1,131 @@
+#include "dx9mt/upload_dedup.h"
+
+#include <string.h>
+
+#define DX9MT_DEDUP_PRIME1 0x9E3779B185EBCA87ull
+#define DX9MT_DEDUP_PRIME2 0xC2B2AE3D27D4EB4Full
+#define DX9MT_DEDUP_PRIME3 0x165667B19E3779F9ull
+
+static uint64_t dx9mt_dedup_rotl(uint64_t value, unsigned bits) {
+  return (value << bits) | (value >> (64u - bits));
+}
+
+static uint64_t dx9mt_dedup_read_u64(const unsigned char *bytes) {
+  uint64_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+static uint64_t dx9mt_dedup_round(uint64_t acc, uint64_t lane) {
+  acc += lane * DX9MT_DEDUP_PRIME2;
+  acc = dx9mt_dedup_rotl(acc, 31);
+  return acc * DX9MT_DEDUP_PRIME1;
+}
+
+/*
+ * Four independent 64-bit lanes over 32-byte blocks (xxHash64-style), so the
+ * hash runs at memory speed instead of the byte-at-a-time FNV used for
+ * small state hashes elsewhere.
+ */
+uint64_t dx9mt_upload_dedup_hash(const void *data, uint32_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  const unsigned char *end = bytes + size;
+  uint64_t hash;
+
+  if (size >= 32u) {
+    uint64_t v0 = DX9MT_DEDUP_PRIME1 + DX9MT_DEDUP_PRIME2;
+    uint64_t v1 = DX9MT_DEDUP_PRIME2;
+    uint64_t v2 = 0;
+    uint64_t v3 = 0 - DX9MT_DEDUP_PRIME1;
+
+    while (end - bytes >= 32) {
+      v0 = dx9mt_dedup_round(v0, dx9mt_dedup_read_u64(bytes));
+      v1 = dx9mt_dedup_round(v1, dx9mt_dedup_read_u64(bytes + 8));
+      v2 = dx9mt_dedup_round(v2, dx9mt_dedup_read_u64(bytes + 16));
+      v3 = dx9mt_dedup_round(v3, dx9mt_dedup_read_u64(bytes + 24));
+      bytes += 32;
+    }
+    hash = dx9mt_dedup_rotl(v0, 1) + dx9mt_dedup_rotl(v1, 7) +
+           dx9mt_dedup_rotl(v2, 12) + dx9mt_dedup_rotl(v3, 18);
+  } else {
+    hash = DX9MT_DEDUP_PRIME3;
+  }
+  hash += size;
+
+  while (end - bytes >= 8) {
+    hash ^= dx9mt_dedup_round(0, dx9mt_dedup_read_u64(bytes));
+    hash = dx9mt_dedup_rotl(hash, 27) * DX9MT_DEDUP_PRIME1 + DX9MT_DEDUP_PRIME3;
+    bytes += 8;
+  }
+  while (bytes < end) {
+    hash ^= (uint64_t)(*bytes) * DX9MT_DEDUP_PRIME3;
+    hash = dx9mt_dedup_rotl(hash, 11) * DX9MT_DEDUP_PRIME1;
+    ++bytes;
+  }
+
+  hash ^= hash >> 33;
+  hash *= DX9MT_DEDUP_PRIME2;
+  hash ^= hash >> 29;
+  hash *= DX9MT_DEDUP_PRIME3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+void dx9mt_upload_dedup_reset(dx9mt_upload_dedup_table *table) {
+  if (!table) {
+    return;
+  }
+  table->count = 0;
+  memset(table->entries, 0, sizeof(table->entries));
+}
+
+int dx9mt_upload_dedup_find(const dx9mt_upload_dedup_table *table,
+                            uint64_t hash, const void *data, uint32_t size,
+                            uint32_t *out_offset) {
+  uint32_t mask = DX9MT_UPLOAD_DEDUP_CAPACITY - 1u;
+  uint32_t index;
+  uint32_t probe;
+
+  if (!table || !data || size == 0 || table->count == 0) {
+    return 0;
+  }
+
+  index = (uint32_t)hash & mask;
+  for (probe = 0; probe < DX9MT_UPLOAD_DEDUP_CAPACITY; ++probe) {
+    const dx9mt_upload_dedup_entry *entry = &table->entries[index];
+    if (entry->size == 0) {
+      return 0;
+    }
+    if (entry->hash == hash && entry->size == size &&
+        memcmp(entry->bytes, data, size) == 0) {
+      if (out_offset) {
+        *out_offset = entry->offset;
+      }
+      return 1;
+    }
+    index = (index + 1u) & mask;
+  }
+  return 0;
+}
+
+void dx9mt_upload_dedup_insert(dx9mt_upload_dedup_table *table, uint64_t hash,
+                               const unsigned char *bytes, uint32_t offset,
+                               uint32_t size) {
+  uint32_t mask = DX9MT_UPLOAD_DEDUP_CAPACITY - 1u;
+  uint32_t index;
+
+  if (!table || !bytes || size == 0 ||
+      table->count >= (DX9MT_UPLOAD_DEDUP_CAPACITY / 4u) * 3u) {
+    return;
+  }
+
+  index = (uint32_t)hash & mask;
+  while (table->entries[index].size != 0) {
+    index = (index + 1u) & mask;
+  }
+  table->entries[index].hash = hash;
+  table->entries[index].bytes = bytes;
+  table->entries[index].offset = offset;
+  table->entries[index].size = size;
+  ++table->count;
+}
@@ -8,10 +8,13 @@
 #include <string.h>
 
 #include "dx9mt/backend_bridge.h"
+#include "dx9mt/draw_range.h"
+#include "dx9mt/draw_state.h"
 #include "dx9mt/log.h"
 #include "dx9mt/object_ids.h"
 #include "dx9mt/packets.h"
 #include "dx9mt/runtime.h"
+#include "dx9mt/upload_dedup.h"
 
 #define DX9MT_MAX_RENDER_TARGETS 4
 #define DX9MT_MAX_TEXTURE_STAGES 16
@@ -26,6 +29,8 @@
 #define DX9MT_MAX_SHADER_BOOL_CONSTANTS 16
 #define DX9MT_UPLOAD_BYTES_PER_SLOT DX9MT_UPLOAD_ARENA_BYTES_PER_SLOT
 #define DX9MT_TEXTURE_UPLOAD_REFRESH_INTERVAL 8u
+#define DX9MT_BUFFER_UPLOAD_REFRESH_INTERVAL 60u
+#define DX9MT_SHADER_UPLOAD_REFRESH_INTERVAL 8u
 #define DX9MT_DRAW_SHADER_CONSTANT_BYTES                                          \
   (DX9MT_MAX_SHADER_FLOAT_CONSTANTS * 4u * sizeof(float))
 
@@ -74,15 +79,82 @@ static WINBOOL dx9mt_log_once_u64(uint64_t key) {
   return TRUE;
 }
 
+static int dx9mt_env_flag_enabled(const char *name) {
+  const char *value;
+
+  if (!name) {
+    return 0;
+  }
+
+  value = getenv(name);
+  if (!value || !*value || strcmp(value, "0") == 0 ||
+      strcmp(value, "false") == 0 || strcmp(value, "FALSE") == 0 ||
+      strcmp(value, "off") == 0 || strcmp(value, "OFF") == 0 ||
+      strcmp(value, "no") == 0 || strcmp(value, "NO") == 0) {
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Upload chunk header. Owned chunks carry their payload right after the
+ * header at DX9MT_UPLOAD_CHUNK_HEADER_BYTES so it stays 16-byte aligned;
+ * external chunks point into the zero-copy arena of the shared IPC mapping.
+ * `base` is the slot-relative offset of the chunk's first byte.
+ */
+typedef struct dx9mt_upload_chunk {
+  struct dx9mt_upload_chunk *next;
+  unsigned char *bytes;
+  uint32_t base;
+  uint32_t capacity;
+  WINBOOL external;
+} dx9mt_upload_chunk;
+
+#define DX9MT_UPLOAD_CHUNK_HEADER_BYTES 64u
+
+#define DX9MT_UPLOAD_FENCE_LOG_INTERVAL_US 2000000u
+
+typedef struct dx9mt_upload_slot {
+  uint32_t fence; /* present fence that retires this slot's data */
+  dx9mt_upload_chunk *head;
+  dx9mt_upload_chunk *tail;
+  uint32_t next_offset; /* slot-relative; skips unused chunk tails */
+  uint32_t used_bytes;  /* aligned payload bytes copied this frame */
+  uint32_t high_water;
+  uint32_t chunk_count;
+  dx9mt_upload_dedup_table dedup;
+} dx9mt_upload_slot;
+
 typedef struct dx9mt_frontend_upload_state {
   uint32_t frame_id;
   uint16_t slot_index;
-  uint32_t next_offset;
-  unsigned char slots[DX9MT_UPLOAD_ARENA_SLOTS][DX9MT_UPLOAD_BYTES_PER_SLOT];
+  int dedup_enabled;
+  dx9mt_upload_dedup_stats dedup_stats;
+  uint32_t committed_bytes;
+  uint32_t overflow_chunks;
+  uint32_t failed_copies;
+  uint32_t peak_frame_bytes;
+  uint32_t usage_count;
+  uint32_t usage_cursor;
+  uint32_t usage_history[DX9MT_UPLOAD_ARENA_USAGE_HISTORY];
+  uint32_t active_slots;
+  uint32_t stall_count;
+  uint32_t stall_max_us;
+  uint64_t stall_total_us;
+  uint32_t fence_timeouts;
+  dx9mt_upload_slot slots[DX9MT_UPLOAD_ARENA_MAX_SLOTS];
 } dx9mt_frontend_upload_state;
 
 static dx9mt_frontend_upload_state *g_frontend_upload_state;
 
+/*
+ * Count of backend presents issued by the frontend. Mirrors
+ * dx9mt_backend_bridge_completed_fence(): the data a frame uploads is
+ * retired once the completed fence reaches the value this had + 1.
+ */
+static uint32_t g_frontend_present_fence;
+
 static dx9mt_frontend_upload_state *dx9mt_frontend_upload_ensure(void) {
   if (!g_frontend_upload_state) {
     g_frontend_upload_state = (dx9mt_frontend_upload_state *)VirtualAlloc(
@@ -91,25 +163,245 @@ static dx9mt_frontend_upload_state *dx9mt_frontend_upload_ensure(void) {
     if (!g_frontend_upload_state) {
       dx9mt_logf("upload", "FATAL: VirtualAlloc failed for upload state (%u bytes)",
                  (unsigned)sizeof(dx9mt_frontend_upload_state));
+    } else {
+      g_frontend_upload_state->active_slots = DX9MT_UPLOAD_ARENA_SLOTS;
+      /*
+       * Content dedup trades hashing time for arena space; hashing a payload
+       * costs more than a cache-hot copy of it (upload_dedup_bench), so it
+       * is opt-in for arena-bound workloads.
+       */
+      g_frontend_upload_state->dedup_enabled =
+          dx9mt_env_flag_enabled("DX9MT_FRONTEND_UPLOAD_DEDUP");
+      dx9mt_logf("upload", "content dedup %s",
+                 g_frontend_upload_state->dedup_enabled ? "enabled"
+                                                        : "disabled");
     }
   }
   return g_frontend_upload_state;
 }
 
-const void *dx9mt_frontend_upload_resolve(const dx9mt_upload_ref *ref) {
-  if (!ref || ref->size == 0) {
+static unsigned char *dx9mt_upload_chunk_bytes(dx9mt_upload_chunk *chunk) {
+  return chunk->bytes;
+}
+
+/*
+ * A slot's head chunk lives in the IPC mapping when the backend offers
+ * zero-copy memory for it, so present() can hand those bytes to the viewer
+ * without copying them. Overflow chunks are always process-private.
+ */
+static dx9mt_upload_chunk *dx9mt_upload_chunk_create(uint16_t slot_index,
+                                                     uint32_t base,
+                                                     uint32_t capacity) {
+  dx9mt_upload_chunk *chunk;
+  unsigned char *shared = NULL;
+  uint32_t shared_bytes = 0;
+
+  if (base == 0 && capacity == DX9MT_UPLOAD_ARENA_CHUNK_BYTES) {
+    shared = (unsigned char *)dx9mt_backend_bridge_ipc_upload_slot(
+        slot_index, &shared_bytes);
+  }
+
+  if (shared && shared_bytes >= capacity) {
+    chunk = (dx9mt_upload_chunk *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                            sizeof(*chunk));
+    if (!chunk) {
+      return NULL;
+    }
+    chunk->bytes = shared;
+    chunk->external = TRUE;
+  } else {
+    chunk = (dx9mt_upload_chunk *)VirtualAlloc(
+        NULL, (SIZE_T)DX9MT_UPLOAD_CHUNK_HEADER_BYTES + capacity,
+        MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!chunk) {
+      dx9mt_logf("upload",
+                 "VirtualAlloc failed for upload chunk base=%u bytes=%u", base,
+                 capacity);
+      return NULL;
+    }
+    chunk->bytes = (unsigned char *)chunk + DX9MT_UPLOAD_CHUNK_HEADER_BYTES;
+    chunk->external = FALSE;
+  }
+  chunk->next = NULL;
+  chunk->base = base;
+  chunk->capacity = capacity;
+  g_frontend_upload_state->committed_bytes += capacity;
+  return chunk;
+}
+
+static void dx9mt_upload_chunk_destroy(dx9mt_upload_chunk *chunk) {
+  g_frontend_upload_state->committed_bytes -= chunk->capacity;
+  if (chunk->external) {
+    HeapFree(GetProcessHeap(), 0, chunk);
+  } else {
+    VirtualFree(chunk, 0, MEM_RELEASE);
+  }
+}
+
+/*
+ * Retire a slot for reuse: keep the standard-size head chunk committed,
+ * release overflow chunks (and an oversized head) chained by the frame that
+ * used the slot last.
+ */
+static void dx9mt_upload_slot_retire(dx9mt_upload_slot *slot) {
+  dx9mt_upload_chunk *chunk;
+  dx9mt_upload_chunk *next;
+
+  chunk = slot->head ? slot->head->next : NULL;
+  while (chunk) {
+    next = chunk->next;
+    dx9mt_upload_chunk_destroy(chunk);
+    chunk = next;
+  }
+  if (slot->head && slot->head->capacity > DX9MT_UPLOAD_ARENA_CHUNK_BYTES) {
+    dx9mt_upload_chunk_destroy(slot->head);
+    slot->head = NULL;
+  }
+  if (slot->head) {
+    slot->head->next = NULL;
+  }
+  slot->tail = slot->head;
+  slot->chunk_count = slot->head ? 1u : 0u;
+  slot->next_offset = 0;
+  slot->used_bytes = 0;
+  dx9mt_upload_dedup_reset(&slot->dedup);
+}
+
+/*
+ * Carve `aligned_size` bytes out of the slot, chaining a new chunk when the
+ * tail chunk is full. Allocations never straddle chunks.
+ */
+static unsigned char *dx9mt_upload_slot_alloc(dx9mt_upload_slot *slot,
+                                              uint16_t slot_index,
+                                              uint32_t aligned_size,
+                                              uint32_t *out_offset) {
+  dx9mt_upload_chunk *tail = slot->tail;
+  dx9mt_upload_chunk *chunk;
+  uint32_t used;
+  uint32_t base;
+  uint32_t capacity;
+
+  if (tail) {
+    used = slot->next_offset - tail->base;
+    if (used <= tail->capacity && aligned_size <= tail->capacity - used) {
+      *out_offset = slot->next_offset;
+      slot->next_offset += aligned_size;
+      return dx9mt_upload_chunk_bytes(tail) + used;
+    }
+  }
+
+  base = tail ? tail->base + tail->capacity : 0u;
+  capacity = aligned_size > DX9MT_UPLOAD_ARENA_CHUNK_BYTES
+                 ? aligned_size
+                 : (uint32_t)DX9MT_UPLOAD_ARENA_CHUNK_BYTES;
+  if (base > DX9MT_UPLOAD_BYTES_PER_SLOT ||
+      capacity > DX9MT_UPLOAD_BYTES_PER_SLOT - base) {
+    return NULL;
+  }
+  chunk = dx9mt_upload_chunk_create(slot_index, base, capacity);
+  if (!chunk) {
     return NULL;
   }
-  if ((uint32_t)ref->arena_index >= DX9MT_UPLOAD_ARENA_SLOTS) {
+  if (tail) {
+    tail->next = chunk;
+    ++g_frontend_upload_state->overflow_chunks;
+  } else {
+    slot->head = chunk;
+  }
+  slot->tail = chunk;
+  ++slot->chunk_count;
+
+  *out_offset = base;
+  slot->next_offset = base + aligned_size;
+  return dx9mt_upload_chunk_bytes(chunk);
+}
+
+static void dx9mt_frontend_upload_record_usage(uint32_t used_bytes) {
+  dx9mt_frontend_upload_state *state = g_frontend_upload_state;
+
+  state->usage_history[state->usage_cursor] = used_bytes;
+  state->usage_cursor =
+      (state->usage_cursor + 1u) % DX9MT_UPLOAD_ARENA_USAGE_HISTORY;
+  if (state->usage_count < DX9MT_UPLOAD_ARENA_USAGE_HISTORY) {
+    ++state->usage_count;
+  }
+  if (used_bytes > state->peak_frame_bytes) {
+    state->peak_frame_bytes = used_bytes;
+  }
+}
+
+const void *dx9mt_frontend_upload_resolve(const dx9mt_upload_ref *ref) {
+  dx9mt_upload_chunk *chunk;
+  uint32_t local;
+
+  if (!ref || ref->size == 0) {
     return NULL;
   }
-  if (ref->offset + ref->size > DX9MT_UPLOAD_BYTES_PER_SLOT) {
+  if ((uint32_t)ref->arena_index >= DX9MT_UPLOAD_ARENA_MAX_SLOTS) {
     return NULL;
   }
   if (!g_frontend_upload_state) {
     return NULL;
   }
-  return g_frontend_upload_state->slots[ref->arena_index] + ref->offset;
+  for (chunk = g_frontend_upload_state->slots[ref->arena_index].head; chunk;
+       chunk = chunk->next) {
+    if (ref->offset < chunk->base) {
+      break;
+    }
+    local = ref->offset - chunk->base;
+    if (local < chunk->capacity) {
+      if (ref->size > chunk->capacity - local) {
+        return NULL;
+      }
+      return dx9mt_upload_chunk_bytes(chunk) + local;
+    }
+  }
+  return NULL;
+}
+
+static int dx9mt_compare_u32(const void *lhs, const void *rhs) {
+  uint32_t a = *(const uint32_t *)lhs;
+  uint32_t b = *(const uint32_t *)rhs;
+  return (a > b) - (a < b);
+}
+
+void dx9mt_frontend_upload_get_stats(dx9mt_upload_arena_stats *out) {
+  dx9mt_frontend_upload_state *state = g_frontend_upload_state;
+  uint32_t sorted[DX9MT_UPLOAD_ARENA_USAGE_HISTORY];
+  uint32_t count;
+  uint32_t i;
+
+  if (!out) {
+    return;
+  }
+  memset(out, 0, sizeof(*out));
+  if (!state) {
+    return;
+  }
+
+  count = state->usage_count;
+  out->frames_sampled = count;
+  out->peak_frame_bytes = state->peak_frame_bytes;
+  out->committed_bytes = state->committed_bytes;
+  out->overflow_chunks = state->overflow_chunks;
+  out->failed_copies = state->failed_copies;
+  out->active_slots = state->active_slots;
+  out->stall_count = state->stall_count;
+  out->stall_max_us = state->stall_max_us;
+  out->stall_total_us = state->stall_total_us;
+  out->fence_timeouts = state->fence_timeouts;
+  for (i = 0; i < DX9MT_UPLOAD_ARENA_MAX_SLOTS; ++i) {
+    out->slot_high_water[i] = state->slots[i].high_water;
+  }
+  if (count == 0) {
+    return;
+  }
+
+  memcpy(sorted, state->usage_history, count * sizeof(sorted[0]));
+  qsort(sorted, count, sizeof(sorted[0]), dx9mt_compare_u32);
+  out->p50_frame_bytes = sorted[((count - 1u) * 50u) / 100u];
+  out->p95_frame_bytes = sorted[((count - 1u) * 95u) / 100u];
+  out->p99_frame_bytes = sorted[((count - 1u) * 99u) / 100u];
 }
 
 typedef struct dx9mt_device dx9mt_device;
@@ -146,6 +438,24 @@ struct dx9mt_swapchain {
   UINT present_count;
 };
 
+/*
+ * Versioned VB/IB contents for the persistent store. generation bumps on
+ * every write Unlock; [dirty_begin, dirty_end) is the byte span written since
+ * the last upload. DISCARD renames the buffer (the next upload starts a fresh
+ * copy from just the dirty span), NOOVERWRITE-only updates may be patched in
+ * place on the viewer side, and any other write lock forces copy-on-write.
+ */
+typedef struct dx9mt_buffer_store {
+  uint32_t generation;
+  uint32_t last_upload_generation;
+  uint32_t last_full_upload_frame_id;
+  uint32_t dirty_begin;
+  uint32_t dirty_end;
+  WINBOOL write_locked;
+  WINBOOL discarded;
+  WINBOOL in_place;
+} dx9mt_buffer_store;
+
 struct dx9mt_vertex_buffer {
   IDirect3DVertexBuffer9 iface;
   LONG refcount;
@@ -153,6 +463,7 @@ struct dx9mt_vertex_buffer {
   dx9mt_device *device;
   D3DVERTEXBUFFER_DESC desc;
   unsigned char *data;
+  dx9mt_buffer_store store;
 };
 
 struct dx9mt_index_buffer {
@@ -162,6 +473,7 @@ struct dx9mt_index_buffer {
   dx9mt_device *device;
   D3DINDEXBUFFER_DESC desc;
   unsigned char *data;
+  dx9mt_buffer_store store;
 };
 
 struct dx9mt_vertex_decl {
@@ -180,6 +492,9 @@ struct dx9mt_vertex_shader {
   dx9mt_device *device;
   DWORD *byte_code;
   UINT dword_count;
+  /* Shader table entry: bytecode hash and the frame it was last attached. */
+  uint32_t bytecode_hash;
+  uint32_t last_upload_frame_id;
 };
 
 struct dx9mt_pixel_shader {
@@ -189,6 +504,9 @@ struct dx9mt_pixel_shader {
   dx9mt_device *device;
   DWORD *byte_code;
   UINT dword_count;
+  /* Shader table entry: bytecode hash and the frame it was last attached. */
+  uint32_t bytecode_hash;
+  uint32_t last_upload_frame_id;
 };
 
 struct dx9mt_texture {
@@ -259,6 +577,10 @@ struct dx9mt_device {
   float n_patch_mode;
   DWORD fvf;
   UINT frame_id;
+  /* Last viewer resync counter seen, and the frame that saw it change:
+   * cached uploads sent before that frame may never have arrived. */
+  uint32_t viewer_resync;
+  UINT resync_frame_id;
   uint64_t present_target_id;
 
   DWORD render_states[DX9MT_MAX_RENDER_STATES];
@@ -291,11 +613,38 @@ struct dx9mt_device {
   WINBOOL vs_const_b[DX9MT_MAX_SHADER_BOOL_CONSTANTS];
   WINBOOL ps_const_b[DX9MT_MAX_SHADER_BOOL_CONSTANTS];
 
-  /* Dirty tracking for shader constants -- avoid re-uploading when unchanged */
-  WINBOOL vs_const_dirty;
-  WINBOOL ps_const_dirty;
-  dx9mt_upload_ref vs_const_last_ref;
-  dx9mt_upload_ref ps_const_last_ref;
+  /* Dirty float4 register range [lo, hi) since the last draw. Draws upload
+   * only that range; the first draw of a frame uploads the whole block. */
+  uint32_t vs_const_dirty_lo;
+  uint32_t vs_const_dirty_hi;
+  uint32_t ps_const_dirty_lo;
+  uint32_t ps_const_dirty_hi;
+  WINBOOL vs_const_keyframe_sent;
+  WINBOOL ps_const_keyframe_sent;
+
+  /* Per-frame constant upload accounting: delta bytes actually uploaded vs.
+   * what re-uploading the whole block on every change would have cost. */
+  uint64_t constant_upload_bytes;
+  uint64_t constant_full_bytes;
+
+  /* Per-frame geometry upload accounting: bytes actually uploaded for
+   * VB/IB ranges vs. what whole-buffer uploads would have cost. */
+  uint64_t geometry_upload_bytes;
+  uint64_t geometry_full_bytes;
+
+  /* State groups (DX9MT_STATE_GROUP_* bits) to resend with the next draw,
+   * and the texture stage groups the backend currently holds. */
+  uint32_t state_dirty;
+  dx9mt_state_texture_stage sent_texture_stages[DX9MT_MAX_PS_SAMPLERS];
+
+  /* Per-frame draw packet accounting: bytes actually submitted for state
+   * deltas + slim draws vs. one full snapshot packet per draw. */
+  uint64_t draw_stream_bytes;
+  uint64_t draw_snapshot_bytes;
+
+  /* Backend-side draw state mirrored for the DRAW_INDEXED fallback when
+   * DX9MT_PROTOCOL_CAP_STATE_DELTA was not agreed; unused otherwise. */
+  dx9mt_draw_state snapshot_state;
 
   dx9mt_swapchain *swapchain;
 };
@@ -525,7 +874,7 @@ static void dx9mt_device_emit_stretch_rect(dx9mt_device *self,
   packet.dst_right = resolved_dst.right;
   packet.dst_bottom = resolved_dst.bottom;
   packet.filter = (uint32_t)filter;
-  dx9mt_backend_bridge_submit_packets(&packet.header, (uint32_t)sizeof(packet));
+  dx9mt_runtime_submit_packets(&packet.header, (uint32_t)sizeof(packet));
 }
 
 enum dx9mt_texture_upload_skip_reason {
@@ -566,19 +915,111 @@ static uint32_t dx9mt_align_up_u32(uint32_t value, uint32_t alignment) {
   return (value + alignment - 1u) & ~(alignment - 1u);
 }
 
+static WINBOOL dx9mt_upload_fence_passed(uint32_t completed, uint32_t fence) {
+  return (int32_t)(completed - fence) >= 0;
+}
+
+/*
+ * Block until the backend retires `fence`. An inline present consumes
+ * uploads before it returns; with DX9MT_BACKEND_FRAMES_IN_FLIGHT the
+ * present worker retires them later, so this waits once the frontend has
+ * every slot queued. The slot is never reused early: the worker may still
+ * be serializing from it, and overwriting it would publish a corrupt frame
+ * instead of stalling. Every DX9MT_UPLOAD_FENCE_LOG_INTERVAL_US of waiting
+ * is logged and counted as a fence timeout.
+ */
+static void dx9mt_frontend_upload_wait_fence(dx9mt_frontend_upload_state *state,
+                                             uint32_t fence) {
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER start;
+  LARGE_INTEGER now;
+  uint64_t elapsed_us = 0;
+  uint64_t log_at_us = DX9MT_UPLOAD_FENCE_LOG_INTERVAL_US;
+  uint32_t spins = 0;
+
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&start);
+  while (!dx9mt_upload_fence_passed(dx9mt_backend_bridge_completed_fence(),
+                                    fence)) {
+    QueryPerformanceCounter(&now);
+    elapsed_us = (uint64_t)(now.QuadPart - start.QuadPart) * 1000000ull /
+                 (uint64_t)frequency.QuadPart;
+    if (elapsed_us >= log_at_us) {
+      ++state->fence_timeouts;
+      dx9mt_logf("upload",
+                 "fence wait still blocked: fence=%u completed=%u "
+                 "waited_us=%llu",
+                 fence, dx9mt_backend_bridge_completed_fence(),
+                 (unsigned long long)elapsed_us);
+      log_at_us += DX9MT_UPLOAD_FENCE_LOG_INTERVAL_US;
+    }
+    ++spins;
+    if (spins < 64) {
+      YieldProcessor();
+    } else {
+      Sleep(spins < 256 ? 0 : 1);
+    }
+  }
+
+  ++state->stall_count;
+  state->stall_total_us += elapsed_us;
+  if (elapsed_us > state->stall_max_us) {
+    state->stall_max_us = (uint32_t)elapsed_us;
+  }
+}
+
+/*
+ * Pick the slot for a new frame: the next retired slot in rotation order,
+ * else a newly activated slot, else wait for the next slot's fence.
+ */
+static uint16_t dx9mt_frontend_upload_acquire_slot(
+    dx9mt_frontend_upload_state *state) {
+  uint32_t completed = dx9mt_backend_bridge_completed_fence();
+  uint32_t index;
+  uint32_t i;
+
+  for (i = 1; i <= state->active_slots; ++i) {
+    index = (state->slot_index + i) % state->active_slots;
+    if (dx9mt_upload_fence_passed(completed, state->slots[index].fence)) {
+      return (uint16_t)index;
+    }
+  }
+
+  if (state->active_slots < DX9MT_UPLOAD_ARENA_MAX_SLOTS) {
+    index = state->active_slots++;
+    dx9mt_logf("upload",
+               "all slots in flight (completed=%u), growing to %u slots",
+               completed, state->active_slots);
+    return (uint16_t)index;
+  }
+
+  index = (state->slot_index + 1u) % state->active_slots;
+  dx9mt_frontend_upload_wait_fence(state, state->slots[index].fence);
+  return (uint16_t)index;
+}
+
 static void dx9mt_frontend_upload_begin_frame(uint32_t frame_id) {
+  dx9mt_frontend_upload_state *state;
+  dx9mt_upload_slot *slot;
+
   dx9mt_frontend_upload_ensure();
-  if (!g_frontend_upload_state) {
+  state = g_frontend_upload_state;
+  if (!state) {
     return;
   }
-  if (g_frontend_upload_state->frame_id == frame_id) {
+  if (state->frame_id == frame_id) {
     return;
   }
 
-  g_frontend_upload_state->frame_id = frame_id;
-  g_frontend_upload_state->slot_index =
-      (uint16_t)(frame_id % DX9MT_UPLOAD_ARENA_SLOTS);
-  g_frontend_upload_state->next_offset = 0;
+  if (state->frame_id != 0) {
+    dx9mt_frontend_upload_record_usage(
+        state->slots[state->slot_index].used_bytes);
+  }
+  state->frame_id = frame_id;
+  state->slot_index = dx9mt_frontend_upload_acquire_slot(state);
+  slot = &state->slots[state->slot_index];
+  dx9mt_upload_slot_retire(slot);
+  slot->fence = g_frontend_present_fence + 1u;
 }
 
 static dx9mt_upload_ref dx9mt_frontend_upload_copy(uint32_t frame_id,
@@ -586,7 +1027,11 @@ static dx9mt_upload_ref dx9mt_frontend_upload_copy(uint32_t frame_id,
                                                    uint32_t size) {
   dx9mt_upload_ref ref;
   uint32_t aligned_size;
-  unsigned char *slot_base;
+  dx9mt_upload_slot *slot;
+  unsigned char *dst;
+  uint64_t hash = 0;
+  int dedup = 0;
+  uint32_t offset;
 
   memset(&ref, 0, sizeof(ref));
   if (!data || size == 0 || size > DX9MT_UPLOAD_BYTES_PER_SLOT) {
@@ -599,76 +1044,65 @@ static dx9mt_upload_ref dx9mt_frontend_upload_copy(uint32_t frame_id,
   }
 
   dx9mt_frontend_upload_begin_frame(frame_id);
+  if (!g_frontend_upload_state) {
+    return ref;
+  }
+  slot = &g_frontend_upload_state->slots[g_frontend_upload_state->slot_index];
 
   /*
-   * Slot overflow: if this allocation doesn't fit in the remaining space,
-   * return a zero-ref instead of silently wrapping to offset 0. Wrapping
-   * would overwrite earlier constant uploads from the same frame, causing
-   * the backend to read corrupted shader constant data with no error.
-   *
-   * At ~19 draws/frame * 8KB constants = ~152KB per frame this won't trigger
-   * for FNV (slot is 1MB), but a heavier game could hit it. The backend
-   * validates upload refs and will reject draws with zero-size refs, so this
-   * surfaces cleanly in logs rather than producing silent visual corruption.
+   * Content dedup: declarations, bytecode and constant blocks repeat across
+   * draws within a frame. When the same bytes already sit in this slot, hand
+   * back that ref instead of copying again.
+   */
+  if (g_frontend_upload_state->dedup_enabled &&
+      size <= DX9MT_UPLOAD_DEDUP_MAX_BYTES) {
+    dedup = 1;
+    hash = dx9mt_upload_dedup_hash(data, size);
+    if (dx9mt_upload_dedup_find(&slot->dedup, hash, data, size, &offset)) {
+      ++g_frontend_upload_state->dedup_stats.hits;
+      g_frontend_upload_state->dedup_stats.bytes_saved += aligned_size;
+      ref.arena_index = g_frontend_upload_state->slot_index;
+      ref.offset = offset;
+      ref.size = size;
+      return ref;
+    }
+    ++g_frontend_upload_state->dedup_stats.misses;
+  }
+
+  /*
+   * A full chunk chains a new one, so heavy frames grow the slot instead of
+   * dropping data. A zero ref is only returned when the slot would pass its
+   * address-space cap or the chunk cannot be committed; the backend rejects
+   * draws with missing refs, so that still surfaces in logs rather than as
+   * silent corruption.
    */
-  if (g_frontend_upload_state->next_offset >
-      DX9MT_UPLOAD_BYTES_PER_SLOT - aligned_size) {
+  dst = dx9mt_upload_slot_alloc(slot, g_frontend_upload_state->slot_index,
+                                aligned_size, &offset);
+  if (!dst) {
     static LONG overflow_counter = 0;
+    ++g_frontend_upload_state->failed_copies;
     if (dx9mt_should_log_method_sample(&overflow_counter, 4, 256)) {
       dx9mt_logf("upload",
-                 "slot overflow: frame=%u slot=%u offset=%u need=%u capacity=%u",
+                 "slot overflow: frame=%u slot=%u offset=%u need=%u chunks=%u cap=%u",
                  frame_id, (unsigned)g_frontend_upload_state->slot_index,
-                 g_frontend_upload_state->next_offset, aligned_size,
+                 slot->next_offset, aligned_size, slot->chunk_count,
                  DX9MT_UPLOAD_BYTES_PER_SLOT);
     }
     return ref;
   }
 
-  slot_base = g_frontend_upload_state->slots[g_frontend_upload_state->slot_index];
-  memcpy(slot_base + g_frontend_upload_state->next_offset, data, size);
+  memcpy(dst, data, size);
   ref.arena_index = g_frontend_upload_state->slot_index;
-  ref.offset = g_frontend_upload_state->next_offset;
+  ref.offset = offset;
   ref.size = size;
-  g_frontend_upload_state->next_offset += aligned_size;
-  return ref;
-}
-
-static uint32_t dx9mt_hash_texture_stage_state(const dx9mt_device *self) {
-  uint32_t hash = 2166136261u;
-  uint32_t stage;
-  uint32_t type;
-
-  if (!self) {
-    return 0;
-  }
-
-  for (stage = 0; stage < DX9MT_MAX_TEXTURE_STAGES; ++stage) {
-    hash =
-        dx9mt_hash_u32(hash, dx9mt_texture_object_id_from_base_iface(self->textures[stage]));
-    for (type = 0; type < DX9MT_MAX_TEXTURE_STAGE_STATES; ++type) {
-      hash = dx9mt_hash_u32(hash, self->tex_stage_states[stage][type]);
-    }
-  }
-
-  return hash;
-}
-
-static uint32_t dx9mt_hash_sampler_state(const dx9mt_device *self) {
-  uint32_t hash = 2166136261u;
-  uint32_t sampler;
-  uint32_t type;
-
-  if (!self) {
-    return 0;
+  slot->used_bytes += aligned_size;
+  if (slot->used_bytes > slot->high_water) {
+    slot->high_water = slot->used_bytes;
   }
-
-  for (sampler = 0; sampler < DX9MT_MAX_SAMPLERS; ++sampler) {
-    for (type = 0; type < DX9MT_MAX_SAMPLER_STATES; ++type) {
-      hash = dx9mt_hash_u32(hash, self->sampler_states[sampler][type]);
-    }
+  if (dedup) {
+    dx9mt_upload_dedup_insert(&slot->dedup, hash, dst, offset, size);
   }
-
-  return hash;
+  return ref;
 }
 
 static uint32_t dx9mt_hash_stream_bindings(const dx9mt_device *self) {
@@ -690,111 +1124,42 @@ static uint32_t dx9mt_hash_stream_bindings(const dx9mt_device *self) {
   return hash;
 }
 
-static uint32_t dx9mt_hash_float_bits(float value) {
-  uint32_t bits;
-  memcpy(&bits, &value, sizeof(bits));
-  return bits;
-}
-
-static uint32_t dx9mt_hash_viewport(const D3DVIEWPORT9 *viewport) {
-  uint32_t hash = 2166136261u;
-
-  if (!viewport) {
-    return 0;
-  }
-
-  hash = dx9mt_hash_u32(hash, viewport->X);
-  hash = dx9mt_hash_u32(hash, viewport->Y);
-  hash = dx9mt_hash_u32(hash, viewport->Width);
-  hash = dx9mt_hash_u32(hash, viewport->Height);
-  hash = dx9mt_hash_u32(hash, dx9mt_hash_float_bits(viewport->MinZ));
-  hash = dx9mt_hash_u32(hash, dx9mt_hash_float_bits(viewport->MaxZ));
-  return hash;
-}
-
-static uint32_t dx9mt_hash_rect(const RECT *rect) {
-  uint32_t hash = 2166136261u;
-
-  if (!rect) {
+static uint32_t dx9mt_render_state_group(D3DRENDERSTATETYPE state) {
+  switch (state) {
+  case D3DRS_ZENABLE:
+  case D3DRS_ZWRITEENABLE:
+  case D3DRS_ZFUNC:
+  case D3DRS_STENCILENABLE:
+  case D3DRS_STENCILFUNC:
+  case D3DRS_STENCILREF:
+  case D3DRS_STENCILMASK:
+  case D3DRS_STENCILWRITEMASK:
+  case D3DRS_STENCILPASS:
+  case D3DRS_STENCILFAIL:
+  case D3DRS_STENCILZFAIL:
+    return DX9MT_STATE_GROUP_DEPTH_STENCIL;
+  case D3DRS_ALPHABLENDENABLE:
+  case D3DRS_SRCBLEND:
+  case D3DRS_DESTBLEND:
+  case D3DRS_BLENDOP:
+  case D3DRS_ALPHATESTENABLE:
+  case D3DRS_ALPHAREF:
+  case D3DRS_ALPHAFUNC:
+  case D3DRS_COLORWRITEENABLE:
+  case D3DRS_TEXTUREFACTOR:
+    return DX9MT_STATE_GROUP_BLEND;
+  case D3DRS_CULLMODE:
+  case D3DRS_SCISSORTESTENABLE:
+  case D3DRS_FOGENABLE:
+  case D3DRS_FOGCOLOR:
+  case D3DRS_FOGSTART:
+  case D3DRS_FOGEND:
+  case D3DRS_FOGDENSITY:
+  case D3DRS_FOGTABLEMODE:
+    return DX9MT_STATE_GROUP_RASTER;
+  default:
     return 0;
   }
-
-  hash = dx9mt_hash_u32(hash, (uint32_t)rect->left);
-  hash = dx9mt_hash_u32(hash, (uint32_t)rect->top);
-  hash = dx9mt_hash_u32(hash, (uint32_t)rect->right);
-  hash = dx9mt_hash_u32(hash, (uint32_t)rect->bottom);
-  return hash;
-}
-
-static uint32_t
-dx9mt_hash_draw_state(const dx9mt_packet_draw_indexed *packet) {
-  uint32_t hash = 2166136261u;
-
-  if (!packet) {
-    return 0;
-  }
-
-  hash = dx9mt_hash_u32(hash, packet->render_target_id);
-  hash = dx9mt_hash_u32(hash, packet->depth_stencil_id);
-  hash = dx9mt_hash_u32(hash, packet->render_target_texture_id);
-  hash = dx9mt_hash_u32(hash, packet->render_target_width);
-  hash = dx9mt_hash_u32(hash, packet->render_target_height);
-  hash = dx9mt_hash_u32(hash, packet->render_target_format);
-  hash = dx9mt_hash_u32(hash, packet->vertex_buffer_id);
-  hash = dx9mt_hash_u32(hash, packet->index_buffer_id);
-  hash = dx9mt_hash_u32(hash, packet->vertex_decl_id);
-  hash = dx9mt_hash_u32(hash, packet->vertex_shader_id);
-  hash = dx9mt_hash_u32(hash, packet->pixel_shader_id);
-  hash = dx9mt_hash_u32(hash, packet->fvf);
-  hash = dx9mt_hash_u32(hash, packet->stream0_offset);
-  hash = dx9mt_hash_u32(hash, packet->stream0_stride);
-  hash = dx9mt_hash_u32(hash, packet->primitive_type);
-  hash = dx9mt_hash_u32(hash, packet->viewport_hash);
-  hash = dx9mt_hash_u32(hash, packet->scissor_hash);
-  hash = dx9mt_hash_u32(hash, packet->texture_stage_hash);
-  hash = dx9mt_hash_u32(hash, packet->sampler_state_hash);
-  hash = dx9mt_hash_u32(hash, packet->stream_binding_hash);
-  for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
-    hash = dx9mt_hash_u32(hash, packet->tex_id[s]);
-    hash = dx9mt_hash_u32(hash, packet->tex_generation[s]);
-    hash = dx9mt_hash_u32(hash, packet->sampler_min_filter[s]);
-    hash = dx9mt_hash_u32(hash, packet->sampler_mag_filter[s]);
-    hash = dx9mt_hash_u32(hash, packet->sampler_mip_filter[s]);
-    hash = dx9mt_hash_u32(hash, packet->sampler_address_u[s]);
-    hash = dx9mt_hash_u32(hash, packet->sampler_address_v[s]);
-    hash = dx9mt_hash_u32(hash, packet->sampler_address_w[s]);
-  }
-  hash = dx9mt_hash_u32(hash, packet->tss0_color_op);
-  hash = dx9mt_hash_u32(hash, packet->tss0_color_arg1);
-  hash = dx9mt_hash_u32(hash, packet->tss0_color_arg2);
-  hash = dx9mt_hash_u32(hash, packet->tss0_alpha_op);
-  hash = dx9mt_hash_u32(hash, packet->tss0_alpha_arg1);
-  hash = dx9mt_hash_u32(hash, packet->tss0_alpha_arg2);
-  hash = dx9mt_hash_u32(hash, packet->rs_texture_factor);
-  hash = dx9mt_hash_u32(hash, packet->rs_alpha_blend_enable);
-  hash = dx9mt_hash_u32(hash, packet->rs_src_blend);
-  hash = dx9mt_hash_u32(hash, packet->rs_dest_blend);
-  hash = dx9mt_hash_u32(hash, packet->rs_alpha_test_enable);
-  hash = dx9mt_hash_u32(hash, packet->rs_alpha_ref);
-  hash = dx9mt_hash_u32(hash, packet->rs_alpha_func);
-  hash = dx9mt_hash_u32(hash, packet->rs_zenable);
-  hash = dx9mt_hash_u32(hash, packet->rs_zwriteenable);
-  hash = dx9mt_hash_u32(hash, packet->rs_zfunc);
-  hash = dx9mt_hash_u32(hash, packet->rs_stencilenable);
-  hash = dx9mt_hash_u32(hash, packet->rs_stencilfunc);
-  hash = dx9mt_hash_u32(hash, packet->rs_stencilref);
-  hash = dx9mt_hash_u32(hash, packet->rs_stencilmask);
-  hash = dx9mt_hash_u32(hash, packet->rs_stencilwritemask);
-  hash = dx9mt_hash_u32(hash, packet->rs_cull_mode);
-  hash = dx9mt_hash_u32(hash, packet->rs_scissortestenable);
-  hash = dx9mt_hash_u32(hash, packet->rs_blendop);
-  hash = dx9mt_hash_u32(hash, packet->rs_colorwriteenable);
-  hash = dx9mt_hash_u32(hash, packet->rs_stencilpass);
-  hash = dx9mt_hash_u32(hash, packet->rs_stencilfail);
-  hash = dx9mt_hash_u32(hash, packet->rs_stencilzfail);
-  hash = dx9mt_hash_u32(hash, packet->rs_fogenable);
-  hash = dx9mt_hash_u32(hash, packet->rs_fogcolor);
-  return hash;
 }
 
 static UINT dx9mt_bytes_per_pixel(D3DFORMAT format) {
@@ -830,7 +1195,7 @@ static UINT dx9mt_format_block_bytes(D3DFORMAT format) {
   return 0;
 }
 
-static uint32_t dx9mt_texture_next_generation(uint32_t generation) {
+static uint32_t dx9mt_next_generation(uint32_t generation) {
   ++generation;
   if (generation == 0) {
     generation = 1;
@@ -838,6 +1203,51 @@ static uint32_t dx9mt_texture_next_generation(uint32_t generation) {
   return generation;
 }
 
+static void dx9mt_buffer_store_init(dx9mt_buffer_store *store, UINT size) {
+  memset(store, 0, sizeof(*store));
+  store->generation = 1;
+  store->dirty_end = size;
+}
+
+static void dx9mt_buffer_store_lock(dx9mt_buffer_store *store, UINT offset,
+                                    UINT length, DWORD flags) {
+  uint32_t end = offset + length;
+
+  if (flags & D3DLOCK_READONLY) {
+    return;
+  }
+
+  if (flags & D3DLOCK_DISCARD) {
+    store->discarded = TRUE;
+    store->in_place = FALSE;
+    store->dirty_begin = offset;
+    store->dirty_end = end;
+  } else {
+    if (!(flags & D3DLOCK_NOOVERWRITE)) {
+      store->in_place = FALSE;
+    }
+    if (store->dirty_end <= store->dirty_begin) {
+      store->dirty_begin = offset;
+      store->dirty_end = end;
+    } else {
+      if (offset < store->dirty_begin) {
+        store->dirty_begin = offset;
+      }
+      if (end > store->dirty_end) {
+        store->dirty_end = end;
+      }
+    }
+  }
+  store->write_locked = TRUE;
+}
+
+static void dx9mt_buffer_store_unlock(dx9mt_buffer_store *store) {
+  if (store->write_locked) {
+    store->generation = dx9mt_next_generation(store->generation);
+    store->write_locked = FALSE;
+  }
+}
+
 static uint32_t dx9mt_surface_upload_size_from_desc(const D3DSURFACE_DESC *desc,
                                                     UINT pitch) {
   uint32_t block_rows;
@@ -866,14 +1276,14 @@ static void dx9mt_texture_mark_dirty(dx9mt_texture *texture) {
   if (!texture) {
     return;
   }
-  texture->generation = dx9mt_texture_next_generation(texture->generation);
+  texture->generation = dx9mt_next_generation(texture->generation);
 }
 
 static void dx9mt_cube_texture_mark_dirty(dx9mt_cube_texture *texture) {
   if (!texture) {
     return;
   }
-  texture->generation = dx9mt_texture_next_generation(texture->generation);
+  texture->generation = dx9mt_next_generation(texture->generation);
 }
 
 static void dx9mt_surface_mark_container_dirty(dx9mt_surface *surface) {
@@ -906,24 +1316,6 @@ static void dx9mt_surface_mark_container_dirty(dx9mt_surface *surface) {
   IDirect3DBaseTexture9_Release(base);
 }
 
-static int dx9mt_env_flag_enabled(const char *name) {
-  const char *value;
-
-  if (!name) {
-    return 0;
-  }
-
-  value = getenv(name);
-  if (!value || !*value || strcmp(value, "0") == 0 ||
-      strcmp(value, "false") == 0 || strcmp(value, "FALSE") == 0 ||
-      strcmp(value, "off") == 0 || strcmp(value, "OFF") == 0 ||
-      strcmp(value, "no") == 0 || strcmp(value, "NO") == 0) {
-    return 0;
-  }
-
-  return 1;
-}
-
 static int dx9mt_frontend_soft_present_enabled(void) {
   static LONG cached = -1;
   LONG current;
@@ -1191,7 +1583,7 @@ static HRESULT dx9mt_device_publish_present_target(dx9mt_device *self) {
   desc.format = (uint32_t)dx9mt_resolve_backbuffer_format(&self->params);
   desc.windowed = self->params.Windowed ? 1u : 0u;
 
-  if (dx9mt_backend_bridge_update_present_target(&desc) != 0) {
+  if (dx9mt_runtime_update_present_target(&desc) != 0) {
     dx9mt_logf(
         "device",
         "failed to publish present target metadata target=%llu hwnd=0x%llx size=%ux%u fmt=%u windowed=%u",
@@ -2609,12 +3001,26 @@ static HRESULT WINAPI dx9mt_cube_texture_AddDirtyRect(
 /* Shared resource object helpers (VB, IB, declaration, shaders)             */
 /* -------------------------------------------------------------------------- */
 
+/* FNV-1a over dwords; must match dx9mt_sm_bytecode_hash in the viewer. */
+static uint32_t dx9mt_shader_bytecode_hash(const DWORD *byte_code,
+                                           UINT dword_count) {
+  uint32_t hash = 2166136261u;
+  UINT i;
+
+  for (i = 0; i < dword_count; ++i) {
+    hash ^= (uint32_t)byte_code[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
 static HRESULT dx9mt_copy_shader_blob(const DWORD *src, DWORD **dst,
-                                      UINT *dword_count) {
+                                      UINT *dword_count,
+                                      uint32_t *bytecode_hash) {
   UINT count;
   DWORD *blob;
 
-  if (!src || !dst || !dword_count) {
+  if (!src || !dst || !dword_count || !bytecode_hash) {
     return D3DERR_INVALIDCALL;
   }
 
@@ -2631,6 +3037,7 @@ static HRESULT dx9mt_copy_shader_blob(const DWORD *src, DWORD **dst,
   memcpy(blob, src, count * sizeof(DWORD));
   *dst = blob;
   *dword_count = count;
+  *bytecode_hash = dx9mt_shader_bytecode_hash(blob, count);
   return D3D_OK;
 }
 
@@ -2708,6 +3115,7 @@ static HRESULT dx9mt_vb_create(dx9mt_device *device, UINT length, DWORD usage,
   vb->desc.Pool = pool;
   vb->desc.Size = length;
   vb->desc.FVF = fvf;
+  dx9mt_buffer_store_init(&vb->store, length);
 
   vb->data = (unsigned char *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, length);
   if (!vb->data) {
@@ -2824,7 +3232,6 @@ static HRESULT WINAPI dx9mt_vb_Lock(IDirect3DVertexBuffer9 *iface,
                                      UINT offset_to_lock, UINT size_to_lock,
                                      void **data, DWORD flags) {
   dx9mt_vertex_buffer *self = dx9mt_vb_from_iface(iface);
-  (void)flags;
 
   if (!data || offset_to_lock > self->desc.Size) {
     return D3DERR_INVALIDCALL;
@@ -2834,12 +3241,15 @@ static HRESULT WINAPI dx9mt_vb_Lock(IDirect3DVertexBuffer9 *iface,
     size_to_lock = self->desc.Size - offset_to_lock;
   }
 
+  dx9mt_buffer_store_lock(&self->store, offset_to_lock, size_to_lock, flags);
   *data = self->data + offset_to_lock;
   return D3D_OK;
 }
 
 static HRESULT WINAPI dx9mt_vb_Unlock(IDirect3DVertexBuffer9 *iface) {
-  (void)iface;
+  dx9mt_vertex_buffer *self = dx9mt_vb_from_iface(iface);
+
+  dx9mt_buffer_store_unlock(&self->store);
   return D3D_OK;
 }
 
@@ -2920,6 +3330,7 @@ static HRESULT dx9mt_ib_create(dx9mt_device *device, UINT length, DWORD usage,
   ib->desc.Usage = usage;
   ib->desc.Pool = pool;
   ib->desc.Size = length;
+  dx9mt_buffer_store_init(&ib->store, length);
 
   ib->data = (unsigned char *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, length);
   if (!ib->data) {
@@ -3036,7 +3447,6 @@ static HRESULT WINAPI dx9mt_ib_Lock(IDirect3DIndexBuffer9 *iface,
                                      UINT offset_to_lock, UINT size_to_lock,
                                      void **data, DWORD flags) {
   dx9mt_index_buffer *self = dx9mt_ib_from_iface(iface);
-  (void)flags;
 
   if (!data || offset_to_lock > self->desc.Size) {
     return D3DERR_INVALIDCALL;
@@ -3046,12 +3456,15 @@ static HRESULT WINAPI dx9mt_ib_Lock(IDirect3DIndexBuffer9 *iface,
     size_to_lock = self->desc.Size - offset_to_lock;
   }
 
+  dx9mt_buffer_store_lock(&self->store, offset_to_lock, size_to_lock, flags);
   *data = self->data + offset_to_lock;
   return D3D_OK;
 }
 
 static HRESULT WINAPI dx9mt_ib_Unlock(IDirect3DIndexBuffer9 *iface) {
-  (void)iface;
+  dx9mt_index_buffer *self = dx9mt_ib_from_iface(iface);
+
+  dx9mt_buffer_store_unlock(&self->store);
   return D3D_OK;
 }
 
@@ -3241,7 +3654,7 @@ static HRESULT dx9mt_vshader_create(dx9mt_device *device, const DWORD *byte_code
   shader->device = device;
 
   hr = dx9mt_copy_shader_blob(byte_code, &shader->byte_code,
-                              &shader->dword_count);
+                              &shader->dword_count, &shader->bytecode_hash);
   if (FAILED(hr)) {
     HeapFree(GetProcessHeap(), 0, shader);
     return hr;
@@ -3363,7 +3776,7 @@ static HRESULT dx9mt_pshader_create(dx9mt_device *device, const DWORD *byte_code
   shader->device = device;
 
   hr = dx9mt_copy_shader_blob(byte_code, &shader->byte_code,
-                              &shader->dword_count);
+                              &shader->dword_count, &shader->bytecode_hash);
   if (FAILED(hr)) {
     HeapFree(GetProcessHeap(), 0, shader);
     return hr;
@@ -4100,6 +4513,8 @@ static HRESULT dx9mt_device_reset_internal(dx9mt_device *self,
   self->scissor_rect.top = 0;
   self->scissor_rect.right = (LONG)self->viewport.Width;
   self->scissor_rect.bottom = (LONG)self->viewport.Height;
+  self->state_dirty = DX9MT_STATE_GROUP_ALL;
+  dx9mt_draw_state_reset(&self->snapshot_state);
 
   self->present_target_id = self->swapchain ? self->swapchain->object_id : 0;
   hr = dx9mt_device_publish_present_target(self);
@@ -4233,6 +4648,27 @@ static HRESULT WINAPI dx9mt_device_Reset(IDirect3DDevice9 *iface,
   return dx9mt_device_reset_internal(self, params);
 }
 
+/*
+ * The viewer bumps its resync counter after a frame that referenced a
+ * cached upload it never received (it skipped the frame carrying it, or
+ * the ring reused that slot). From this frame on, buffers last sent whole
+ * before it are sent whole again and shader bytecode is re-attached.
+ */
+static void dx9mt_device_poll_viewer_resync(dx9mt_device *self) {
+  static LONG resync_log_counter = 0;
+  uint32_t resync = dx9mt_backend_bridge_viewer_resync();
+
+  if (resync == self->viewer_resync) {
+    return;
+  }
+  if (dx9mt_should_log_method_sample(&resync_log_counter, 8, 100)) {
+    dx9mt_logf("upload", "viewer resync %u -> %u frame=%u: resending",
+               self->viewer_resync, resync, self->frame_id);
+  }
+  self->viewer_resync = resync;
+  self->resync_frame_id = self->frame_id;
+}
+
 static HRESULT WINAPI dx9mt_device_Present(IDirect3DDevice9 *iface,
                                             const RECT *src_rect,
                                             const RECT *dst_rect,
@@ -4242,6 +4678,12 @@ static HRESULT WINAPI dx9mt_device_Present(IDirect3DDevice9 *iface,
   HRESULT hr;
   dx9mt_packet_present packet;
   static LONG log_counter = 0;
+  static LONG geometry_log_counter = 0;
+  static LONG constant_log_counter = 0;
+  static LONG draw_stream_log_counter = 0;
+  static LONG dedup_log_counter = 0;
+  static LONG arena_log_counter = 0;
+  static LONG ring_log_counter = 0;
 
   (void)src_rect;
   (void)dst_rect;
@@ -4269,8 +4711,94 @@ static HRESULT WINAPI dx9mt_device_Present(IDirect3DDevice9 *iface,
         dx9mt_device_resolve_present_window(self, dst_window_override));
   }
 
-  dx9mt_backend_bridge_submit_packets(&packet.header, (uint32_t)sizeof(packet));
-  hr = dx9mt_backend_bridge_present(self->frame_id) == 0 ? D3D_OK : D3DERR_DEVICELOST;
+  if (dx9mt_should_log_method_sample(&geometry_log_counter, 10, 120)) {
+    dx9mt_logf("upload",
+               "geometry frame=%u uploaded=%llu whole_buffer=%llu saved=%llu",
+               self->frame_id,
+               (unsigned long long)self->geometry_upload_bytes,
+               (unsigned long long)self->geometry_full_bytes,
+               (unsigned long long)(self->geometry_full_bytes -
+                                    self->geometry_upload_bytes));
+  }
+  self->geometry_upload_bytes = 0;
+  self->geometry_full_bytes = 0;
+
+  if (dx9mt_should_log_method_sample(&constant_log_counter, 10, 120)) {
+    dx9mt_logf("upload",
+               "constants frame=%u uploaded=%llu full_block=%llu saved=%llu",
+               self->frame_id,
+               (unsigned long long)self->constant_upload_bytes,
+               (unsigned long long)self->constant_full_bytes,
+               (unsigned long long)(self->constant_full_bytes -
+                                    self->constant_upload_bytes));
+  }
+  self->constant_upload_bytes = 0;
+  self->constant_full_bytes = 0;
+
+  if (dx9mt_should_log_method_sample(&draw_stream_log_counter, 10, 120)) {
+    dx9mt_logf("packets",
+               "draw state frame=%u submitted=%llu full_snapshot=%llu saved=%llu",
+               self->frame_id, (unsigned long long)self->draw_stream_bytes,
+               (unsigned long long)self->draw_snapshot_bytes,
+               (unsigned long long)(self->draw_snapshot_bytes -
+                                    self->draw_stream_bytes));
+  }
+  self->draw_stream_bytes = 0;
+  self->draw_snapshot_bytes = 0;
+
+  if (dx9mt_should_log_method_sample(&ring_log_counter, 10, 600)) {
+    dx9mt_packet_ring_stats ring_stats;
+    dx9mt_runtime_get_packet_stats(&ring_stats);
+    dx9mt_logf("packets",
+               "ring frame=%u flushes=%u threshold=%u pressure=%u failed=%u "
+               "packets=%llu bytes=%llu max_batch=%u",
+               self->frame_id, ring_stats.flushes,
+               ring_stats.threshold_flushes, ring_stats.pressure_flushes,
+               ring_stats.failed_flushes,
+               (unsigned long long)ring_stats.packets,
+               (unsigned long long)ring_stats.bytes,
+               ring_stats.max_batch_packets);
+  }
+
+  if (g_frontend_upload_state) {
+    dx9mt_upload_dedup_stats *dedup_stats =
+        &g_frontend_upload_state->dedup_stats;
+    if (dx9mt_should_log_method_sample(&dedup_log_counter, 10, 120)) {
+      dx9mt_logf("upload", "dedup frame=%u hits=%u misses=%u saved=%llu",
+                 self->frame_id, dedup_stats->hits, dedup_stats->misses,
+                 (unsigned long long)dedup_stats->bytes_saved);
+    }
+    memset(dedup_stats, 0, sizeof(*dedup_stats));
+  }
+
+  if (dx9mt_should_log_method_sample(&arena_log_counter, 4, 600)) {
+    dx9mt_upload_arena_stats arena_stats;
+    uint32_t high_water = 0;
+    uint32_t slot;
+    dx9mt_frontend_upload_get_stats(&arena_stats);
+    for (slot = 0; slot < DX9MT_UPLOAD_ARENA_MAX_SLOTS; ++slot) {
+      if (arena_stats.slot_high_water[slot] > high_water) {
+        high_water = arena_stats.slot_high_water[slot];
+      }
+    }
+    dx9mt_logf("upload",
+               "arena frame=%u frames=%u peak=%u p50=%u p95=%u p99=%u "
+               "high_water=%u committed=%u overflow_chunks=%u failed=%u "
+               "slots=%u stalls=%u stall_us=%llu stall_max_us=%u "
+               "fence_timeouts=%u",
+               self->frame_id, arena_stats.frames_sampled,
+               arena_stats.peak_frame_bytes, arena_stats.p50_frame_bytes,
+               arena_stats.p95_frame_bytes, arena_stats.p99_frame_bytes,
+               high_water, arena_stats.committed_bytes,
+               arena_stats.overflow_chunks, arena_stats.failed_copies,
+               arena_stats.active_slots, arena_stats.stall_count,
+               (unsigned long long)arena_stats.stall_total_us,
+               arena_stats.stall_max_us, arena_stats.fence_timeouts);
+  }
+
+  dx9mt_runtime_submit_packets(&packet.header, (uint32_t)sizeof(packet));
+  ++g_frontend_present_fence;
+  hr = dx9mt_runtime_present(self->frame_id) == 0 ? D3D_OK : D3DERR_DEVICELOST;
   if (SUCCEEDED(hr)) {
     HRESULT soft_hr = dx9mt_device_soft_present(self, dst_window_override);
     if (FAILED(soft_hr)) {
@@ -4279,11 +4807,13 @@ static HRESULT WINAPI dx9mt_device_Present(IDirect3DDevice9 *iface,
   }
 
   ++self->frame_id;
-  /* Invalidate cached constant refs -- arena slot rotates per frame */
-  memset(&self->vs_const_last_ref, 0, sizeof(self->vs_const_last_ref));
-  memset(&self->ps_const_last_ref, 0, sizeof(self->ps_const_last_ref));
-  self->vs_const_dirty = TRUE;
-  self->ps_const_dirty = TRUE;
+  dx9mt_device_poll_viewer_resync(self);
+  /* The backend rebuilds constant views and draw state per frame: start
+   * from a full block and a full state keyframe. */
+  self->vs_const_keyframe_sent = FALSE;
+  self->ps_const_keyframe_sent = FALSE;
+  self->state_dirty = DX9MT_STATE_GROUP_ALL;
+  dx9mt_draw_state_reset(&self->snapshot_state);
   return hr;
 }
 
@@ -4728,7 +5258,7 @@ static HRESULT WINAPI dx9mt_device_BeginScene(IDirect3DDevice9 *iface) {
   packet.header.size = (uint16_t)sizeof(packet);
   packet.header.sequence = dx9mt_runtime_next_packet_sequence();
   packet.frame_id = self->frame_id;
-  dx9mt_backend_bridge_submit_packets(&packet.header, (uint32_t)sizeof(packet));
+  dx9mt_runtime_submit_packets(&packet.header, (uint32_t)sizeof(packet));
 
   return D3D_OK;
 }
@@ -4743,6 +5273,21 @@ static HRESULT WINAPI dx9mt_device_EndScene(IDirect3DDevice9 *iface) {
   return D3D_OK;
 }
 
+static void dx9mt_rect_intersect(RECT *rect, const RECT *clip) {
+  if (rect->left < clip->left) {
+    rect->left = clip->left;
+  }
+  if (rect->top < clip->top) {
+    rect->top = clip->top;
+  }
+  if (rect->right > clip->right) {
+    rect->right = clip->right;
+  }
+  if (rect->bottom > clip->bottom) {
+    rect->bottom = clip->bottom;
+  }
+}
+
 static HRESULT WINAPI dx9mt_device_Clear(IDirect3DDevice9 *iface,
                                           DWORD rect_count,
                                           const D3DRECT *rects, DWORD flags,
@@ -4752,6 +5297,10 @@ static HRESULT WINAPI dx9mt_device_Clear(IDirect3DDevice9 *iface,
   dx9mt_packet_clear packet;
   HRESULT hr;
   dx9mt_surface *rt0;
+  RECT bounds;
+  LONG target_width = 0;
+  LONG target_height = 0;
+  DWORD clear_count;
   DWORD i;
 
   rt0 = dx9mt_surface_from_iface(self->render_targets[0]);
@@ -4779,15 +5328,71 @@ static HRESULT WINAPI dx9mt_device_Clear(IDirect3DDevice9 *iface,
   memset(&packet, 0, sizeof(packet));
   packet.header.type = DX9MT_PACKET_CLEAR;
   packet.header.size = (uint16_t)sizeof(packet);
-  packet.header.sequence = dx9mt_runtime_next_packet_sequence();
   packet.frame_id = self->frame_id;
-  packet.rect_count = rect_count;
   packet.flags = flags;
   packet.color = color;
   packet.z = z;
   packet.stencil = stencil;
+  packet.render_target_id =
+      dx9mt_surface_object_id_from_iface(self->render_targets[0]);
+  packet.depth_stencil_id =
+      dx9mt_surface_object_id_from_iface(self->depth_stencil);
+  if (rt0) {
+    packet.render_target_texture_id = dx9mt_surface_container_texture_id(rt0);
+    packet.render_target_width = rt0->desc.Width;
+    packet.render_target_height = rt0->desc.Height;
+    packet.render_target_format = (uint32_t)rt0->desc.Format;
+    target_width = (LONG)rt0->desc.Width;
+    target_height = (LONG)rt0->desc.Height;
+  } else if (self->depth_stencil) {
+    dx9mt_surface *ds = dx9mt_surface_from_iface(self->depth_stencil);
+    target_width = (LONG)ds->desc.Width;
+    target_height = (LONG)ds->desc.Height;
+  }
+
+  /* Clear() only touches the viewport, and the scissor rect when enabled. */
+  bounds.left = (LONG)self->viewport.X;
+  bounds.top = (LONG)self->viewport.Y;
+  bounds.right = bounds.left + (LONG)self->viewport.Width;
+  bounds.bottom = bounds.top + (LONG)self->viewport.Height;
+  if (self->render_states[D3DRS_SCISSORTESTENABLE]) {
+    dx9mt_rect_intersect(&bounds, &self->scissor_rect);
+  }
+  if (target_width > 0 && target_height > 0) {
+    RECT target = {0, 0, target_width, target_height};
+    dx9mt_rect_intersect(&bounds, &target);
+  }
+
+  /* One packet per surviving rect, so the backend records them in order. */
+  clear_count = (rects && rect_count > 0) ? rect_count : 1;
+  for (i = 0; i < clear_count; ++i) {
+    RECT clear_rect = bounds;
+
+    if (rects && rect_count > 0) {
+      RECT user_rect;
+      user_rect.left = rects[i].x1;
+      user_rect.top = rects[i].y1;
+      user_rect.right = rects[i].x2;
+      user_rect.bottom = rects[i].y2;
+      dx9mt_rect_intersect(&clear_rect, &user_rect);
+    }
+    if (clear_rect.right <= clear_rect.left ||
+        clear_rect.bottom <= clear_rect.top) {
+      continue;
+    }
 
-  dx9mt_backend_bridge_submit_packets(&packet.header, (uint32_t)sizeof(packet));
+    packet.header.sequence = dx9mt_runtime_next_packet_sequence();
+    packet.rect_count = (clear_rect.left <= 0 && clear_rect.top <= 0 &&
+                         clear_rect.right >= target_width &&
+                         clear_rect.bottom >= target_height)
+                            ? 0u
+                            : 1u;
+    packet.rect_left = (int32_t)clear_rect.left;
+    packet.rect_top = (int32_t)clear_rect.top;
+    packet.rect_right = (int32_t)clear_rect.right;
+    packet.rect_bottom = (int32_t)clear_rect.bottom;
+    dx9mt_runtime_submit_packets(&packet.header, (uint32_t)sizeof(packet));
+  }
   return D3D_OK;
 }
 
@@ -4828,6 +5433,7 @@ static HRESULT WINAPI dx9mt_device_SetViewport(IDirect3DDevice9 *iface,
   }
 
   self->viewport = *viewport;
+  self->state_dirty |= DX9MT_STATE_GROUP_VIEWPORT;
   return D3D_OK;
 }
 
@@ -4873,7 +5479,11 @@ static HRESULT WINAPI dx9mt_device_SetRenderState(IDirect3DDevice9 *iface,
     return D3DERR_INVALIDCALL;
   }
 
+  if (self->render_states[state] == value) {
+    return D3D_OK;
+  }
   self->render_states[state] = value;
+  self->state_dirty |= dx9mt_render_state_group(state);
   return D3D_OK;
 }
 
@@ -4904,6 +5514,9 @@ static HRESULT WINAPI dx9mt_device_SetTexture(IDirect3DDevice9 *iface,
   dx9mt_safe_addref((IUnknown *)texture);
   dx9mt_safe_release((IUnknown *)self->textures[stage]);
   self->textures[stage] = texture;
+  if (stage < DX9MT_MAX_PS_SAMPLERS) {
+    self->state_dirty |= DX9MT_STATE_GROUP_TEXTURE_STAGE0 << stage;
+  }
   return D3D_OK;
 }
 
@@ -4930,7 +5543,13 @@ static HRESULT WINAPI dx9mt_device_SetTextureStageState(
     return D3DERR_INVALIDCALL;
   }
 
+  if (self->tex_stage_states[stage][type] == value) {
+    return D3D_OK;
+  }
   self->tex_stage_states[stage][type] = value;
+  if (stage < DX9MT_MAX_PS_SAMPLERS) {
+    self->state_dirty |= DX9MT_STATE_GROUP_TEXTURE_STAGE0 << stage;
+  }
   return D3D_OK;
 }
 
@@ -4956,7 +5575,13 @@ static HRESULT WINAPI dx9mt_device_SetSamplerState(IDirect3DDevice9 *iface,
     return D3DERR_INVALIDCALL;
   }
 
+  if (self->sampler_states[sampler][type] == value) {
+    return D3D_OK;
+  }
   self->sampler_states[sampler][type] = value;
+  if (sampler < DX9MT_MAX_PS_SAMPLERS) {
+    self->state_dirty |= DX9MT_STATE_GROUP_SAMPLER0 << sampler;
+  }
   return D3D_OK;
 }
 
@@ -4981,6 +5606,7 @@ static HRESULT WINAPI dx9mt_device_SetScissorRect(IDirect3DDevice9 *iface,
     return D3DERR_INVALIDCALL;
   }
   self->scissor_rect = *rect;
+  self->state_dirty |= DX9MT_STATE_GROUP_VIEWPORT;
   return D3D_OK;
 }
 
@@ -5198,186 +5824,552 @@ static uint16_t dx9mt_fvf_to_vertex_elements(DWORD fvf,
   return count;
 }
 
-static void
-dx9mt_device_fill_draw_texture_stages(dx9mt_device *self,
-                                       dx9mt_packet_draw_indexed *packet) {
-  uint32_t stage;
+static uint32_t dx9mt_device_pack_combiner(const DWORD *tss) {
+  uint32_t word = 0;
 
-  if (!self || !packet) {
+  word = dx9mt_packed_set(word, DX9MT_PACKED_COLOROP, tss[D3DTSS_COLOROP]);
+  word = dx9mt_packed_set(word, DX9MT_PACKED_COLORARG1,
+                          dx9mt_packed_texture_arg(tss[D3DTSS_COLORARG1]));
+  word = dx9mt_packed_set(word, DX9MT_PACKED_COLORARG2,
+                          dx9mt_packed_texture_arg(tss[D3DTSS_COLORARG2]));
+  word = dx9mt_packed_set(word, DX9MT_PACKED_ALPHAOP, tss[D3DTSS_ALPHAOP]);
+  word = dx9mt_packed_set(word, DX9MT_PACKED_ALPHAARG1,
+                          dx9mt_packed_texture_arg(tss[D3DTSS_ALPHAARG1]));
+  word = dx9mt_packed_set(word, DX9MT_PACKED_ALPHAARG2,
+                          dx9mt_packed_texture_arg(tss[D3DTSS_ALPHAARG2]));
+  return word;
+}
+
+/*
+ * Builds one texture stage group: the bound texture's metadata, its upload
+ * when the texture changed or is due for a refresh, and the stage's
+ * combiner ops.
+ */
+static void dx9mt_device_build_texture_stage(dx9mt_device *self,
+                                             uint32_t stage,
+                                             dx9mt_state_texture_stage *out) {
+  IDirect3DBaseTexture9 *base_texture;
+  D3DRESOURCETYPE type;
+  dx9mt_texture *texture;
+  dx9mt_object_id texture_id;
+  uint32_t level;
+  dx9mt_surface *surface;
+  uint32_t upload_size;
+  WINBOOL should_upload;
+  char detail[256];
+
+  memset(out, 0, sizeof(*out));
+  out->combiner = dx9mt_device_pack_combiner(self->tex_stage_states[stage]);
+
+  base_texture = self->textures[stage];
+  if (!base_texture) {
     return;
   }
+  texture_id = dx9mt_texture_object_id_from_base_iface(base_texture);
 
-  /* Stage-0 fixed-function combiner state (TSS path only) */
-  packet->tss0_color_op = self->tex_stage_states[0][D3DTSS_COLOROP];
-  packet->tss0_color_arg1 = self->tex_stage_states[0][D3DTSS_COLORARG1];
-  packet->tss0_color_arg2 = self->tex_stage_states[0][D3DTSS_COLORARG2];
-  packet->tss0_alpha_op = self->tex_stage_states[0][D3DTSS_ALPHAOP];
-  packet->tss0_alpha_arg1 = self->tex_stage_states[0][D3DTSS_ALPHAARG1];
-  packet->tss0_alpha_arg2 = self->tex_stage_states[0][D3DTSS_ALPHAARG2];
-  packet->rs_texture_factor = self->render_states[D3DRS_TEXTUREFACTOR];
-
-  /* Global render states */
-  packet->rs_alpha_blend_enable = self->render_states[D3DRS_ALPHABLENDENABLE];
-  packet->rs_src_blend = self->render_states[D3DRS_SRCBLEND];
-  packet->rs_dest_blend = self->render_states[D3DRS_DESTBLEND];
-  packet->rs_alpha_test_enable = self->render_states[D3DRS_ALPHATESTENABLE];
-  packet->rs_alpha_ref = self->render_states[D3DRS_ALPHAREF];
-  packet->rs_alpha_func = self->render_states[D3DRS_ALPHAFUNC];
-  packet->rs_zenable = self->render_states[D3DRS_ZENABLE];
-  packet->rs_zwriteenable = self->render_states[D3DRS_ZWRITEENABLE];
-  packet->rs_zfunc = self->render_states[D3DRS_ZFUNC];
-  packet->rs_stencilenable = self->render_states[D3DRS_STENCILENABLE];
-  packet->rs_stencilfunc = self->render_states[D3DRS_STENCILFUNC];
-  packet->rs_stencilref = self->render_states[D3DRS_STENCILREF];
-  packet->rs_stencilmask = self->render_states[D3DRS_STENCILMASK];
-  packet->rs_stencilwritemask = self->render_states[D3DRS_STENCILWRITEMASK];
-  packet->rs_cull_mode = self->render_states[D3DRS_CULLMODE];
-  packet->rs_scissortestenable = self->render_states[D3DRS_SCISSORTESTENABLE];
-  packet->rs_blendop = self->render_states[D3DRS_BLENDOP];
-  packet->rs_colorwriteenable = self->render_states[D3DRS_COLORWRITEENABLE];
-  packet->rs_stencilpass = self->render_states[D3DRS_STENCILPASS];
-  packet->rs_stencilfail = self->render_states[D3DRS_STENCILFAIL];
-  packet->rs_stencilzfail = self->render_states[D3DRS_STENCILZFAIL];
-  packet->rs_fogenable = self->render_states[D3DRS_FOGENABLE];
-  packet->rs_fogcolor = self->render_states[D3DRS_FOGCOLOR];
-  memcpy(&packet->rs_fogstart, &self->render_states[D3DRS_FOGSTART],
-         sizeof(float));
-  memcpy(&packet->rs_fogend, &self->render_states[D3DRS_FOGEND], sizeof(float));
-  memcpy(&packet->rs_fogdensity, &self->render_states[D3DRS_FOGDENSITY],
-         sizeof(float));
-  packet->rs_fogtablemode = self->render_states[D3DRS_FOGTABLEMODE];
-
-  /* Per-stage texture and sampler data */
-  for (stage = 0; stage < DX9MT_MAX_PS_SAMPLERS; ++stage) {
-    IDirect3DBaseTexture9 *base_texture;
-    D3DRESOURCETYPE type;
-    dx9mt_texture *texture;
-    dx9mt_object_id texture_id;
-    uint32_t level;
-    dx9mt_surface *surface;
-    uint32_t upload_size;
-    WINBOOL should_upload;
-    char detail[256];
-
-    packet->sampler_min_filter[stage] = self->sampler_states[stage][D3DSAMP_MINFILTER];
-    packet->sampler_mag_filter[stage] = self->sampler_states[stage][D3DSAMP_MAGFILTER];
-    packet->sampler_mip_filter[stage] = self->sampler_states[stage][D3DSAMP_MIPFILTER];
-    packet->sampler_address_u[stage] = self->sampler_states[stage][D3DSAMP_ADDRESSU];
-    packet->sampler_address_v[stage] = self->sampler_states[stage][D3DSAMP_ADDRESSV];
-    packet->sampler_address_w[stage] = self->sampler_states[stage][D3DSAMP_ADDRESSW];
-
-    base_texture = self->textures[stage];
-    if (!base_texture) {
-      continue;
+  type = IDirect3DBaseTexture9_GetType(base_texture);
+  if (type != D3DRTYPE_TEXTURE) {
+    snprintf(detail, sizeof(detail),
+             "unsupported texture type=%u stage=%u", (unsigned)type, stage);
+    dx9mt_log_texture_upload_skip(stage, texture_id, 0,
+                                  DX9MT_TEX_SKIP_UNSUPPORTED_TYPE, detail);
+    return;
+  }
+
+  texture = dx9mt_texture_from_iface((IDirect3DTexture9 *)base_texture);
+  if (!texture || texture->levels == 0 || !texture->surfaces) {
+    snprintf(detail, sizeof(detail),
+             "missing metadata levels=%u surfaces=%s stage=%u",
+             texture ? texture->levels : 0u,
+             (texture && texture->surfaces) ? "yes" : "no", stage);
+    dx9mt_log_texture_upload_skip(stage, texture_id, texture ? texture->generation : 0,
+                                  DX9MT_TEX_SKIP_MISSING_METADATA, detail);
+    return;
+  }
+
+  level = texture->lod;
+  if (level >= texture->levels) {
+    level = 0;
+  }
+  if (!texture->surfaces[level]) {
+    snprintf(detail, sizeof(detail),
+             "missing level surface level=%u levels=%u stage=%u", level,
+             texture->levels, stage);
+    dx9mt_log_texture_upload_skip(stage, texture->object_id,
+                                  texture->generation,
+                                  DX9MT_TEX_SKIP_MISSING_LEVEL_SURFACE,
+                                  detail);
+    return;
+  }
+  surface = dx9mt_surface_from_iface(texture->surfaces[level]);
+
+  out->tex_id = texture->object_id;
+  out->tex_generation = texture->generation;
+  out->tex_format = (uint32_t)texture->format;
+  out->tex_width = texture->width >> level;
+  out->tex_height = texture->height >> level;
+  if (out->tex_width == 0) {
+    out->tex_width = 1;
+  }
+  if (out->tex_height == 0) {
+    out->tex_height = 1;
+  }
+  out->tex_pitch = surface->pitch;
+
+  if (!surface->sysmem) {
+    snprintf(detail, sizeof(detail),
+             "no sysmem copy level=%u usage=0x%08x fmt=%u stage=%u surf_id=%u",
+             level, (unsigned)surface->desc.Usage,
+             (unsigned)surface->desc.Format, stage, surface->object_id);
+    dx9mt_log_texture_upload_skip(stage, texture->object_id,
+                                  texture->generation,
+                                  DX9MT_TEX_SKIP_NO_SYSMEM, detail);
+    return;
+  }
+
+  upload_size = dx9mt_surface_upload_size(surface);
+  if (upload_size == 0) {
+    snprintf(detail, sizeof(detail),
+             "zero upload size level=%u pitch=%u size=%ux%u stage=%u",
+             level, surface->pitch, surface->desc.Width, surface->desc.Height,
+             stage);
+    dx9mt_log_texture_upload_skip(stage, texture->object_id,
+                                  texture->generation,
+                                  DX9MT_TEX_SKIP_ZERO_UPLOAD_SIZE, detail);
+    return;
+  }
+
+  should_upload = FALSE;
+  if (texture->last_upload_generation != texture->generation ||
+      texture->last_upload_frame_id == 0 ||
+      texture->last_upload_frame_id > self->frame_id ||
+      (self->frame_id - texture->last_upload_frame_id) >=
+          DX9MT_TEXTURE_UPLOAD_REFRESH_INTERVAL) {
+    should_upload = TRUE;
+  }
+  if (!should_upload) {
+    snprintf(detail, sizeof(detail),
+             "no upload this frame stage=%u last_gen=%u current_gen=%u last_frame=%u current_frame=%u refresh_interval=%u",
+             stage, texture->last_upload_generation, texture->generation,
+             texture->last_upload_frame_id, self->frame_id,
+             DX9MT_TEXTURE_UPLOAD_REFRESH_INTERVAL);
+    dx9mt_log_texture_upload_skip(stage, texture->object_id,
+                                  texture->generation,
+                                  DX9MT_TEX_SKIP_NOT_DIRTY, detail);
+    return;
+  }
+
+  out->tex_data =
+      dx9mt_frontend_upload_copy(self->frame_id, surface->sysmem, upload_size);
+  if (out->tex_data.size > 0) {
+    texture->last_upload_generation = texture->generation;
+    texture->last_upload_frame_id = self->frame_id;
+  } else {
+    snprintf(detail, sizeof(detail),
+             "upload copy failed stage=%u size=%u frame=%u arena_slot=%u",
+             stage, upload_size, self->frame_id,
+             g_frontend_upload_state
+                 ? (unsigned)g_frontend_upload_state->slot_index
+                 : 0u);
+    dx9mt_log_texture_upload_skip(stage, texture->object_id,
+                                  texture->generation,
+                                  DX9MT_TEX_SKIP_UPLOAD_COPY_FAILED, detail);
+  }
+}
+
+/*
+ * VB/IB contents live in a persistent store on the viewer side keyed by
+ * buffer id + generation, the same way textures are cached. Only the dirty
+ * span written since the last upload crosses the boundary, as a patch on top
+ * of base_generation (or as a fresh copy after DISCARD). A full upload is
+ * forced on first use, when the last one predates resync_frame_id (the
+ * viewer lost a patch or its base), and on a slow refresh so a viewer that
+ * started late still converges.
+ *
+ * Returns FALSE when the buffer is still write-locked, in which case the
+ * caller falls back to per-draw data.
+ */
+static WINBOOL dx9mt_buffer_store_build_update(
+    dx9mt_buffer_store *store, const unsigned char *data, UINT size,
+    uint32_t frame_id, uint32_t resync_frame_id, dx9mt_upload_ref *out_ref,
+    dx9mt_buffer_update *out_update) {
+  WINBOOL full;
+  uint32_t begin = 0;
+  uint32_t end = size;
+
+  memset(out_ref, 0, sizeof(*out_ref));
+  memset(out_update, 0, sizeof(*out_update));
+  if (store->write_locked) {
+    return FALSE;
+  }
+
+  out_update->generation = store->generation;
+  out_update->buffer_size = size;
+
+  full = dx9mt_upload_resend_due(store->last_full_upload_frame_id, frame_id,
+                                 resync_frame_id,
+                                 DX9MT_BUFFER_UPLOAD_REFRESH_INTERVAL);
+  if (!full && store->last_upload_generation == store->generation) {
+    return TRUE;
+  }
+  if (store->dirty_end <= store->dirty_begin || store->dirty_end > size) {
+    full = TRUE;
+  }
+
+  if (!full) {
+    begin = store->dirty_begin;
+    end = store->dirty_end;
+    if (!store->discarded) {
+      out_update->base_generation = store->last_upload_generation;
+      out_update->flags = store->in_place ? DX9MT_BUFFER_UPDATE_IN_PLACE : 0;
     }
-    texture_id = dx9mt_texture_object_id_from_base_iface(base_texture);
-
-    type = IDirect3DBaseTexture9_GetType(base_texture);
-    if (type != D3DRTYPE_TEXTURE) {
-      snprintf(detail, sizeof(detail),
-               "unsupported texture type=%u stage=%u", (unsigned)type, stage);
-      dx9mt_log_texture_upload_skip(stage, texture_id, 0,
-                                    DX9MT_TEX_SKIP_UNSUPPORTED_TYPE, detail);
-      continue;
+  }
+
+  *out_ref = dx9mt_frontend_upload_copy(frame_id, data + begin, end - begin);
+  if (out_ref->size == 0) {
+    return TRUE;
+  }
+  out_update->offset = begin;
+
+  store->last_upload_generation = store->generation;
+  if (full) {
+    store->last_full_upload_frame_id = frame_id;
+  }
+  store->dirty_begin = 0;
+  store->dirty_end = 0;
+  store->discarded = FALSE;
+  store->in_place = TRUE;
+  return TRUE;
+}
+
+static void dx9mt_device_mark_constants_dirty(uint32_t *dirty_lo,
+                                              uint32_t *dirty_hi,
+                                              UINT reg_idx, UINT count) {
+  if (count == 0) {
+    return;
+  }
+  if (*dirty_hi <= *dirty_lo) {
+    *dirty_lo = reg_idx;
+    *dirty_hi = reg_idx + count;
+    return;
+  }
+  if (reg_idx < *dirty_lo) {
+    *dirty_lo = reg_idx;
+  }
+  if (reg_idx + count > *dirty_hi) {
+    *dirty_hi = reg_idx + count;
+  }
+}
+
+/*
+ * Uploads the float constants a draw needs the backend to see: the whole
+ * block for the first draw of a frame, then only the dirty register range.
+ * Returns an empty ref when nothing changed. A failed copy keeps the range
+ * dirty so the next draw retries it instead of losing the delta.
+ */
+static dx9mt_upload_ref dx9mt_device_upload_constants(
+    dx9mt_device *self, float (*registers)[4], WINBOOL *keyframe_sent,
+    uint32_t *dirty_lo, uint32_t *dirty_hi, uint16_t *out_start) {
+  dx9mt_upload_ref ref;
+  uint32_t lo = 0;
+  uint32_t hi = DX9MT_MAX_SHADER_FLOAT_CONSTANTS;
+
+  memset(&ref, 0, sizeof(ref));
+  *out_start = 0;
+  if (*keyframe_sent) {
+    if (*dirty_hi <= *dirty_lo) {
+      return ref;
     }
+    lo = *dirty_lo;
+    hi = *dirty_hi;
+  }
 
-    texture = dx9mt_texture_from_iface((IDirect3DTexture9 *)base_texture);
-    if (!texture || texture->levels == 0 || !texture->surfaces) {
-      snprintf(detail, sizeof(detail),
-               "missing metadata levels=%u surfaces=%s stage=%u",
-               texture ? texture->levels : 0u,
-               (texture && texture->surfaces) ? "yes" : "no", stage);
-      dx9mt_log_texture_upload_skip(stage, texture_id, texture ? texture->generation : 0,
-                                    DX9MT_TEX_SKIP_MISSING_METADATA, detail);
-      continue;
+  ref = dx9mt_frontend_upload_copy(self->frame_id, &registers[lo][0],
+                                   (hi - lo) * 4u * sizeof(float));
+  if (ref.size == 0) {
+    return ref;
+  }
+  *out_start = (uint16_t)lo;
+  *keyframe_sent = TRUE;
+  *dirty_lo = 0;
+  *dirty_hi = 0;
+  self->constant_upload_bytes += ref.size;
+  self->constant_full_bytes += DX9MT_DRAW_SHADER_CONSTANT_BYTES;
+  return ref;
+}
+
+/*
+ * Bytecode is immutable per shader object, so the viewer interns it by hash.
+ * Attach it on first use, again once the viewer asks for a resync (it
+ * missed the frame carrying it), and on a refresh for a viewer that started
+ * late. Within a frame only the first draw carries it.
+ */
+static dx9mt_upload_ref dx9mt_device_attach_shader_bytecode(
+    dx9mt_device *self, const DWORD *byte_code, UINT dword_count,
+    uint32_t *last_upload_frame_id) {
+  dx9mt_upload_ref ref;
+
+  memset(&ref, 0, sizeof(ref));
+  if ((dx9mt_runtime_protocol_caps() & DX9MT_PROTOCOL_CAP_RESOURCE_HANDLES) &&
+      !dx9mt_upload_resend_due(*last_upload_frame_id, self->frame_id,
+                               self->resync_frame_id,
+                               DX9MT_SHADER_UPLOAD_REFRESH_INTERVAL)) {
+    return ref;
+  }
+  ref = dx9mt_frontend_upload_copy(self->frame_id, byte_code,
+                                   dword_count * sizeof(DWORD));
+  if (ref.size != 0) {
+    *last_upload_frame_id = self->frame_id;
+  }
+  return ref;
+}
+
+static void dx9mt_device_pack_control_constants(
+    const int (*int_registers)[4], const WINBOOL *bool_registers,
+    dx9mt_shader_control_constants *out) {
+  uint32_t i;
+
+  memcpy(out->i, int_registers, sizeof(out->i));
+  out->b_mask = 0;
+  for (i = 0; i < DX9MT_MAX_SHADER_BOOL_CONSTANTS; ++i) {
+    if (bool_registers[i]) {
+      out->b_mask |= (uint16_t)(1u << i);
     }
+  }
+}
+
+/*
+ * Packets one draw call submits together: the state groups that changed
+ * since the previous draw, then the slim draw itself.
+ */
+#define DX9MT_DRAW_PACKET_STREAM_BYTES                                            \
+  (sizeof(dx9mt_packet_state_depth_stencil) + sizeof(dx9mt_packet_state_blend) + \
+   sizeof(dx9mt_packet_state_raster) + sizeof(dx9mt_packet_state_viewport) +     \
+   DX9MT_MAX_PS_SAMPLERS * (sizeof(dx9mt_packet_state_sampler) +                \
+                            sizeof(dx9mt_packet_state_texture_stage)) +         \
+   2u * sizeof(dx9mt_packet_state_shader_control) + sizeof(dx9mt_packet_draw))
+
+typedef struct dx9mt_draw_packet_stream {
+  uint32_t words[DX9MT_DRAW_PACKET_STREAM_BYTES / sizeof(uint32_t)];
+  uint32_t used;
+} dx9mt_draw_packet_stream;
+
+static void *dx9mt_draw_packet_stream_push(dx9mt_draw_packet_stream *stream,
+                                           uint16_t type, uint32_t size) {
+  dx9mt_packet_header *header =
+      (dx9mt_packet_header *)((unsigned char *)stream->words + stream->used);
+
+  memset(header, 0, size);
+  header->type = type;
+  header->size = (uint16_t)size;
+  header->sequence = dx9mt_runtime_next_packet_sequence();
+  stream->used += size;
+  return header;
+}
+
+/*
+ * Appends a packet for every state group that changed since the previous
+ * draw. Set* calls mark groups dirty; Present and Reset mark all of them so
+ * each frame opens with a full keyframe. Bound texture stages are rebuilt
+ * every draw because a Lock/Unlock or the refresh interval can attach an
+ * upload without any Set* call, but they are only sent when they differ
+ * from what the backend already holds.
+ */
+static void dx9mt_device_emit_state_groups(dx9mt_device *self,
+                                           dx9mt_draw_packet_stream *stream) {
+  const DWORD *rs = self->render_states;
+  uint32_t dirty = self->state_dirty;
+  uint32_t stage;
 
-    level = texture->lod;
-    if (level >= texture->levels) {
-      level = 0;
+  if (dirty & DX9MT_STATE_GROUP_DEPTH_STENCIL) {
+    dx9mt_packet_state_depth_stencil *packet = dx9mt_draw_packet_stream_push(
+        stream, DX9MT_PACKET_STATE_DEPTH_STENCIL, sizeof(*packet));
+    uint32_t depth = 0;
+    uint32_t stencil = 0;
+
+    depth = dx9mt_packed_set(depth, DX9MT_PACKED_ZENABLE, rs[D3DRS_ZENABLE]);
+    depth = dx9mt_packed_set(depth, DX9MT_PACKED_ZWRITEENABLE,
+                             rs[D3DRS_ZWRITEENABLE]);
+    depth = dx9mt_packed_set(depth, DX9MT_PACKED_ZFUNC, rs[D3DRS_ZFUNC]);
+    depth = dx9mt_packed_set(depth, DX9MT_PACKED_STENCILENABLE,
+                             rs[D3DRS_STENCILENABLE]);
+    depth = dx9mt_packed_set(depth, DX9MT_PACKED_STENCILFUNC,
+                             rs[D3DRS_STENCILFUNC]);
+    depth = dx9mt_packed_set(depth, DX9MT_PACKED_STENCILPASS,
+                             rs[D3DRS_STENCILPASS]);
+    depth = dx9mt_packed_set(depth, DX9MT_PACKED_STENCILFAIL,
+                             rs[D3DRS_STENCILFAIL]);
+    depth = dx9mt_packed_set(depth, DX9MT_PACKED_STENCILZFAIL,
+                             rs[D3DRS_STENCILZFAIL]);
+    stencil = dx9mt_packed_set(stencil, DX9MT_PACKED_STENCILREF,
+                               rs[D3DRS_STENCILREF]);
+    stencil = dx9mt_packed_set(stencil, DX9MT_PACKED_STENCILMASK,
+                               rs[D3DRS_STENCILMASK]);
+    stencil = dx9mt_packed_set(stencil, DX9MT_PACKED_STENCILWRITEMASK,
+                               rs[D3DRS_STENCILWRITEMASK]);
+    packet->state.depth = depth;
+    packet->state.stencil = stencil;
+  }
+  if (dirty & DX9MT_STATE_GROUP_BLEND) {
+    dx9mt_packet_state_blend *packet = dx9mt_draw_packet_stream_push(
+        stream, DX9MT_PACKET_STATE_BLEND, sizeof(*packet));
+    uint32_t blend = 0;
+
+    blend = dx9mt_packed_set(blend, DX9MT_PACKED_ALPHABLENDENABLE,
+                             rs[D3DRS_ALPHABLENDENABLE]);
+    blend = dx9mt_packed_set(blend, DX9MT_PACKED_SRCBLEND, rs[D3DRS_SRCBLEND]);
+    blend =
+        dx9mt_packed_set(blend, DX9MT_PACKED_DESTBLEND, rs[D3DRS_DESTBLEND]);
+    blend = dx9mt_packed_set(blend, DX9MT_PACKED_BLENDOP, rs[D3DRS_BLENDOP]);
+    blend = dx9mt_packed_set(blend, DX9MT_PACKED_ALPHATESTENABLE,
+                             rs[D3DRS_ALPHATESTENABLE]);
+    blend =
+        dx9mt_packed_set(blend, DX9MT_PACKED_ALPHAFUNC, rs[D3DRS_ALPHAFUNC]);
+    blend = dx9mt_packed_set(blend, DX9MT_PACKED_ALPHAREF, rs[D3DRS_ALPHAREF]);
+    blend = dx9mt_packed_set(blend, DX9MT_PACKED_COLORWRITEENABLE,
+                             rs[D3DRS_COLORWRITEENABLE]);
+    packet->state.blend = blend;
+    packet->state.texture_factor = rs[D3DRS_TEXTUREFACTOR];
+  }
+  if (dirty & DX9MT_STATE_GROUP_RASTER) {
+    dx9mt_packet_state_raster *packet = dx9mt_draw_packet_stream_push(
+        stream, DX9MT_PACKET_STATE_RASTER, sizeof(*packet));
+    uint32_t raster = 0;
+
+    raster =
+        dx9mt_packed_set(raster, DX9MT_PACKED_CULLMODE, rs[D3DRS_CULLMODE]);
+    raster = dx9mt_packed_set(raster, DX9MT_PACKED_SCISSORTESTENABLE,
+                              rs[D3DRS_SCISSORTESTENABLE]);
+    raster =
+        dx9mt_packed_set(raster, DX9MT_PACKED_FOGENABLE, rs[D3DRS_FOGENABLE]);
+    raster = dx9mt_packed_set(raster, DX9MT_PACKED_FOGTABLEMODE,
+                              rs[D3DRS_FOGTABLEMODE]);
+    packet->state.raster = raster;
+    packet->state.fogcolor = rs[D3DRS_FOGCOLOR];
+    memcpy(&packet->state.fogstart, &rs[D3DRS_FOGSTART], sizeof(float));
+    memcpy(&packet->state.fogend, &rs[D3DRS_FOGEND], sizeof(float));
+    memcpy(&packet->state.fogdensity, &rs[D3DRS_FOGDENSITY], sizeof(float));
+  }
+  if (dirty & DX9MT_STATE_GROUP_VIEWPORT) {
+    dx9mt_packet_state_viewport *packet = dx9mt_draw_packet_stream_push(
+        stream, DX9MT_PACKET_STATE_VIEWPORT, sizeof(*packet));
+    packet->state.x = self->viewport.X;
+    packet->state.y = self->viewport.Y;
+    packet->state.width = self->viewport.Width;
+    packet->state.height = self->viewport.Height;
+    packet->state.min_z = self->viewport.MinZ;
+    packet->state.max_z = self->viewport.MaxZ;
+    packet->state.scissor_left = (int32_t)self->scissor_rect.left;
+    packet->state.scissor_top = (int32_t)self->scissor_rect.top;
+    packet->state.scissor_right = (int32_t)self->scissor_rect.right;
+    packet->state.scissor_bottom = (int32_t)self->scissor_rect.bottom;
+  }
+  if (dirty & DX9MT_STATE_GROUP_CONTROL_VS) {
+    dx9mt_packet_state_shader_control *packet = dx9mt_draw_packet_stream_push(
+        stream, DX9MT_PACKET_STATE_SHADER_CONTROL, sizeof(*packet));
+    packet->shader_stage = DX9MT_SHADER_STAGE_VERTEX;
+    dx9mt_device_pack_control_constants((const int (*)[4])self->vs_const_i,
+                                        self->vs_const_b, &packet->constants);
+  }
+  if (dirty & DX9MT_STATE_GROUP_CONTROL_PS) {
+    dx9mt_packet_state_shader_control *packet = dx9mt_draw_packet_stream_push(
+        stream, DX9MT_PACKET_STATE_SHADER_CONTROL, sizeof(*packet));
+    packet->shader_stage = DX9MT_SHADER_STAGE_PIXEL;
+    dx9mt_device_pack_control_constants((const int (*)[4])self->ps_const_i,
+                                        self->ps_const_b, &packet->constants);
+  }
+
+  for (stage = 0; stage < DX9MT_MAX_PS_SAMPLERS; ++stage) {
+    const DWORD *ss = self->sampler_states[stage];
+    uint32_t stage_bit = DX9MT_STATE_GROUP_TEXTURE_STAGE0 << stage;
+    dx9mt_state_texture_stage texture_stage;
+
+    if (dirty & (DX9MT_STATE_GROUP_SAMPLER0 << stage)) {
+      dx9mt_packet_state_sampler *packet = dx9mt_draw_packet_stream_push(
+          stream, DX9MT_PACKET_STATE_SAMPLER, sizeof(*packet));
+      uint32_t sampler = 0;
+
+      sampler = dx9mt_packed_set(sampler, DX9MT_PACKED_MINFILTER,
+                                 ss[D3DSAMP_MINFILTER]);
+      sampler = dx9mt_packed_set(sampler, DX9MT_PACKED_MAGFILTER,
+                                 ss[D3DSAMP_MAGFILTER]);
+      sampler = dx9mt_packed_set(sampler, DX9MT_PACKED_MIPFILTER,
+                                 ss[D3DSAMP_MIPFILTER]);
+      sampler = dx9mt_packed_set(sampler, DX9MT_PACKED_ADDRESSU,
+                                 ss[D3DSAMP_ADDRESSU]);
+      sampler = dx9mt_packed_set(sampler, DX9MT_PACKED_ADDRESSV,
+                                 ss[D3DSAMP_ADDRESSV]);
+      sampler = dx9mt_packed_set(sampler, DX9MT_PACKED_ADDRESSW,
+                                 ss[D3DSAMP_ADDRESSW]);
+      packet->stage = stage;
+      packet->state.sampler = sampler;
     }
-    if (!texture->surfaces[level]) {
-      snprintf(detail, sizeof(detail),
-               "missing level surface level=%u levels=%u stage=%u", level,
-               texture->levels, stage);
-      dx9mt_log_texture_upload_skip(stage, texture->object_id,
-                                    texture->generation,
-                                    DX9MT_TEX_SKIP_MISSING_LEVEL_SURFACE,
-                                    detail);
+
+    if (!(dirty & stage_bit) && !self->textures[stage]) {
       continue;
     }
-    surface = dx9mt_surface_from_iface(texture->surfaces[level]);
-
-    packet->tex_id[stage] = texture->object_id;
-    packet->tex_generation[stage] = texture->generation;
-    packet->tex_format[stage] = (uint32_t)texture->format;
-    packet->tex_width[stage] = texture->width >> level;
-    packet->tex_height[stage] = texture->height >> level;
-    if (packet->tex_width[stage] == 0) {
-      packet->tex_width[stage] = 1;
-    }
-    if (packet->tex_height[stage] == 0) {
-      packet->tex_height[stage] = 1;
-    }
-    packet->tex_pitch[stage] = surface->pitch;
-
-    if (!surface->sysmem) {
-      snprintf(detail, sizeof(detail),
-               "no sysmem copy level=%u usage=0x%08x fmt=%u stage=%u surf_id=%u",
-               level, (unsigned)surface->desc.Usage,
-               (unsigned)surface->desc.Format, stage, surface->object_id);
-      dx9mt_log_texture_upload_skip(stage, texture->object_id,
-                                    texture->generation,
-                                    DX9MT_TEX_SKIP_NO_SYSMEM, detail);
+    dx9mt_device_build_texture_stage(self, stage, &texture_stage);
+    if (!(dirty & stage_bit) &&
+        memcmp(&texture_stage, &self->sent_texture_stages[stage],
+               sizeof(texture_stage)) == 0) {
       continue;
     }
-
-    upload_size = dx9mt_surface_upload_size(surface);
-    if (upload_size == 0) {
-      snprintf(detail, sizeof(detail),
-               "zero upload size level=%u pitch=%u size=%ux%u stage=%u",
-               level, surface->pitch, surface->desc.Width, surface->desc.Height,
-               stage);
-      dx9mt_log_texture_upload_skip(stage, texture->object_id,
-                                    texture->generation,
-                                    DX9MT_TEX_SKIP_ZERO_UPLOAD_SIZE, detail);
-      continue;
+    {
+      dx9mt_packet_state_texture_stage *packet = dx9mt_draw_packet_stream_push(
+          stream, DX9MT_PACKET_STATE_TEXTURE_STAGE, sizeof(*packet));
+      packet->stage = stage;
+      packet->state = texture_stage;
     }
+    /* The backend consumes tex_data with the next draw. */
+    memset(&texture_stage.tex_data, 0, sizeof(texture_stage.tex_data));
+    self->sent_texture_stages[stage] = texture_stage;
+  }
 
-    should_upload = FALSE;
-    if (texture->last_upload_generation != texture->generation ||
-        texture->last_upload_frame_id == 0 ||
-        texture->last_upload_frame_id > self->frame_id ||
-        (self->frame_id - texture->last_upload_frame_id) >=
-            DX9MT_TEXTURE_UPLOAD_REFRESH_INTERVAL) {
-      should_upload = TRUE;
-    }
-    if (!should_upload) {
-      snprintf(detail, sizeof(detail),
-               "no upload this frame stage=%u last_gen=%u current_gen=%u last_frame=%u current_frame=%u refresh_interval=%u",
-               stage, texture->last_upload_generation, texture->generation,
-               texture->last_upload_frame_id, self->frame_id,
-               DX9MT_TEXTURE_UPLOAD_REFRESH_INTERVAL);
-      dx9mt_log_texture_upload_skip(stage, texture->object_id,
-                                    texture->generation,
-                                    DX9MT_TEX_SKIP_NOT_DIRTY, detail);
-      continue;
-    }
+  self->state_dirty = 0;
+}
 
-    packet->tex_data[stage] =
-        dx9mt_frontend_upload_copy(self->frame_id, surface->sysmem, upload_size);
-    if (packet->tex_data[stage].size > 0) {
-      texture->last_upload_generation = texture->generation;
-      texture->last_upload_frame_id = self->frame_id;
+/*
+ * Fallback when DX9MT_PROTOCOL_CAP_STATE_DELTA was not agreed: fold the
+ * stream's state groups into the frontend's copy of the backend draw state
+ * and send the draw as one self-contained DRAW_INDEXED snapshot instead.
+ */
+static void dx9mt_device_submit_draw_snapshot(
+    dx9mt_device *self, const dx9mt_draw_packet_stream *stream) {
+  const unsigned char *bytes = (const unsigned char *)stream->words;
+  dx9mt_packet_draw_indexed snapshot;
+  uint32_t offset = 0;
+
+  while (offset < stream->used) {
+    const dx9mt_packet_header *header =
+        (const dx9mt_packet_header *)(bytes + offset);
+
+    if (header->type == DX9MT_PACKET_DRAW) {
+      dx9mt_draw_state_expand(&self->snapshot_state,
+                              (const dx9mt_packet_draw *)header, &snapshot);
+      dx9mt_runtime_submit_packets(&snapshot.header, (uint32_t)sizeof(snapshot));
     } else {
-      snprintf(detail, sizeof(detail),
-               "upload copy failed stage=%u size=%u frame=%u arena_slot=%u",
-               stage, upload_size, self->frame_id,
-               self->frame_id % DX9MT_UPLOAD_ARENA_SLOTS);
-      dx9mt_log_texture_upload_skip(stage, texture->object_id,
-                                    texture->generation,
-                                    DX9MT_TEX_SKIP_UPLOAD_COPY_FAILED, detail);
+      dx9mt_draw_state_apply(&self->snapshot_state, header);
     }
+    offset += header->size;
+  }
+}
+
+static uint32_t dx9mt_index_count_for_primitive(D3DPRIMITIVETYPE primitive_type,
+                                                UINT prim_count) {
+  switch (primitive_type) {
+  case D3DPT_POINTLIST:
+    return prim_count;
+  case D3DPT_LINELIST:
+    return prim_count * 2u;
+  case D3DPT_LINESTRIP:
+    return prim_count + 1u;
+  case D3DPT_TRIANGLELIST:
+    return prim_count * 3u;
+  case D3DPT_TRIANGLESTRIP:
+  case D3DPT_TRIANGLEFAN:
+    return prim_count + 2u;
+  default:
+    return 0;
   }
 }
 
@@ -5386,58 +6378,51 @@ static HRESULT WINAPI dx9mt_device_DrawIndexedPrimitive(
     INT base_vertex_index, UINT min_vertex_index, UINT num_vertices,
     UINT start_index, UINT prim_count) {
   dx9mt_device *self = dx9mt_device_from_iface(iface);
-  dx9mt_packet_draw_indexed packet;
-
-  memset(&packet, 0, sizeof(packet));
-  packet.header.type = DX9MT_PACKET_DRAW_INDEXED;
-  packet.header.size = (uint16_t)sizeof(packet);
-  packet.header.sequence = dx9mt_runtime_next_packet_sequence();
-  packet.primitive_type = primitive_type;
-  packet.base_vertex = base_vertex_index;
-  packet.min_vertex_index = min_vertex_index;
-  packet.num_vertices = num_vertices;
-  packet.start_index = start_index;
-  packet.primitive_count = prim_count;
-  packet.render_target_id =
+  dx9mt_draw_packet_stream stream;
+  dx9mt_packet_draw *draw;
+
+  stream.used = 0;
+  dx9mt_device_emit_state_groups(self, &stream);
+  draw = dx9mt_draw_packet_stream_push(&stream, DX9MT_PACKET_DRAW,
+                                       sizeof(*draw));
+  draw->primitive_type = primitive_type;
+  draw->base_vertex = base_vertex_index;
+  draw->min_vertex_index = min_vertex_index;
+  draw->num_vertices = num_vertices;
+  draw->start_index = start_index;
+  draw->primitive_count = prim_count;
+  draw->render_target_id =
       dx9mt_surface_object_id_from_iface(self->render_targets[0]);
-  packet.depth_stencil_id =
+  draw->depth_stencil_id =
       dx9mt_surface_object_id_from_iface(self->depth_stencil);
   if (self->render_targets[0]) {
     dx9mt_surface *rt0 = dx9mt_surface_from_iface(self->render_targets[0]);
-    packet.render_target_texture_id = dx9mt_surface_container_texture_id(rt0);
-    packet.render_target_width = rt0->desc.Width;
-    packet.render_target_height = rt0->desc.Height;
-    packet.render_target_format = (uint32_t)rt0->desc.Format;
+    draw->render_target_texture_id = dx9mt_surface_container_texture_id(rt0);
+    draw->render_target_width = rt0->desc.Width;
+    draw->render_target_height = rt0->desc.Height;
+    draw->render_target_format = (uint32_t)rt0->desc.Format;
   }
-  packet.vertex_buffer_id =
+  draw->vertex_buffer_id =
       dx9mt_vb_object_id_from_iface(self->streams[0]);
-  packet.index_buffer_id = dx9mt_ib_object_id_from_iface(self->indices);
-  packet.vertex_decl_id =
+  draw->index_buffer_id = dx9mt_ib_object_id_from_iface(self->indices);
+  draw->vertex_decl_id =
       dx9mt_vdecl_object_id_from_iface(self->vertex_decl);
-  packet.vertex_shader_id =
+  draw->vertex_shader_id =
       dx9mt_vshader_object_id_from_iface(self->vertex_shader);
-  packet.pixel_shader_id =
+  draw->pixel_shader_id =
       dx9mt_pshader_object_id_from_iface(self->pixel_shader);
-  packet.fvf = self->fvf;
-  packet.stream0_offset = self->stream_offsets[0];
-  packet.stream0_stride = self->stream_strides[0];
-  packet.viewport_hash = dx9mt_hash_viewport(&self->viewport);
-  packet.scissor_hash = dx9mt_hash_rect(&self->scissor_rect);
-  packet.texture_stage_hash = dx9mt_hash_texture_stage_state(self);
-  packet.sampler_state_hash = dx9mt_hash_sampler_state(self);
-  packet.stream_binding_hash = dx9mt_hash_stream_bindings(self);
-  if (self->vs_const_dirty || self->vs_const_last_ref.size == 0) {
-    self->vs_const_last_ref = dx9mt_frontend_upload_copy(
-        self->frame_id, &self->vs_const_f[0][0], DX9MT_DRAW_SHADER_CONSTANT_BYTES);
-    self->vs_const_dirty = FALSE;
-  }
-  packet.constants_vs = self->vs_const_last_ref;
-  if (self->ps_const_dirty || self->ps_const_last_ref.size == 0) {
-    self->ps_const_last_ref = dx9mt_frontend_upload_copy(
-        self->frame_id, &self->ps_const_f[0][0], DX9MT_DRAW_SHADER_CONSTANT_BYTES);
-    self->ps_const_dirty = FALSE;
-  }
-  packet.constants_ps = self->ps_const_last_ref;
+  draw->fvf = self->fvf;
+  draw->stream0_offset = self->stream_offsets[0];
+  draw->stream0_stride = self->stream_strides[0];
+  draw->stream_binding_hash = dx9mt_hash_stream_bindings(self);
+  draw->constants_vs = dx9mt_device_upload_constants(
+      self, self->vs_const_f, &self->vs_const_keyframe_sent,
+      &self->vs_const_dirty_lo, &self->vs_const_dirty_hi,
+      &draw->constants_vs_start);
+  draw->constants_ps = dx9mt_device_upload_constants(
+      self, self->ps_const_f, &self->ps_const_keyframe_sent,
+      &self->ps_const_dirty_lo, &self->ps_const_dirty_hi,
+      &draw->constants_ps_start);
 
   /* RB3 Phase 3: shader bytecode for translation */
   {
@@ -5446,29 +6431,19 @@ static HRESULT WINAPI dx9mt_device_DrawIndexedPrimitive(
     dx9mt_pixel_shader *ps = self->pixel_shader
         ? dx9mt_pshader_from_iface(self->pixel_shader) : NULL;
     if (vs && vs->byte_code && vs->dword_count > 0) {
-      packet.vs_bytecode = dx9mt_frontend_upload_copy(
-          self->frame_id, vs->byte_code, vs->dword_count * sizeof(DWORD));
-      packet.vs_bytecode_dwords = vs->dword_count;
+      draw->vs_bytecode_hash = vs->bytecode_hash;
+      draw->vs_bytecode_dwords = vs->dword_count;
+      draw->vs_bytecode = dx9mt_device_attach_shader_bytecode(
+          self, vs->byte_code, vs->dword_count, &vs->last_upload_frame_id);
     }
     if (ps && ps->byte_code && ps->dword_count > 0) {
-      packet.ps_bytecode = dx9mt_frontend_upload_copy(
-          self->frame_id, ps->byte_code, ps->dword_count * sizeof(DWORD));
-      packet.ps_bytecode_dwords = ps->dword_count;
+      draw->ps_bytecode_hash = ps->bytecode_hash;
+      draw->ps_bytecode_dwords = ps->dword_count;
+      draw->ps_bytecode = dx9mt_device_attach_shader_bytecode(
+          self, ps->byte_code, ps->dword_count, &ps->last_upload_frame_id);
     }
   }
 
-  /* RB3: actual viewport/scissor values */
-  packet.viewport_x = self->viewport.X;
-  packet.viewport_y = self->viewport.Y;
-  packet.viewport_width = self->viewport.Width;
-  packet.viewport_height = self->viewport.Height;
-  packet.viewport_min_z = self->viewport.MinZ;
-  packet.viewport_max_z = self->viewport.MaxZ;
-  packet.scissor_left = (int32_t)self->scissor_rect.left;
-  packet.scissor_top = (int32_t)self->scissor_rect.top;
-  packet.scissor_right = (int32_t)self->scissor_rect.right;
-  packet.scissor_bottom = (int32_t)self->scissor_rect.bottom;
-
   /* RB3: geometry data -- VB/IB bytes and vertex declaration */
   {
     dx9mt_vertex_buffer *vb =
@@ -5477,42 +6452,117 @@ static HRESULT WINAPI dx9mt_device_DrawIndexedPrimitive(
         self->indices ? dx9mt_ib_from_iface(self->indices) : NULL;
     dx9mt_vertex_decl *decl =
         self->vertex_decl ? dx9mt_vdecl_from_iface(self->vertex_decl) : NULL;
-
-    if (vb && vb->data && vb->desc.Size > 0) {
-      packet.vertex_data = dx9mt_frontend_upload_copy(
-          self->frame_id, vb->data, vb->desc.Size);
-      packet.vertex_data_size = vb->desc.Size;
+    int handles = (dx9mt_runtime_protocol_caps() &
+                   DX9MT_PROTOCOL_CAP_RESOURCE_HANDLES) != 0;
+
+    /*
+     * VB/IB contents go through the versioned persistent store and ship only
+     * their dirty spans. Draw offsets stay in whole-buffer space.
+     *
+     * A buffer that is still write-locked at draw time has no stable version,
+     * and without DX9MT_PROTOCOL_CAP_RESOURCE_HANDLES the backend takes no
+     * versions at all, so the draw falls back to uploading just the
+     * vertex/index ranges it touches. That packet is rebased so the uploaded
+     * vertex range starts at vertex 0 and the index range starts at index 0:
+     * start_index becomes 0, stream0_offset becomes 0 and base_vertex
+     * becomes -min_vertex_index, so every fetched index i lands on
+     * (i - min_vertex_index) in the trimmed buffer. Draws whose ranges don't
+     * fit the buffer upload it whole with the original offsets.
+     *
+     * Only stream 0 is trimmed because only stream 0 is sent: the draw
+     * packet and the IPC entry carry one vertex buffer, and streams 1-15
+     * (instancing, split position/normal streams) are not uploaded at all.
+     * Carrying them means a per-stream range here, from the declaration's
+     * Stream fields, and a per-stream buffer in the draw.
+     */
+    if (handles && vb && vb->data && vb->desc.Size > 0 &&
+        dx9mt_buffer_store_build_update(&vb->store, vb->data, vb->desc.Size,
+                                        self->frame_id, self->resync_frame_id,
+                                        &draw->vertex_data,
+                                        &draw->vertex_update)) {
+      draw->vertex_data_size = draw->vertex_data.size;
+      self->geometry_upload_bytes += draw->vertex_data_size;
+      self->geometry_full_bytes += vb->desc.Size;
+    } else if (vb && vb->data && vb->desc.Size > 0) {
+      uint32_t vb_begin;
+      uint32_t vb_bytes;
+
+      if (dx9mt_draw_vertex_range(vb->desc.Size, self->stream_offsets[0],
+                                  self->stream_strides[0], base_vertex_index,
+                                  min_vertex_index, num_vertices, &vb_begin,
+                                  &vb_bytes)) {
+        draw->vertex_data = dx9mt_frontend_upload_copy(
+            self->frame_id, vb->data + vb_begin, vb_bytes);
+        draw->vertex_data_size = vb_bytes;
+        draw->base_vertex = -(int32_t)min_vertex_index;
+        draw->stream0_offset = 0;
+      } else {
+        draw->vertex_data = dx9mt_frontend_upload_copy(
+            self->frame_id, vb->data, vb->desc.Size);
+        draw->vertex_data_size = vb->desc.Size;
+      }
+      self->geometry_upload_bytes += draw->vertex_data_size;
+      self->geometry_full_bytes += vb->desc.Size;
     }
-    if (ib && ib->data && ib->desc.Size > 0) {
-      packet.index_data = dx9mt_frontend_upload_copy(
-          self->frame_id, ib->data, ib->desc.Size);
-      packet.index_data_size = ib->desc.Size;
-      packet.index_format = (uint32_t)ib->desc.Format;
+    if (handles && ib && ib->data && ib->desc.Size > 0 &&
+        dx9mt_buffer_store_build_update(&ib->store, ib->data, ib->desc.Size,
+                                        self->frame_id, self->resync_frame_id,
+                                        &draw->index_data,
+                                        &draw->index_update)) {
+      draw->index_data_size = draw->index_data.size;
+      draw->index_format = (uint32_t)ib->desc.Format;
+      self->geometry_upload_bytes += draw->index_data_size;
+      self->geometry_full_bytes += ib->desc.Size;
+    } else if (ib && ib->data && ib->desc.Size > 0) {
+      uint32_t ib_begin;
+      uint32_t ib_bytes;
+
+      if (dx9mt_draw_index_range(
+              ib->desc.Size, ib->desc.Format == D3DFMT_INDEX32 ? 4u : 2u,
+              start_index,
+              dx9mt_index_count_for_primitive(primitive_type, prim_count),
+              &ib_begin, &ib_bytes)) {
+        draw->index_data = dx9mt_frontend_upload_copy(
+            self->frame_id, ib->data + ib_begin, ib_bytes);
+        draw->index_data_size = ib_bytes;
+        draw->start_index = 0;
+      } else {
+        draw->index_data = dx9mt_frontend_upload_copy(
+            self->frame_id, ib->data, ib->desc.Size);
+        draw->index_data_size = ib->desc.Size;
+      }
+      draw->index_format = (uint32_t)ib->desc.Format;
+      self->geometry_upload_bytes += draw->index_data_size;
+      self->geometry_full_bytes += ib->desc.Size;
     }
     if (decl && decl->elements && decl->count > 0) {
-      packet.vertex_decl_data = dx9mt_frontend_upload_copy(
+      draw->vertex_decl_data = dx9mt_frontend_upload_copy(
           self->frame_id, decl->elements,
           decl->count * (uint32_t)sizeof(D3DVERTEXELEMENT9));
-      packet.vertex_decl_count = (uint16_t)decl->count;
+      draw->vertex_decl_count = (uint16_t)decl->count;
     } else if (self->fvf != 0) {
       /* No vertex declaration -- synthesize from FVF code. */
       D3DVERTEXELEMENT9 fvf_elems[16];
       uint16_t fvf_count =
           dx9mt_fvf_to_vertex_elements(self->fvf, fvf_elems, 16);
       if (fvf_count > 0) {
-        packet.vertex_decl_data = dx9mt_frontend_upload_copy(
+        draw->vertex_decl_data = dx9mt_frontend_upload_copy(
             self->frame_id, fvf_elems,
             fvf_count * (uint32_t)sizeof(D3DVERTEXELEMENT9));
-        packet.vertex_decl_count = fvf_count;
+        draw->vertex_decl_count = fvf_count;
       }
     }
   }
 
-  dx9mt_device_fill_draw_texture_stages(self, &packet);
-
-  packet.state_block_hash = dx9mt_hash_draw_state(&packet);
-
-  dx9mt_backend_bridge_submit_packets(&packet.header, (uint32_t)sizeof(packet));
+  self->draw_snapshot_bytes += sizeof(dx9mt_packet_draw_indexed);
+  if (!(dx9mt_runtime_protocol_caps() & DX9MT_PROTOCOL_CAP_STATE_DELTA)) {
+    self->draw_stream_bytes += sizeof(dx9mt_packet_draw_indexed);
+    dx9mt_device_submit_draw_snapshot(self, &stream);
+    return D3D_OK;
+  }
+  self->draw_stream_bytes += stream.used;
+  dx9mt_runtime_submit_packets((const dx9mt_packet_header *)stream.words,
+                               stream.used);
   return D3D_OK;
 }
 
@@ -5617,7 +6667,8 @@ static HRESULT WINAPI dx9mt_device_SetVertexShaderConstantF(
   }
 
   memcpy(&self->vs_const_f[reg_idx][0], data, count * sizeof(self->vs_const_f[0]));
-  self->vs_const_dirty = TRUE;
+  dx9mt_device_mark_constants_dirty(&self->vs_const_dirty_lo,
+                                    &self->vs_const_dirty_hi, reg_idx, count);
   return D3D_OK;
 }
 
@@ -5640,6 +6691,7 @@ static HRESULT WINAPI dx9mt_device_SetVertexShaderConstantI(
   }
 
   memcpy(&self->vs_const_i[reg_idx][0], data, count * sizeof(self->vs_const_i[0]));
+  self->state_dirty |= DX9MT_STATE_GROUP_CONTROL_VS;
   return D3D_OK;
 }
 
@@ -5662,6 +6714,7 @@ static HRESULT WINAPI dx9mt_device_SetVertexShaderConstantB(
   }
 
   memcpy(&self->vs_const_b[reg_idx], data, count * sizeof(WINBOOL));
+  self->state_dirty |= DX9MT_STATE_GROUP_CONTROL_VS;
   return D3D_OK;
 }
 
@@ -5810,7 +6863,8 @@ static HRESULT WINAPI dx9mt_device_SetPixelShaderConstantF(
   }
 
   memcpy(&self->ps_const_f[reg_idx][0], data, count * sizeof(self->ps_const_f[0]));
-  self->ps_const_dirty = TRUE;
+  dx9mt_device_mark_constants_dirty(&self->ps_const_dirty_lo,
+                                    &self->ps_const_dirty_hi, reg_idx, count);
   return D3D_OK;
 }
 
@@ -5833,6 +6887,7 @@ static HRESULT WINAPI dx9mt_device_SetPixelShaderConstantI(
   }
 
   memcpy(&self->ps_const_i[reg_idx][0], data, count * sizeof(self->ps_const_i[0]));
+  self->state_dirty |= DX9MT_STATE_GROUP_CONTROL_PS;
   return D3D_OK;
 }
 
@@ -5855,6 +6910,7 @@ static HRESULT WINAPI dx9mt_device_SetPixelShaderConstantB(
   }
 
   memcpy(&self->ps_const_b[reg_idx], data, count * sizeof(WINBOOL));
+  self->state_dirty |= DX9MT_STATE_GROUP_CONTROL_PS;
   return D3D_OK;
 }
 
@@ -1,21 +1,170 @@
 #include "dx9mt/runtime.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #include <windows.h>
 
 #include "dx9mt/backend_bridge.h"
 #include "dx9mt/log.h"
+#include "dx9mt/packet_capture.h"
+#include "dx9mt/packet_ring.h"
 #include "dx9mt/packets.h"
 #include "dx9mt/upload_arena.h"
 
+/*
+ * Default batch size before the packet ring hands packets to the backend.
+ * Each flush is one PE->unixlib transition under Wine; see
+ * packet_ring_bench for per-call cost vs. batch size. Override with
+ * DX9MT_PACKET_FLUSH_BYTES (0 submits every packet immediately).
+ */
+#define DX9MT_PACKET_RING_DEFAULT_FLUSH_BYTES (64u << 10)
+/* Presents recorded when DX9MT_CAPTURE_PATH is set. */
+#define DX9MT_CAPTURE_DEFAULT_FRAMES 300u
+
 static LONG g_runtime_state;
 static LONG g_packet_seq;
+static dx9mt_packet_ring g_packet_ring;
+static void *g_packet_ring_storage;
+static dx9mt_packet_capture g_packet_capture;
+static uint32_t g_protocol_caps;
+
+static uint32_t dx9mt_runtime_packet_flush_bytes(void) {
+  const char *value = getenv("DX9MT_PACKET_FLUSH_BYTES");
+  char *end = NULL;
+  unsigned long bytes;
+
+  if (!value || !*value) {
+    return DX9MT_PACKET_RING_DEFAULT_FLUSH_BYTES;
+  }
+  bytes = strtoul(value, &end, 0);
+  if (end == value) {
+    return DX9MT_PACKET_RING_DEFAULT_FLUSH_BYTES;
+  }
+  return bytes > 0xFFFFFFFFul ? 0xFFFFFFFFu : (uint32_t)bytes;
+}
+
+/* DX9MT_BACKEND_PACKET_THREAD=block|spin moves packet parsing off-thread. */
+static uint32_t dx9mt_runtime_packet_thread_mode(void) {
+  const char *value = getenv("DX9MT_BACKEND_PACKET_THREAD");
+
+  if (!value || !*value) {
+    return DX9MT_BACKEND_PACKET_THREAD_OFF;
+  }
+  if (strcmp(value, "spin") == 0) {
+    return DX9MT_BACKEND_PACKET_THREAD_SPIN;
+  }
+  if (strcmp(value, "block") == 0 || strcmp(value, "1") == 0) {
+    return DX9MT_BACKEND_PACKET_THREAD_BLOCK;
+  }
+  return DX9MT_BACKEND_PACKET_THREAD_OFF;
+}
+
+/*
+ * DX9MT_PROTOCOL_CAPS=<mask> limits the DX9MT_PROTOCOL_CAP_* bits offered
+ * to the backend, to force the fallback encodings (0 offers none).
+ */
+static uint32_t dx9mt_runtime_offered_caps(void) {
+  const char *value = getenv("DX9MT_PROTOCOL_CAPS");
+  char *end = NULL;
+  unsigned long mask;
+
+  if (!value || !*value) {
+    return DX9MT_PROTOCOL_CAPS_ALL;
+  }
+  mask = strtoul(value, &end, 0);
+  if (end == value) {
+    return DX9MT_PROTOCOL_CAPS_ALL;
+  }
+  return (uint32_t)mask & DX9MT_PROTOCOL_CAPS_ALL;
+}
+
+/*
+ * DX9MT_CAPTURE_PATH=<file> records the bridge traffic of the first
+ * DX9MT_CAPTURE_FRAMES presents for src/tools/capture_replay.
+ */
+static void dx9mt_runtime_open_capture(void) {
+  const char *path = getenv("DX9MT_CAPTURE_PATH");
+  const char *frames = getenv("DX9MT_CAPTURE_FRAMES");
+  uint32_t frame_limit = DX9MT_CAPTURE_DEFAULT_FRAMES;
+
+  if (!path || !*path) {
+    return;
+  }
+  if (frames && *frames) {
+    frame_limit = (uint32_t)strtoul(frames, NULL, 0);
+  }
+  dx9mt_packet_capture_open(&g_packet_capture, path, frame_limit,
+                            dx9mt_frontend_upload_resolve);
+}
+
+static int dx9mt_runtime_capture_sink(const dx9mt_packet_header *packets,
+                                      uint32_t packet_bytes) {
+  dx9mt_packet_capture_packets(&g_packet_capture, packets, packet_bytes);
+  return dx9mt_backend_bridge_submit_packets(packets, packet_bytes);
+}
+
+static void dx9mt_runtime_init_packet_ring(uint32_t capacity) {
+  uint32_t flush_bytes = (g_protocol_caps & DX9MT_PROTOCOL_CAP_PACKET_BATCH)
+                             ? dx9mt_runtime_packet_flush_bytes()
+                             : 0u;
+
+  g_packet_ring_storage =
+      VirtualAlloc(NULL, capacity, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  if (!g_packet_ring_storage) {
+    dx9mt_logf("runtime",
+               "packet ring allocation failed (%u bytes), submitting unbatched",
+               capacity);
+    capacity = 0;
+  }
+  dx9mt_packet_ring_init(&g_packet_ring, g_packet_ring_storage, capacity,
+                         flush_bytes,
+                         dx9mt_packet_capture_active(&g_packet_capture)
+                             ? dx9mt_runtime_capture_sink
+                             : dx9mt_backend_bridge_submit_packets);
+  dx9mt_logf("runtime", "packet ring capacity=%u flush_bytes=%u",
+             g_packet_ring.capacity, g_packet_ring.flush_threshold);
+}
+
+uint32_t dx9mt_runtime_protocol_caps(void) {
+  return g_protocol_caps;
+}
 
 uint32_t dx9mt_runtime_next_packet_sequence(void) {
   return (uint32_t)InterlockedIncrement(&g_packet_seq);
 }
 
+int dx9mt_runtime_submit_packets(const dx9mt_packet_header *packets,
+                                 uint32_t packet_bytes) {
+  return dx9mt_packet_ring_append(&g_packet_ring, packets, packet_bytes);
+}
+
+int dx9mt_runtime_flush_packets(void) {
+  return dx9mt_packet_ring_flush(&g_packet_ring);
+}
+
+void dx9mt_runtime_get_packet_stats(dx9mt_packet_ring_stats *out_stats) {
+  if (out_stats) {
+    *out_stats = g_packet_ring.stats;
+  }
+}
+
+int dx9mt_runtime_update_present_target(
+    const dx9mt_backend_present_target_desc *desc) {
+  dx9mt_packet_capture_present_target(&g_packet_capture, desc);
+  return dx9mt_backend_bridge_update_present_target(desc);
+}
+
+int dx9mt_runtime_present(uint32_t frame_id) {
+  int result;
+
+  dx9mt_runtime_flush_packets();
+  result = dx9mt_backend_bridge_present(frame_id);
+  dx9mt_packet_capture_present(&g_packet_capture, frame_id, result,
+                               dx9mt_backend_bridge_debug_get_last_replay_hash());
+  return result;
+}
+
 void dx9mt_runtime_ensure_initialized(void) {
   LONG previous = InterlockedCompareExchange(&g_runtime_state, 1, 0);
 
@@ -35,16 +184,27 @@ void dx9mt_runtime_ensure_initialized(void) {
 
   dx9mt_backend_init_desc init_desc;
   memset(&init_desc, 0, sizeof(init_desc));
-  init_desc.protocol_version = 1;
+  init_desc.protocol_version = DX9MT_PROTOCOL_VERSION;
   init_desc.ring_capacity_bytes = 1u << 20;
-  init_desc.upload_desc.slot_count = DX9MT_UPLOAD_ARENA_SLOTS;
+  init_desc.upload_desc.slot_count = DX9MT_UPLOAD_ARENA_MAX_SLOTS;
   init_desc.upload_desc.bytes_per_slot = DX9MT_UPLOAD_ARENA_BYTES_PER_SLOT;
-  dx9mt_logf("runtime", "upload arena config slots=%u bytes_per_slot=%u",
+  init_desc.packet_thread_mode = dx9mt_runtime_packet_thread_mode();
+  init_desc.capabilities = dx9mt_runtime_offered_caps();
+  dx9mt_logf("runtime",
+             "upload arena config slots=%u bytes_per_slot=%u chunk_bytes=%u",
              init_desc.upload_desc.slot_count,
-             init_desc.upload_desc.bytes_per_slot);
+             init_desc.upload_desc.bytes_per_slot,
+             (unsigned)DX9MT_UPLOAD_ARENA_CHUNK_BYTES);
 
+  dx9mt_runtime_open_capture();
+  dx9mt_packet_capture_init(&g_packet_capture, &init_desc);
   if (dx9mt_backend_bridge_init(&init_desc) == 0) {
     dx9mt_packet_init packet;
+    g_protocol_caps = dx9mt_backend_bridge_capabilities();
+    dx9mt_logf("runtime", "protocol=%u caps offered=0x%08x agreed=0x%08x",
+               init_desc.protocol_version, init_desc.capabilities,
+               g_protocol_caps);
+    dx9mt_runtime_init_packet_ring(init_desc.ring_capacity_bytes);
     memset(&packet, 0, sizeof(packet));
     packet.header.type = DX9MT_PACKET_INIT;
     packet.header.size = (uint16_t)sizeof(packet);
@@ -52,8 +212,11 @@ void dx9mt_runtime_ensure_initialized(void) {
     packet.protocol_version = init_desc.protocol_version;
     packet.ring_capacity_bytes = init_desc.ring_capacity_bytes;
     packet.upload_desc = init_desc.upload_desc;
+    packet.capabilities = g_protocol_caps;
 
-    dx9mt_backend_bridge_submit_packets(&packet.header, (uint32_t)sizeof(packet));
+    dx9mt_runtime_submit_packets(&packet.header, (uint32_t)sizeof(packet));
+  } else {
+    dx9mt_packet_capture_close(&g_packet_capture);
   }
 
   InterlockedExchange(&g_runtime_state, 2);
@@ -64,7 +227,14 @@ void dx9mt_runtime_shutdown(void) {
     return;
   }
 
+  dx9mt_runtime_flush_packets();
+  dx9mt_packet_capture_close(&g_packet_capture);
   dx9mt_backend_bridge_shutdown();
+  memset(&g_packet_ring, 0, sizeof(g_packet_ring));
+  if (g_packet_ring_storage) {
+    VirtualFree(g_packet_ring_storage, 0, MEM_RELEASE);
+    g_packet_ring_storage = NULL;
+  }
   dx9mt_log_shutdown();
   InterlockedExchange(&g_packet_seq, 0);
   InterlockedExchange(&g_runtime_state, 0);
@@ -0,0 +1,419 @@
+/*
+ * Headless replay of a frontend packet capture (DX9MT_CAPTURE_PATH) into
+ * the backend bridge. Recorded packet batches and presents go through
+ * dx9mt_backend_bridge_submit_packets / _present as fast as possible;
+ * per frame it reports the time spent inside the bridge, the bytes
+ * serialized into the IPC frame and whether the backend replay hash
+ * matches the one recorded at capture time.
+ *
+ *   make capture-replay BACKEND_CC=gcc
+ *   build/capture_replay [--loops N] [--quiet] [--no-ipc]
+ *                        [--packet-thread off|block|spin] <capture>
+ *
+ * IPC assembly maps DX9MT_BACKEND_IPC_PATH (default
+ * /tmp/dx9mt_replay_frame.bin) so serialization is part of the measured
+ * cost; --no-ipc leaves it unmapped. The summary compares the draw
+ * table's size with the interned state blocks against the same table with
+ * every draw carrying its state inline. Exits 1 on any hash mismatch.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dx9mt/backend_bridge.h"
+#include "dx9mt/metal_ipc.h"
+#include "dx9mt/packet_capture.h"
+
+#define REPLAY_DEFAULT_IPC_PATH "/tmp/dx9mt_replay_frame.bin"
+#define REPLAY_SLOT_GROW_BYTES (1u << 20)
+/* Per-draw state bytes carried inline, and the index words replacing them. */
+#define REPLAY_INLINE_STATE_BYTES                                               \
+  (sizeof(dx9mt_packed_render_state) + sizeof(dx9mt_metal_ipc_sampler_set))
+#define REPLAY_INDEXED_STATE_BYTES                                              \
+  (sizeof(((dx9mt_metal_ipc_draw *)0)->state_index) +                           \
+   sizeof(((dx9mt_metal_ipc_draw *)0)->tss0_combiner))
+
+/* Native stand-in for the frontend upload arena: one flat buffer per slot. */
+typedef struct replay_slot {
+  unsigned char *bytes;
+  size_t capacity;
+} replay_slot;
+
+static replay_slot g_slots[DX9MT_UPLOAD_ARENA_MAX_SLOTS];
+
+static double replay_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static const void *replay_upload_resolve(const dx9mt_upload_ref *ref) {
+  const replay_slot *slot;
+
+  if (!ref || ref->size == 0 ||
+      ref->arena_index >= DX9MT_UPLOAD_ARENA_MAX_SLOTS) {
+    return NULL;
+  }
+  slot = &g_slots[ref->arena_index];
+  if ((size_t)ref->offset + ref->size > slot->capacity) {
+    return NULL;
+  }
+  return slot->bytes + ref->offset;
+}
+
+static int replay_store_upload(const dx9mt_capture_record *record) {
+  const dx9mt_capture_upload *upload =
+      (const dx9mt_capture_upload *)(record + 1);
+  const dx9mt_upload_ref *ref;
+  replay_slot *slot;
+  size_t end;
+
+  if (record->bytes < sizeof(*upload)) {
+    return -1;
+  }
+  ref = &upload->ref;
+  if (ref->arena_index >= DX9MT_UPLOAD_ARENA_MAX_SLOTS ||
+      ref->size != record->bytes - sizeof(*upload)) {
+    return -1;
+  }
+  slot = &g_slots[ref->arena_index];
+  end = (size_t)ref->offset + ref->size;
+  if (end > slot->capacity) {
+    size_t capacity = (end + REPLAY_SLOT_GROW_BYTES - 1u) &
+                      ~(size_t)(REPLAY_SLOT_GROW_BYTES - 1u);
+    unsigned char *bytes = (unsigned char *)realloc(slot->bytes, capacity);
+    if (!bytes) {
+      return -1;
+    }
+    memset(bytes + slot->capacity, 0, capacity - slot->capacity);
+    slot->bytes = bytes;
+    slot->capacity = capacity;
+  }
+  memcpy(slot->bytes + ref->offset, upload + 1, ref->size);
+  return 0;
+}
+
+static unsigned char *replay_load(const char *path, size_t *out_bytes) {
+  FILE *file = fopen(path, "rb");
+  unsigned char *data = NULL;
+  size_t capacity = 0;
+  size_t used = 0;
+
+  if (!file) {
+    return NULL;
+  }
+  for (;;) {
+    size_t got;
+    if (used == capacity) {
+      unsigned char *grown;
+      capacity = capacity ? capacity * 2u : (16u << 20);
+      grown = (unsigned char *)realloc(data, capacity);
+      if (!grown) {
+        free(data);
+        fclose(file);
+        return NULL;
+      }
+      data = grown;
+    }
+    got = fread(data + used, 1, capacity - used, file);
+    used += got;
+    if (got == 0) {
+      break;
+    }
+  }
+  fclose(file);
+  *out_bytes = used;
+  return data;
+}
+
+static int replay_compare_double(const void *lhs, const void *rhs) {
+  double a = *(const double *)lhs;
+  double b = *(const double *)rhs;
+  return (a > b) - (a < b);
+}
+
+typedef struct replay_totals {
+  uint32_t frames;
+  uint32_t mismatches;
+  uint32_t failed_presents;
+  uint64_t packet_bytes;
+  uint64_t ipc_bytes;
+  uint64_t ipc_copied_bytes;
+  uint64_t ipc_draws;
+  uint64_t state_blocks;
+  uint64_t state_bytes;
+  double *frame_ns;
+  uint32_t frame_ns_capacity;
+} replay_totals;
+
+static void replay_push_frame_ns(replay_totals *totals, double ns) {
+  if (totals->frames == totals->frame_ns_capacity) {
+    uint32_t capacity =
+        totals->frame_ns_capacity ? totals->frame_ns_capacity * 2u : 1024u;
+    double *grown =
+        (double *)realloc(totals->frame_ns, capacity * sizeof(double));
+    if (!grown) {
+      return;
+    }
+    totals->frame_ns = grown;
+    totals->frame_ns_capacity = capacity;
+  }
+  totals->frame_ns[totals->frames] = ns;
+}
+
+static int replay_pass(const unsigned char *data, size_t bytes, size_t first,
+                       int packet_thread_mode, int quiet,
+                       replay_totals *totals) {
+  const dx9mt_capture_record *record;
+  size_t cursor = first;
+  double frame_ns = 0.0;
+  uint64_t frame_packet_bytes = 0;
+  int initialized = 0;
+  int ended = 0;
+
+  while ((record = dx9mt_packet_capture_next(data, bytes, &cursor)) != NULL) {
+    const void *payload = record + 1;
+    double start;
+
+    switch (record->type) {
+    case DX9MT_CAPTURE_RECORD_INIT: {
+      const dx9mt_capture_init *init = (const dx9mt_capture_init *)payload;
+      dx9mt_backend_init_desc desc;
+
+      if (record->bytes < sizeof(*init)) {
+        return -1;
+      }
+      memset(&desc, 0, sizeof(desc));
+      desc.protocol_version = init->protocol_version;
+      desc.ring_capacity_bytes = init->ring_capacity_bytes;
+      desc.upload_desc.slot_count = init->slot_count;
+      desc.upload_desc.bytes_per_slot = init->bytes_per_slot;
+      desc.packet_thread_mode = packet_thread_mode >= 0
+                                    ? (uint32_t)packet_thread_mode
+                                    : init->packet_thread_mode;
+      desc.capabilities = init->capabilities;
+      if (packet_thread_mode > 0) {
+        desc.capabilities |= DX9MT_PROTOCOL_CAP_PACKET_THREAD;
+      }
+      if (dx9mt_backend_bridge_init(&desc) != 0) {
+        fprintf(stderr, "capture_replay: bridge init failed\n");
+        return -1;
+      }
+      dx9mt_backend_bridge_set_upload_resolver(replay_upload_resolve);
+      initialized = 1;
+      break;
+    }
+    case DX9MT_CAPTURE_RECORD_PRESENT_TARGET: {
+      const dx9mt_capture_present_target *target =
+          (const dx9mt_capture_present_target *)payload;
+      dx9mt_backend_present_target_desc desc;
+
+      if (record->bytes < sizeof(*target)) {
+        return -1;
+      }
+      memset(&desc, 0, sizeof(desc));
+      desc.target_id = target->target_id;
+      desc.window_handle = target->window_handle;
+      desc.width = target->width;
+      desc.height = target->height;
+      desc.format = target->format;
+      desc.windowed = target->windowed;
+      dx9mt_backend_bridge_update_present_target(&desc);
+      break;
+    }
+    case DX9MT_CAPTURE_RECORD_UPLOAD:
+      if (replay_store_upload(record) != 0) {
+        fprintf(stderr, "capture_replay: bad upload record\n");
+        return -1;
+      }
+      break;
+    case DX9MT_CAPTURE_RECORD_PACKETS:
+      start = replay_now_ns();
+      dx9mt_backend_bridge_submit_packets((const dx9mt_packet_header *)payload,
+                                          record->bytes);
+      frame_ns += replay_now_ns() - start;
+      frame_packet_bytes += record->bytes;
+      break;
+    case DX9MT_CAPTURE_RECORD_PRESENT: {
+      const dx9mt_capture_present *present =
+          (const dx9mt_capture_present *)payload;
+      dx9mt_backend_ipc_stats ipc;
+      uint32_t hash;
+      int result;
+      int match;
+
+      if (record->bytes < sizeof(*present)) {
+        return -1;
+      }
+      start = replay_now_ns();
+      result = dx9mt_backend_bridge_present(present->frame_id);
+      frame_ns += replay_now_ns() - start;
+      hash = dx9mt_backend_bridge_debug_get_last_replay_hash();
+      dx9mt_backend_bridge_debug_get_ipc_stats(&ipc);
+      match = hash == present->replay_hash && result == present->result;
+
+      if (!quiet) {
+        printf("frame %6u  %9.1f us  packets %8llu B  ipc %9u B "
+               "(copied %9u)  draws %5u  hash 0x%08x %s\n",
+               present->frame_id, frame_ns / 1e3,
+               (unsigned long long)frame_packet_bytes, ipc.frame_bytes,
+               ipc.copied_bytes, ipc.draw_count, hash,
+               match ? "ok" : "MISMATCH");
+      }
+      replay_push_frame_ns(totals, frame_ns);
+      ++totals->frames;
+      totals->mismatches += match ? 0u : 1u;
+      totals->failed_presents += result != 0 ? 1u : 0u;
+      totals->packet_bytes += frame_packet_bytes;
+      totals->ipc_bytes += ipc.frame_bytes;
+      totals->ipc_copied_bytes += ipc.copied_bytes;
+      totals->ipc_draws += ipc.draw_count;
+      totals->state_blocks += ipc.state_blocks;
+      totals->state_bytes += ipc.state_bytes;
+      frame_ns = 0.0;
+      frame_packet_bytes = 0;
+      break;
+    }
+    case DX9MT_CAPTURE_RECORD_END:
+      ended = 1;
+      break;
+    default:
+      break;
+    }
+    if (ended) {
+      break;
+    }
+  }
+
+  if (!ended) {
+    fprintf(stderr, "capture_replay: capture has no END record (truncated)\n");
+  }
+  if (initialized) {
+    dx9mt_backend_bridge_set_upload_resolver(NULL);
+    dx9mt_backend_bridge_shutdown();
+  }
+  return initialized ? 0 : -1;
+}
+
+static void replay_usage(void) {
+  fprintf(stderr, "usage: capture_replay [--loops N] [--quiet] [--no-ipc] "
+                  "[--packet-thread off|block|spin] <capture>\n");
+}
+
+int main(int argc, char **argv) {
+  const char *path = NULL;
+  unsigned char *data;
+  size_t bytes = 0;
+  size_t first;
+  uint32_t loops = 1;
+  int quiet = 0;
+  int ipc = 1;
+  int packet_thread_mode = -1;
+  replay_totals totals;
+  double sum_ns = 0.0;
+  int i;
+
+  for (i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--loops") == 0 && i + 1 < argc) {
+      loops = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--quiet") == 0) {
+      quiet = 1;
+    } else if (strcmp(argv[i], "--no-ipc") == 0) {
+      ipc = 0;
+    } else if (strcmp(argv[i], "--packet-thread") == 0 && i + 1 < argc) {
+      const char *mode = argv[++i];
+      packet_thread_mode = strcmp(mode, "spin") == 0
+                               ? DX9MT_BACKEND_PACKET_THREAD_SPIN
+                           : strcmp(mode, "block") == 0
+                               ? DX9MT_BACKEND_PACKET_THREAD_BLOCK
+                               : DX9MT_BACKEND_PACKET_THREAD_OFF;
+    } else if (argv[i][0] != '-' && !path) {
+      path = argv[i];
+    } else {
+      replay_usage();
+      return 2;
+    }
+  }
+  if (!path || loops == 0) {
+    replay_usage();
+    return 2;
+  }
+
+  data = replay_load(path, &bytes);
+  if (!data) {
+    fprintf(stderr, "capture_replay: cannot read %s\n", path);
+    return 2;
+  }
+  first = dx9mt_packet_capture_check_header(data, bytes);
+  if (first == 0) {
+    fprintf(stderr,
+            "capture_replay: %s is not a capture this build can replay\n",
+            path);
+    free(data);
+    return 2;
+  }
+  if (ipc) {
+    setenv("DX9MT_BACKEND_IPC_PATH", REPLAY_DEFAULT_IPC_PATH, 0);
+  } else {
+    unsetenv("DX9MT_BACKEND_IPC_PATH");
+  }
+
+  memset(&totals, 0, sizeof(totals));
+  for (uint32_t loop = 0; loop < loops; ++loop) {
+    if (replay_pass(data, bytes, first, packet_thread_mode, quiet,
+                    &totals) != 0) {
+      fprintf(stderr, "capture_replay: replay failed\n");
+      free(data);
+      return 2;
+    }
+  }
+
+  if (totals.frames > 0) {
+    uint32_t sampled = totals.frames < totals.frame_ns_capacity
+                           ? totals.frames
+                           : totals.frame_ns_capacity;
+    for (uint32_t f = 0; f < sampled; ++f) {
+      sum_ns += totals.frame_ns[f];
+    }
+    qsort(totals.frame_ns, sampled, sizeof(double), replay_compare_double);
+    printf("%u frames x %u loops  mean %.1f us  p50 %.1f us  p95 %.1f us  "
+           "max %.1f us\n",
+           totals.frames / loops, loops, sum_ns / sampled / 1e3,
+           totals.frame_ns[sampled / 2] / 1e3,
+           totals.frame_ns[(uint32_t)((sampled - 1) * 0.95)] / 1e3,
+           totals.frame_ns[sampled - 1] / 1e3);
+    printf("packets %.1f KiB/frame  ipc %.1f KiB/frame (copied %.1f)  "
+           "failed presents %u  hash mismatches %u\n",
+           (double)totals.packet_bytes / totals.frames / 1024.0,
+           (double)totals.ipc_bytes / totals.frames / 1024.0,
+           (double)totals.ipc_copied_bytes / totals.frames / 1024.0,
+           totals.failed_presents, totals.mismatches);
+    if (totals.ipc_draws > 0) {
+      double table = (double)totals.ipc_draws * sizeof(dx9mt_metal_ipc_draw);
+      double inline_table =
+          table + (double)totals.ipc_draws *
+                      (REPLAY_INLINE_STATE_BYTES - REPLAY_INDEXED_STATE_BYTES);
+
+      printf("draw table %.1f KiB/frame + state blocks %.1f KiB/frame "
+             "(%.1f blocks)  inline state %.1f KiB/frame  saved %.1f%%\n",
+             table / totals.frames / 1024.0,
+             (double)totals.state_bytes / totals.frames / 1024.0,
+             (double)totals.state_blocks / totals.frames,
+             inline_table / totals.frames / 1024.0,
+             100.0 * (1.0 - (table + (double)totals.state_bytes) /
+                                inline_table));
+    }
+  } else {
+    printf("no frames in capture\n");
+  }
+
+  free(totals.frame_ns);
+  free(data);
+  for (i = 0; i < DX9MT_UPLOAD_ARENA_MAX_SLOTS; ++i) {
+    free(g_slots[i].bytes);
+  }
+  return totals.mismatches ? 1 : 0;
+}
@@ -72,7 +72,9 @@ static void reg_name(char *out, size_t out_sz, const dx9mt_sm_register *r,
     snprintf(out, out_sz, "in.v%u", r->number);
     break;
   case DX9MT_SM_REG_CONST:
-    if (r->has_relative) {
+    if (r->has_relative && r->relative_type == DX9MT_SM_REG_LOOP) {
+      snprintf(out, out_sz, "c[clamp(aL + %u, 0, 255)]", r->number);
+    } else if (r->has_relative) {
       const char *rc = "xyzw";
       snprintf(out, out_sz, "c[clamp(int(a0.%c) + %u, 0, 255)]",
                rc[r->relative_component], r->number);
@@ -127,6 +129,9 @@ static void reg_name(char *out, size_t out_sz, const dx9mt_sm_register *r,
   case DX9MT_SM_REG_CONSTBOOL:
     snprintf(out, out_sz, "b%u", r->number);
     break;
+  case DX9MT_SM_REG_LOOP:
+    snprintf(out, out_sz, "aL");
+    break;
   case DX9MT_SM_REG_MISCTYPE:
     if (r->number == 0)
       snprintf(out, out_sz, "in.position");
@@ -803,6 +808,22 @@ static void emit_instruction(emit_ctx *ctx, const dx9mt_sm_instruction *inst) {
     emit(ctx, "  }\n");
     return;
 
+  case DX9MT_SM_OP_LOOP: {
+    /* loop aL, i#: i#.x = iteration count, .y = initial aL, .z = step */
+    char ie[DX9MT_MSL_NAME_BUFSZ];
+    reg_name(ie, sizeof(ie), &inst->src[1], ctx);
+    emit(ctx, "  {\n");
+    emit(ctx, "  int aL = int(%s.y);\n", ie);
+    emit(ctx, "  for (int loop_i = 0; loop_i < int(%s.x); "
+              "loop_i++, aL += int(%s.z)) {\n", ie, ie);
+    return;
+  }
+
+  case DX9MT_SM_OP_ENDLOOP:
+    emit(ctx, "  }\n");
+    emit(ctx, "  }\n");
+    return;
+
   case DX9MT_SM_OP_BREAK:
     emit(ctx, "  break;\n");
     return;
@@ -905,6 +926,56 @@ static int usage_to_attr_idx(uint8_t usage, uint8_t usage_index) {
   return -1; /* unmapped */
 }
 
+/* ------------------------------------------------------------------ */
+/* Integer / boolean constants                                         */
+/* ------------------------------------------------------------------ */
+
+/*
+ * i#/b# registers read by the program that have no defi/defb: their values
+ * come from the per-draw control constants the viewer binds next to c[].
+ */
+static void control_register_masks(const dx9mt_sm_program *prog,
+                                   uint32_t *int_mask, uint32_t *bool_mask) {
+  *int_mask = 0;
+  *bool_mask = 0;
+  for (uint32_t i = 0; i < prog->instruction_count; ++i) {
+    const dx9mt_sm_instruction *inst = &prog->instructions[i];
+    for (uint32_t s = 0; s < inst->num_sources; ++s) {
+      const dx9mt_sm_register *r = &inst->src[s];
+      if (r->number >= 16) continue;
+      if (r->type == DX9MT_SM_REG_CONSTINT) *int_mask |= 1u << r->number;
+      if (r->type == DX9MT_SM_REG_CONSTBOOL) *bool_mask |= 1u << r->number;
+    }
+  }
+  for (uint32_t i = 0; i < prog->def_count; ++i) {
+    const dx9mt_sm_def_entry *d = &prog->defs[i];
+    if (d->reg_number >= 16) continue;
+    if (d->reg_type == DX9MT_SM_REG_CONSTINT) *int_mask &= ~(1u << d->reg_number);
+    if (d->reg_type == DX9MT_SM_REG_CONSTBOOL) *bool_mask &= ~(1u << d->reg_number);
+  }
+}
+
+/* Matches dx9mt_shader_control_constants (272 bytes). */
+static void emit_control_struct(emit_ctx *ctx) {
+  emit(ctx, "struct Control_%08x {\n", ctx->hash);
+  emit(ctx, "  int4 i[16];\n");
+  emit(ctx, "  ushort b;\n");
+  emit(ctx, "};\n\n");
+}
+
+static void emit_control_locals(emit_ctx *ctx, uint32_t int_mask,
+                                uint32_t bool_mask) {
+  for (uint32_t n = 0; n < 16; ++n) {
+    if (int_mask & (1u << n)) {
+      emit(ctx, "  float4 i%u = float4(ctl.i[%u]);\n", n, n);
+    }
+    if (bool_mask & (1u << n)) {
+      emit(ctx, "  float4 b%u = float4((ctl.b & (1u << %u)) != 0 ? 1.0 : 0.0, "
+                "0.0, 0.0, 0.0);\n", n, n);
+    }
+  }
+}
+
 /* ------------------------------------------------------------------ */
 /* VS emitter                                                          */
 /* ------------------------------------------------------------------ */
@@ -929,6 +1000,9 @@ int dx9mt_msl_emit_vs(const dx9mt_sm_program *prog, uint32_t bytecode_hash,
   ctx.is_vs = 1;
   ctx.major_ver = prog->major_version;
 
+  uint32_t int_mask, bool_mask;
+  control_register_masks(prog, &int_mask, &bool_mask);
+
   /* Mark which c# registers have def values */
   for (uint32_t i = 0; i < prog->def_count; ++i) {
     if (prog->defs[i].reg_type == DX9MT_SM_REG_CONST &&
@@ -950,6 +1024,9 @@ int dx9mt_msl_emit_vs(const dx9mt_sm_program *prog, uint32_t bytecode_hash,
 
   emit(&ctx, "#include <metal_stdlib>\n");
   emit(&ctx, "using namespace metal;\n\n");
+  if (int_mask || bool_mask) {
+    emit_control_struct(&ctx);
+  }
 
   /* Input struct from vertex attributes.
    * Variable name = v{reg_number} (matches shader instructions).
@@ -1011,7 +1088,11 @@ int dx9mt_msl_emit_vs(const dx9mt_sm_program *prog, uint32_t bytecode_hash,
   /* Vertex function */
   emit(&ctx, "vertex VS_Out_%08x %s(\n", bytecode_hash, out->entry_name);
   emit(&ctx, "    VS_In_%08x in [[stage_in]],\n", bytecode_hash);
-  emit(&ctx, "    constant float4 *c [[buffer(1)]]) {\n");
+  emit(&ctx, "    constant float4 *c [[buffer(1)]]");
+  if (int_mask || bool_mask) {
+    emit(&ctx, ",\n    constant Control_%08x &ctl [[buffer(2)]]", bytecode_hash);
+  }
+  emit(&ctx, ") {\n");
 
   /* Declare temp registers */
   for (uint32_t i = 0; i <= prog->max_temp_reg; ++i) {
@@ -1043,6 +1124,7 @@ int dx9mt_msl_emit_vs(const dx9mt_sm_program *prog, uint32_t bytecode_hash,
            d->reg_number, d->values.b ? "1.0" : "0.0");
     }
   }
+  emit_control_locals(&ctx, int_mask, bool_mask);
 
   for (uint32_t i = 0; i < prog->dcl_count; ++i) {
     const dx9mt_sm_dcl_entry *d = &prog->dcls[i];
@@ -1118,6 +1200,9 @@ int dx9mt_msl_emit_ps(const dx9mt_sm_program *prog, uint32_t bytecode_hash,
   ctx.is_vs = 0;
   ctx.major_ver = prog->major_version;
 
+  uint32_t int_mask, bool_mask;
+  control_register_masks(prog, &int_mask, &bool_mask);
+
   for (uint32_t i = 0; i < prog->def_count; ++i) {
     if (prog->defs[i].reg_type == DX9MT_SM_REG_CONST &&
         prog->defs[i].reg_number < 256) {
@@ -1135,6 +1220,9 @@ int dx9mt_msl_emit_ps(const dx9mt_sm_program *prog, uint32_t bytecode_hash,
 
   emit(&ctx, "#include <metal_stdlib>\n");
   emit(&ctx, "using namespace metal;\n\n");
+  if (int_mask || bool_mask) {
+    emit_control_struct(&ctx);
+  }
 
   /* Input struct (interpolants from VS) */
   emit(&ctx, "struct PS_In_%08x {\n", bytecode_hash);
@@ -1211,7 +1299,11 @@ int dx9mt_msl_emit_ps(const dx9mt_sm_program *prog, uint32_t bytecode_hash,
     emit(&ctx, ",\n    sampler samp%u [[sampler(%u)]]", d->reg_number, d->reg_number);
   }
 
-  emit(&ctx, ",\n    constant float4 *c [[buffer(0)]]) {\n");
+  emit(&ctx, ",\n    constant float4 *c [[buffer(0)]]");
+  if (int_mask || bool_mask) {
+    emit(&ctx, ",\n    constant Control_%08x &ctl [[buffer(1)]]", bytecode_hash);
+  }
+  emit(&ctx, ") {\n");
 
   /* Declare temp registers */
   for (uint32_t i = 0; i <= prog->max_temp_reg; ++i) {
@@ -1242,6 +1334,7 @@ int dx9mt_msl_emit_ps(const dx9mt_sm_program *prog, uint32_t bytecode_hash,
            d->reg_number, d->values.b ? "1.0" : "0.0");
     }
   }
+  emit_control_locals(&ctx, int_mask, bool_mask);
 
   emit(&ctx, "\n");
 
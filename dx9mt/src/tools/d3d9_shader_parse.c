@@ -92,6 +92,8 @@ static int opcode_src_count(uint16_t op) {
   /* Flow control (no dst/src in normal sense) */
   case DX9MT_SM_OP_REP:     return -2;
   case DX9MT_SM_OP_ENDREP:  return -2;
+  case DX9MT_SM_OP_LOOP:    return -2;
+  case DX9MT_SM_OP_ENDLOOP: return -2;
   case DX9MT_SM_OP_IF:      return -2;
   case DX9MT_SM_OP_IFC:     return -2;
   case DX9MT_SM_OP_ELSE:    return -2;
@@ -113,6 +115,8 @@ static int opcode_has_dst(uint16_t op) {
   case DX9MT_SM_OP_NOP:
   case DX9MT_SM_OP_REP:
   case DX9MT_SM_OP_ENDREP:
+  case DX9MT_SM_OP_LOOP:
+  case DX9MT_SM_OP_ENDLOOP:
   case DX9MT_SM_OP_IF:
   case DX9MT_SM_OP_ELSE:
   case DX9MT_SM_OP_ENDIF:
@@ -124,6 +128,8 @@ static int opcode_has_dst(uint16_t op) {
   }
 }
 
+static const char *opcode_name(uint16_t op);
+
 /* ------------------------------------------------------------------ */
 /* Register usage tracking                                             */
 /* ------------------------------------------------------------------ */
@@ -439,12 +445,13 @@ int dx9mt_sm_parse(const uint32_t *bytecode, uint32_t dword_count,
       continue;
     }
 
-    /* Flow control: ifc src0, src1 (comparison in instruction token bits 18-20) */
-    if (opcode == DX9MT_SM_OP_IFC || opcode == DX9MT_SM_OP_BREAKC) {
+    /* Flow control: ifc src0, src1 (comparison in instruction token bits 18-20)
+     * and loop aL, i# (comparison bits are zero) */
+    if (opcode == DX9MT_SM_OP_IFC || opcode == DX9MT_SM_OP_BREAKC ||
+        opcode == DX9MT_SM_OP_LOOP) {
       if (pos + 2 > dword_count) {
         snprintf(out->error_msg, sizeof(out->error_msg),
-                 "truncated %s at dword %u",
-                 opcode == DX9MT_SM_OP_IFC ? "ifc" : "breakc", pos);
+                 "truncated %s at dword %u", opcode_name(opcode), pos);
         out->has_error = 1;
         return -1;
       }
@@ -487,9 +494,10 @@ int dx9mt_sm_parse(const uint32_t *bytecode, uint32_t dword_count,
       continue;
     }
 
-    /* Flow control: else / endif / endrep / break (no operands) */
+    /* Flow control: else / endif / endrep / endloop / break (no operands) */
     if (opcode == DX9MT_SM_OP_ELSE || opcode == DX9MT_SM_OP_ENDIF ||
-        opcode == DX9MT_SM_OP_ENDREP || opcode == DX9MT_SM_OP_BREAK) {
+        opcode == DX9MT_SM_OP_ENDREP || opcode == DX9MT_SM_OP_ENDLOOP ||
+        opcode == DX9MT_SM_OP_BREAK) {
       if (out->instruction_count >= DX9MT_SM_MAX_INSTRUCTIONS) {
         snprintf(out->error_msg, sizeof(out->error_msg),
                  "too many instructions (>%u)", DX9MT_SM_MAX_INSTRUCTIONS);
@@ -557,6 +565,7 @@ int dx9mt_sm_parse(const uint32_t *bytecode, uint32_t dword_count,
         uint32_t rel_token = bytecode[pos++];
         inst->dst.has_relative = 1;
         inst->dst.relative_component = (uint8_t)((rel_token >> 16) & 0x3u);
+        inst->dst.relative_type = (uint8_t)decode_reg_type(rel_token);
       }
 
       track_register_usage(out, &inst->dst, 1);
@@ -588,6 +597,7 @@ int dx9mt_sm_parse(const uint32_t *bytecode, uint32_t dword_count,
         }
         uint32_t rel_token = bytecode[pos++];
         inst->src[s].relative_component = (uint8_t)((rel_token >> 16) & 0x3u);
+        inst->src[s].relative_type = (uint8_t)decode_reg_type(rel_token);
       }
 
       track_register_usage(out, &inst->src[s], 0);
@@ -667,6 +677,8 @@ static const char *opcode_name(uint16_t op) {
   case DX9MT_SM_OP_DP2ADD:  return "dp2add";
   case DX9MT_SM_OP_REP:     return "rep";
   case DX9MT_SM_OP_ENDREP:  return "endrep";
+  case DX9MT_SM_OP_LOOP:    return "loop";
+  case DX9MT_SM_OP_ENDLOOP: return "endloop";
   case DX9MT_SM_OP_IF:      return "if";
   case DX9MT_SM_OP_IFC:     return "ifc";
   case DX9MT_SM_OP_ELSE:    return "else";
@@ -60,6 +60,8 @@ enum dx9mt_sm_opcode {
   DX9MT_SM_OP_M3x4    = 22,
   DX9MT_SM_OP_M3x3    = 23,
   DX9MT_SM_OP_M3x2    = 24,
+  DX9MT_SM_OP_LOOP    = 27,
+  DX9MT_SM_OP_ENDLOOP = 29,
   DX9MT_SM_OP_DCL     = 31,
   DX9MT_SM_OP_POW     = 32,
   DX9MT_SM_OP_CRS     = 33,
@@ -158,6 +160,7 @@ typedef struct dx9mt_sm_register {
   uint8_t  result_modifier; /* dx9mt_sm_result_mod */
   uint8_t  has_relative;
   uint8_t  relative_component; /* 0=x, 1=y, 2=z, 3=w (from relative token) */
+  uint8_t  relative_type;      /* ADDR (a0) or LOOP (aL) */
 } dx9mt_sm_register;
 
 typedef struct dx9mt_sm_instruction {
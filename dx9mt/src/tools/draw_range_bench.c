@@ -0,0 +1,206 @@
+/*
+ * Microbenchmark for range-trimmed geometry uploads: bytes per frame and
+ * copy cost when a write-locked draw uploads its whole VB/IB vs. only the
+ * ranges include/dx9mt/draw_range.h gives it. The frame mirrors the FNV
+ * captures: ~1400 DrawIndexedPrimitive calls, most of them a few hundred
+ * vertices out of a handful of large shared world buffers, the rest small
+ * per-object buffers that each draw uses nearly whole.
+ *
+ *   make bench-native BACKEND_CC=gcc
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dx9mt/draw_range.h"
+#include "dx9mt/upload_arena.h"
+
+#define BENCH_FRAMES 3u
+#define BENCH_WORLD_DRAWS 1200u
+#define BENCH_OBJECT_DRAWS 200u
+#define BENCH_WORLD_BUFFERS 4u
+#define BENCH_WORLD_VB_BYTES (4u << 20)
+#define BENCH_WORLD_IB_BYTES (1u << 20)
+#define BENCH_OBJECT_VB_BYTES (48u << 10)
+#define BENCH_OBJECT_IB_BYTES (12u << 10)
+#define BENCH_STRIDE 32u
+/* Copies wrap here; the byte counts are what a slot would have to hold. */
+#define BENCH_ARENA_BYTES (64u << 20)
+
+typedef struct bench_draw {
+  uint32_t vb_size;
+  uint32_t ib_size;
+  uint32_t vb_source;
+  uint32_t ib_source;
+  int32_t base_vertex;
+  uint32_t min_vertex_index;
+  uint32_t num_vertices;
+  uint32_t start_index;
+  uint32_t index_count;
+} bench_draw;
+
+typedef struct bench_bytes {
+  uint64_t whole;
+  uint64_t trimmed;
+  uint32_t fallbacks;
+} bench_bytes;
+
+static uint32_t g_rng = 0x1234567u;
+
+static uint32_t bench_rand(uint32_t limit) {
+  g_rng = g_rng * 1664525u + 1013904223u;
+  return (g_rng >> 8) % limit;
+}
+
+static double bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void bench_make_frame(bench_draw *draws) {
+  uint32_t i;
+
+  for (i = 0; i < BENCH_WORLD_DRAWS; ++i) {
+    bench_draw *draw = &draws[i];
+    uint32_t buffer = bench_rand(BENCH_WORLD_BUFFERS);
+    uint32_t vertices = BENCH_WORLD_VB_BYTES / BENCH_STRIDE;
+
+    draw->vb_size = BENCH_WORLD_VB_BYTES;
+    draw->ib_size = BENCH_WORLD_IB_BYTES;
+    draw->vb_source = buffer * BENCH_WORLD_VB_BYTES;
+    draw->ib_source = buffer * BENCH_WORLD_IB_BYTES;
+    draw->num_vertices = 100u + bench_rand(500u);
+    draw->base_vertex = (int32_t)bench_rand(vertices - 4096u);
+    draw->min_vertex_index = bench_rand(2048u);
+    draw->index_count =
+        3u * (draw->num_vertices + bench_rand(draw->num_vertices));
+    draw->start_index =
+        bench_rand(BENCH_WORLD_IB_BYTES / 2u - draw->index_count);
+  }
+  for (; i < BENCH_WORLD_DRAWS + BENCH_OBJECT_DRAWS; ++i) {
+    bench_draw *draw = &draws[i];
+    uint32_t vertices = BENCH_OBJECT_VB_BYTES / BENCH_STRIDE;
+
+    draw->vb_size = BENCH_OBJECT_VB_BYTES;
+    draw->ib_size = BENCH_OBJECT_IB_BYTES;
+    draw->vb_source = BENCH_WORLD_BUFFERS * BENCH_WORLD_VB_BYTES;
+    draw->ib_source = BENCH_WORLD_BUFFERS * BENCH_WORLD_IB_BYTES;
+    draw->base_vertex = 0;
+    draw->min_vertex_index = bench_rand(vertices / 8u);
+    draw->num_vertices = vertices - draw->min_vertex_index;
+    draw->index_count = BENCH_OBJECT_IB_BYTES / 2u - 3u * bench_rand(256u);
+    draw->start_index = 0;
+  }
+}
+
+static void bench_copy(unsigned char *arena, uint32_t *cursor,
+                       const unsigned char *src, uint32_t size) {
+  if (*cursor + size > BENCH_ARENA_BYTES) {
+    *cursor = 0;
+  }
+  memcpy(arena + *cursor, src, size);
+  *cursor += size;
+}
+
+/* One frame of uploads into `arena`, the way the frontend's fallback does. */
+static void bench_upload_frame(const bench_draw *draws, const unsigned char *vb,
+                               const unsigned char *ib, unsigned char *arena,
+                               int trim, bench_bytes *bytes) {
+  uint64_t used = 0;
+  uint32_t cursor = 0;
+
+  for (uint32_t i = 0; i < BENCH_WORLD_DRAWS + BENCH_OBJECT_DRAWS; ++i) {
+    const bench_draw *draw = &draws[i];
+    uint32_t vb_begin = 0;
+    uint32_t vb_bytes = draw->vb_size;
+    uint32_t ib_begin = 0;
+    uint32_t ib_bytes = draw->ib_size;
+
+    if (trim && !dx9mt_draw_vertex_range(draw->vb_size, 0, BENCH_STRIDE,
+                                         draw->base_vertex,
+                                         draw->min_vertex_index,
+                                         draw->num_vertices, &vb_begin,
+                                         &vb_bytes)) {
+      vb_begin = 0;
+      vb_bytes = draw->vb_size;
+      ++bytes->fallbacks;
+    }
+    if (trim && !dx9mt_draw_index_range(draw->ib_size, 2u, draw->start_index,
+                                        draw->index_count, &ib_begin,
+                                        &ib_bytes)) {
+      ib_begin = 0;
+      ib_bytes = draw->ib_size;
+      ++bytes->fallbacks;
+    }
+    bench_copy(arena, &cursor, vb + draw->vb_source + vb_begin, vb_bytes);
+    bench_copy(arena, &cursor, ib + draw->ib_source + ib_begin, ib_bytes);
+    used += (uint64_t)vb_bytes + ib_bytes;
+  }
+  if (trim) {
+    bytes->trimmed = used;
+  } else {
+    bytes->whole = used;
+  }
+}
+
+int main(void) {
+  size_t vb_bytes = (size_t)BENCH_WORLD_BUFFERS * BENCH_WORLD_VB_BYTES +
+                    BENCH_OBJECT_VB_BYTES;
+  size_t ib_bytes = (size_t)BENCH_WORLD_BUFFERS * BENCH_WORLD_IB_BYTES +
+                    BENCH_OBJECT_IB_BYTES;
+  bench_draw *draws =
+      calloc(BENCH_WORLD_DRAWS + BENCH_OBJECT_DRAWS, sizeof(*draws));
+  unsigned char *vb = malloc(vb_bytes);
+  unsigned char *ib = malloc(ib_bytes);
+  unsigned char *arena = malloc(BENCH_ARENA_BYTES);
+  bench_bytes bytes;
+  double whole_ns = 0.0;
+  double trimmed_ns = 0.0;
+
+  assert(draws && vb && ib && arena);
+  memset(vb, 0x5A, vb_bytes);
+  memset(ib, 0xA5, ib_bytes);
+  memset(arena, 0, BENCH_ARENA_BYTES);
+  memset(&bytes, 0, sizeof(bytes));
+  bench_make_frame(draws);
+
+  for (uint32_t frame = 0; frame < BENCH_FRAMES; ++frame) {
+    double start = bench_now_ns();
+
+    bench_upload_frame(draws, vb, ib, arena, 0, &bytes);
+    whole_ns += bench_now_ns() - start;
+    start = bench_now_ns();
+    bench_upload_frame(draws, vb, ib, arena, 1, &bytes);
+    trimmed_ns += bench_now_ns() - start;
+  }
+  bytes.fallbacks /= BENCH_FRAMES;
+
+  printf("dx9mt draw range bench: %u draws/frame (%u world from %u x %u KB VB "
+         "+ %u KB IB, %u object from %u KB VB + %u KB IB), %u frames\n",
+         BENCH_WORLD_DRAWS + BENCH_OBJECT_DRAWS, BENCH_WORLD_DRAWS,
+         BENCH_WORLD_BUFFERS, BENCH_WORLD_VB_BYTES >> 10,
+         BENCH_WORLD_IB_BYTES >> 10, BENCH_OBJECT_DRAWS,
+         BENCH_OBJECT_VB_BYTES >> 10, BENCH_OBJECT_IB_BYTES >> 10,
+         BENCH_FRAMES);
+  printf("  %-12s %14s %12s %10s\n", "upload", "bytes/frame", "ms/frame",
+         "fits slot");
+  printf("  %-12s %14llu %12.2f %10s\n", "whole",
+         (unsigned long long)bytes.whole, whole_ns / BENCH_FRAMES / 1e6,
+         bytes.whole <= DX9MT_UPLOAD_ARENA_BYTES_PER_SLOT ? "yes" : "no");
+  printf("  %-12s %14llu %12.2f %10s\n", "trimmed",
+         (unsigned long long)bytes.trimmed, trimmed_ns / BENCH_FRAMES / 1e6,
+         bytes.trimmed <= DX9MT_UPLOAD_ARENA_BYTES_PER_SLOT ? "yes" : "no");
+  printf("  trimmed/whole %.4f, %u ranges fell back to the whole buffer\n",
+         (double)bytes.trimmed / (double)bytes.whole, bytes.fallbacks);
+
+  free(arena);
+  free(ib);
+  free(vb);
+  free(draws);
+  return 0;
+}
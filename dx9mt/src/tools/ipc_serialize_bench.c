@@ -0,0 +1,217 @@
+/*
+ * Scaling benchmark for parallel IPC serialization: present() cost of a
+ * synthetic 2000-draw frame with DX9MT_BACKEND_IPC_THREADS=1..N. Every
+ * present writes a full frame (static frames, deltas and the frame ring
+ * are off), so the serializer's sizing pass and table/bulk fill dominate.
+ * Each draw copies its own vertex and index bytes; every other draw also
+ * moves a VS constant block. The published frame is checked byte for
+ * byte against the single-threaded one. Thread counts past the host's
+ * CPU count only show the cost of the sizing pass.
+ *
+ *   make bench-native BACKEND_CC=gcc
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dx9mt/backend_bridge.h"
+#include "dx9mt/metal_ipc.h"
+#include "dx9mt/packets.h"
+
+#define BENCH_IPC_PATH "/tmp/dx9mt_ipc_serialize_bench.bin"
+#define BENCH_WARMUP_FRAMES 5u
+#define BENCH_FRAMES 50u
+#define BENCH_DRAWS_PER_FRAME 2000u
+#define BENCH_MAX_THREADS 8u
+#define BENCH_VERTEX_BYTES 2048u
+#define BENCH_INDEX_BYTES 768u
+#define BENCH_CONSTANT_BYTES 256u
+#define BENCH_UPLOAD_BYTES (1u << 20)
+
+typedef struct bench_frame {
+  dx9mt_packet_draw_indexed draws[BENCH_DRAWS_PER_FRAME];
+  dx9mt_packet_present present;
+} bench_frame;
+
+static unsigned char g_upload[BENCH_UPLOAD_BYTES];
+static uint32_t g_sequence;
+
+static double bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static const void *bench_upload_resolve(const dx9mt_upload_ref *ref) {
+  if (ref->arena_index != 0 || ref->offset + ref->size > sizeof(g_upload)) {
+    return NULL;
+  }
+  return g_upload + ref->offset;
+}
+
+static void bench_build_frame(bench_frame *frame) {
+  uint32_t i;
+
+  memset(frame, 0, sizeof(*frame));
+  for (i = 0; i < BENCH_DRAWS_PER_FRAME; ++i) {
+    dx9mt_packet_draw_indexed *draw = &frame->draws[i];
+
+    draw->header.type = DX9MT_PACKET_DRAW_INDEXED;
+    draw->header.size = (uint16_t)sizeof(*draw);
+    draw->primitive_type = 4;
+    draw->primitive_count = BENCH_INDEX_BYTES / 6u;
+    draw->render_target_id = 0x05000001u;
+    draw->depth_stencil_id = 0x05000002u;
+    draw->vertex_buffer_id = 0x03000001u + (i & 7u);
+    draw->index_buffer_id = 0x03000101u;
+    draw->vertex_decl_id = 0x0A000001u;
+    draw->vertex_shader_id = 0x06000001u;
+    draw->pixel_shader_id = 0x07000001u;
+    draw->stream0_stride = 32;
+    draw->vertex_data.offset =
+        (i * BENCH_VERTEX_BYTES) % (BENCH_UPLOAD_BYTES / 2u);
+    draw->vertex_data.size = BENCH_VERTEX_BYTES;
+    draw->vertex_data_size = BENCH_VERTEX_BYTES;
+    draw->index_data.offset =
+        BENCH_UPLOAD_BYTES / 2u +
+        (i * BENCH_INDEX_BYTES) % (BENCH_UPLOAD_BYTES / 4u);
+    draw->index_data.size = BENCH_INDEX_BYTES;
+    draw->index_data_size = BENCH_INDEX_BYTES;
+    if (i % 2u == 0) {
+      draw->constants_vs.offset =
+          BENCH_UPLOAD_BYTES - 65536u + (i * 16u) % 32768u;
+      draw->constants_vs.size = BENCH_CONSTANT_BYTES;
+    }
+  }
+  frame->present.header.type = DX9MT_PACKET_PRESENT;
+  frame->present.header.size = (uint16_t)sizeof(frame->present);
+}
+
+/* The published frame: header, table and bulk bytes. */
+static unsigned char *bench_read_ipc_frame(uint32_t *out_bytes) {
+  dx9mt_metal_ipc_header header;
+  unsigned char *bytes;
+  FILE *file = fopen(BENCH_IPC_PATH, "rb");
+
+  assert(file);
+  assert(fread(&header, sizeof(header), 1, file) == 1);
+  assert(header.draw_count == BENCH_DRAWS_PER_FRAME);
+  *out_bytes = header.bulk_data_offset + header.bulk_data_used;
+  bytes = malloc(*out_bytes);
+  assert(bytes);
+  assert(fseek(file, 0, SEEK_SET) == 0);
+  assert(fread(bytes, *out_bytes, 1, file) == 1);
+  fclose(file);
+  return bytes;
+}
+
+/* Returns ns per present; *out_frame gets the last published frame. */
+static double bench_threads(bench_frame *frame, uint32_t threads,
+                            unsigned char **out_frame, uint32_t *out_bytes,
+                            dx9mt_backend_ipc_stats *out_stats) {
+  dx9mt_backend_init_desc init_desc;
+  dx9mt_backend_present_target_desc target_desc;
+  char value[16];
+  double elapsed = 0.0;
+  uint32_t frame_id;
+  uint32_t i;
+
+  memset(&init_desc, 0, sizeof(init_desc));
+  init_desc.protocol_version = DX9MT_PROTOCOL_VERSION;
+  init_desc.capabilities = DX9MT_PROTOCOL_CAPS_ALL;
+  init_desc.ring_capacity_bytes = 1u << 20;
+  init_desc.upload_desc.slot_count = 3;
+  init_desc.upload_desc.bytes_per_slot = BENCH_UPLOAD_BYTES;
+  memset(&target_desc, 0, sizeof(target_desc));
+  target_desc.target_id = 1;
+  target_desc.width = 1280;
+  target_desc.height = 720;
+  target_desc.format = 21;
+  target_desc.windowed = 1;
+
+  snprintf(value, sizeof(value), "%u", threads);
+  setenv("DX9MT_BACKEND_IPC_THREADS", value, 1);
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  dx9mt_backend_bridge_set_upload_resolver(bench_upload_resolve);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+
+  g_sequence = 0;
+  for (frame_id = 1; frame_id <= BENCH_WARMUP_FRAMES + BENCH_FRAMES;
+       ++frame_id) {
+    double start;
+
+    for (i = 0; i < BENCH_DRAWS_PER_FRAME; ++i) {
+      frame->draws[i].header.sequence = ++g_sequence;
+    }
+    frame->present.header.sequence = ++g_sequence;
+    frame->present.frame_id = frame_id;
+    assert(dx9mt_backend_bridge_begin_frame(frame_id) == 0);
+    assert(dx9mt_backend_bridge_submit_packets(&frame->draws[0].header,
+                                               (uint32_t)sizeof(*frame)) == 0);
+    start = bench_now_ns();
+    assert(dx9mt_backend_bridge_present(frame_id) == 0);
+    if (frame_id > BENCH_WARMUP_FRAMES) {
+      elapsed += bench_now_ns() - start;
+    }
+  }
+  dx9mt_backend_bridge_debug_get_ipc_stats(out_stats);
+  *out_frame = bench_read_ipc_frame(out_bytes);
+  dx9mt_backend_bridge_set_upload_resolver(NULL);
+  dx9mt_backend_bridge_shutdown();
+  return elapsed / BENCH_FRAMES;
+}
+
+int main(void) {
+  bench_frame *frame = malloc(sizeof(*frame));
+  unsigned char *serial = NULL;
+  uint32_t serial_bytes = 0;
+  double serial_ns = 0.0;
+  uint32_t threads;
+  uint32_t i;
+
+  assert(frame);
+  for (i = 0; i < sizeof(g_upload); ++i) {
+    g_upload[i] = (unsigned char)(i * 13u + 5u);
+  }
+  bench_build_frame(frame);
+  remove(BENCH_IPC_PATH);
+  setenv("DX9MT_BACKEND_IPC_PATH", BENCH_IPC_PATH, 1);
+  setenv("DX9MT_BACKEND_STATIC_FRAMES", "0", 1);
+  setenv("DX9MT_BACKEND_IPC_DELTA", "0", 1);
+  setenv("DX9MT_BACKEND_IPC_RING", "0", 1);
+
+  printf("%u frames x %u draws, full IPC frames, %ld CPUs online\n",
+         BENCH_FRAMES, BENCH_DRAWS_PER_FRAME, sysconf(_SC_NPROCESSORS_ONLN));
+  for (threads = 1; threads <= BENCH_MAX_THREADS; ++threads) {
+    dx9mt_backend_ipc_stats stats;
+    unsigned char *bytes;
+    uint32_t bytes_size;
+    double ns = bench_threads(frame, threads, &bytes, &bytes_size, &stats);
+
+    if (threads == 1) {
+      serial = bytes;
+      serial_bytes = bytes_size;
+      serial_ns = ns;
+    } else {
+      /* The threaded frame must be the serial one, byte for byte. */
+      assert(bytes_size == serial_bytes);
+      assert(memcmp(bytes, serial, serial_bytes) == 0);
+      free(bytes);
+    }
+    printf("threads %u (used %u)  frame %6.2f MB  %8.3f ms/present  "
+           "%5.2fx\n",
+           threads, stats.threads, stats.frame_bytes / (1024.0 * 1024.0),
+           ns / 1e6, serial_ns / ns);
+  }
+
+  free(serial);
+  free(frame);
+  remove(BENCH_IPC_PATH);
+  printf("ipc_serialize_bench: done\n");
+  return 0;
+}
@@ -137,6 +137,12 @@ enum {
   D3DCMP_ALWAYS = 8,
 };
 
+enum {
+  D3DCLEAR_TARGET = 0x1,
+  D3DCLEAR_ZBUFFER = 0x2,
+  D3DCLEAR_STENCIL = 0x4,
+};
+
 enum {
   D3DTOP_DISABLE = 1,
   D3DTOP_SELECTARG1 = 2,
@@ -192,6 +198,7 @@ static id<MTLRenderPipelineState> s_geometry_pso;
 static id<MTLRenderPipelineState> s_geometry_textured_pso;
 static id<MTLRenderPipelineState> s_blit_pso;
 static NSMutableDictionary *s_blit_pso_cache;
+static NSMutableDictionary *s_clear_pso_cache; /* partial Clear() quads */
 static id<MTLLibrary> s_library;
 static uint32_t s_geometry_pso_stride;
 static uint32_t s_geometry_textured_pso_stride;
@@ -199,6 +206,10 @@ static uint64_t s_geometry_pso_key;
 static uint64_t s_geometry_textured_pso_key;
 static NSMutableDictionary *s_texture_cache;
 static NSMutableDictionary *s_texture_generation;
+static NSMutableDictionary *s_buffer_cache;       /* buffer_id -> id<MTLBuffer> */
+static NSMutableDictionary *s_buffer_generation;  /* buffer_id -> generation */
+static NSMutableDictionary *s_buffer_last_use;    /* buffer_id -> render count */
+static uint32_t s_render_count; /* render_frame() calls, for cache aging */
 static NSMutableDictionary *s_sampler_cache;
 static NSMutableDictionary *s_render_target_cache;
 static NSMutableDictionary *s_render_target_desc;
@@ -213,6 +224,9 @@ static int s_output_dir_warned = 0;
 static FILE *s_log_file;
 static unsigned char *s_frame_snapshot;
 static size_t s_frame_snapshot_capacity;
+static size_t s_ipc_mapped_size; /* IPC_SIZE, or ZERO_COPY_SIZE with arena */
+/* The mapping's control header, for the fields the viewer writes. */
+static volatile dx9mt_metal_ipc_header *s_ipc_control;
 
 /* RB3 Phase 3: shader translation caches */
 static NSMutableDictionary *s_vs_func_cache;  /* bytecode_hash -> id<MTLFunction> or NSNull */
@@ -234,6 +248,7 @@ static uint32_t s_drawable_depth_w;
 static uint32_t s_drawable_depth_h;
 static NSMutableDictionary *s_depth_stencil_cache;  /* key -> id<MTLDepthStencilState> */
 static id<MTLDepthStencilState> s_no_depth_state;   /* always-pass, no write (overlay) */
+static id<MTLDepthStencilState> s_clear_depth_state; /* always-pass, write (partial clear) */
 static id<MTLSamplerState> s_blit_linear_sampler;
 static id<MTLSamplerState> s_blit_point_sampler;
 
@@ -254,6 +269,56 @@ static int dx9mt_ensure_frame_snapshot_capacity(size_t size) {
   return 1;
 }
 
+/*
+ * Applies a delta frame to the snapshot we hold, which must be its
+ * base_sequence frame: the header, the listed table entries and the bulk
+ * bytes appended since. Returns 0, with the snapshot untouched, when the
+ * delta does not fit the held frame; the caller then copies everything.
+ * Indices are read from the live mapping, so a torn list is only caught by
+ * the caller's sequence re-check.
+ */
+static int dx9mt_patch_frame_snapshot(const volatile unsigned char *ipc,
+                                      const dx9mt_metal_ipc_header *hdr,
+                                      size_t snapshot_bytes) {
+  const dx9mt_metal_ipc_header *held =
+      (const dx9mt_metal_ipc_header *)s_frame_snapshot;
+  const volatile uint32_t *change_list;
+  size_t bulk_start = hdr->bulk_data_offset;
+  uint32_t i;
+
+  if (!s_frame_snapshot || held->draw_count != hdr->draw_count ||
+      held->bulk_data_offset != hdr->bulk_data_offset ||
+      held->bulk_data_used > hdr->bulk_data_used ||
+      hdr->arena_data_size != 0 ||
+      hdr->bulk_delta_offset > hdr->bulk_data_used ||
+      hdr->change_list_offset < hdr->bulk_delta_offset ||
+      hdr->change_count > hdr->draw_count ||
+      (size_t)hdr->change_count * sizeof(uint32_t) >
+          (size_t)hdr->bulk_data_used - hdr->change_list_offset) {
+    return 0;
+  }
+  if (!dx9mt_ensure_frame_snapshot_capacity(snapshot_bytes)) {
+    return 0;
+  }
+
+  change_list = (const volatile uint32_t *)(ipc + bulk_start +
+                                            hdr->change_list_offset);
+  for (i = 0; i < hdr->change_count; ++i) {
+    size_t entry = sizeof(dx9mt_metal_ipc_header) +
+                   (size_t)change_list[i] * sizeof(dx9mt_metal_ipc_draw);
+    if (entry + sizeof(dx9mt_metal_ipc_draw) > bulk_start) {
+      continue;
+    }
+    memcpy(s_frame_snapshot + entry, (const void *)(ipc + entry),
+           sizeof(dx9mt_metal_ipc_draw));
+  }
+  memcpy(s_frame_snapshot + bulk_start + hdr->bulk_delta_offset,
+         (const void *)(ipc + bulk_start + hdr->bulk_delta_offset),
+         snapshot_bytes - bulk_start - hdr->bulk_delta_offset);
+  memcpy(s_frame_snapshot, hdr, sizeof(*hdr));
+  return 1;
+}
+
 static const char *dx9mt_output_dir(void) {
   const char *env;
 
@@ -600,7 +665,13 @@ typedef struct dx9mt_frame_diag {
   uint32_t shader_translation_failed;
   uint32_t translated_pso_failed;
   uint32_t skipped_empty_geometry;
+  uint32_t invalid_state_index;
+  uint32_t missing_buffer_base; /* cached VB/IB never received; resync */
+  uint32_t shader_not_interned; /* bytecode never received; resync */
   uint32_t drawn_translated;
+  uint32_t clears_folded;  /* became a pass load action */
+  uint32_t clears_drawn;   /* partial rect, drawn as a quad */
+  uint32_t clears_flushed; /* needed a pass of their own */
   uint32_t detail_logs_emitted;
 } dx9mt_frame_diag;
 
@@ -632,7 +703,8 @@ static uint32_t dx9mt_diag_skipped_total(const dx9mt_frame_diag *diag) {
          diag->missing_target_texture + diag->missing_decl +
          diag->missing_shader_bytecode + diag->invalid_shader_bytecode +
          diag->missing_stage_texture + diag->shader_translation_failed +
-         diag->translated_pso_failed + diag->skipped_empty_geometry;
+         diag->translated_pso_failed + diag->skipped_empty_geometry +
+         diag->invalid_state_index;
 }
 
 static void dx9mt_diag_summary(uint32_t frame_id, const dx9mt_frame_diag *diag) {
@@ -645,8 +717,11 @@ static void dx9mt_diag_summary(uint32_t frame_id, const dx9mt_frame_diag *diag)
   skipped_total = dx9mt_diag_skipped_total(diag);
   if (skipped_total == 0) {
     if (frame_id < 10 || (frame_id % 120) == 0) {
-      viewer_logf("INFO", "frame %u diagnostics: translated=%u skipped=0",
-                  frame_id, diag->drawn_translated);
+      viewer_logf("INFO",
+                  "frame %u diagnostics: translated=%u skipped=0 "
+                  "clears folded=%u drawn=%u flushed=%u",
+                  frame_id, diag->drawn_translated, diag->clears_folded,
+                  diag->clears_drawn, diag->clears_flushed);
     }
     return;
   }
@@ -657,13 +732,51 @@ static void dx9mt_diag_summary(uint32_t frame_id, const dx9mt_frame_diag *diag)
       "missing_draw_rt=%u missing_target_texture=%u missing_decl=%u "
       "missing_shader_bytecode=%u invalid_shader_bytecode=%u "
       "missing_stage_texture=%u shader_translation_failed=%u "
-      "translated_pso_failed=%u skipped_empty_geometry=%u",
+      "translated_pso_failed=%u skipped_empty_geometry=%u "
+      "invalid_state_index=%u missing_buffer_base=%u "
+      "shader_not_interned=%u",
       frame_id, diag->drawn_translated, skipped_total,
       diag->missing_primary_rt, diag->missing_draw_rt,
       diag->missing_target_texture, diag->missing_decl,
       diag->missing_shader_bytecode, diag->invalid_shader_bytecode,
       diag->missing_stage_texture, diag->shader_translation_failed,
-      diag->translated_pso_failed, diag->skipped_empty_geometry);
+      diag->translated_pso_failed, diag->skipped_empty_geometry,
+      diag->invalid_state_index, diag->missing_buffer_base,
+      diag->shader_not_interned);
+}
+
+/*
+ * The frame referenced cached uploads we never received: a buffer patch
+ * whose base we lack, or a shader hash whose bytecode rode on a frame we
+ * skipped. Bumping
+ * viewer_resync makes the frontend send them whole again within a few
+ * frames instead of waiting for its slow refresh. Frames up to
+ * DX9MT_VIEWER_RESYNC_LAG past a request were recorded before the frontend
+ * saw it (present queue plus the frame being recorded), so their misses
+ * do not ask again.
+ */
+#define DX9MT_VIEWER_RESYNC_LAG 6u
+static uint32_t s_resync_frame_id; /* IPC frame of the last request */
+
+static void dx9mt_request_resync(uint32_t frame_id,
+                                 const dx9mt_frame_diag *diag) {
+  uint32_t resync;
+
+  if (!s_ipc_control ||
+      (diag->missing_buffer_base == 0 && diag->shader_not_interned == 0)) {
+    return;
+  }
+  if (s_resync_frame_id != 0 && frame_id >= s_resync_frame_id &&
+      frame_id - s_resync_frame_id <= DX9MT_VIEWER_RESYNC_LAG) {
+    return;
+  }
+  s_resync_frame_id = frame_id;
+  resync = __atomic_add_fetch(&s_ipc_control->viewer_resync, 1,
+                              __ATOMIC_RELEASE);
+  viewer_logf("INFO",
+              "frame %u requested resync %u: buffer_base=%u shaders=%u",
+              frame_id, resync, diag->missing_buffer_base,
+              diag->shader_not_interned);
 }
 
 static int dx9mt_ipc_bulk_range_valid(uint32_t bulk_off, uint32_t bulk_used,
@@ -684,13 +797,13 @@ static int dx9mt_ipc_bulk_range_valid(uint32_t bulk_off, uint32_t bulk_used,
   return 1;
 }
 
-static void dx9mt_cohort_add(NSMutableDictionary *dict,
-                             const volatile unsigned char *ipc_base,
-                             uint32_t bulk_off, uint32_t bulk_used,
-                             const volatile dx9mt_metal_ipc_draw *d) {
+static void
+dx9mt_cohort_add(NSMutableDictionary *dict,
+                 const volatile dx9mt_metal_ipc_draw *d,
+                 const volatile dx9mt_metal_ipc_texture_set *textures) {
   uint32_t texmask = 0;
-  uint32_t vs_hash = 0;
-  uint32_t ps_hash = 0;
+  uint32_t vs_hash;
+  uint32_t ps_hash;
   NSString *key;
   NSNumber *count;
 
@@ -698,32 +811,14 @@ static void dx9mt_cohort_add(NSMutableDictionary *dict,
     return;
   }
 
-  for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
-    if (d->tex_id[s] != 0) {
+  for (uint32_t s = 0; textures && s < DX9MT_MAX_PS_SAMPLERS; ++s) {
+    if (textures->stage[s].id != 0) {
       texmask |= (1u << s);
     }
   }
 
-  if (dx9mt_ipc_bulk_range_valid(bulk_off, bulk_used,
-                                 d->vs_bytecode_bulk_offset,
-                                 d->vs_bytecode_bulk_size) &&
-      d->vs_bytecode_bulk_size >= 4) {
-    const uint32_t *vs_bc = (const uint32_t *)(ipc_base + bulk_off +
-                                               d->vs_bytecode_bulk_offset);
-    if ((vs_bc[0] & 0xFFFF0000u) == 0xFFFE0000u) {
-      vs_hash = dx9mt_sm_bytecode_hash(vs_bc, d->vs_bytecode_bulk_size / 4);
-    }
-  }
-  if (dx9mt_ipc_bulk_range_valid(bulk_off, bulk_used,
-                                 d->ps_bytecode_bulk_offset,
-                                 d->ps_bytecode_bulk_size) &&
-      d->ps_bytecode_bulk_size >= 4) {
-    const uint32_t *ps_bc = (const uint32_t *)(ipc_base + bulk_off +
-                                               d->ps_bytecode_bulk_offset);
-    if ((ps_bc[0] & 0xFFFF0000u) == 0xFFFF0000u) {
-      ps_hash = dx9mt_sm_bytecode_hash(ps_bc, d->ps_bytecode_bulk_size / 4);
-    }
-  }
+  vs_hash = d->vs_bytecode_hash;
+  ps_hash = d->ps_bytecode_hash;
 
   key = [NSString stringWithFormat:
                     @"rt=%u fmt=%u(0x%08x) vs=0x%08x ps=0x%08x texmask=0x%08x",
@@ -776,14 +871,13 @@ static int dx9mt_should_use_compat_textured_tint(uint32_t vs_hash,
          vs_hash == 0x61867afeu && ps_hash == 0x42c963d9u;
 }
 
-static int dx9mt_should_use_scene_blit_fallback(uint32_t vs_hash,
-                                                uint32_t ps_hash,
-                                                uint32_t stride,
-                                                int target_is_drawable,
-                                                const volatile dx9mt_metal_ipc_draw *d) {
+static int dx9mt_should_use_scene_blit_fallback(
+    uint32_t vs_hash, uint32_t ps_hash, uint32_t stride,
+    int target_is_drawable,
+    const volatile dx9mt_metal_ipc_texture_set *textures) {
   return target_is_drawable && stride == 20u &&
          vs_hash == 0x3110bd24u && ps_hash == 0xef64157cu &&
-         d && d->tex_id[1] != 0;
+         textures && textures->stage[1].id != 0;
 }
 
 static NSString *const s_shader_source =
@@ -852,6 +946,28 @@ static NSString *const s_shader_source =
      "  return tex.sample(samp, in.uv);\n"
      "}\n"
      "\n"
+     "/* Partial Clear(): a full-target quad, scissored to the rect. */\n"
+     "struct ClearConstants {\n"
+     "  float4 color;\n"
+     "  float depth;\n"
+     "};\n"
+     "vertex OverlayOut clear_vertex(\n"
+     "    uint vid [[vertex_id]],\n"
+     "    constant ClearConstants &c [[buffer(0)]]) {\n"
+     "  float2 corners[4] = {\n"
+     "    float2(-1.0,  1.0), float2(1.0,  1.0),\n"
+     "    float2(-1.0, -1.0), float2(1.0, -1.0),\n"
+     "  };\n"
+     "  OverlayOut out;\n"
+     "  out.position = float4(corners[vid], c.depth, 1.0);\n"
+     "  return out;\n"
+     "}\n"
+     "fragment float4 clear_fragment(\n"
+     "    OverlayOut in [[stage_in]],\n"
+     "    constant ClearConstants &c [[buffer(0)]]) {\n"
+     "  return c.color;\n"
+     "}\n"
+     "\n"
      "/* RB3 geometry shader with WVP matrix from VS constants.\n"
      " * D3D9 SM3.0 vertex shaders typically store the world-view-\n"
      " * projection matrix in constants c0-c3 (4 rows of float4).\n"
@@ -1622,20 +1738,19 @@ static MTLStencilOperation d3d_stencilop_to_mtl(uint32_t op) {
 }
 
 static id<MTLDepthStencilState>
-depth_stencil_state_for_draw(const volatile dx9mt_metal_ipc_draw *d) {
-  uint32_t zenable = d->rs_zenable;
-  uint32_t zwrite = d->rs_zwriteenable;
-  uint32_t zfunc = d->rs_zfunc;
-  uint32_t stencil_en = d->rs_stencilenable;
-  uint64_t key_val = (uint64_t)zenable | ((uint64_t)zwrite << 8) |
-                     ((uint64_t)zfunc << 16);
+depth_stencil_state_for_block(uint32_t depth, uint32_t stencil) {
+  uint32_t zenable = dx9mt_packed_get(depth, DX9MT_PACKED_ZENABLE);
+  uint32_t zwrite = dx9mt_packed_get(depth, DX9MT_PACKED_ZWRITEENABLE);
+  uint32_t zfunc = dx9mt_packed_get(depth, DX9MT_PACKED_ZFUNC);
+  uint32_t stencil_en = dx9mt_packed_get(depth, DX9MT_PACKED_STENCILENABLE);
+  /* The packed words are the key; the stencil ref is set per encoder. */
+  uint64_t key_val = depth;
   if (stencil_en) {
-    key_val ^= ((uint64_t)d->rs_stencilfunc << 24) |
-               ((uint64_t)d->rs_stencilpass << 28) |
-               ((uint64_t)d->rs_stencilfail << 32) |
-               ((uint64_t)d->rs_stencilzfail << 36) |
-               ((uint64_t)d->rs_stencilmask << 40) |
-               ((uint64_t)(d->rs_stencilwritemask & 0xFF) << 48);
+    key_val |= (uint64_t)(stencil >> DX9MT_PACKED_FIELD_SHIFT(
+                              DX9MT_PACKED_STENCILMASK))
+               << 32;
+  } else {
+    key_val &= (1u << DX9MT_PACKED_FIELD_END(DX9MT_PACKED_ZFUNC)) - 1u;
   }
   NSNumber *key = @(key_val);
   id<MTLDepthStencilState> cached = [s_depth_stencil_cache objectForKey:key];
@@ -1652,12 +1767,16 @@ depth_stencil_state_for_draw(const volatile dx9mt_metal_ipc_draw *d) {
   }
   if (stencil_en) {
     MTLStencilDescriptor *sd = [[MTLStencilDescriptor alloc] init];
-    sd.stencilCompareFunction = d3d_cmp_to_mtl(d->rs_stencilfunc);
-    sd.stencilFailureOperation = d3d_stencilop_to_mtl(d->rs_stencilfail);
-    sd.depthFailureOperation = d3d_stencilop_to_mtl(d->rs_stencilzfail);
-    sd.depthStencilPassOperation = d3d_stencilop_to_mtl(d->rs_stencilpass);
-    sd.readMask = d->rs_stencilmask;
-    sd.writeMask = d->rs_stencilwritemask;
+    sd.stencilCompareFunction =
+        d3d_cmp_to_mtl(dx9mt_packed_get(depth, DX9MT_PACKED_STENCILFUNC));
+    sd.stencilFailureOperation = d3d_stencilop_to_mtl(
+        dx9mt_packed_get(depth, DX9MT_PACKED_STENCILFAIL));
+    sd.depthFailureOperation = d3d_stencilop_to_mtl(
+        dx9mt_packed_get(depth, DX9MT_PACKED_STENCILZFAIL));
+    sd.depthStencilPassOperation = d3d_stencilop_to_mtl(
+        dx9mt_packed_get(depth, DX9MT_PACKED_STENCILPASS));
+    sd.readMask = dx9mt_packed_get(stencil, DX9MT_PACKED_STENCILMASK);
+    sd.writeMask = dx9mt_packed_get(stencil, DX9MT_PACKED_STENCILWRITEMASK);
     desc.frontFaceStencil = sd;
     desc.backFaceStencil = sd;
   }
@@ -1679,35 +1798,21 @@ static MTLSamplerMipFilter d3d_filter_to_mtl_mip(uint32_t filter) {
   return MTLSamplerMipFilterNotMipmapped;
 }
 
-static id<MTLSamplerState>
-sampler_state_for_draw_stage(const volatile dx9mt_metal_ipc_draw *draw,
-                             uint32_t stage) {
-  uint64_t key_value;
+static id<MTLSamplerState> sampler_state_for_word(uint32_t sampler) {
   NSNumber *key;
   id<MTLSamplerState> state;
   MTLSamplerDescriptor *desc;
   uint32_t min_filter;
   uint32_t mag_filter;
-  uint32_t mip_filter;
-  uint32_t address_u;
-  uint32_t address_v;
-  uint32_t address_w;
 
-  if (!draw || !s_sampler_cache) {
+  if (!s_sampler_cache) {
     return nil;
   }
 
-  min_filter = draw->sampler_min_filter[stage];
-  mag_filter = draw->sampler_mag_filter[stage];
-  mip_filter = draw->sampler_mip_filter[stage];
-  address_u = draw->sampler_address_u[stage];
-  address_v = draw->sampler_address_v[stage];
-  address_w = draw->sampler_address_w[stage];
-
-  key_value = (uint64_t)min_filter | ((uint64_t)mag_filter << 8) |
-              ((uint64_t)mip_filter << 16) | ((uint64_t)address_u << 24) |
-              ((uint64_t)address_v << 32) | ((uint64_t)address_w << 40);
-  key = @(key_value);
+  /* The packed sampler word is the cache key. */
+  min_filter = dx9mt_packed_get(sampler, DX9MT_PACKED_MINFILTER);
+  mag_filter = dx9mt_packed_get(sampler, DX9MT_PACKED_MAGFILTER);
+  key = @(sampler);
   state = [s_sampler_cache objectForKey:key];
   if (state) {
     return state;
@@ -1716,10 +1821,14 @@ sampler_state_for_draw_stage(const volatile dx9mt_metal_ipc_draw *draw,
   desc = [[MTLSamplerDescriptor alloc] init];
   desc.minFilter = d3d_filter_to_mtl_minmag(min_filter);
   desc.magFilter = d3d_filter_to_mtl_minmag(mag_filter);
-  desc.mipFilter = d3d_filter_to_mtl_mip(mip_filter);
-  desc.sAddressMode = d3d_address_to_mtl(address_u);
-  desc.tAddressMode = d3d_address_to_mtl(address_v);
-  desc.rAddressMode = d3d_address_to_mtl(address_w);
+  desc.mipFilter =
+      d3d_filter_to_mtl_mip(dx9mt_packed_get(sampler, DX9MT_PACKED_MIPFILTER));
+  desc.sAddressMode =
+      d3d_address_to_mtl(dx9mt_packed_get(sampler, DX9MT_PACKED_ADDRESSU));
+  desc.tAddressMode =
+      d3d_address_to_mtl(dx9mt_packed_get(sampler, DX9MT_PACKED_ADDRESSV));
+  desc.rAddressMode =
+      d3d_address_to_mtl(dx9mt_packed_get(sampler, DX9MT_PACKED_ADDRESSW));
   desc.maxAnisotropy =
       (min_filter == D3DTEXF_ANISOTROPIC || mag_filter == D3DTEXF_ANISOTROPIC)
           ? 8
@@ -1897,10 +2006,135 @@ static id<MTLRenderPipelineState> blit_pso_for_format(MTLPixelFormat format) {
   return pso;
 }
 
+static id<MTLRenderPipelineState>
+clear_pso_for_format(MTLPixelFormat format, int write_color, int has_depth) {
+  NSNumber *key;
+  id<MTLRenderPipelineState> cached;
+  MTLRenderPipelineDescriptor *desc;
+  NSError *error = nil;
+  id<MTLRenderPipelineState> pso;
+
+  if (!s_device || !s_library) {
+    return nil;
+  }
+  if (!s_clear_pso_cache) {
+    s_clear_pso_cache = [[NSMutableDictionary alloc] init];
+  }
+
+  key = @(((uint64_t)format << 2) | ((uint64_t)(write_color ? 1 : 0) << 1) |
+          (uint64_t)(has_depth ? 1 : 0));
+  cached = [s_clear_pso_cache objectForKey:key];
+  if (cached) {
+    return cached;
+  }
+
+  desc = [[MTLRenderPipelineDescriptor alloc] init];
+  desc.vertexFunction = [s_library newFunctionWithName:@"clear_vertex"];
+  desc.fragmentFunction = [s_library newFunctionWithName:@"clear_fragment"];
+  desc.colorAttachments[0].pixelFormat = format;
+  desc.colorAttachments[0].writeMask =
+      write_color ? MTLColorWriteMaskAll : MTLColorWriteMaskNone;
+  desc.depthAttachmentPixelFormat =
+      has_depth ? MTLPixelFormatDepth32Float : MTLPixelFormatInvalid;
+  pso = [s_device newRenderPipelineStateWithDescriptor:desc error:&error];
+  if (!pso) {
+    viewer_logf("ERROR", "clear PSO failed for format=%lu: %s",
+                (unsigned long)format,
+                error ? [[error localizedDescription] UTF8String] : "unknown");
+    return nil;
+  }
+  [s_clear_pso_cache setObject:pso forKey:key];
+  return pso;
+}
+
+/*
+ * A whole-target Clear() that has not reached the GPU yet. It waits for the
+ * next pass on its target and becomes that pass's load actions, so a clear
+ * followed by draws costs no pass of its own. Stencil clears are dropped:
+ * the viewer's depth targets are Depth32Float.
+ */
+typedef struct dx9mt_pending_clear {
+  uint32_t flags; /* D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER still to apply */
+  uint32_t color_argb;
+  float z;
+  uint32_t command_index; /* latest CLEAR, to resolve the target at flush */
+} dx9mt_pending_clear;
+
+static MTLClearColor clear_color_from_argb(uint32_t argb) {
+  return MTLClearColorMake(((argb >> 16) & 0xFFu) / 255.0,
+                           ((argb >> 8) & 0xFFu) / 255.0,
+                           (argb & 0xFFu) / 255.0,
+                           ((argb >> 24) & 0xFFu) / 255.0);
+}
+
+/*
+ * Open a pass on a replay target. Load actions come from the target's
+ * pending clear, else Load once the target has been rendered this frame,
+ * else a clear to the defaults (the drawable's contents are undefined).
+ */
+static id<MTLRenderCommandEncoder>
+begin_target_pass(id<MTLCommandBuffer> cmd_buf, id<MTLTexture> color_tex,
+                  id<MTLTexture> depth_tex, NSNumber *target_key,
+                  int target_is_drawable, NSMutableSet *seen_targets,
+                  NSMutableDictionary *pending_clears) {
+  MTLRenderPassDescriptor *pass_desc;
+  dx9mt_pending_clear pending;
+  NSValue *pending_value = [pending_clears objectForKey:target_key];
+  BOOL seen_target = [seen_targets containsObject:target_key];
+
+  memset(&pending, 0, sizeof(pending));
+  if (pending_value) {
+    [pending_value getValue:&pending size:sizeof(pending)];
+  }
+
+  pass_desc = [MTLRenderPassDescriptor renderPassDescriptor];
+  pass_desc.colorAttachments[0].texture = color_tex;
+  pass_desc.colorAttachments[0].storeAction = MTLStoreActionStore;
+  if (pending.flags & D3DCLEAR_TARGET) {
+    pass_desc.colorAttachments[0].loadAction = MTLLoadActionClear;
+    pass_desc.colorAttachments[0].clearColor =
+        clear_color_from_argb(pending.color_argb);
+  } else if (seen_target) {
+    pass_desc.colorAttachments[0].loadAction = MTLLoadActionLoad;
+  } else {
+    pass_desc.colorAttachments[0].loadAction = MTLLoadActionClear;
+    pass_desc.colorAttachments[0].clearColor =
+        MTLClearColorMake(0, 0, 0, target_is_drawable ? 1 : 0);
+  }
+  pending.flags &= ~(uint32_t)D3DCLEAR_TARGET;
+
+  if (depth_tex) {
+    pass_desc.depthAttachment.texture = depth_tex;
+    pass_desc.depthAttachment.storeAction = MTLStoreActionStore;
+    if (pending.flags & D3DCLEAR_ZBUFFER) {
+      pass_desc.depthAttachment.loadAction = MTLLoadActionClear;
+      pass_desc.depthAttachment.clearDepth = pending.z;
+    } else if (seen_target) {
+      pass_desc.depthAttachment.loadAction = MTLLoadActionLoad;
+    } else {
+      pass_desc.depthAttachment.loadAction = MTLLoadActionClear;
+      pass_desc.depthAttachment.clearDepth = 1.0;
+    }
+    pending.flags &= ~(uint32_t)D3DCLEAR_ZBUFFER;
+  }
+
+  /* A pass without depth (stretch rect) leaves a depth clear pending. */
+  if (pending.flags) {
+    [pending_clears setObject:[NSValue valueWithBytes:&pending
+                                             objCType:@encode(dx9mt_pending_clear)]
+                       forKey:target_key];
+  } else if (pending_value) {
+    [pending_clears removeObjectForKey:target_key];
+  }
+  [seen_targets addObject:target_key];
+  return [cmd_buf renderCommandEncoderWithDescriptor:pass_desc];
+}
+
 static id<MTLTexture>
 texture_for_draw_stage(const volatile unsigned char *ipc_base, uint32_t bulk_off,
                        uint32_t bulk_used,
                        const volatile dx9mt_metal_ipc_draw *draw,
+                       const volatile dx9mt_metal_ipc_texture *bound,
                        uint32_t stage) {
   uint32_t texture_id;
   uint32_t generation;
@@ -1919,19 +2153,19 @@ texture_for_draw_stage(const volatile unsigned char *ipc_base, uint32_t bulk_off
   const void *texture_bytes;
   MTLRegion region;
 
-  if (!draw || !s_texture_cache || !s_texture_generation) {
+  if (!draw || !bound || !s_texture_cache || !s_texture_generation) {
     return nil;
   }
 
-  texture_id = draw->tex_id[stage];
+  texture_id = bound->id;
   if (texture_id == 0) {
     return nil;
   }
-  generation = draw->tex_generation[stage];
-  format = draw->tex_format[stage];
-  width = draw->tex_width[stage];
-  height = draw->tex_height[stage];
-  pitch = draw->tex_pitch[stage];
+  generation = bound->generation;
+  format = bound->format;
+  width = bound->width;
+  height = bound->height;
+  pitch = bound->pitch;
   upload_offset = draw->tex_bulk_offset[stage];
   upload_size = draw->tex_bulk_size[stage];
 
@@ -2017,6 +2251,129 @@ texture_for_draw_stage(const volatile unsigned char *ipc_base, uint32_t bulk_off
   return texture;
 }
 
+/*
+ * Resolve a draw's VB or IB. Cached buffers (update generation != 0) live in
+ * a persistent store keyed by buffer id, like textures. The bulk payload is
+ * a versioned update: a fresh copy when base_generation is 0, otherwise a
+ * patch on top of the cached base_generation -- in place when the frontend
+ * saw only NOOVERWRITE locks, copy-on-write otherwise so in-flight command
+ * buffers keep reading the old contents. A patch whose base is not resident
+ * (the viewer skipped a frame) returns nil; render_frame() then asks the
+ * frontend for a resync, which resends the buffer whole.
+ * Per-draw buffers (generation 0) are created fresh from the bulk data.
+ */
+static id<MTLBuffer>
+geometry_buffer_for_draw(const volatile unsigned char *ipc_base,
+                         uint32_t bulk_off, uint32_t bulk_used,
+                         uint32_t buffer_id,
+                         const volatile dx9mt_buffer_update *update,
+                         uint32_t upload_offset, uint32_t upload_size) {
+  NSNumber *key;
+  NSNumber *cached_generation;
+  id<MTLBuffer> cached_buffer;
+  id<MTLBuffer> buffer;
+  const void *bytes;
+  uint32_t generation = update->generation;
+  uint32_t base_generation = update->base_generation;
+  uint32_t offset = update->offset;
+  uint32_t buffer_size = update->buffer_size;
+
+  if (upload_size > 0 &&
+      !dx9mt_ipc_bulk_range_valid(bulk_off, bulk_used, upload_offset,
+                                  upload_size)) {
+    return nil;
+  }
+  bytes = (const void *)(ipc_base + bulk_off + upload_offset);
+
+  if (generation == 0 || buffer_id == 0) {
+    if (upload_size == 0) {
+      return nil;
+    }
+    return [s_device newBufferWithBytes:bytes
+                                 length:upload_size
+                                options:MTLResourceStorageModeShared];
+  }
+
+  key = @(buffer_id);
+  cached_buffer = [s_buffer_cache objectForKey:key];
+  cached_generation = [s_buffer_generation objectForKey:key];
+  if (cached_buffer && cached_generation &&
+      [cached_generation unsignedIntValue] == generation &&
+      cached_buffer.length == buffer_size) {
+    [s_buffer_last_use setObject:@(s_render_count) forKey:key];
+    return cached_buffer;
+  }
+  if (upload_size == 0 || buffer_size == 0 || upload_size > buffer_size ||
+      offset > buffer_size - upload_size) {
+    return nil;
+  }
+
+  if (base_generation == 0) {
+    buffer = [s_device newBufferWithLength:buffer_size
+                                   options:MTLResourceStorageModeShared];
+    if (buffer) {
+      memset(buffer.contents, 0, buffer_size);
+    }
+  } else if (cached_buffer && cached_generation &&
+             [cached_generation unsignedIntValue] == base_generation &&
+             cached_buffer.length == buffer_size) {
+    if (update->flags & DX9MT_BUFFER_UPDATE_IN_PLACE) {
+      buffer = cached_buffer;
+    } else {
+      buffer = [s_device newBufferWithBytes:cached_buffer.contents
+                                     length:buffer_size
+                                    options:MTLResourceStorageModeShared];
+    }
+  } else {
+    return nil;
+  }
+  if (!buffer) {
+    return nil;
+  }
+
+  memcpy((unsigned char *)buffer.contents + offset, bytes, upload_size);
+  [s_buffer_cache setObject:buffer forKey:key];
+  [s_buffer_generation setObject:@(generation) forKey:key];
+  [s_buffer_last_use setObject:@(s_render_count) forKey:key];
+  return buffer;
+}
+
+/*
+ * The frontend never tells us a VB/IB was released, so drop stored buffers
+ * no draw has referenced for DX9MT_VIEWER_BUFFER_IDLE_FRAMES frames (level
+ * geometry that streamed out). Command buffers still in flight keep their
+ * own references. A draw that brings one back misses its base and asks
+ * the frontend for a resync.
+ */
+#define DX9MT_VIEWER_BUFFER_IDLE_FRAMES 600u
+#define DX9MT_VIEWER_BUFFER_SWEEP_FRAMES 60u
+
+static void evict_idle_geometry_buffers(void) {
+  NSMutableArray *idle;
+
+  if (s_render_count % DX9MT_VIEWER_BUFFER_SWEEP_FRAMES != 0) {
+    return;
+  }
+  idle = [NSMutableArray array];
+  for (NSNumber *key in s_buffer_last_use) {
+    NSNumber *last_use = [s_buffer_last_use objectForKey:key];
+
+    if (s_render_count - [last_use unsignedIntValue] >=
+        DX9MT_VIEWER_BUFFER_IDLE_FRAMES) {
+      [idle addObject:key];
+    }
+  }
+  if ([idle count] == 0) {
+    return;
+  }
+  [s_buffer_cache removeObjectsForKeys:idle];
+  [s_buffer_generation removeObjectsForKeys:idle];
+  [s_buffer_last_use removeObjectsForKeys:idle];
+  viewer_logf("INFO", "evicted %lu idle geometry buffers, %lu resident",
+              (unsigned long)[idle count],
+              (unsigned long)[s_buffer_cache count]);
+}
+
 /*
  * Create or re-create the geometry PSO for a given vertex stride
  * and declaration. Keep separate untextured/textured variants.
@@ -2188,6 +2545,9 @@ static int init_metal(void) {
 
   s_texture_cache = [[NSMutableDictionary alloc] init];
   s_texture_generation = [[NSMutableDictionary alloc] init];
+  s_buffer_cache = [[NSMutableDictionary alloc] init];
+  s_buffer_generation = [[NSMutableDictionary alloc] init];
+  s_buffer_last_use = [[NSMutableDictionary alloc] init];
   s_sampler_cache = [[NSMutableDictionary alloc] init];
   s_render_target_cache = [[NSMutableDictionary alloc] init];
   s_render_target_desc = [[NSMutableDictionary alloc] init];
@@ -2207,7 +2567,7 @@ static int init_metal(void) {
   s_depth_texture_cache = [[NSMutableDictionary alloc] init];
   s_depth_stencil_cache = [[NSMutableDictionary alloc] init];
 
-  /* Create "no depth" state for overlay draws */
+  /* "No depth" state for overlay draws, and its writing twin for clears */
   {
     MTLDepthStencilDescriptor *no_depth_desc =
         [[MTLDepthStencilDescriptor alloc] init];
@@ -2215,6 +2575,9 @@ static int init_metal(void) {
     no_depth_desc.depthWriteEnabled = NO;
     s_no_depth_state =
         [s_device newDepthStencilStateWithDescriptor:no_depth_desc];
+    no_depth_desc.depthWriteEnabled = YES;
+    s_clear_depth_state =
+        [s_device newDepthStencilStateWithDescriptor:no_depth_desc];
   }
 
   /* Overlay PSO (same as RB1) */
@@ -2535,6 +2898,49 @@ static id<MTLFunction> translate_and_compile_ps(
   return func;
 }
 
+/*
+ * The frontend attaches shader bytecode only on a shader's first draw and
+ * on a slow refresh, keyed by its precomputed hash. Translate it into the
+ * function caches whenever it is present, before any draw skip, so later
+ * draws that carry only the hash can resolve it. Returns the number of
+ * attached blobs with a bad version token.
+ */
+static uint32_t intern_draw_shaders(const volatile unsigned char *ipc_base,
+                                    uint32_t bulk_off, uint32_t bulk_used,
+                                    const volatile dx9mt_metal_ipc_draw *d) {
+  uint32_t invalid = 0;
+
+  if (d->vs_bytecode_hash != 0 && d->vs_bytecode_bulk_size >= 8 &&
+      ![s_vs_func_cache objectForKey:@(d->vs_bytecode_hash)] &&
+      dx9mt_ipc_bulk_range_valid(bulk_off, bulk_used,
+                                 d->vs_bytecode_bulk_offset,
+                                 d->vs_bytecode_bulk_size)) {
+    const uint32_t *bc = (const uint32_t *)(ipc_base + bulk_off +
+                                            d->vs_bytecode_bulk_offset);
+    if ((bc[0] & 0xFFFF0000u) == 0xFFFE0000u) {
+      translate_and_compile_vs(bc, d->vs_bytecode_bulk_size / 4,
+                               d->vs_bytecode_hash);
+    } else {
+      ++invalid;
+    }
+  }
+  if (d->ps_bytecode_hash != 0 && d->ps_bytecode_bulk_size >= 8 &&
+      ![s_ps_func_cache objectForKey:@(d->ps_bytecode_hash)] &&
+      dx9mt_ipc_bulk_range_valid(bulk_off, bulk_used,
+                                 d->ps_bytecode_bulk_offset,
+                                 d->ps_bytecode_bulk_size)) {
+    const uint32_t *bc = (const uint32_t *)(ipc_base + bulk_off +
+                                            d->ps_bytecode_bulk_offset);
+    if ((bc[0] & 0xFFFF0000u) == 0xFFFF0000u) {
+      translate_and_compile_ps(bc, d->ps_bytecode_bulk_size / 4,
+                               d->ps_bytecode_hash);
+    } else {
+      ++invalid;
+    }
+  }
+  return invalid;
+}
+
 static id<MTLRenderPipelineState> create_translated_pso(
     id<MTLFunction> vs_func, id<MTLFunction> ps_func,
     uint32_t vs_hash, uint32_t ps_hash,
@@ -2639,6 +3045,8 @@ static void dump_frame_to(const volatile unsigned char *ipc_base,
                                               sizeof(dx9mt_metal_ipc_header));
   uint32_t bulk_off = hdr->bulk_data_offset;
   uint32_t draw_count = hdr->draw_count;
+  const volatile unsigned char *state_tables[DX9MT_METAL_IPC_STATE_GROUPS];
+  int have_state_tables = dx9mt_metal_ipc_state_tables(ipc_base, state_tables);
 
   ensure_output_dir();
 
@@ -2654,10 +3062,54 @@ static void dump_frame_to(const volatile unsigned char *ipc_base,
   fprintf(f, "clear: %s  color: 0x%08x  present_rt: %u\n",
           hdr->have_clear ? "yes" : "no", hdr->clear_color_argb,
           hdr->present_render_target_id);
+  fprintf(f,
+          "state blocks: depth=%u blend=%u raster=%u samplers=%u "
+          "vs_control=%u ps_control=%u textures=%u%s\n",
+          hdr->state_table_count[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL],
+          hdr->state_table_count[DX9MT_METAL_IPC_STATE_BLEND],
+          hdr->state_table_count[DX9MT_METAL_IPC_STATE_RASTER],
+          hdr->state_table_count[DX9MT_METAL_IPC_STATE_SAMPLERS],
+          hdr->state_table_count[DX9MT_METAL_IPC_STATE_CONTROL_VS],
+          hdr->state_table_count[DX9MT_METAL_IPC_STATE_CONTROL_PS],
+          hdr->state_table_count[DX9MT_METAL_IPC_STATE_TEXTURES],
+          have_state_tables ? "" : " (invalid)");
   fprintf(f, "\n");
 
   for (uint32_t i = 0; i < draw_count && i < DX9MT_METAL_IPC_MAX_DRAWS; ++i) {
     const volatile dx9mt_metal_ipc_draw *d = &draws[i];
+    dx9mt_state_depth_stencil ds_block;
+    dx9mt_state_blend blend_block;
+    dx9mt_state_raster raster_block;
+    dx9mt_metal_ipc_sampler_set sampler_block;
+    dx9mt_metal_ipc_texture_set texture_block;
+    int have_state = have_state_tables;
+
+    /* Copy the draw's blocks out; out-of-range indices dump as zeros. */
+    memset(&ds_block, 0, sizeof(ds_block));
+    memset(&blend_block, 0, sizeof(blend_block));
+    memset(&raster_block, 0, sizeof(raster_block));
+    memset(&sampler_block, 0, sizeof(sampler_block));
+    memset(&texture_block, 0, sizeof(texture_block));
+    for (uint32_t g = 0; g < DX9MT_METAL_IPC_STATE_GROUPS; ++g) {
+      have_state = have_state && d->state_index[g] < hdr->state_table_count[g];
+    }
+    if (have_state) {
+      ds_block = ((const dx9mt_state_depth_stencil *)state_tables
+                      [DX9MT_METAL_IPC_STATE_DEPTH_STENCIL])
+          [d->state_index[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL]];
+      blend_block = ((const dx9mt_state_blend *)
+                         state_tables[DX9MT_METAL_IPC_STATE_BLEND])
+          [d->state_index[DX9MT_METAL_IPC_STATE_BLEND]];
+      raster_block = ((const dx9mt_state_raster *)
+                          state_tables[DX9MT_METAL_IPC_STATE_RASTER])
+          [d->state_index[DX9MT_METAL_IPC_STATE_RASTER]];
+      sampler_block = ((const dx9mt_metal_ipc_sampler_set *)
+                           state_tables[DX9MT_METAL_IPC_STATE_SAMPLERS])
+          [d->state_index[DX9MT_METAL_IPC_STATE_SAMPLERS]];
+      texture_block = ((const dx9mt_metal_ipc_texture_set *)
+                           state_tables[DX9MT_METAL_IPC_STATE_TEXTURES])
+          [d->state_index[DX9MT_METAL_IPC_STATE_TEXTURES]];
+    }
 
     fprintf(f, "--- draw[%u] ---\n", i);
     fprintf(f, "  prim_type=%u  prim_count=%u  base_vertex=%d  start_index=%u\n",
@@ -2672,6 +3124,17 @@ static void dump_frame_to(const volatile unsigned char *ipc_base,
     fprintf(f, "  viewport=(%u,%u %ux%u) z=[%.3f,%.3f]\n",
             d->viewport_x, d->viewport_y, d->viewport_width,
             d->viewport_height, d->viewport_min_z, d->viewport_max_z);
+    fprintf(f,
+            "  state: depth=%u blend=%u raster=%u samplers=%u "
+            "vs_control=%u ps_control=%u textures=%u%s\n",
+            d->state_index[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL],
+            d->state_index[DX9MT_METAL_IPC_STATE_BLEND],
+            d->state_index[DX9MT_METAL_IPC_STATE_RASTER],
+            d->state_index[DX9MT_METAL_IPC_STATE_SAMPLERS],
+            d->state_index[DX9MT_METAL_IPC_STATE_CONTROL_VS],
+            d->state_index[DX9MT_METAL_IPC_STATE_CONTROL_PS],
+            d->state_index[DX9MT_METAL_IPC_STATE_TEXTURES],
+            have_state ? "" : " (out of range)");
 
     /* Vertex declaration */
     fprintf(f, "  decl_count=%u", d->decl_count);
@@ -2692,41 +3155,61 @@ static void dump_frame_to(const volatile unsigned char *ipc_base,
 
     /* Textures and samplers */
     for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
-      if (d->tex_id[s] == 0) continue;
+      const dx9mt_metal_ipc_texture *tex = &texture_block.stage[s];
+      if (tex->id == 0) continue;
       fprintf(f, "  tex%u: id=%u gen=%u fmt=%s size=%ux%u pitch=%u upload=%u\n",
-              s, d->tex_id[s], d->tex_generation[s],
-              d3d_fmt_name(d->tex_format[s]),
-              d->tex_width[s], d->tex_height[s],
-              d->tex_pitch[s], d->tex_bulk_size[s]);
+              s, tex->id, tex->generation, d3d_fmt_name(tex->format),
+              tex->width, tex->height, tex->pitch, d->tex_bulk_size[s]);
+      uint32_t ss = sampler_block.stage[s].sampler;
       fprintf(f, "  sampler%u: min=%u mag=%u mip=%u addr=(%u,%u,%u)\n",
-              s, d->sampler_min_filter[s], d->sampler_mag_filter[s],
-              d->sampler_mip_filter[s], d->sampler_address_u[s],
-              d->sampler_address_v[s], d->sampler_address_w[s]);
+              s, dx9mt_packed_get(ss, DX9MT_PACKED_MINFILTER),
+              dx9mt_packed_get(ss, DX9MT_PACKED_MAGFILTER),
+              dx9mt_packed_get(ss, DX9MT_PACKED_MIPFILTER),
+              dx9mt_packed_get(ss, DX9MT_PACKED_ADDRESSU),
+              dx9mt_packed_get(ss, DX9MT_PACKED_ADDRESSV),
+              dx9mt_packed_get(ss, DX9MT_PACKED_ADDRESSW));
     }
 
     /* TSS combiner */
+    uint32_t tss0 = d->tss0_combiner;
+    uint32_t blend = blend_block.blend;
+    uint32_t depth = ds_block.depth;
+    uint32_t stencil = ds_block.stencil;
     fprintf(f, "  tss0: color_op=%s  arg1=%s  arg2=%s\n",
-            d3d_texop_name(d->tss0_color_op),
-            d3d_texarg_name(d->tss0_color_arg1),
-            d3d_texarg_name(d->tss0_color_arg2));
+            d3d_texop_name(dx9mt_packed_get(tss0, DX9MT_PACKED_COLOROP)),
+            d3d_texarg_name(dx9mt_unpacked_texture_arg(
+                dx9mt_packed_get(tss0, DX9MT_PACKED_COLORARG1))),
+            d3d_texarg_name(dx9mt_unpacked_texture_arg(
+                dx9mt_packed_get(tss0, DX9MT_PACKED_COLORARG2))));
     fprintf(f, "  tss0: alpha_op=%s  arg1=%s  arg2=%s\n",
-            d3d_texop_name(d->tss0_alpha_op),
-            d3d_texarg_name(d->tss0_alpha_arg1),
-            d3d_texarg_name(d->tss0_alpha_arg2));
-    fprintf(f, "  texture_factor=0x%08x\n", d->rs_texture_factor);
+            d3d_texop_name(dx9mt_packed_get(tss0, DX9MT_PACKED_ALPHAOP)),
+            d3d_texarg_name(dx9mt_unpacked_texture_arg(
+                dx9mt_packed_get(tss0, DX9MT_PACKED_ALPHAARG1))),
+            d3d_texarg_name(dx9mt_unpacked_texture_arg(
+                dx9mt_packed_get(tss0, DX9MT_PACKED_ALPHAARG2))));
+    fprintf(f, "  texture_factor=0x%08x\n",
+            blend_block.texture_factor);
 
     /* Blend / alpha test */
     fprintf(f, "  blend: enable=%u  src=%s  dst=%s\n",
-            d->rs_alpha_blend_enable,
-            d3d_blend_name(d->rs_src_blend),
-            d3d_blend_name(d->rs_dest_blend));
+            dx9mt_packed_get(blend, DX9MT_PACKED_ALPHABLENDENABLE),
+            d3d_blend_name(dx9mt_packed_get(blend, DX9MT_PACKED_SRCBLEND)),
+            d3d_blend_name(dx9mt_packed_get(blend, DX9MT_PACKED_DESTBLEND)));
     fprintf(f, "  alpha_test: enable=%u  ref=%u  func=%u\n",
-            d->rs_alpha_test_enable, d->rs_alpha_ref, d->rs_alpha_func);
+            dx9mt_packed_get(blend, DX9MT_PACKED_ALPHATESTENABLE),
+            dx9mt_packed_get(blend, DX9MT_PACKED_ALPHAREF),
+            dx9mt_packed_get(blend, DX9MT_PACKED_ALPHAFUNC));
     fprintf(f, "  depth: enable=%u  write=%u  func=%u  cull=%u\n",
-            d->rs_zenable, d->rs_zwriteenable, d->rs_zfunc, d->rs_cull_mode);
-    fprintf(f, "  stencil: enable=%u  func=%u  ref=%u  mask=0x%08x  writemask=0x%08x\n",
-            d->rs_stencilenable, d->rs_stencilfunc, d->rs_stencilref,
-            d->rs_stencilmask, d->rs_stencilwritemask);
+            dx9mt_packed_get(depth, DX9MT_PACKED_ZENABLE),
+            dx9mt_packed_get(depth, DX9MT_PACKED_ZWRITEENABLE),
+            dx9mt_packed_get(depth, DX9MT_PACKED_ZFUNC),
+            dx9mt_packed_get(raster_block.raster, DX9MT_PACKED_CULLMODE));
+    fprintf(f, "  stencil: enable=%u  func=%u  ref=%u  mask=0x%02x  writemask=0x%02x\n",
+            dx9mt_packed_get(depth, DX9MT_PACKED_STENCILENABLE),
+            dx9mt_packed_get(depth, DX9MT_PACKED_STENCILFUNC),
+            dx9mt_packed_get(stencil, DX9MT_PACKED_STENCILREF),
+            dx9mt_packed_get(stencil, DX9MT_PACKED_STENCILMASK),
+            dx9mt_packed_get(stencil, DX9MT_PACKED_STENCILWRITEMASK));
 
     /* Buffer sizes */
     fprintf(f, "  vb: offset=%u size=%u  ib: offset=%u size=%u\n",
@@ -2737,10 +3220,12 @@ static void dump_frame_to(const volatile unsigned char *ipc_base,
             d->ps_constants_bulk_offset, d->ps_constants_size);
 
     /* Shader bytecode */
-    fprintf(f, "  vs_id=%u  vs_bc: offset=%u size=%u  ps_bc: offset=%u size=%u\n",
-            d->vertex_shader_id,
+    fprintf(f, "  vs_id=%u  vs_bc: hash=0x%08x offset=%u size=%u  "
+               "ps_bc: hash=0x%08x offset=%u size=%u\n",
+            d->vertex_shader_id, d->vs_bytecode_hash,
             d->vs_bytecode_bulk_offset, d->vs_bytecode_bulk_size,
-            d->ps_bytecode_bulk_offset, d->ps_bytecode_bulk_size);
+            d->ps_bytecode_hash, d->ps_bytecode_bulk_offset,
+            d->ps_bytecode_bulk_size);
     if (d->vs_bytecode_bulk_size >= 4) {
       const uint32_t *bc = (const uint32_t *)(ipc_base + bulk_off +
                                                d->vs_bytecode_bulk_offset);
@@ -2818,11 +3303,12 @@ static void dump_frame_to(const volatile unsigned char *ipc_base,
 
     /* Save texture data to file */
     for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
-      if (d->tex_bulk_size[s] > 0 && d->tex_id[s] != 0) {
+      const dx9mt_metal_ipc_texture *tex = &texture_block.stage[s];
+      if (d->tex_bulk_size[s] > 0 && tex->id != 0) {
         char tex_name[64];
         char tex_path[PATH_MAX];
         snprintf(tex_name, sizeof(tex_name), "dx9mt_tex_%u_s%u.raw",
-                 d->tex_id[s], s);
+                 tex->id, s);
         build_output_path(tex_path, sizeof(tex_path), tex_name);
         FILE *tf = fopen(tex_path, "wb");
         if (tf) {
@@ -2831,9 +3317,8 @@ static void dump_frame_to(const volatile unsigned char *ipc_base,
           fwrite(tex_data, 1, d->tex_bulk_size[s], tf);
           fclose(tf);
           fprintf(f, "  >> texture saved: %s (%u bytes, %s %ux%u)\n",
-                  tex_path, d->tex_bulk_size[s],
-                  d3d_fmt_name(d->tex_format[s]),
-                  d->tex_width[s], d->tex_height[s]);
+                  tex_path, d->tex_bulk_size[s], d3d_fmt_name(tex->format),
+                  tex->width, tex->height);
         }
       }
     }
@@ -2851,6 +3336,12 @@ static void dump_frame(const volatile unsigned char *ipc_base) {
   dump_frame_to(ipc_base, path);
 }
 
+/* Entry k of a per-frame state block array; nil for a failed block. */
+static id dx9mt_block_state(NSArray *states, NSUInteger k) {
+  id state = states[k];
+  return state == (id)[NSNull null] ? nil : state;
+}
+
 static void render_frame(const volatile unsigned char *ipc_base) {
   const volatile dx9mt_metal_ipc_header *hdr =
       (const volatile dx9mt_metal_ipc_header *)ipc_base;
@@ -2860,6 +3351,7 @@ static void render_frame(const volatile unsigned char *ipc_base) {
   uint32_t bulk_off = hdr->bulk_data_offset;
   uint32_t bulk_used = hdr->bulk_data_used;
   uint32_t draw_count = hdr->draw_count;
+  const volatile unsigned char *state_tables[DX9MT_METAL_IPC_STATE_GROUPS];
   dx9mt_frame_diag diag;
 
   memset(&diag, 0, sizeof(diag));
@@ -2880,6 +3372,48 @@ static void render_frame(const volatile unsigned char *ipc_base) {
                 bulk_off, bulk_used, draw_count);
     return;
   }
+  if (!dx9mt_metal_ipc_state_tables(ipc_base, state_tables)) {
+    viewer_logf("ERROR", "invalid IPC state tables frame=%u", hdr->frame_id);
+    return;
+  }
+
+  const volatile dx9mt_state_depth_stencil *depth_table =
+      (const volatile dx9mt_state_depth_stencil *)
+          state_tables[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL];
+  const volatile dx9mt_state_blend *blend_table =
+      (const volatile dx9mt_state_blend *)
+          state_tables[DX9MT_METAL_IPC_STATE_BLEND];
+  const volatile dx9mt_state_raster *raster_table =
+      (const volatile dx9mt_state_raster *)
+          state_tables[DX9MT_METAL_IPC_STATE_RASTER];
+  const volatile dx9mt_metal_ipc_sampler_set *sampler_table =
+      (const volatile dx9mt_metal_ipc_sampler_set *)
+          state_tables[DX9MT_METAL_IPC_STATE_SAMPLERS];
+  uint32_t depth_count =
+      hdr->state_table_count[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL];
+  uint32_t blend_count = hdr->state_table_count[DX9MT_METAL_IPC_STATE_BLEND];
+  uint32_t raster_count =
+      hdr->state_table_count[DX9MT_METAL_IPC_STATE_RASTER];
+  uint32_t sampler_count =
+      hdr->state_table_count[DX9MT_METAL_IPC_STATE_SAMPLERS];
+  const volatile dx9mt_shader_control_constants *vs_control_table =
+      (const volatile dx9mt_shader_control_constants *)
+          state_tables[DX9MT_METAL_IPC_STATE_CONTROL_VS];
+  const volatile dx9mt_shader_control_constants *ps_control_table =
+      (const volatile dx9mt_shader_control_constants *)
+          state_tables[DX9MT_METAL_IPC_STATE_CONTROL_PS];
+  uint32_t vs_control_count =
+      hdr->state_table_count[DX9MT_METAL_IPC_STATE_CONTROL_VS];
+  uint32_t ps_control_count =
+      hdr->state_table_count[DX9MT_METAL_IPC_STATE_CONTROL_PS];
+  const volatile dx9mt_metal_ipc_texture_set *texture_table =
+      (const volatile dx9mt_metal_ipc_texture_set *)
+          state_tables[DX9MT_METAL_IPC_STATE_TEXTURES];
+  uint32_t texture_count =
+      hdr->state_table_count[DX9MT_METAL_IPC_STATE_TEXTURES];
+
+  ++s_render_count;
+  evict_idle_geometry_buffers();
 
   @autoreleasepool {
     id<CAMetalDrawable> drawable = [s_metal_layer nextDrawable];
@@ -2892,18 +3426,6 @@ static void render_frame(const volatile unsigned char *ipc_base) {
       return;
     }
 
-    /* Clear color from the game's Clear() call */
-    float r, g, b, a;
-    if (hdr->have_clear) {
-      a = ((hdr->clear_color_argb >> 24) & 0xFFu) / 255.0f;
-      r = ((hdr->clear_color_argb >> 16) & 0xFFu) / 255.0f;
-      g = ((hdr->clear_color_argb >> 8) & 0xFFu) / 255.0f;
-      b = (hdr->clear_color_argb & 0xFFu) / 255.0f;
-    } else {
-      r = g = b = 0.0f;
-      a = 1.0f;
-    }
-
     /*
      * Replay draws into their recorded render target IDs. Do not infer a
      * fallback drawable target when the frontend fails to tell us which
@@ -2920,16 +3442,35 @@ static void render_frame(const volatile unsigned char *ipc_base) {
     id<MTLRenderCommandEncoder> encoder = nil;
     uint32_t active_rt_id = UINT32_MAX;
     int active_target_is_drawable = 0;
-    NSMutableSet *cleared_targets = [[NSMutableSet alloc] init];
+    int active_has_depth = 0;
+    /* Targets rendered this frame, and whole-target clears not yet applied
+     * (target key -> dx9mt_pending_clear). */
+    NSMutableSet *seen_targets = [[NSMutableSet alloc] init];
+    NSMutableDictionary *pending_clears = [[NSMutableDictionary alloc] init];
     NSMutableDictionary *cohort_counts = [[NSMutableDictionary alloc] init];
     NSNumber *drawable_key = @(0u);
 
-    /* RB4: depth clear value from Clear() call */
-    float clear_depth = 1.0f;
-    int clear_depth_flag = 0;
-    if (hdr->have_clear) {
-      clear_depth = hdr->clear_z;
-      clear_depth_flag = (hdr->clear_flags & 0x2) ? 1 : 0;
+    /*
+     * One Metal state object per interned block, resolved once per frame;
+     * draws index these instead of hashing their state. NSNull marks a
+     * block Metal rejected.
+     */
+    NSMutableArray *block_depth_states =
+        [[NSMutableArray alloc] initWithCapacity:depth_count];
+    NSMutableArray *block_sampler_states = [[NSMutableArray alloc]
+        initWithCapacity:sampler_count * DX9MT_MAX_PS_SAMPLERS];
+    for (uint32_t k = 0; k < depth_count; ++k) {
+      id<MTLDepthStencilState> state = depth_stencil_state_for_block(
+          depth_table[k].depth, depth_table[k].stencil);
+      [block_depth_states addObject:state ? (id)state : (id)[NSNull null]];
+    }
+    for (uint32_t k = 0; k < sampler_count; ++k) {
+      for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
+        id<MTLSamplerState> state =
+            sampler_state_for_word(sampler_table[k].stage[s].sampler);
+        [block_sampler_states
+            addObject:state ? (id)state : (id)[NSNull null]];
+      }
     }
 
     /* RB3: Render actual geometry from per-draw IPC data */
@@ -2954,18 +3495,184 @@ static void render_frame(const volatile unsigned char *ipc_base) {
       int textured = 0;
       int use_compat_textured_tint = 0;
       int use_scene_blit_fallback = 0;
+      id<MTLBuffer> vb_buf = nil;
+      id<MTLBuffer> ib_buf = nil;
+      const volatile dx9mt_metal_ipc_texture_set *textures = NULL;
       if (d->command_type == DX9MT_METAL_IPC_COMMAND_DRAW) {
-        dx9mt_cohort_add(cohort_counts, ipc_base, bulk_off, hdr->bulk_data_used,
-                         d);
+        if (d->state_index[DX9MT_METAL_IPC_STATE_TEXTURES] < texture_count) {
+          textures =
+              &texture_table[d->state_index[DX9MT_METAL_IPC_STATE_TEXTURES]];
+        }
+        dx9mt_cohort_add(cohort_counts, d, textures);
+        /* Resolve geometry before any skip so persistent VB/IB uploads
+         * always land in the cache, even if this draw is not rendered. */
+        vb_buf = geometry_buffer_for_draw(
+            ipc_base, bulk_off, bulk_used, d->vertex_buffer_id,
+            &d->vertex_update, d->vb_bulk_offset, d->vb_bulk_size);
+        ib_buf = geometry_buffer_for_draw(
+            ipc_base, bulk_off, bulk_used, d->index_buffer_id,
+            &d->index_update, d->ib_bulk_offset, d->ib_bulk_size);
+        if ((!vb_buf && d->vertex_update.generation != 0) ||
+            (!ib_buf && d->index_update.generation != 0)) {
+          ++diag.missing_buffer_base;
+        }
+        diag.invalid_shader_bytecode +=
+            intern_draw_shaders(ipc_base, bulk_off, bulk_used, d);
+      }
+
+      if (d->command_type == DX9MT_METAL_IPC_COMMAND_CLEAR) {
+        uint32_t flags =
+            d->clear_flags & (D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER);
+        uint32_t rt_w = d->render_target_width;
+        uint32_t rt_h = d->render_target_height;
+        NSNumber *target_key;
+        id<MTLTexture> depth_tex = nil;
+        id<MTLRenderPipelineState> clear_pso;
+        MTLScissorRect sr;
+        struct {
+          float color[4];
+          float depth;
+          float _pad[3];
+        } clear_params;
+
+        draw_rt_id = d->render_target_id;
+        if (draw_rt_id == 0) {
+          ++diag.missing_draw_rt;
+          dx9mt_diag_detail(&diag, hdr->frame_id, i,
+                            "clear missing render_target_id");
+          continue;
+        }
+        if (flags == 0) {
+          continue;
+        }
+        target_is_drawable =
+            (primary_rt_id != 0 && draw_rt_id == primary_rt_id);
+        if (target_is_drawable) {
+          draw_rt_id = 0;
+        }
+        target_key = target_is_drawable ? drawable_key : @(draw_rt_id);
+
+        if (d->dst_left <= 0 && d->dst_top <= 0 &&
+            d->dst_right >= (int32_t)rt_w && d->dst_bottom >= (int32_t)rt_h) {
+          dx9mt_pending_clear pending;
+          NSValue *pending_value = [pending_clears objectForKey:target_key];
+
+          memset(&pending, 0, sizeof(pending));
+          if (pending_value) {
+            [pending_value getValue:&pending size:sizeof(pending)];
+          }
+          pending.flags |= flags;
+          if (flags & D3DCLEAR_TARGET) {
+            pending.color_argb = d->clear_color_argb;
+          }
+          if (flags & D3DCLEAR_ZBUFFER) {
+            pending.z = d->clear_z;
+          }
+          pending.command_index = i;
+          [pending_clears
+              setObject:[NSValue valueWithBytes:&pending
+                                       objCType:@encode(dx9mt_pending_clear)]
+                 forKey:target_key];
+          /* Draws after the clear must land in a pass that starts with it. */
+          if (encoder && draw_rt_id == active_rt_id &&
+              target_is_drawable == active_target_is_drawable) {
+            [encoder endEncoding];
+            encoder = nil;
+          }
+          ++diag.clears_folded;
+          continue;
+        }
+
+        /* Partial rect: draw the clear into the target's pass. */
+        if (target_is_drawable) {
+          draw_target_texture = drawable.texture;
+          depth_tex = ensure_drawable_depth_texture(s_width, s_height);
+        } else {
+          draw_target_texture = render_target_texture_for_draw(d);
+          depth_tex = depth_texture_for_rt(draw_rt_id, rt_w, rt_h);
+        }
+        if (!draw_target_texture) {
+          ++diag.missing_target_texture;
+          dx9mt_diag_detail(&diag, hdr->frame_id, i,
+                            "clear missing target texture rt_id=%u size=%ux%u",
+                            d->render_target_id, rt_w, rt_h);
+          continue;
+        }
+        if (!encoder || draw_rt_id != active_rt_id ||
+            target_is_drawable != active_target_is_drawable ||
+            (depth_tex && !active_has_depth)) {
+          if (encoder) {
+            [encoder endEncoding];
+          }
+          encoder = begin_target_pass(cmd_buf, draw_target_texture, depth_tex,
+                                      target_key, target_is_drawable,
+                                      seen_targets, pending_clears);
+          if (!encoder) {
+            ++diag.missing_target_texture;
+            dx9mt_diag_detail(&diag, hdr->frame_id, i,
+                              "clear failed to create encoder rt_id=%u",
+                              d->render_target_id);
+            continue;
+          }
+          active_rt_id = draw_rt_id;
+          active_target_is_drawable = target_is_drawable;
+          active_has_depth = depth_tex != nil;
+        }
+
+        clear_pso = clear_pso_for_format(draw_target_texture.pixelFormat,
+                                         (flags & D3DCLEAR_TARGET) != 0,
+                                         active_has_depth);
+        sr.x = d->dst_left > 0 ? (NSUInteger)d->dst_left : 0;
+        sr.y = d->dst_top > 0 ? (NSUInteger)d->dst_top : 0;
+        sr.width = d->dst_right > 0 ? (NSUInteger)d->dst_right : 0;
+        sr.height = d->dst_bottom > 0 ? (NSUInteger)d->dst_bottom : 0;
+        if (sr.width > draw_target_texture.width) {
+          sr.width = draw_target_texture.width;
+        }
+        if (sr.height > draw_target_texture.height) {
+          sr.height = draw_target_texture.height;
+        }
+        if (!clear_pso || sr.width <= sr.x || sr.height <= sr.y) {
+          continue;
+        }
+        sr.width -= sr.x;
+        sr.height -= sr.y;
+
+        clear_params.color[0] = ((d->clear_color_argb >> 16) & 0xFFu) / 255.0f;
+        clear_params.color[1] = ((d->clear_color_argb >> 8) & 0xFFu) / 255.0f;
+        clear_params.color[2] = (d->clear_color_argb & 0xFFu) / 255.0f;
+        clear_params.color[3] = ((d->clear_color_argb >> 24) & 0xFFu) / 255.0f;
+        clear_params.depth = d->clear_z;
+
+        [encoder setRenderPipelineState:clear_pso];
+        if ((flags & D3DCLEAR_ZBUFFER) && active_has_depth &&
+            s_clear_depth_state) {
+          [encoder setDepthStencilState:s_clear_depth_state];
+        } else if (s_no_depth_state) {
+          [encoder setDepthStencilState:s_no_depth_state];
+        }
+        [encoder setCullMode:MTLCullModeNone];
+        [encoder setViewport:(MTLViewport){
+                                 0, 0, (double)draw_target_texture.width,
+                                 (double)draw_target_texture.height, 0, 1}];
+        [encoder setScissorRect:sr];
+        [encoder setVertexBytes:&clear_params
+                         length:sizeof(clear_params)
+                        atIndex:0];
+        [encoder setFragmentBytes:&clear_params
+                           length:sizeof(clear_params)
+                          atIndex:0];
+        [encoder drawPrimitives:MTLPrimitiveTypeTriangleStrip
+                    vertexStart:0
+                    vertexCount:4];
+        ++diag.clears_drawn;
+        continue;
       }
 
       if (d->command_type == DX9MT_METAL_IPC_COMMAND_STRETCH_RECT) {
         id<MTLTexture> src_texture = nil;
         id<MTLSamplerState> blit_sampler = nil;
         id<MTLRenderPipelineState> blit_pso = nil;
-        MTLRenderPassDescriptor *pass_desc;
-        NSNumber *target_key;
-        BOOL seen_target;
         uint32_t dst_w;
         uint32_t dst_h;
         struct {
@@ -3037,21 +3744,10 @@ static void render_frame(const volatile unsigned char *ipc_base) {
           encoder = nil;
         }
 
-        pass_desc = [MTLRenderPassDescriptor renderPassDescriptor];
-        pass_desc.colorAttachments[0].texture = draw_target_texture;
-        pass_desc.colorAttachments[0].storeAction = MTLStoreActionStore;
-        target_key = target_is_drawable ? drawable_key : @(draw_rt_id);
-        seen_target = [cleared_targets containsObject:target_key];
-        if (seen_target) {
-          pass_desc.colorAttachments[0].loadAction = MTLLoadActionLoad;
-        } else {
-          pass_desc.colorAttachments[0].loadAction = MTLLoadActionClear;
-          pass_desc.colorAttachments[0].clearColor =
-              MTLClearColorMake(r, g, b, a);
-          [cleared_targets addObject:target_key];
-        }
-
-        encoder = [cmd_buf renderCommandEncoderWithDescriptor:pass_desc];
+        encoder = begin_target_pass(
+            cmd_buf, draw_target_texture, nil,
+            target_is_drawable ? drawable_key : @(draw_rt_id),
+            target_is_drawable, seen_targets, pending_clears);
         if (!encoder) {
           ++diag.missing_target_texture;
           dx9mt_diag_detail(&diag, hdr->frame_id, i,
@@ -3061,6 +3757,7 @@ static void render_frame(const volatile unsigned char *ipc_base) {
         }
         active_rt_id = draw_rt_id;
         active_target_is_drawable = target_is_drawable;
+        active_has_depth = 0;
 
         dst_w = target_is_drawable ? s_width : d->render_target_width;
         dst_h = target_is_drawable ? s_height : d->render_target_height;
@@ -3104,11 +3801,51 @@ static void render_frame(const volatile unsigned char *ipc_base) {
         continue;
       }
 
-      if (d->vb_bulk_size == 0 || d->ib_bulk_size == 0 || stride == 0) {
+      const volatile uint16_t *state_index = d->state_index;
+      if (state_index[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL] >= depth_count ||
+          state_index[DX9MT_METAL_IPC_STATE_BLEND] >= blend_count ||
+          state_index[DX9MT_METAL_IPC_STATE_RASTER] >= raster_count ||
+          state_index[DX9MT_METAL_IPC_STATE_SAMPLERS] >= sampler_count ||
+          state_index[DX9MT_METAL_IPC_STATE_CONTROL_VS] >= vs_control_count ||
+          state_index[DX9MT_METAL_IPC_STATE_CONTROL_PS] >= ps_control_count ||
+          !textures) {
+        ++diag.invalid_state_index;
+        dx9mt_diag_detail(
+            &diag, hdr->frame_id, i,
+            "state index out of range depth=%u blend=%u raster=%u "
+            "samplers=%u vs_control=%u ps_control=%u textures=%u",
+            state_index[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL],
+            state_index[DX9MT_METAL_IPC_STATE_BLEND],
+            state_index[DX9MT_METAL_IPC_STATE_RASTER],
+            state_index[DX9MT_METAL_IPC_STATE_SAMPLERS],
+            state_index[DX9MT_METAL_IPC_STATE_CONTROL_VS],
+            state_index[DX9MT_METAL_IPC_STATE_CONTROL_PS],
+            state_index[DX9MT_METAL_IPC_STATE_TEXTURES]);
+        continue;
+      }
+      const volatile dx9mt_state_depth_stencil *ds_block =
+          &depth_table[state_index[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL]];
+      const volatile dx9mt_state_blend *blend_block =
+          &blend_table[state_index[DX9MT_METAL_IPC_STATE_BLEND]];
+      const volatile dx9mt_state_raster *raster_block =
+          &raster_table[state_index[DX9MT_METAL_IPC_STATE_RASTER]];
+      NSUInteger sampler_base =
+          (NSUInteger)state_index[DX9MT_METAL_IPC_STATE_SAMPLERS] *
+          DX9MT_MAX_PS_SAMPLERS;
+      const volatile dx9mt_shader_control_constants *vs_control =
+          &vs_control_table[state_index[DX9MT_METAL_IPC_STATE_CONTROL_VS]];
+      const volatile dx9mt_shader_control_constants *ps_control =
+          &ps_control_table[state_index[DX9MT_METAL_IPC_STATE_CONTROL_PS]];
+
+      if (!vb_buf || !ib_buf || stride == 0) {
         ++diag.skipped_empty_geometry;
-        dx9mt_diag_detail(&diag, hdr->frame_id, i,
-                          "missing geometry payload vb=%u ib=%u stride=%u",
-                          d->vb_bulk_size, d->ib_bulk_size, stride);
+        dx9mt_diag_detail(
+            &diag, hdr->frame_id, i,
+            "missing geometry payload vb=%u ib=%u stride=%u vb_id=%u gen=%u base=%u ib_id=%u gen=%u base=%u bulk_used=%u",
+            d->vb_bulk_size, d->ib_bulk_size, stride, d->vertex_buffer_id,
+            d->vertex_update.generation, d->vertex_update.base_generation,
+            d->index_buffer_id, d->index_update.generation,
+            d->index_update.base_generation, bulk_used);
         continue;
       }
       if (d->primitive_count == 0) {
@@ -3144,33 +3881,14 @@ static void render_frame(const volatile unsigned char *ipc_base) {
       }
 
       if (!encoder || draw_rt_id != active_rt_id ||
-          target_is_drawable != active_target_is_drawable) {
-        MTLRenderPassDescriptor *pass_desc;
-        NSNumber *target_key;
-        BOOL seen_target;
+          target_is_drawable != active_target_is_drawable ||
+          !active_has_depth) {
         id<MTLTexture> depth_tex = nil;
 
         if (encoder) {
           [encoder endEncoding];
         }
 
-        pass_desc = [MTLRenderPassDescriptor renderPassDescriptor];
-        pass_desc.colorAttachments[0].texture = draw_target_texture;
-        pass_desc.colorAttachments[0].storeAction = MTLStoreActionStore;
-        target_key = target_is_drawable ? drawable_key : @(draw_rt_id);
-        seen_target = [cleared_targets containsObject:target_key];
-        if (seen_target) {
-          pass_desc.colorAttachments[0].loadAction = MTLLoadActionLoad;
-        } else {
-          pass_desc.colorAttachments[0].loadAction = MTLLoadActionClear;
-          if (target_is_drawable) {
-            pass_desc.colorAttachments[0].clearColor = MTLClearColorMake(r, g, b, a);
-          } else {
-            pass_desc.colorAttachments[0].clearColor = MTLClearColorMake(0, 0, 0, 0);
-          }
-          [cleared_targets addObject:target_key];
-        }
-
         /* RB4: attach depth texture */
         if (target_is_drawable) {
           depth_tex = ensure_drawable_depth_texture(s_width, s_height);
@@ -3178,23 +3896,11 @@ static void render_frame(const volatile unsigned char *ipc_base) {
           depth_tex = depth_texture_for_rt(
               draw_rt_id, d->render_target_width, d->render_target_height);
         }
-        if (depth_tex) {
-          pass_desc.depthAttachment.texture = depth_tex;
-          pass_desc.depthAttachment.storeAction = MTLStoreActionStore;
-          if (seen_target) {
-            pass_desc.depthAttachment.loadAction = MTLLoadActionLoad;
-          } else {
-            if (target_is_drawable && clear_depth_flag) {
-              pass_desc.depthAttachment.loadAction = MTLLoadActionClear;
-              pass_desc.depthAttachment.clearDepth = clear_depth;
-            } else {
-              pass_desc.depthAttachment.loadAction = MTLLoadActionClear;
-              pass_desc.depthAttachment.clearDepth = 1.0;
-            }
-          }
-        }
 
-        encoder = [cmd_buf renderCommandEncoderWithDescriptor:pass_desc];
+        encoder = begin_target_pass(
+            cmd_buf, draw_target_texture, depth_tex,
+            target_is_drawable ? drawable_key : @(draw_rt_id),
+            target_is_drawable, seen_targets, pending_clears);
         if (!encoder) {
           ++diag.missing_target_texture;
           dx9mt_diag_detail(&diag, hdr->frame_id, i,
@@ -3204,6 +3910,7 @@ static void render_frame(const volatile unsigned char *ipc_base) {
         }
         active_rt_id = draw_rt_id;
         active_target_is_drawable = target_is_drawable;
+        active_has_depth = depth_tex != nil;
       }
 
       if (d->decl_count > 0 && d->decl_count < 64 &&
@@ -3227,29 +3934,31 @@ static void render_frame(const volatile unsigned char *ipc_base) {
       }
 
       for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
-        if (d->tex_id[s] == 0) {
+        const volatile dx9mt_metal_ipc_texture *bound = &textures->stage[s];
+        if (bound->id == 0) {
           continue;
         }
-        stage_textures[s] =
-            texture_for_draw_stage(ipc_base, bulk_off, bulk_used, d, s);
+        stage_textures[s] = texture_for_draw_stage(ipc_base, bulk_off,
+                                                   bulk_used, d, bound, s);
         if (!stage_textures[s]) {
           ++diag.missing_stage_texture;
           dx9mt_diag_detail(
               &diag, hdr->frame_id, i,
               "missing stage texture s=%u tex_id=%u gen=%u fmt=%s upload=%u",
-              s, d->tex_id[s], d->tex_generation[s],
-              d3d_fmt_name(d->tex_format[s]), d->tex_bulk_size[s]);
+              s, bound->id, bound->generation, d3d_fmt_name(bound->format),
+              d->tex_bulk_size[s]);
           missing_stage_texture = 1;
           break;
         }
-        stage_samplers[s] = sampler_state_for_draw_stage(d, s);
+        stage_samplers[s] =
+            dx9mt_block_state(block_sampler_states, sampler_base + s);
         textured = 1;
       }
       if (missing_stage_texture) {
         continue;
       }
 
-      if (d->vs_bytecode_bulk_size < 8 || d->ps_bytecode_bulk_size < 8) {
+      if (d->vs_bytecode_hash == 0 || d->ps_bytecode_hash == 0) {
         ++diag.missing_shader_bytecode;
         dx9mt_diag_detail(
             &diag, hdr->frame_id, i,
@@ -3258,49 +3967,35 @@ static void render_frame(const volatile unsigned char *ipc_base) {
             d->vertex_shader_id, d->pixel_shader_id);
         continue;
       }
-      if (!dx9mt_ipc_bulk_range_valid(bulk_off, bulk_used,
-                                      d->vs_bytecode_bulk_offset,
-                                      d->vs_bytecode_bulk_size) ||
-          !dx9mt_ipc_bulk_range_valid(bulk_off, bulk_used,
-                                      d->ps_bytecode_bulk_offset,
-                                      d->ps_bytecode_bulk_size)) {
-        ++diag.invalid_shader_bytecode;
-        dx9mt_diag_detail(
-            &diag, hdr->frame_id, i,
-            "invalid shader bytecode bulk range vs_off=%u vs_size=%u ps_off=%u ps_size=%u bulk_used=%u",
-            d->vs_bytecode_bulk_offset, d->vs_bytecode_bulk_size,
-            d->ps_bytecode_bulk_offset, d->ps_bytecode_bulk_size, bulk_used);
-        continue;
-      }
 
       {
-        const uint32_t *vs_bc = (const uint32_t *)(ipc_base + bulk_off +
-                                                   d->vs_bytecode_bulk_offset);
-        const uint32_t *ps_bc = (const uint32_t *)(ipc_base + bulk_off +
-                                                   d->ps_bytecode_bulk_offset);
-        uint32_t vs_dwords = d->vs_bytecode_bulk_size / 4;
-        uint32_t ps_dwords = d->ps_bytecode_bulk_size / 4;
-        uint32_t vs_ver = vs_bc[0] & 0xFFFF0000u;
-        uint32_t ps_ver = ps_bc[0] & 0xFFFF0000u;
-        uint32_t vs_hash;
-        uint32_t ps_hash;
+        uint32_t vs_hash = d->vs_bytecode_hash;
+        uint32_t ps_hash = d->ps_bytecode_hash;
+        id vs_entry = [s_vs_func_cache objectForKey:@(vs_hash)];
+        id ps_entry = [s_ps_func_cache objectForKey:@(ps_hash)];
         uint64_t pso_key;
+        uint32_t blend_word;
+        uint32_t blend_enable;
+        uint32_t src_blend;
+        uint32_t dest_blend;
+        uint32_t blendop;
+        uint32_t color_write;
         id<MTLFunction> vs_func;
         id<MTLFunction> ps_func;
 
-        if (vs_ver != 0xFFFE0000u || ps_ver != 0xFFFF0000u) {
-          ++diag.invalid_shader_bytecode;
+        if (!vs_entry || !ps_entry) {
+          /* Bytecode was attached on a frame this viewer did not see; the
+           * resync request makes the frontend re-attach it. */
+          ++diag.missing_shader_bytecode;
+          ++diag.shader_not_interned;
           dx9mt_diag_detail(
               &diag, hdr->frame_id, i,
-              "invalid shader bytecode version vs=0x%08x ps=0x%08x",
-              vs_bc[0], ps_bc[0]);
+              "shader not interned yet vs_hash=0x%08x ps_hash=0x%08x vs_id=%u ps_id=%u",
+              vs_hash, ps_hash, d->vertex_shader_id, d->pixel_shader_id);
           continue;
         }
-
-        vs_hash = dx9mt_sm_bytecode_hash(vs_bc, vs_dwords);
-        ps_hash = dx9mt_sm_bytecode_hash(ps_bc, ps_dwords);
-        vs_func = translate_and_compile_vs(vs_bc, vs_dwords, vs_hash);
-        ps_func = translate_and_compile_ps(ps_bc, ps_dwords, ps_hash);
+        vs_func = (vs_entry == (id)[NSNull null]) ? nil : vs_entry;
+        ps_func = (ps_entry == (id)[NSNull null]) ? nil : ps_entry;
         if (!vs_func || !ps_func) {
           ++diag.shader_translation_failed;
           dx9mt_diag_detail(
@@ -3310,28 +4005,33 @@ static void render_frame(const volatile unsigned char *ipc_base) {
           continue;
         }
 
+        blend_word = blend_block->blend;
+        blend_enable =
+            dx9mt_packed_get(blend_word, DX9MT_PACKED_ALPHABLENDENABLE);
+        src_blend = dx9mt_packed_get(blend_word, DX9MT_PACKED_SRCBLEND);
+        dest_blend = dx9mt_packed_get(blend_word, DX9MT_PACKED_DESTBLEND);
+        blendop = dx9mt_packed_get(blend_word, DX9MT_PACKED_BLENDOP);
+        color_write =
+            dx9mt_packed_get(blend_word, DX9MT_PACKED_COLORWRITEENABLE);
+
         pso_key = ((uint64_t)vs_hash << 32) | ps_hash;
         pso_key ^= (uint64_t)stride * 0x9E3779B97F4A7C15ULL;
-        pso_key ^= ((uint64_t)d->rs_alpha_blend_enable << 48) |
-                   ((uint64_t)d->rs_src_blend << 40) |
-                   ((uint64_t)d->rs_dest_blend << 32);
-        pso_key ^= ((uint64_t)d->rs_blendop << 24) |
-                   ((uint64_t)d->rs_colorwriteenable << 16);
+        pso_key ^= ((uint64_t)blend_enable << 48) |
+                   ((uint64_t)src_blend << 40) |
+                   ((uint64_t)dest_blend << 32);
+        pso_key ^= ((uint64_t)blendop << 24) | ((uint64_t)color_write << 16);
         pso_key ^= (uint64_t)draw_target_texture.pixelFormat << 8;
 
         translated_pso = create_translated_pso(
             vs_func, ps_func, vs_hash, ps_hash, elems, decl_count, stride,
-            draw_target_texture.pixelFormat, textured,
-            d->rs_alpha_blend_enable, d->rs_src_blend, d->rs_dest_blend,
-            d->rs_blendop, d->rs_colorwriteenable, pso_key);
+            draw_target_texture.pixelFormat, textured, blend_enable,
+            src_blend, dest_blend, blendop, color_write, pso_key);
         if (!translated_pso) {
           if (dx9mt_should_use_compat_textured_tint(vs_hash, ps_hash, stride,
                                                     textured,
                                                     target_is_drawable)) {
-            ensure_geometry_pso(stride, elems, decl_count, 1,
-                                d->rs_alpha_blend_enable, d->rs_src_blend,
-                                d->rs_dest_blend, d->rs_blendop,
-                                d->rs_colorwriteenable);
+            ensure_geometry_pso(stride, elems, decl_count, 1, blend_enable,
+                                src_blend, dest_blend, blendop, color_write);
             geometry_pso = s_geometry_textured_pso;
             if (geometry_pso) {
               use_compat_textured_tint = 1;
@@ -3360,53 +4060,14 @@ static void render_frame(const volatile unsigned char *ipc_base) {
 
         if (!use_compat_textured_tint &&
             dx9mt_should_use_scene_blit_fallback(vs_hash, ps_hash, stride,
-                                                 target_is_drawable, d) &&
+                                                 target_is_drawable,
+                                                 textures) &&
             stage_textures[1]) {
           use_scene_blit_fallback = 1;
           scene_blit_texture = stage_textures[1];
         }
       }
 
-      /* Create Metal buffers from IPC bulk data */
-      if (!dx9mt_ipc_bulk_range_valid(bulk_off, bulk_used, d->vb_bulk_offset,
-                                      d->vb_bulk_size) ||
-          !dx9mt_ipc_bulk_range_valid(bulk_off, bulk_used, d->ib_bulk_offset,
-                                      d->ib_bulk_size)) {
-        ++diag.skipped_empty_geometry;
-        dx9mt_diag_detail(
-            &diag, hdr->frame_id, i,
-            "invalid geometry bulk range vb_off=%u vb_size=%u ib_off=%u ib_size=%u bulk_used=%u",
-            d->vb_bulk_offset, d->vb_bulk_size, d->ib_bulk_offset,
-            d->ib_bulk_size, bulk_used);
-        continue;
-      }
-      const void *vb_data = (const void *)(ipc_base + bulk_off + d->vb_bulk_offset);
-      const void *ib_data = (const void *)(ipc_base + bulk_off + d->ib_bulk_offset);
-
-      id<MTLBuffer> vb_buf =
-          [s_device newBufferWithBytes:vb_data
-                               length:d->vb_bulk_size
-                              options:MTLResourceStorageModeShared];
-      if (!vb_buf) {
-        ++diag.skipped_empty_geometry;
-        dx9mt_diag_detail(&diag, hdr->frame_id, i,
-                          "failed to create vertex buffer len=%u",
-                          d->vb_bulk_size);
-        continue;
-      }
-
-      id<MTLBuffer> ib_buf =
-          [s_device newBufferWithBytes:ib_data
-                               length:d->ib_bulk_size
-                              options:MTLResourceStorageModeShared];
-      if (!ib_buf) {
-        ++diag.skipped_empty_geometry;
-        dx9mt_diag_detail(&diag, hdr->frame_id, i,
-                          "failed to create index buffer len=%u",
-                          d->ib_bulk_size);
-        continue;
-      }
-
       /* Set viewport from draw entry */
       if (d->viewport_width > 0 && d->viewport_height > 0) {
         MTLViewport vp;
@@ -3426,7 +4087,8 @@ static void render_frame(const volatile unsigned char *ipc_base) {
         uint32_t rt_w = target_is_drawable ? s_width : d->render_target_width;
         uint32_t rt_h = target_is_drawable ? s_height : d->render_target_height;
         MTLScissorRect sr;
-        if (d->rs_scissortestenable &&
+        if (dx9mt_packed_get(raster_block->raster,
+                             DX9MT_PACKED_SCISSORTESTENABLE) &&
             d->scissor_right > d->scissor_left &&
             d->scissor_bottom > d->scissor_top) {
           sr.x = (NSUInteger)d->scissor_left;
@@ -3513,6 +4175,13 @@ static void render_frame(const volatile unsigned char *ipc_base) {
           static const float zero[4] = {0, 0, 0, 0};
           [encoder setFragmentBytes:zero length:sizeof(zero) atIndex:0];
         }
+        /* i#/b# constants for rep/loop/if b# (Control_* in emitted MSL) */
+        [encoder setVertexBytes:(const void *)vs_control
+                         length:sizeof(dx9mt_shader_control_constants)
+                        atIndex:2];
+        [encoder setFragmentBytes:(const void *)ps_control
+                           length:sizeof(dx9mt_shader_control_constants)
+                          atIndex:1];
         for (uint32_t s = 0; s < DX9MT_MAX_PS_SAMPLERS; ++s) {
           [encoder setFragmentTexture:stage_textures[s] atIndex:s];
           [encoder setFragmentSamplerState:stage_samplers[s] atIndex:s];
@@ -3546,9 +4215,9 @@ static void render_frame(const volatile unsigned char *ipc_base) {
         frag_params.use_vertex_color = 0;
         frag_params.use_stage0_combiner = 0;
         frag_params.alpha_only =
-            (uint32_t)(d->tex_format[0] == D3DFMT_A8 ? 1 : 0);
+            (uint32_t)(textures->stage[0].format == D3DFMT_A8 ? 1 : 0);
         frag_params.force_alpha_one =
-            (uint32_t)(d->tex_format[0] == D3DFMT_X8R8G8B8 ? 1 : 0);
+            (uint32_t)(textures->stage[0].format == D3DFMT_X8R8G8B8 ? 1 : 0);
         frag_params.alpha_test_enable = 0;
         frag_params.alpha_func = 8;
         frag_params.color_op = 4;
@@ -3557,7 +4226,7 @@ static void render_frame(const volatile unsigned char *ipc_base) {
         frag_params.alpha_op = 2;
         frag_params.alpha_arg1 = 2;
         frag_params.alpha_arg2 = 1;
-        frag_params.texture_factor_argb = d->rs_texture_factor;
+        frag_params.texture_factor_argb = blend_block->texture_factor;
         frag_params.has_pixel_shader = 1;
         frag_params.ps_c0[0] = 1.0f;
         frag_params.ps_c0[1] = 1.0f;
@@ -3594,17 +4263,23 @@ static void render_frame(const volatile unsigned char *ipc_base) {
 
       /* RB4: set depth/stencil state per draw */
       {
-        id<MTLDepthStencilState> ds_state = depth_stencil_state_for_draw(d);
+        id<MTLDepthStencilState> ds_state = dx9mt_block_state(
+            block_depth_states,
+            state_index[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL]);
+        uint32_t ds_depth = ds_block->depth;
+        uint32_t ds_stencil = ds_block->stencil;
         if (ds_state) {
           [encoder setDepthStencilState:ds_state];
         }
-        if (d->rs_stencilenable) {
-          [encoder setStencilReferenceValue:d->rs_stencilref];
+        if (dx9mt_packed_get(ds_depth, DX9MT_PACKED_STENCILENABLE)) {
+          [encoder setStencilReferenceValue:
+                       dx9mt_packed_get(ds_stencil, DX9MT_PACKED_STENCILREF)];
         }
       }
 
       /* RB5: set cull mode per draw */
-      [encoder setCullMode:d3d_cull_to_mtl(d->rs_cull_mode)];
+      [encoder setCullMode:d3d_cull_to_mtl(dx9mt_packed_get(
+                               raster_block->raster, DX9MT_PACKED_CULLMODE))];
 
       [encoder drawIndexedPrimitives:d3d_prim_to_mtl(d->primitive_type)
                           indexCount:index_count
@@ -3637,14 +4312,51 @@ static void render_frame(const volatile unsigned char *ipc_base) {
       }
     }
 
+    /* Clears no later pass picked up still have to reach their targets. */
+    if (pending_clears.count > 0 && encoder) {
+      [encoder endEncoding];
+      encoder = nil;
+    }
+    for (NSNumber *target_key in [pending_clears allKeys]) {
+      dx9mt_pending_clear pending;
+      const volatile dx9mt_metal_ipc_draw *d;
+      id<MTLTexture> color_tex;
+      id<MTLTexture> depth_tex;
+      id<MTLRenderCommandEncoder> clear_encoder;
+
+      [[pending_clears objectForKey:target_key] getValue:&pending
+                                                    size:sizeof(pending)];
+      d = &draws[pending.command_index];
+      if ([target_key isEqual:drawable_key]) {
+        color_tex = drawable.texture;
+        depth_tex = ensure_drawable_depth_texture(s_width, s_height);
+      } else {
+        color_tex = render_target_texture_for_draw(d);
+        depth_tex = depth_texture_for_rt(d->render_target_id,
+                                         d->render_target_width,
+                                         d->render_target_height);
+      }
+      if (!color_tex) {
+        [pending_clears removeObjectForKey:target_key];
+        continue;
+      }
+      clear_encoder = begin_target_pass(
+          cmd_buf, color_tex, depth_tex, target_key,
+          [target_key isEqual:drawable_key], seen_targets, pending_clears);
+      [clear_encoder endEncoding];
+      [pending_clears removeObjectForKey:target_key];
+      ++diag.clears_flushed;
+    }
+
     dx9mt_diag_summary(hdr->frame_id, &diag);
     dx9mt_log_cohort_summary(hdr->frame_id, cohort_counts, &diag);
+    dx9mt_request_resync(hdr->frame_id, &diag);
 
     /* Overlay bar (draw count indicator from RB1) */
     if (s_overlay_pso && draw_count > 0 && s_width > 0 && s_height > 0) {
-      if (!encoder || !active_target_is_drawable) {
+      if (!encoder || !active_target_is_drawable || !active_has_depth) {
         MTLRenderPassDescriptor *overlay_desc;
-        BOOL seen_drawable = [cleared_targets containsObject:drawable_key];
+        BOOL seen_drawable = [seen_targets containsObject:drawable_key];
 
         if (encoder) {
           [encoder endEncoding];
@@ -3656,8 +4368,9 @@ static void render_frame(const volatile unsigned char *ipc_base) {
           overlay_desc.colorAttachments[0].loadAction = MTLLoadActionLoad;
         } else {
           overlay_desc.colorAttachments[0].loadAction = MTLLoadActionClear;
-          overlay_desc.colorAttachments[0].clearColor = MTLClearColorMake(r, g, b, a);
-          [cleared_targets addObject:drawable_key];
+          overlay_desc.colorAttachments[0].clearColor =
+              MTLClearColorMake(0, 0, 0, 1);
+          [seen_targets addObject:drawable_key];
         }
         /* RB4: overlay depth attachment (required by PSO, but unused) */
         {
@@ -3729,6 +4442,8 @@ static void render_frame(const volatile unsigned char *ipc_base) {
 @interface DX9MTViewerDelegate : NSObject <NSApplicationDelegate> {
   const volatile unsigned char *_ipc_base;
   uint32_t _last_seq;
+  uint32_t _last_repeat;
+  uint32_t _repeats_seen; /* repeated presents since the last new frame */
   NSTimer *_timer;
 }
 @end
@@ -3740,6 +4455,8 @@ static void render_frame(const volatile unsigned char *ipc_base) {
   if (self) {
     _ipc_base = base;
     _last_seq = 0;
+    _last_repeat = 0;
+    _repeats_seen = 0;
   }
   return self;
 }
@@ -3778,18 +4495,106 @@ static void render_frame(const volatile unsigned char *ipc_base) {
   }];
 }
 
+/* Renders (and dumps, if asked) one whole frame: a snapshot or a slot. */
+- (void)showFrame:(const volatile unsigned char *)frame {
+  const volatile dx9mt_metal_ipc_header *frame_hdr =
+      (const volatile dx9mt_metal_ipc_header *)frame;
+
+  if (_repeats_seen > 0) {
+    viewer_logf("INFO", "frame %u follows %u repeated presents",
+                frame_hdr->frame_id, _repeats_seen);
+    _repeats_seen = 0;
+  }
+
+  uint32_t w = frame_hdr->width;
+  uint32_t h = frame_hdr->height;
+  if (w > 0 && h > 0 && (w != s_width || h != s_height)) {
+    create_window(w, h);
+  }
+
+  if (s_dump_next_frame) {
+    s_dump_next_frame = 0;
+    dump_frame(frame);
+  }
+  if (s_dump_continuous) {
+    char name[64];
+    char path[PATH_MAX];
+    snprintf(name, sizeof(name), "dx9mt_frame_dump_%04u.txt", s_dump_seq++);
+    build_output_path(path, sizeof(path), name);
+    dump_frame_to(frame, path);
+  }
+
+  render_frame(frame);
+}
+
+/*
+ * Frame ring: claim the latest slot and render it in place. The backend
+ * never writes a claimed slot, and patches deltas into the slot of the
+ * frame they build on, so a slot always holds a whole frame and there is
+ * nothing to copy or re-check. Ring frames are never zero-copy.
+ */
+- (void)pollRingSlot {
+  volatile dx9mt_metal_ipc_header *control =
+      (volatile dx9mt_metal_ipc_header *)_ipc_base;
+  const volatile dx9mt_metal_ipc_header *frame_hdr;
+  const volatile unsigned char *frame;
+  uint32_t draw_count;
+  uint32_t bulk_off;
+  uint32_t bulk_used;
+  uint32_t seq;
+  int slot = dx9mt_metal_ipc_ring_acquire(control);
+
+  if (slot < 0) {
+    return; /* reclaimed for a newer frame; the next poll gets that one */
+  }
+  frame = dx9mt_metal_ipc_ring_slot(control, (uint32_t)slot);
+  frame_hdr = (const volatile dx9mt_metal_ipc_header *)frame;
+  seq = frame_hdr->sequence;
+  draw_count = frame_hdr->draw_count;
+  bulk_off = frame_hdr->bulk_data_offset;
+  bulk_used = frame_hdr->bulk_data_used;
+  if (seq != _last_seq && seq != 0 &&
+      frame_hdr->magic == DX9MT_METAL_IPC_MAGIC &&
+      draw_count <=
+          DX9MT_METAL_IPC_MAX_DRAWS_IN(DX9MT_METAL_IPC_RING_SLOT_BYTES) &&
+      bulk_off >= sizeof(dx9mt_metal_ipc_header) +
+                      (size_t)draw_count * sizeof(dx9mt_metal_ipc_draw) &&
+      bulk_off <= DX9MT_METAL_IPC_RING_SLOT_BYTES &&
+      bulk_used <= DX9MT_METAL_IPC_RING_SLOT_BYTES - bulk_off &&
+      frame_hdr->arena_data_size == 0) {
+    _last_seq = seq;
+    [self showFrame:frame];
+  }
+  dx9mt_metal_ipc_ring_release(control, slot);
+}
+
 - (void)pollAndRender {
   const volatile dx9mt_metal_ipc_header *hdr =
       (const volatile dx9mt_metal_ipc_header *)_ipc_base;
   dx9mt_metal_ipc_header header_copy;
-  const dx9mt_metal_ipc_header *snapshot_hdr;
   size_t min_bytes;
   size_t snapshot_bytes;
+  size_t arena_reserved;
   uint32_t seq = __atomic_load_n(&hdr->sequence, __ATOMIC_ACQUIRE);
+  uint32_t repeat = __atomic_load_n(&hdr->repeat_count, __ATOMIC_ACQUIRE);
   uint32_t seq_after;
+  int patched;
+  if (repeat != _last_repeat) {
+    /*
+     * The backend presented the published frame again. Our drawable still
+     * shows it, so there is nothing to snapshot or render.
+     */
+    _repeats_seen += repeat - _last_repeat;
+    _last_repeat = repeat;
+  }
   if (seq == _last_seq || seq == 0) {
     return;
   }
+  if (__atomic_load_n(&hdr->backend_caps, __ATOMIC_RELAXED) &
+      DX9MT_METAL_IPC_CAP_FRAME_RING) {
+    [self pollRingSlot];
+    return;
+  }
 
   memcpy(&header_copy, (const void *)_ipc_base, sizeof(header_copy));
   if (header_copy.magic != DX9MT_METAL_IPC_MAGIC ||
@@ -3806,42 +4611,54 @@ static void render_frame(const volatile unsigned char *ipc_base) {
     return;
   }
 
-  snapshot_bytes = (size_t)header_copy.bulk_data_offset +
-                   (size_t)header_copy.bulk_data_used;
-  if (!dx9mt_ensure_frame_snapshot_capacity(snapshot_bytes)) {
-    viewer_logf("ERROR", "failed to allocate IPC snapshot buffer (%zu bytes)",
-                snapshot_bytes);
+  /*
+   * Zero-copy frames leave the first align16(arena_data_size) bulk bytes
+   * unwritten; their contents live in the upload arena part of the mapping.
+   */
+  arena_reserved = ((size_t)header_copy.arena_data_size + 15u) & ~(size_t)15u;
+  if (header_copy.arena_data_size > 0 &&
+      (header_copy.arena_data_offset < DX9MT_METAL_IPC_ARENA_OFFSET ||
+       (size_t)header_copy.arena_data_offset +
+               header_copy.arena_data_size > s_ipc_mapped_size ||
+       arena_reserved > header_copy.bulk_data_used)) {
     return;
   }
 
-  memcpy(s_frame_snapshot, (const void *)_ipc_base, snapshot_bytes);
+  snapshot_bytes = (size_t)header_copy.bulk_data_offset +
+                   (size_t)header_copy.bulk_data_used;
+  /* A delta against the frame we hold only needs its changes. */
+  patched = header_copy.base_sequence != 0 &&
+            header_copy.base_sequence == _last_seq &&
+            dx9mt_patch_frame_snapshot(_ipc_base, &header_copy, snapshot_bytes);
+  if (!patched) {
+    if (!dx9mt_ensure_frame_snapshot_capacity(snapshot_bytes)) {
+      viewer_logf("ERROR",
+                  "failed to allocate IPC snapshot buffer (%zu bytes)",
+                  snapshot_bytes);
+      return;
+    }
+    if (header_copy.arena_data_size > 0) {
+      size_t bulk_start = header_copy.bulk_data_offset;
+      memcpy(s_frame_snapshot, (const void *)_ipc_base, bulk_start);
+      memcpy(s_frame_snapshot + bulk_start,
+             (const void *)(_ipc_base + header_copy.arena_data_offset),
+             header_copy.arena_data_size);
+      memcpy(s_frame_snapshot + bulk_start + arena_reserved,
+             (const void *)(_ipc_base + bulk_start + arena_reserved),
+             snapshot_bytes - bulk_start - arena_reserved);
+    } else {
+      memcpy(s_frame_snapshot, (const void *)_ipc_base, snapshot_bytes);
+    }
+  }
   seq_after = __atomic_load_n(&hdr->sequence, __ATOMIC_ACQUIRE);
   if (seq_after != seq || seq_after == 0) {
+    /* The held snapshot is torn; the next frame must be copied whole. */
+    _last_seq = 0;
     return;
   }
 
-  snapshot_hdr = (const dx9mt_metal_ipc_header *)s_frame_snapshot;
   _last_seq = seq;
-
-  uint32_t w = snapshot_hdr->width;
-  uint32_t h = snapshot_hdr->height;
-  if (w > 0 && h > 0 && (w != s_width || h != s_height)) {
-    create_window(w, h);
-  }
-
-  if (s_dump_next_frame) {
-    s_dump_next_frame = 0;
-    dump_frame((const volatile unsigned char *)s_frame_snapshot);
-  }
-  if (s_dump_continuous) {
-    char name[64];
-    char path[PATH_MAX];
-    snprintf(name, sizeof(name), "dx9mt_frame_dump_%04u.txt", s_dump_seq++);
-    build_output_path(path, sizeof(path), name);
-    dump_frame_to((const volatile unsigned char *)s_frame_snapshot, path);
-  }
-
-  render_frame((const volatile unsigned char *)s_frame_snapshot);
+  [self showFrame:(const volatile unsigned char *)s_frame_snapshot];
 }
 
 
@@ -3868,7 +4685,11 @@ int main(int argc, const char *argv[]) {
   (void)argc;
   (void)argv;
 
-  fd = open(DX9MT_METAL_IPC_PATH, O_RDONLY);
+  /*
+   * Writable only to announce viewer_caps, request resyncs and claim ring
+   * slots; frames are read-only to us.
+   */
+  fd = open(DX9MT_METAL_IPC_PATH, O_RDWR);
   if (fd < 0) {
     fprintf(stderr,
             "dx9mt_metal_viewer: cannot open %s (create it before launching)\n",
@@ -3883,12 +4704,28 @@ int main(int argc, const char *argv[]) {
     return 1;
   }
 
-  mapped = mmap(NULL, DX9MT_METAL_IPC_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+  /* A file with room for the upload arena enables zero-copy frames. */
+  s_ipc_mapped_size = (size_t)st.st_size >= DX9MT_METAL_IPC_ZERO_COPY_SIZE
+                          ? DX9MT_METAL_IPC_ZERO_COPY_SIZE
+                          : DX9MT_METAL_IPC_SIZE;
+  mapped = mmap(NULL, s_ipc_mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
   close(fd);
   if (mapped == MAP_FAILED) {
     fprintf(stderr, "dx9mt_metal_viewer: mmap failed\n");
     return 1;
   }
+  s_ipc_control = (volatile dx9mt_metal_ipc_header *)mapped;
+  __atomic_store_n(&((dx9mt_metal_ipc_header *)mapped)->viewer_caps,
+                   DX9MT_METAL_IPC_CAPS_VALID | DX9MT_METAL_IPC_CAPS_ALL,
+                   __ATOMIC_RELEASE);
+  /* A viewer that exited mid-frame left its ring slot claimed. */
+  for (uint32_t i = 0; i < DX9MT_METAL_IPC_RING_SLOTS; ++i) {
+    uint32_t expected = DX9MT_METAL_IPC_SLOT_READING;
+    __atomic_compare_exchange_n(
+        &((dx9mt_metal_ipc_header *)mapped)->ring_state[i], &expected,
+        DX9MT_METAL_IPC_SLOT_READY, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+  }
 
   if (init_metal() != 0) {
     return 1;
@@ -3903,6 +4740,6 @@ int main(int argc, const char *argv[]) {
     [app run];
   }
 
-  munmap(mapped, DX9MT_METAL_IPC_SIZE);
+  munmap(mapped, s_ipc_mapped_size);
   return 0;
 }
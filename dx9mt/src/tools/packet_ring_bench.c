@@ -0,0 +1,248 @@
+/*
+ * Microbenchmark for frontend packet batching: per-draw cost of handing
+ * packets to dx9mt_backend_bridge_submit_packets one call at a time vs. in
+ * batches through the packet ring. Each draw is the steady-state stream the
+ * frontend emits (one changed state group + a slim DRAW).
+ *
+ * Natively the per-call cost is only the backend's entry/parse overhead.
+ * Under Wine every submit is also a PE->unixlib transition, so the
+ * "+transition" column adds DX9MT_BENCH_TRANSITION_NS per call (default
+ * 1000 ns; set the env var to a value measured on the target machine).
+ *
+ *   make bench-native BACKEND_CC=gcc
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dx9mt/backend_bridge.h"
+#include "dx9mt/packet_ring.h"
+#include "dx9mt/packets.h"
+
+#define BENCH_FRAMES 200u
+#define BENCH_DRAWS_PER_FRAME 2000u
+#define BENCH_RING_BYTES (1u << 20)
+
+static unsigned char g_ring_storage[BENCH_RING_BYTES];
+static uint32_t g_sequence;
+static uint32_t g_submit_calls;
+
+static double bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int bench_counting_sink(const dx9mt_packet_header *packets,
+                               uint32_t packet_bytes) {
+  ++g_submit_calls;
+  return dx9mt_backend_bridge_submit_packets(packets, packet_bytes);
+}
+
+typedef struct bench_packets {
+  uint32_t words[512];
+  uint32_t used;
+} bench_packets;
+
+static void *bench_push(bench_packets *packets, uint16_t type, uint32_t size) {
+  dx9mt_packet_header *header =
+      (dx9mt_packet_header *)((unsigned char *)packets->words + packets->used);
+
+  assert(packets->used + size <= sizeof(packets->words));
+  memset(header, 0, size);
+  header->type = type;
+  header->size = (uint16_t)size;
+  header->sequence = ++g_sequence;
+  packets->used += size;
+  return header;
+}
+
+static void bench_push_keyframe(bench_packets *packets) {
+  dx9mt_packet_state_shader_control *control;
+  uint32_t stage;
+
+  bench_push(packets, DX9MT_PACKET_STATE_DEPTH_STENCIL,
+             sizeof(dx9mt_packet_state_depth_stencil));
+  bench_push(packets, DX9MT_PACKET_STATE_BLEND,
+             sizeof(dx9mt_packet_state_blend));
+  bench_push(packets, DX9MT_PACKET_STATE_RASTER,
+             sizeof(dx9mt_packet_state_raster));
+  bench_push(packets, DX9MT_PACKET_STATE_VIEWPORT,
+             sizeof(dx9mt_packet_state_viewport));
+  control = bench_push(packets, DX9MT_PACKET_STATE_SHADER_CONTROL,
+                       sizeof(*control));
+  control->shader_stage = DX9MT_SHADER_STAGE_VERTEX;
+  control = bench_push(packets, DX9MT_PACKET_STATE_SHADER_CONTROL,
+                       sizeof(*control));
+  control->shader_stage = DX9MT_SHADER_STAGE_PIXEL;
+  for (stage = 0; stage < DX9MT_MAX_PS_SAMPLERS; ++stage) {
+    dx9mt_packet_state_sampler *sampler = bench_push(
+        packets, DX9MT_PACKET_STATE_SAMPLER, sizeof(*sampler));
+    dx9mt_packet_state_texture_stage *texture = bench_push(
+        packets, DX9MT_PACKET_STATE_TEXTURE_STAGE, sizeof(*texture));
+    sampler->stage = stage;
+    texture->stage = stage;
+  }
+}
+
+static void bench_push_draw(bench_packets *packets, uint32_t index) {
+  dx9mt_packet_state_blend *blend;
+  dx9mt_packet_draw *draw;
+
+  blend = bench_push(packets, DX9MT_PACKET_STATE_BLEND, sizeof(*blend));
+  blend->state.blend =
+      dx9mt_packed_set(0, DX9MT_PACKED_ALPHABLENDENABLE, index & 1u);
+  draw = bench_push(packets, DX9MT_PACKET_DRAW, sizeof(*draw));
+  draw->primitive_type = 4;
+  draw->primitive_count = 64;
+  draw->render_target_id = 0x05000001u;
+  draw->vertex_buffer_id = 0x03000001u + (index & 7u);
+  draw->index_buffer_id = 0x03000101u;
+  draw->vertex_decl_id = 0x0A000001u;
+  draw->stream0_stride = 32;
+}
+
+static void bench_submit(dx9mt_packet_ring *ring, const bench_packets *packets) {
+  int result = dx9mt_packet_ring_append(
+      ring, (const dx9mt_packet_header *)packets->words, packets->used);
+  assert(result == 0);
+  (void)result;
+}
+
+static void bench_threshold(uint32_t flush_bytes, double transition_ns) {
+  dx9mt_backend_init_desc init_desc;
+  dx9mt_backend_present_target_desc target_desc;
+  dx9mt_packet_ring ring;
+  uint32_t frame;
+  double start, elapsed;
+  double draws = (double)BENCH_FRAMES * BENCH_DRAWS_PER_FRAME;
+  double per_draw, calls_per_frame;
+
+  memset(&init_desc, 0, sizeof(init_desc));
+  init_desc.protocol_version = DX9MT_PROTOCOL_VERSION;
+  init_desc.capabilities = DX9MT_PROTOCOL_CAPS_ALL;
+  init_desc.ring_capacity_bytes = BENCH_RING_BYTES;
+  init_desc.upload_desc.slot_count = 3;
+  init_desc.upload_desc.bytes_per_slot = 1u << 20;
+  memset(&target_desc, 0, sizeof(target_desc));
+  target_desc.target_id = 1;
+  target_desc.width = 1280;
+  target_desc.height = 720;
+  target_desc.format = 21;
+  target_desc.windowed = 1;
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+
+  dx9mt_packet_ring_init(&ring, g_ring_storage, BENCH_RING_BYTES, flush_bytes,
+                         bench_counting_sink);
+  g_sequence = 0;
+  g_submit_calls = 0;
+
+  start = bench_now_ns();
+  for (frame = 1; frame <= BENCH_FRAMES; ++frame) {
+    bench_packets packets;
+    dx9mt_packet_begin_frame *begin;
+    dx9mt_packet_present *present;
+    uint32_t draw;
+
+    packets.used = 0;
+    begin = bench_push(&packets, DX9MT_PACKET_BEGIN_FRAME, sizeof(*begin));
+    begin->frame_id = frame;
+    bench_submit(&ring, &packets);
+
+    packets.used = 0;
+    bench_push_keyframe(&packets);
+    bench_submit(&ring, &packets);
+
+    for (draw = 0; draw < BENCH_DRAWS_PER_FRAME; ++draw) {
+      packets.used = 0;
+      bench_push_draw(&packets, draw);
+      bench_submit(&ring, &packets);
+    }
+
+    packets.used = 0;
+    present = bench_push(&packets, DX9MT_PACKET_PRESENT, sizeof(*present));
+    present->frame_id = frame;
+    bench_submit(&ring, &packets);
+    assert(dx9mt_packet_ring_flush(&ring) == 0);
+    assert(dx9mt_backend_bridge_present(frame) == 0);
+  }
+  elapsed = bench_now_ns() - start;
+  dx9mt_backend_bridge_shutdown();
+
+  per_draw = elapsed / draws;
+  calls_per_frame = (double)g_submit_calls / BENCH_FRAMES;
+  printf("flush %8u B  calls/frame %8.1f  max_batch %5u pkts  "
+         "%7.1f ns/draw  +transition %8.1f ns/draw\n",
+         flush_bytes, calls_per_frame, ring.stats.max_batch_packets, per_draw,
+         per_draw + calls_per_frame * transition_ns / BENCH_DRAWS_PER_FRAME);
+}
+
+/* Sanity: order is kept across pressure flushes and oversized appends. */
+static uint32_t g_check_last_sequence;
+static uint32_t g_check_packets;
+
+static int bench_check_sink(const dx9mt_packet_header *packets,
+                            uint32_t packet_bytes) {
+  uint32_t offset = 0;
+
+  while (offset < packet_bytes) {
+    const dx9mt_packet_header *header =
+        (const dx9mt_packet_header *)((const unsigned char *)packets + offset);
+    assert(header->sequence == g_check_last_sequence + 1u);
+    g_check_last_sequence = header->sequence;
+    ++g_check_packets;
+    offset += header->size;
+  }
+  assert(offset == packet_bytes);
+  return 0;
+}
+
+static void bench_check_ring(void) {
+  static uint32_t storage[256];
+  dx9mt_packet_ring ring;
+  bench_packets packets;
+  uint32_t i;
+
+  g_sequence = 0;
+  dx9mt_packet_ring_init(&ring, storage, sizeof(storage), 512, bench_check_sink);
+  for (i = 0; i < 64; ++i) {
+    packets.used = 0;
+    if (i % 16 == 15) {
+      bench_push_keyframe(&packets); /* larger than the whole ring */
+    } else {
+      bench_push_draw(&packets, i);
+    }
+    assert(dx9mt_packet_ring_append(
+               &ring, (const dx9mt_packet_header *)packets.words,
+               packets.used) == 0);
+    assert(ring.used < ring.flush_threshold);
+  }
+  assert(dx9mt_packet_ring_flush(&ring) == 0);
+  assert(ring.used == 0);
+  assert(g_check_packets == g_sequence);
+  assert(ring.stats.packets == g_sequence);
+  assert(ring.stats.threshold_flushes > 0 && ring.stats.failed_flushes == 0);
+}
+
+int main(void) {
+  static const uint32_t thresholds[] = {0u,         1u << 10,  4u << 10,
+                                        16u << 10,  64u << 10, 256u << 10,
+                                        BENCH_RING_BYTES};
+  const char *transition_env = getenv("DX9MT_BENCH_TRANSITION_NS");
+  double transition_ns = transition_env ? atof(transition_env) : 1000.0;
+  uint32_t i;
+
+  bench_check_ring();
+  printf("%u frames x %u draws, %.0f ns assumed per submit transition\n",
+         BENCH_FRAMES, BENCH_DRAWS_PER_FRAME, transition_ns);
+  for (i = 0; i < sizeof(thresholds) / sizeof(thresholds[0]); ++i) {
+    bench_threshold(thresholds[i], transition_ns);
+  }
+  printf("packet_ring_bench: done\n");
+  return 0;
+}
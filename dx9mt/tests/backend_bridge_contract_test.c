@@ -1,17 +1,30 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "dx9mt/backend_bridge.h"
+#include "dx9mt/draw_range.h"
+#include "dx9mt/draw_state.h"
+#include "dx9mt/metal_ipc.h"
+#include "dx9mt/packet_capture.h"
 #include "dx9mt/packets.h"
 
-#define TEST_DRAW_CAPTURE_OVERFLOW_COUNT 8256u
+/* Past the old 8192-command backend array and 2048-entry IPC table. */
+#define TEST_HEAVY_FRAME_DRAWS 8256u
+#define TEST_HEAVY_FRAME_IPC_PATH "/tmp/dx9mt_contract_heavy_ipc.bin"
+/* Past the backend's 65536-command cap (256 chunks of 256). */
+#define TEST_DRAW_CAPTURE_OVERFLOW_COUNT (65536u + 64u)
 
 static dx9mt_backend_init_desc make_init_desc(void) {
   dx9mt_backend_init_desc desc;
   memset(&desc, 0, sizeof(desc));
-  desc.protocol_version = 1;
+  desc.protocol_version = DX9MT_PROTOCOL_VERSION;
+  desc.capabilities = DX9MT_PROTOCOL_CAPS_ALL;
   desc.ring_capacity_bytes = 1u << 20;
   desc.upload_desc.slot_count = 8;
   desc.upload_desc.bytes_per_slot = 1u << 20;
@@ -31,6 +44,7 @@ static dx9mt_backend_present_target_desc make_target_desc(void) {
 
 static dx9mt_packet_draw_indexed make_valid_draw_packet(uint32_t sequence) {
   dx9mt_packet_draw_indexed packet;
+  dx9mt_state_depth_stencil *ds;
   memset(&packet, 0, sizeof(packet));
   packet.header.type = DX9MT_PACKET_DRAW_INDEXED;
   packet.header.size = (uint16_t)sizeof(packet);
@@ -59,29 +73,26 @@ static dx9mt_packet_draw_indexed make_valid_draw_packet(uint32_t sequence) {
   packet.constants_ps.offset = 4096;
   packet.constants_ps.size = 4096;
   packet.state_block_hash = 0x0BADF00Du;
-  /* RB4: depth/stencil defaults (D3D9 defaults) */
-  packet.rs_zenable = 1;          /* D3DZB_TRUE */
-  packet.rs_zwriteenable = 1;     /* TRUE */
-  packet.rs_zfunc = 4;            /* D3DCMP_LESSEQUAL */
-  packet.rs_stencilenable = 0;    /* FALSE */
-  packet.rs_stencilfunc = 8;      /* D3DCMP_ALWAYS */
-  packet.rs_stencilref = 0;
-  packet.rs_stencilmask = 0xFFFFFFFFu;
-  packet.rs_stencilwritemask = 0xFFFFFFFFu;
-  packet.rs_cull_mode = 2;          /* D3DCULL_CCW */
-  /* RB6: in-game rendering defaults */
-  packet.rs_scissortestenable = 0;  /* FALSE */
-  packet.rs_blendop = 1;            /* D3DBLENDOP_ADD */
-  packet.rs_colorwriteenable = 0xF; /* all channels */
-  packet.rs_stencilpass = 1;        /* D3DSTENCILOP_KEEP */
-  packet.rs_stencilfail = 1;        /* D3DSTENCILOP_KEEP */
-  packet.rs_stencilzfail = 1;       /* D3DSTENCILOP_KEEP */
-  packet.rs_fogenable = 0;          /* FALSE */
-  packet.rs_fogcolor = 0;
-  packet.rs_fogstart = 0.0f;
-  packet.rs_fogend = 1.0f;
-  packet.rs_fogdensity = 1.0f;
-  packet.rs_fogtablemode = 0;       /* D3DFOG_NONE */
+  /* D3D9 defaults for the render states replay reads */
+  ds = &packet.render_state.depth_stencil;
+  ds->depth = dx9mt_packed_set(ds->depth, DX9MT_PACKED_ZENABLE, 1);
+  ds->depth = dx9mt_packed_set(ds->depth, DX9MT_PACKED_ZWRITEENABLE, 1);
+  ds->depth = dx9mt_packed_set(ds->depth, DX9MT_PACKED_ZFUNC, 4);
+  ds->depth = dx9mt_packed_set(ds->depth, DX9MT_PACKED_STENCILFUNC, 8);
+  ds->depth = dx9mt_packed_set(ds->depth, DX9MT_PACKED_STENCILPASS, 1);
+  ds->depth = dx9mt_packed_set(ds->depth, DX9MT_PACKED_STENCILFAIL, 1);
+  ds->depth = dx9mt_packed_set(ds->depth, DX9MT_PACKED_STENCILZFAIL, 1);
+  ds->stencil =
+      dx9mt_packed_set(ds->stencil, DX9MT_PACKED_STENCILMASK, 0xFFFFFFFFu);
+  ds->stencil =
+      dx9mt_packed_set(ds->stencil, DX9MT_PACKED_STENCILWRITEMASK, 0xFFFFFFFFu);
+  packet.render_state.blend.blend =
+      dx9mt_packed_set(dx9mt_packed_set(0, DX9MT_PACKED_BLENDOP, 1),
+                       DX9MT_PACKED_COLORWRITEENABLE, 0xF);
+  packet.render_state.raster.raster =
+      dx9mt_packed_set(0, DX9MT_PACKED_CULLMODE, 2); /* D3DCULL_CCW */
+  packet.render_state.raster.fogend = 1.0f;
+  packet.render_state.raster.fogdensity = 1.0f;
   return packet;
 }
 
@@ -243,16 +254,69 @@ static void test_rejects_present_packet_frame_mismatch(void) {
   dx9mt_backend_bridge_shutdown();
 }
 
+/*
+ * Command storage grows with the frame: a heavy frame reaches the IPC
+ * table whole instead of being truncated.
+ */
+static void test_heavy_frame_keeps_every_draw(void) {
+  dx9mt_backend_init_desc init_desc;
+  dx9mt_backend_present_target_desc target_desc;
+  dx9mt_packet_draw_indexed draw_packet;
+  dx9mt_packet_present present_packet;
+  dx9mt_backend_ipc_stats ipc;
+  uint32_t i;
+
+  init_desc = make_init_desc();
+  target_desc = make_target_desc();
+  setenv("DX9MT_BACKEND_IPC_PATH", TEST_HEAVY_FRAME_IPC_PATH, 1);
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  unsetenv("DX9MT_BACKEND_IPC_PATH");
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+  assert(dx9mt_backend_bridge_begin_frame(1) == 0);
+
+  for (i = 0; i < TEST_HEAVY_FRAME_DRAWS; ++i) {
+    draw_packet = make_valid_draw_packet(i + 1);
+    draw_packet.constants_vs.offset = (i * 16u) % ((1u << 20) - 4096u);
+    draw_packet.constants_ps.offset =
+        ((i * 16u) + 8192u) % ((1u << 20) - 4096u);
+    assert(dx9mt_backend_bridge_submit_packets(&draw_packet.header,
+                                               (uint32_t)sizeof(draw_packet)) ==
+           0);
+  }
+
+  memset(&present_packet, 0, sizeof(present_packet));
+  present_packet.header.type = DX9MT_PACKET_PRESENT;
+  present_packet.header.size = (uint16_t)sizeof(present_packet);
+  present_packet.header.sequence = TEST_HEAVY_FRAME_DRAWS + 1u;
+  present_packet.frame_id = 1;
+  assert(dx9mt_backend_bridge_submit_packets(&present_packet.header,
+                                             (uint32_t)sizeof(present_packet)) ==
+         0);
+  assert(dx9mt_backend_bridge_present(1) == 0);
+  dx9mt_backend_bridge_debug_get_ipc_stats(&ipc);
+  assert(ipc.draw_count == TEST_HEAVY_FRAME_DRAWS);
+  assert(ipc.draws_dropped == 0);
+  dx9mt_backend_bridge_shutdown();
+  remove(TEST_HEAVY_FRAME_IPC_PATH);
+}
+
+/*
+ * A frame past the command cap drops the excess, reports it, and still
+ * presents what it kept.
+ */
 static void test_accepts_draw_capture_overflow_and_presents(void) {
   dx9mt_backend_init_desc init_desc;
   dx9mt_backend_present_target_desc target_desc;
   dx9mt_packet_draw_indexed draw_packet;
   dx9mt_packet_present present_packet;
+  dx9mt_backend_ipc_stats ipc;
   uint32_t i;
 
   init_desc = make_init_desc();
   target_desc = make_target_desc();
+  setenv("DX9MT_BACKEND_IPC_PATH", TEST_HEAVY_FRAME_IPC_PATH, 1);
   assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  unsetenv("DX9MT_BACKEND_IPC_PATH");
   assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
   assert(dx9mt_backend_bridge_begin_frame(1) == 0);
 
@@ -275,7 +339,12 @@ static void test_accepts_draw_capture_overflow_and_presents(void) {
                                              (uint32_t)sizeof(present_packet)) ==
          0);
   assert(dx9mt_backend_bridge_present(1) == 0);
+  dx9mt_backend_bridge_debug_get_ipc_stats(&ipc);
+  assert(ipc.draws_dropped > 0);
+  assert(ipc.draw_count + ipc.draws_dropped ==
+         TEST_DRAW_CAPTURE_OVERFLOW_COUNT);
   dx9mt_backend_bridge_shutdown();
+  remove(TEST_HEAVY_FRAME_IPC_PATH);
 }
 
 static void test_replay_hash_changes_with_draw_payload(void) {
@@ -328,7 +397,202 @@ static void test_replay_hash_changes_with_draw_payload(void) {
   assert(second_hash != 0);
   assert(second_hash != first_hash);
 
+  /* Same draw, only a b# register flipped: static branches differ. */
+  assert(dx9mt_backend_bridge_begin_frame(3) == 0);
+  draw_packet = make_valid_draw_packet(5);
+  draw_packet.texture_stage_hash ^= 0x00FF00FFu;
+  draw_packet.constants_vs.offset += 256u;
+  draw_packet.control_ps.b_mask = 1u << 3;
+  assert(dx9mt_backend_bridge_submit_packets(&draw_packet.header,
+                                             (uint32_t)sizeof(draw_packet)) ==
+         0);
+  present_packet.header.sequence = 6;
+  present_packet.frame_id = 3;
+  assert(dx9mt_backend_bridge_submit_packets(&present_packet.header,
+                                             (uint32_t)sizeof(present_packet)) ==
+         0);
+  assert(dx9mt_backend_bridge_present(3) == 0);
+  assert(dx9mt_backend_bridge_debug_get_last_replay_hash() != second_hash);
+
+  dx9mt_backend_bridge_shutdown();
+}
+
+/*
+ * Static VB/IB draws reference the persistent store by id + generation and
+ * usually carry no geometry upload. The backend must accept them, and a new
+ * generation alone has to change the replay hash.
+ */
+static uint32_t replay_hash_for_persistent_buffer_draw(uint32_t vb_generation) {
+  dx9mt_backend_init_desc init_desc;
+  dx9mt_backend_present_target_desc target_desc;
+  dx9mt_packet_draw_indexed draw_packet;
+  dx9mt_packet_present present_packet;
+  uint32_t hash;
+
+  init_desc = make_init_desc();
+  target_desc = make_target_desc();
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+  assert(dx9mt_backend_bridge_begin_frame(1) == 0);
+
+  draw_packet = make_valid_draw_packet(1);
+  draw_packet.vertex_update.generation = vb_generation;
+  draw_packet.vertex_update.buffer_size = 1024;
+  draw_packet.index_update.generation = 1;
+  draw_packet.index_update.buffer_size = 256;
+  assert(dx9mt_backend_bridge_submit_packets(&draw_packet.header,
+                                             (uint32_t)sizeof(draw_packet)) ==
+         0);
+  memset(&present_packet, 0, sizeof(present_packet));
+  present_packet.header.type = DX9MT_PACKET_PRESENT;
+  present_packet.header.size = (uint16_t)sizeof(present_packet);
+  present_packet.header.sequence = 2;
+  present_packet.frame_id = 1;
+  assert(dx9mt_backend_bridge_submit_packets(&present_packet.header,
+                                             (uint32_t)sizeof(present_packet)) ==
+         0);
+  assert(dx9mt_backend_bridge_present(1) == 0);
+  hash = dx9mt_backend_bridge_debug_get_last_replay_hash();
   dx9mt_backend_bridge_shutdown();
+  return hash;
+}
+
+static void test_persistent_buffer_generation_feeds_replay_hash(void) {
+  uint32_t first_hash = replay_hash_for_persistent_buffer_draw(1);
+  uint32_t same_hash = replay_hash_for_persistent_buffer_draw(1);
+  uint32_t bumped_hash = replay_hash_for_persistent_buffer_draw(2);
+
+  assert(first_hash != 0);
+  assert(same_hash == first_hash);
+  assert(bumped_hash != first_hash);
+}
+
+/*
+ * A buffer update must land inside its buffer and advance the generation;
+ * the viewer patches its cached copy at update.offset without re-checking.
+ */
+static void test_rejects_out_of_range_buffer_update(void) {
+  dx9mt_backend_init_desc init_desc;
+  dx9mt_backend_present_target_desc target_desc;
+  dx9mt_packet_draw_indexed draw_packet;
+
+  init_desc = make_init_desc();
+  target_desc = make_target_desc();
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+
+  draw_packet = make_valid_draw_packet(1);
+  draw_packet.vertex_data_size = 64;
+  draw_packet.vertex_update.generation = 2;
+  draw_packet.vertex_update.base_generation = 1;
+  draw_packet.vertex_update.offset = 0;
+  draw_packet.vertex_update.buffer_size = 32;
+  assert(dx9mt_backend_bridge_submit_packets(&draw_packet.header,
+                                             (uint32_t)sizeof(draw_packet)) ==
+         -1);
+
+  draw_packet = make_valid_draw_packet(2);
+  draw_packet.vertex_data_size = 64;
+  draw_packet.vertex_update.generation = 2;
+  draw_packet.vertex_update.base_generation = 1;
+  draw_packet.vertex_update.offset = 1000;
+  draw_packet.vertex_update.buffer_size = 1024;
+  assert(dx9mt_backend_bridge_submit_packets(&draw_packet.header,
+                                             (uint32_t)sizeof(draw_packet)) ==
+         -1);
+
+  draw_packet = make_valid_draw_packet(3);
+  draw_packet.vertex_data_size = 64;
+  draw_packet.vertex_update.generation = 2;
+  draw_packet.vertex_update.base_generation = 2;
+  draw_packet.vertex_update.buffer_size = 1024;
+  assert(dx9mt_backend_bridge_submit_packets(&draw_packet.header,
+                                             (uint32_t)sizeof(draw_packet)) ==
+         -1);
+
+  dx9mt_backend_bridge_shutdown();
+
+  /* Versioned updates are only valid once resource handles are agreed. */
+  init_desc.capabilities &= ~(uint32_t)DX9MT_PROTOCOL_CAP_RESOURCE_HANDLES;
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+  draw_packet = make_valid_draw_packet(1);
+  draw_packet.vertex_data_size = 64;
+  draw_packet.vertex_update.generation = 1;
+  draw_packet.vertex_update.buffer_size = 1024;
+  assert(dx9mt_backend_bridge_submit_packets(&draw_packet.header,
+                                             (uint32_t)sizeof(draw_packet)) ==
+         -1);
+  draw_packet = make_valid_draw_packet(2);
+  draw_packet.vertex_data_size = 64;
+  assert(dx9mt_backend_bridge_submit_packets(&draw_packet.header,
+                                             (uint32_t)sizeof(draw_packet)) ==
+         0);
+
+  dx9mt_backend_bridge_shutdown();
+}
+
+static void test_constant_deltas_are_bounded(void) {
+  dx9mt_backend_init_desc init_desc;
+  dx9mt_backend_present_target_desc target_desc;
+  dx9mt_packet_draw_indexed draw_packet;
+
+  init_desc = make_init_desc();
+  target_desc = make_target_desc();
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+
+  /* Unchanged constants travel as empty refs. */
+  draw_packet = make_valid_draw_packet(1);
+  memset(&draw_packet.constants_ps, 0, sizeof(draw_packet.constants_ps));
+  draw_packet.constants_vs.size = 64;
+  draw_packet.constants_vs_start = 252;
+  assert(dx9mt_backend_bridge_submit_packets(&draw_packet.header,
+                                             (uint32_t)sizeof(draw_packet)) ==
+         0);
+
+  draw_packet = make_valid_draw_packet(2);
+  draw_packet.constants_vs.size = 64;
+  draw_packet.constants_vs_start = 253;
+  assert(dx9mt_backend_bridge_submit_packets(&draw_packet.header,
+                                             (uint32_t)sizeof(draw_packet)) ==
+         -1);
+
+  draw_packet = make_valid_draw_packet(3);
+  draw_packet.constants_ps.size = 24;
+  assert(dx9mt_backend_bridge_submit_packets(&draw_packet.header,
+                                             (uint32_t)sizeof(draw_packet)) ==
+         -1);
+
+  dx9mt_backend_bridge_shutdown();
+}
+
+/*
+ * The upload retirement fence advances once per present, including a failed
+ * one, so the frontend never waits on a slot the backend dropped.
+ */
+static void test_present_advances_completed_fence(void) {
+  dx9mt_backend_init_desc init_desc;
+  dx9mt_backend_present_target_desc target_desc;
+  uint32_t fence;
+
+  init_desc = make_init_desc();
+  target_desc = make_target_desc();
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  fence = dx9mt_backend_bridge_completed_fence();
+
+  assert(dx9mt_backend_bridge_begin_frame(1) == 0);
+  assert(dx9mt_backend_bridge_present(1) == -1);
+  assert(dx9mt_backend_bridge_completed_fence() == fence + 1u);
+
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+  assert(dx9mt_backend_bridge_begin_frame(2) == 0);
+  assert(dx9mt_backend_bridge_present(2) == 0);
+  assert(dx9mt_backend_bridge_completed_fence() == fence + 2u);
+  dx9mt_backend_bridge_shutdown();
+
+  /* Shutdown does not rewind it; slots from before a restart stay retired. */
+  assert(dx9mt_backend_bridge_completed_fence() == fence + 2u);
 }
 
 /*
@@ -385,6 +649,1503 @@ static void test_begin_frame_via_packet_stream(void) {
   dx9mt_backend_bridge_shutdown();
 }
 
+/*
+ * Slim DRAW packets carry no render state; they expand against the state
+ * groups the frontend sent earlier in the same frame.
+ */
+typedef struct test_packet_stream {
+  uint32_t words[1024];
+  uint32_t used;
+  uint32_t sequence;
+} test_packet_stream;
+
+static void *test_stream_push(test_packet_stream *stream, uint16_t type,
+                              uint32_t size) {
+  dx9mt_packet_header *header =
+      (dx9mt_packet_header *)((unsigned char *)stream->words + stream->used);
+
+  assert(stream->used + size <= sizeof(stream->words));
+  memset(header, 0, size);
+  header->type = type;
+  header->size = (uint16_t)size;
+  header->sequence = ++stream->sequence;
+  stream->used += size;
+  return header;
+}
+
+static void test_stream_push_keyframe(test_packet_stream *stream,
+                                      uint32_t dest_blend) {
+  dx9mt_packet_state_depth_stencil *depth;
+  dx9mt_packet_state_blend *blend;
+  dx9mt_packet_state_viewport *viewport;
+  dx9mt_packet_state_shader_control *control;
+  uint32_t stage;
+
+  depth = test_stream_push(stream, DX9MT_PACKET_STATE_DEPTH_STENCIL,
+                           sizeof(*depth));
+  depth->state.depth = dx9mt_packed_set(
+      dx9mt_packed_set(0, DX9MT_PACKED_ZENABLE, 1), DX9MT_PACKED_ZFUNC, 4);
+  blend = test_stream_push(stream, DX9MT_PACKET_STATE_BLEND, sizeof(*blend));
+  blend->state.blend = dx9mt_packed_set(0, DX9MT_PACKED_SRCBLEND, 2);
+  blend->state.blend =
+      dx9mt_packed_set(blend->state.blend, DX9MT_PACKED_DESTBLEND, dest_blend);
+  blend->state.blend = dx9mt_packed_set(blend->state.blend,
+                                        DX9MT_PACKED_COLORWRITEENABLE, 0xF);
+  test_stream_push(stream, DX9MT_PACKET_STATE_RASTER,
+                   sizeof(dx9mt_packet_state_raster));
+  viewport = test_stream_push(stream, DX9MT_PACKET_STATE_VIEWPORT,
+                              sizeof(*viewport));
+  viewport->state.width = 1280;
+  viewport->state.height = 720;
+  viewport->state.max_z = 1.0f;
+  control = test_stream_push(stream, DX9MT_PACKET_STATE_SHADER_CONTROL,
+                             sizeof(*control));
+  control->shader_stage = DX9MT_SHADER_STAGE_VERTEX;
+  control = test_stream_push(stream, DX9MT_PACKET_STATE_SHADER_CONTROL,
+                             sizeof(*control));
+  control->shader_stage = DX9MT_SHADER_STAGE_PIXEL;
+  for (stage = 0; stage < DX9MT_MAX_PS_SAMPLERS; ++stage) {
+    dx9mt_packet_state_sampler *sampler = test_stream_push(
+        stream, DX9MT_PACKET_STATE_SAMPLER, sizeof(*sampler));
+    dx9mt_packet_state_texture_stage *texture = test_stream_push(
+        stream, DX9MT_PACKET_STATE_TEXTURE_STAGE, sizeof(*texture));
+    sampler->stage = stage;
+    texture->stage = stage;
+  }
+}
+
+static void test_stream_push_draw(test_packet_stream *stream) {
+  dx9mt_packet_draw *draw =
+      test_stream_push(stream, DX9MT_PACKET_DRAW, sizeof(*draw));
+  draw->primitive_type = 4;
+  draw->primitive_count = 1;
+  draw->render_target_id = 0x05000001u;
+  draw->vertex_buffer_id = 0x03000001u;
+  draw->index_buffer_id = 0x03000002u;
+  draw->vertex_decl_id = 0x0A000001u;
+  draw->stream0_stride = 32;
+}
+
+static uint32_t replay_hash_for_state_group_frame(uint32_t dest_blend) {
+  dx9mt_backend_init_desc init_desc;
+  dx9mt_backend_present_target_desc target_desc;
+  test_packet_stream stream;
+  dx9mt_packet_present *present;
+  uint32_t hash;
+
+  init_desc = make_init_desc();
+  target_desc = make_target_desc();
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+  assert(dx9mt_backend_bridge_begin_frame(1) == 0);
+
+  memset(&stream, 0, sizeof(stream));
+  test_stream_push_keyframe(&stream, dest_blend);
+  test_stream_push_draw(&stream);
+  test_stream_push_draw(&stream);
+  present = test_stream_push(&stream, DX9MT_PACKET_PRESENT, sizeof(*present));
+  present->frame_id = 1;
+  assert(dx9mt_backend_bridge_submit_packets(
+             (const dx9mt_packet_header *)stream.words, stream.used) == 0);
+  assert(dx9mt_backend_bridge_present(1) == 0);
+  hash = dx9mt_backend_bridge_debug_get_last_replay_hash();
+  dx9mt_backend_bridge_shutdown();
+  return hash;
+}
+
+static void test_state_group_packets_expand_slim_draws(void) {
+  dx9mt_backend_init_desc init_desc;
+  dx9mt_backend_present_target_desc target_desc;
+  test_packet_stream stream;
+  uint32_t first_hash = replay_hash_for_state_group_frame(6);
+
+  assert(sizeof(dx9mt_packet_draw) * 4u < sizeof(dx9mt_packet_draw_indexed));
+  assert(first_hash != 0);
+  assert(replay_hash_for_state_group_frame(6) == first_hash);
+  /* One blend field changed: the expanded draws must differ. */
+  assert(replay_hash_for_state_group_frame(5) != first_hash);
+
+  init_desc = make_init_desc();
+  target_desc = make_target_desc();
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+
+  /* A draw before the frame's state keyframe has nothing to expand. */
+  memset(&stream, 0, sizeof(stream));
+  assert(dx9mt_backend_bridge_begin_frame(1) == 0);
+  test_stream_push_draw(&stream);
+  assert(dx9mt_backend_bridge_submit_packets(
+             (const dx9mt_packet_header *)stream.words, stream.used) == -1);
+  assert(dx9mt_backend_bridge_present(1) == 0);
+
+  /* Groups sent in frame 2 do not carry over into frame 3. */
+  memset(&stream, 0, sizeof(stream));
+  stream.sequence = 100;
+  assert(dx9mt_backend_bridge_begin_frame(2) == 0);
+  test_stream_push_keyframe(&stream, 6);
+  test_stream_push_draw(&stream);
+  assert(dx9mt_backend_bridge_submit_packets(
+             (const dx9mt_packet_header *)stream.words, stream.used) == 0);
+  assert(dx9mt_backend_bridge_present(2) == 0);
+  stream.used = 0;
+  assert(dx9mt_backend_bridge_begin_frame(3) == 0);
+  test_stream_push_draw(&stream);
+  assert(dx9mt_backend_bridge_submit_packets(
+             (const dx9mt_packet_header *)stream.words, stream.used) == -1);
+
+  dx9mt_backend_bridge_shutdown();
+}
+
+/*
+ * The frontend batches packets, so one rejected packet must not take the
+ * rest of its batch down with it: the present that follows still lands.
+ */
+static void test_rejected_packet_does_not_drop_batch(void) {
+  dx9mt_backend_init_desc init_desc;
+  dx9mt_backend_present_target_desc target_desc;
+  test_packet_stream stream;
+  dx9mt_packet_clear *clear;
+  dx9mt_packet_present *present;
+  uint32_t first_hash;
+
+  init_desc = make_init_desc();
+  target_desc = make_target_desc();
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+  assert(dx9mt_backend_bridge_begin_frame(1) == 0);
+
+  memset(&stream, 0, sizeof(stream));
+  test_stream_push_keyframe(&stream, 6);
+  test_stream_push_draw(&stream);
+  test_stream_push_draw(&stream);
+  ((dx9mt_packet_draw *)((unsigned char *)stream.words + stream.used -
+                         sizeof(dx9mt_packet_draw)))
+      ->vertex_buffer_id = 0;
+  clear = test_stream_push(&stream, DX9MT_PACKET_CLEAR, sizeof(*clear));
+  clear->frame_id = 1;
+  clear->flags = 1;
+  test_stream_push_draw(&stream);
+  present = test_stream_push(&stream, DX9MT_PACKET_PRESENT, sizeof(*present));
+  present->frame_id = 1;
+  assert(dx9mt_backend_bridge_submit_packets(
+             (const dx9mt_packet_header *)stream.words, stream.used) == -1);
+  assert(dx9mt_backend_bridge_present(1) == 0);
+  first_hash = dx9mt_backend_bridge_debug_get_last_replay_hash();
+  assert(first_hash != 0);
+  dx9mt_backend_bridge_shutdown();
+
+  /* Same frame without the bad draw: identical replay. */
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+  assert(dx9mt_backend_bridge_begin_frame(1) == 0);
+  memset(&stream, 0, sizeof(stream));
+  test_stream_push_keyframe(&stream, 6);
+  test_stream_push_draw(&stream);
+  clear = test_stream_push(&stream, DX9MT_PACKET_CLEAR, sizeof(*clear));
+  clear->frame_id = 1;
+  clear->flags = 1;
+  test_stream_push_draw(&stream);
+  present = test_stream_push(&stream, DX9MT_PACKET_PRESENT, sizeof(*present));
+  present->frame_id = 1;
+  assert(dx9mt_backend_bridge_submit_packets(
+             (const dx9mt_packet_header *)stream.words, stream.used) == 0);
+  assert(dx9mt_backend_bridge_present(1) == 0);
+  assert(dx9mt_backend_bridge_debug_get_last_replay_hash() == first_hash);
+  dx9mt_backend_bridge_shutdown();
+}
+
+#define TEST_CLEAR_IPC_PATH "/tmp/dx9mt_contract_clear_ipc.bin"
+
+static void test_stream_push_clear(test_packet_stream *stream,
+                                   uint32_t render_target_id,
+                                   int32_t rect_right) {
+  dx9mt_packet_clear *clear =
+      test_stream_push(stream, DX9MT_PACKET_CLEAR, sizeof(*clear));
+  clear->frame_id = 1;
+  clear->flags = 0x3; /* D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER */
+  clear->color = 0xFF204060u;
+  clear->z = 1.0f;
+  clear->render_target_id = render_target_id;
+  clear->depth_stencil_id = 0x05000002u;
+  clear->render_target_width = 1280;
+  clear->render_target_height = 720;
+  clear->render_target_format = 21;
+  clear->rect_count = rect_right < 1280 ? 1u : 0u;
+  clear->rect_right = rect_right;
+  clear->rect_bottom = 720;
+}
+
+/*
+ * Reads the published frame's first `bytes` (header and table) into `out`
+ * and returns its file offset: 0, or its slot with the frame ring. The
+ * control-only header fields are copied over the slot's.
+ */
+static long read_test_ipc_table(FILE *file, void *out, size_t bytes) {
+  dx9mt_metal_ipc_header control;
+  dx9mt_metal_ipc_header *header = (dx9mt_metal_ipc_header *)out;
+  long base = 0;
+
+  assert(fread(&control, sizeof(control), 1, file) == 1);
+  if (control.backend_caps & DX9MT_METAL_IPC_CAP_FRAME_RING) {
+    assert(control.ring_latest < DX9MT_METAL_IPC_RING_SLOTS);
+    assert(control.ring_state[control.ring_latest] ==
+           DX9MT_METAL_IPC_SLOT_READY);
+    base = (long)DX9MT_METAL_IPC_RING_OFFSET +
+           (long)control.ring_latest * (long)DX9MT_METAL_IPC_RING_SLOT_BYTES;
+  }
+  assert(fseek(file, base, SEEK_SET) == 0);
+  assert(fread(out, bytes, 1, file) == 1);
+  if (base != 0) {
+    assert(header->sequence == control.sequence);
+    header->repeat_count = control.repeat_count;
+    header->viewer_caps = control.viewer_caps;
+  }
+  return base;
+}
+
+/* clear_at: how many draws precede the clear. */
+static uint32_t replay_hash_for_clear_frame(uint32_t clear_at,
+                                            uint32_t render_target_id,
+                                            int32_t rect_right) {
+  dx9mt_backend_init_desc init_desc;
+  dx9mt_backend_present_target_desc target_desc;
+  test_packet_stream stream;
+  dx9mt_packet_present *present;
+  uint32_t hash;
+  uint32_t i;
+
+  init_desc = make_init_desc();
+  target_desc = make_target_desc();
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+  assert(dx9mt_backend_bridge_begin_frame(1) == 0);
+
+  memset(&stream, 0, sizeof(stream));
+  test_stream_push_keyframe(&stream, 6);
+  for (i = 0; i <= 2; ++i) {
+    if (i == clear_at) {
+      test_stream_push_clear(&stream, render_target_id, rect_right);
+    }
+    if (i < 2) {
+      test_stream_push_draw(&stream);
+    }
+  }
+  present = test_stream_push(&stream, DX9MT_PACKET_PRESENT, sizeof(*present));
+  present->frame_id = 1;
+  assert(dx9mt_backend_bridge_submit_packets(
+             (const dx9mt_packet_header *)stream.words, stream.used) == 0);
+  assert(dx9mt_backend_bridge_present(1) == 0);
+  hash = dx9mt_backend_bridge_debug_get_last_replay_hash();
+  dx9mt_backend_bridge_shutdown();
+  return hash;
+}
+
+/*
+ * Clears are replay commands: where they fall among the draws, which
+ * target they hit and which rect they cover all reach the viewer.
+ */
+static void test_clears_replay_in_order(void) {
+  struct {
+    dx9mt_metal_ipc_header header;
+    dx9mt_metal_ipc_draw draws[3];
+  } ipc;
+  uint32_t first_hash = replay_hash_for_clear_frame(0, 0x05000001u, 1280);
+  FILE *file;
+
+  assert(first_hash != 0);
+  assert(replay_hash_for_clear_frame(0, 0x05000001u, 1280) == first_hash);
+  assert(replay_hash_for_clear_frame(1, 0x05000001u, 1280) != first_hash);
+  assert(replay_hash_for_clear_frame(0, 0x05000003u, 1280) != first_hash);
+  assert(replay_hash_for_clear_frame(0, 0x05000001u, 640) != first_hash);
+
+  setenv("DX9MT_BACKEND_IPC_PATH", TEST_CLEAR_IPC_PATH, 1);
+  assert(replay_hash_for_clear_frame(1, 0x05000001u, 640) != first_hash);
+  unsetenv("DX9MT_BACKEND_IPC_PATH");
+
+  file = fopen(TEST_CLEAR_IPC_PATH, "rb");
+  assert(file);
+  read_test_ipc_table(file, &ipc, sizeof(ipc));
+  fclose(file);
+  remove(TEST_CLEAR_IPC_PATH);
+
+  assert(ipc.header.draw_count == 3);
+  assert(ipc.draws[0].command_type == DX9MT_METAL_IPC_COMMAND_DRAW);
+  assert(ipc.draws[1].command_type == DX9MT_METAL_IPC_COMMAND_CLEAR);
+  assert(ipc.draws[2].command_type == DX9MT_METAL_IPC_COMMAND_DRAW);
+  assert(ipc.draws[1].render_target_id == 0x05000001u);
+  assert(ipc.draws[1].depth_stencil_id == 0x05000002u);
+  assert(ipc.draws[1].clear_flags == 0x3);
+  assert(ipc.draws[1].clear_color_argb == 0xFF204060u);
+  assert(ipc.draws[1].dst_left == 0 && ipc.draws[1].dst_right == 640);
+  assert(ipc.draws[1].dst_bottom == 720);
+  assert(ipc.draws[1].vb_bulk_size == 0 && ipc.draws[1].ib_bulk_size == 0);
+}
+
+/*
+ * The backend records slim draws with dx9mt_draw_state_expand_ipc. Its entry
+ * must hold what the DRAW_INDEXED snapshot of the same draw would, and take
+ * the same pending texture upload.
+ */
+static void test_draw_state_expand_ipc_matches_snapshot(void) {
+  test_packet_stream stream;
+  dx9mt_packet_state_texture_stage *texture;
+  dx9mt_packet_state_viewport *viewport;
+  dx9mt_packet_draw *draw;
+  dx9mt_draw_state snapshot_state;
+  dx9mt_draw_state ipc_state;
+  dx9mt_packet_draw_indexed snapshot;
+  dx9mt_metal_ipc_draw entry;
+  dx9mt_upload_ref tex_data[DX9MT_MAX_PS_SAMPLERS];
+  uint32_t offset;
+  uint32_t hash;
+
+  memset(&stream, 0, sizeof(stream));
+  test_stream_push_keyframe(&stream, 6);
+  viewport = test_stream_push(&stream, DX9MT_PACKET_STATE_VIEWPORT,
+                              sizeof(*viewport));
+  viewport->state.x = 8;
+  viewport->state.width = 640;
+  viewport->state.height = 480;
+  viewport->state.min_z = 0.25f;
+  viewport->state.max_z = 0.75f;
+  viewport->state.scissor_right = 320;
+  viewport->state.scissor_bottom = 240;
+  texture = test_stream_push(&stream, DX9MT_PACKET_STATE_TEXTURE_STAGE,
+                             sizeof(*texture));
+  texture->stage = 0;
+  texture->state.tex_id = 0x07000001u;
+  texture->state.combiner = 0x1234u;
+  texture->state.tex_data.offset = 64;
+  texture->state.tex_data.size = 256;
+  dx9mt_draw_state_reset(&snapshot_state);
+  for (offset = 0; offset < stream.used;) {
+    const dx9mt_packet_header *header =
+        (const dx9mt_packet_header *)((const unsigned char *)stream.words +
+                                      offset);
+    assert(dx9mt_draw_state_apply(&snapshot_state, header) != 0);
+    offset += header->size;
+  }
+  ipc_state = snapshot_state;
+
+  test_stream_push_draw(&stream);
+  draw = (dx9mt_packet_draw *)((unsigned char *)stream.words + offset);
+  draw->base_vertex = -4;
+  draw->start_index = 12;
+  draw->index_format = 101;
+  draw->vertex_update.generation = 3;
+  draw->vs_bytecode_hash = 0xABCDu;
+  dx9mt_draw_state_expand(&snapshot_state, draw, &snapshot);
+  hash = dx9mt_draw_state_expand_ipc(&ipc_state, draw, &entry, tex_data);
+
+  assert(hash == snapshot.state_block_hash);
+  assert(entry.command_type == DX9MT_METAL_IPC_COMMAND_DRAW);
+  assert(entry.base_vertex == snapshot.base_vertex);
+  assert(entry.start_index == snapshot.start_index);
+  assert(entry.primitive_type == snapshot.primitive_type);
+  assert(entry.render_target_id == snapshot.render_target_id);
+  assert(entry.vertex_buffer_id == snapshot.vertex_buffer_id);
+  assert(entry.stream0_stride == snapshot.stream0_stride);
+  assert(entry.index_format == snapshot.index_format);
+  assert(entry.tss0_combiner == snapshot.render_state.tss0_combiner);
+  assert(entry.viewport_x == snapshot.viewport_x);
+  assert(entry.viewport_width == snapshot.viewport_width);
+  assert(entry.viewport_min_z == snapshot.viewport_min_z);
+  assert(entry.viewport_max_z == snapshot.viewport_max_z);
+  assert(entry.scissor_right == snapshot.scissor_right);
+  assert(entry.scissor_bottom == snapshot.scissor_bottom);
+  assert(memcmp(&entry.vertex_update, &snapshot.vertex_update,
+                sizeof(entry.vertex_update)) == 0);
+  assert(entry.vs_bytecode_hash == snapshot.vs_bytecode_hash);
+  assert(memcmp(tex_data, snapshot.tex_data, sizeof(tex_data)) == 0);
+  assert(tex_data[0].size == 256);
+  assert(ipc_state.tex_data_pending == 0);
+  assert(snapshot_state.tex_data_pending == 0);
+}
+
+/*
+ * Every capability set the frontend can end up with encodes the same frame:
+ * without STATE_DELTA the state groups are folded into DRAW_INDEXED
+ * snapshots the way the frontend does it (dx9mt_draw_state_expand), without
+ * PACKET_BATCH every packet is its own submit, and without PACKET_THREAD
+ * the backend parses inline even when a thread was requested.
+ */
+static uint32_t replay_hash_for_caps(uint32_t caps) {
+  dx9mt_backend_init_desc init_desc;
+  dx9mt_backend_present_target_desc target_desc;
+  test_packet_stream stream;
+  dx9mt_packet_init *init;
+  dx9mt_packet_state_blend *blend;
+  dx9mt_packet_present *present;
+  dx9mt_draw_state draw_state;
+  static unsigned char wire[32768];
+  uint32_t wire_used = 0;
+  uint32_t offset;
+  uint32_t hash;
+
+  init_desc = make_init_desc();
+  init_desc.capabilities = caps;
+  init_desc.packet_thread_mode = DX9MT_BACKEND_PACKET_THREAD_BLOCK;
+  target_desc = make_target_desc();
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  assert(dx9mt_backend_bridge_capabilities() == caps);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+  assert(dx9mt_backend_bridge_begin_frame(1) == 0);
+
+  memset(&stream, 0, sizeof(stream));
+  init = test_stream_push(&stream, DX9MT_PACKET_INIT, sizeof(*init));
+  init->protocol_version = DX9MT_PROTOCOL_VERSION;
+  init->capabilities = caps;
+  test_stream_push_keyframe(&stream, 6);
+  test_stream_push_draw(&stream);
+  test_stream_push_clear(&stream, 0x05000001u, 640);
+  blend = test_stream_push(&stream, DX9MT_PACKET_STATE_BLEND, sizeof(*blend));
+  blend->state.blend = dx9mt_packed_set(0, DX9MT_PACKED_DESTBLEND, 5);
+  test_stream_push_draw(&stream);
+  present = test_stream_push(&stream, DX9MT_PACKET_PRESENT, sizeof(*present));
+  present->frame_id = 1;
+
+  dx9mt_draw_state_reset(&draw_state);
+  for (offset = 0; offset < stream.used;) {
+    const dx9mt_packet_header *header =
+        (const dx9mt_packet_header *)((const unsigned char *)stream.words +
+                                      offset);
+    const void *packet = header;
+    uint32_t size = header->size;
+    dx9mt_packet_draw_indexed snapshot;
+
+    offset += header->size;
+    if (!(caps & DX9MT_PROTOCOL_CAP_STATE_DELTA)) {
+      if (dx9mt_draw_state_apply(&draw_state, header) != 0) {
+        continue;
+      }
+      if (header->type == DX9MT_PACKET_DRAW) {
+        dx9mt_draw_state_expand(&draw_state, (const dx9mt_packet_draw *)header,
+                                &snapshot);
+        packet = &snapshot;
+        size = snapshot.header.size;
+      }
+    }
+    if (!(caps & DX9MT_PROTOCOL_CAP_PACKET_BATCH)) {
+      assert(dx9mt_backend_bridge_submit_packets(packet, size) == 0);
+      continue;
+    }
+    assert(wire_used + size <= sizeof(wire));
+    memcpy(wire + wire_used, packet, size);
+    wire_used += size;
+  }
+  if (wire_used != 0) {
+    assert(dx9mt_backend_bridge_submit_packets(
+               (const dx9mt_packet_header *)wire, wire_used) == 0);
+  }
+  assert(dx9mt_backend_bridge_present(1) == 0);
+  assert(dx9mt_backend_bridge_debug_get_submit_errors() == 0);
+  hash = dx9mt_backend_bridge_debug_get_last_replay_hash();
+  dx9mt_backend_bridge_shutdown();
+  return hash;
+}
+
+static void test_protocol_caps_negotiate_to_same_replay(void) {
+  dx9mt_backend_init_desc init_desc;
+  uint32_t expected = replay_hash_for_caps(DX9MT_PROTOCOL_CAPS_ALL);
+  uint32_t caps;
+
+  assert(expected != 0);
+  for (caps = 0; caps < DX9MT_PROTOCOL_CAPS_ALL; ++caps) {
+    assert(replay_hash_for_caps(caps) == expected);
+  }
+
+  /* Unknown offers are dropped; a different protocol version is refused. */
+  init_desc = make_init_desc();
+  init_desc.capabilities = 0xFFFFFFFFu;
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  assert(dx9mt_backend_bridge_capabilities() == DX9MT_PROTOCOL_CAPS_ALL);
+  dx9mt_backend_bridge_shutdown();
+  init_desc.protocol_version = DX9MT_PROTOCOL_VERSION - 1u;
+  assert(dx9mt_backend_bridge_init(&init_desc) == -1);
+}
+
+/*
+ * The IPC frame follows what the viewer announced, for every set it can
+ * announce: no announcement means the backend's full set but the frame
+ * ring, and a viewer without ordered clears gets the draws alone. The replay itself does not
+ * depend on the viewer.
+ */
+static void test_ipc_caps_follow_viewer(void) {
+  struct {
+    dx9mt_metal_ipc_header header;
+    dx9mt_metal_ipc_draw draws[3];
+  } ipc;
+  uint32_t expected = 0;
+  uint32_t i;
+
+  /* i == 0 announces nothing; i - 1 is the announced subset otherwise. */
+  for (i = 0; i <= DX9MT_METAL_IPC_CAPS_ALL + 1u; ++i) {
+    uint32_t viewer_caps =
+        i == 0 ? 0u : DX9MT_METAL_IPC_CAPS_VALID | (i - 1u);
+    int ordered_clear = viewer_caps == 0 ||
+                        (viewer_caps & DX9MT_METAL_IPC_CAP_ORDERED_CLEAR);
+    dx9mt_backend_ipc_stats stats;
+    uint32_t hash;
+    uint32_t caps;
+    FILE *file;
+
+    memset(&ipc, 0, sizeof(ipc));
+    ipc.header.viewer_caps = viewer_caps;
+    file = fopen(TEST_CLEAR_IPC_PATH, "wb");
+    assert(file);
+    assert(fwrite(&ipc.header, sizeof(ipc.header), 1, file) == 1);
+    fclose(file);
+
+    setenv("DX9MT_BACKEND_IPC_PATH", TEST_CLEAR_IPC_PATH, 1);
+    hash = replay_hash_for_clear_frame(1, 0x05000001u, 640);
+    unsetenv("DX9MT_BACKEND_IPC_PATH");
+    dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+    if (i == 0) {
+      expected = hash;
+    }
+    assert(hash == expected);
+
+    file = fopen(TEST_CLEAR_IPC_PATH, "rb");
+    assert(file);
+    read_test_ipc_table(file, &ipc, sizeof(ipc));
+    fclose(file);
+    remove(TEST_CLEAR_IPC_PATH);
+
+    /*
+     * Natively there is no upload arena, so never zero-copy; the frame
+     * ring needs a viewer that announced it.
+     */
+    caps = viewer_caps
+               ? viewer_caps
+               : DX9MT_METAL_IPC_CAPS_ALL & ~(uint32_t)
+                                                DX9MT_METAL_IPC_CAP_FRAME_RING;
+    caps &= ~(uint32_t)(DX9MT_METAL_IPC_CAPS_VALID |
+                        DX9MT_METAL_IPC_CAP_ZERO_COPY);
+    assert(ipc.header.viewer_caps == viewer_caps);
+    assert(ipc.header.backend_caps == caps);
+    assert(stats.caps == ipc.header.backend_caps);
+    assert(ipc.header.draw_count == (ordered_clear ? 3u : 2u));
+    assert(ipc.draws[1].command_type == (ordered_clear
+                                             ? DX9MT_METAL_IPC_COMMAND_CLEAR
+                                             : DX9MT_METAL_IPC_COMMAND_DRAW));
+    assert(ipc.header.have_clear);
+  }
+}
+
+static void test_packed_state_round_trips(void) {
+  uint32_t word = 0;
+  uint32_t arg;
+
+  word = dx9mt_packed_set(word, DX9MT_PACKED_SRCBLEND, 5);
+  word = dx9mt_packed_set(word, DX9MT_PACKED_DESTBLEND, 6);
+  word = dx9mt_packed_set(word, DX9MT_PACKED_ALPHAREF, 0x80);
+  word = dx9mt_packed_set(word, DX9MT_PACKED_COLORWRITEENABLE, 0xF);
+  assert(dx9mt_packed_get(word, DX9MT_PACKED_SRCBLEND) == 5);
+  assert(dx9mt_packed_get(word, DX9MT_PACKED_DESTBLEND) == 6);
+  assert(dx9mt_packed_get(word, DX9MT_PACKED_ALPHAREF) == 0x80);
+  assert(dx9mt_packed_get(word, DX9MT_PACKED_COLORWRITEENABLE) == 0xF);
+  assert(dx9mt_packed_get(word, DX9MT_PACKED_ALPHABLENDENABLE) == 0);
+
+  /* Enums saturate to their spare all-ones code; integers keep low bits. */
+  word = dx9mt_packed_set(word, DX9MT_PACKED_DESTBLEND, 0x7FFFFFFFu);
+  assert(dx9mt_packed_get(word, DX9MT_PACKED_DESTBLEND) == 31);
+  assert(dx9mt_packed_get(word, DX9MT_PACKED_SRCBLEND) == 5);
+  word = dx9mt_packed_set(0, DX9MT_PACKED_STENCILMASK, 0x1FFu);
+  assert(dx9mt_packed_get(word, DX9MT_PACKED_STENCILMASK) == 0xFF);
+  assert(dx9mt_packed_get(word, DX9MT_PACKED_STENCILREF) == 0);
+  assert(dx9mt_packed_get(word, DX9MT_PACKED_STENCILWRITEMASK) == 0);
+
+  /* D3DTA_TEXTURE | D3DTA_COMPLEMENT, D3DTA_TFACTOR | D3DTA_ALPHAREPLICATE */
+  assert(dx9mt_unpacked_texture_arg(dx9mt_packed_texture_arg(0x12u)) == 0x12u);
+  assert(dx9mt_unpacked_texture_arg(dx9mt_packed_texture_arg(0x23u)) == 0x23u);
+  arg = dx9mt_packed_texture_arg(0x0Du);
+  assert(arg == 7u && dx9mt_unpacked_texture_arg(arg) == 0x0Fu);
+  word = dx9mt_packed_set(0, DX9MT_PACKED_ALPHAARG2,
+                          dx9mt_packed_texture_arg(0x36u));
+  assert(dx9mt_unpacked_texture_arg(
+             dx9mt_packed_get(word, DX9MT_PACKED_ALPHAARG2)) == 0x36u);
+}
+
+/*
+ * A draw against a write-locked buffer uploads only the vertices and
+ * indices it reads: 50 of 2048 32-byte vertices, 90 of 4096 16-bit indices.
+ */
+static void test_draw_range_trims_sub_range_draw(void) {
+  uint32_t offset = 0;
+  uint32_t size = 0;
+
+  assert(dx9mt_draw_vertex_range(2048u * 32u, 64u, 32u, 10, 100u, 50u,
+                                 &offset, &size));
+  assert(offset == 64u + 110u * 32u);
+  assert(size == 50u * 32u);
+  assert(dx9mt_draw_index_range(4096u * 2u, 2u, 300u, 90u, &offset, &size));
+  assert(offset == 600u);
+  assert(size == 180u);
+
+  /* The vertex range stops at the end of the buffer... */
+  assert(dx9mt_draw_vertex_range(2048u * 32u, 0u, 32u, 0, 2040u, 50u,
+                                 &offset, &size));
+  assert(offset == 2040u * 32u);
+  assert(size == 8u * 32u);
+  /* ...and anything else that does not fit means a whole upload. */
+  assert(!dx9mt_draw_vertex_range(2048u * 32u, 0u, 32u, -101, 100u, 50u,
+                                  &offset, &size));
+  assert(!dx9mt_draw_vertex_range(2048u * 32u, 0u, 32u, 0, 2048u, 1u,
+                                  &offset, &size));
+  assert(!dx9mt_draw_vertex_range(2048u * 32u, 0u, 0u, 0, 0u, 50u, &offset,
+                                  &size));
+  assert(!dx9mt_draw_index_range(4096u * 2u, 2u, 4000u, 150u, &offset,
+                                 &size));
+  assert(!dx9mt_draw_index_range(4096u * 2u, 4u, 0u, 0u, &offset, &size));
+}
+
+/*
+ * A capture holds the bridge calls plus each referenced upload once per
+ * frame, and replaying it from the captured bytes alone reproduces the
+ * recorded hash. Natively the IPC frame is written when
+ * DX9MT_BACKEND_IPC_PATH is set.
+ */
+#define TEST_CAPTURE_PATH "/tmp/dx9mt_contract_capture.bin"
+#define TEST_CAPTURE_IPC_PATH "/tmp/dx9mt_contract_ipc.bin"
+
+static unsigned char g_test_upload[12288];
+
+static const void *test_upload_resolve(const dx9mt_upload_ref *ref) {
+  if (ref->arena_index != 0 || ref->offset + ref->size > sizeof(g_test_upload)) {
+    return NULL;
+  }
+  return g_test_upload + ref->offset;
+}
+
+static void fill_test_upload(void) {
+  for (uint32_t i = 0; i < sizeof(g_test_upload); ++i) {
+    g_test_upload[i] = (unsigned char)(i * 7u + 1u);
+  }
+}
+
+/*
+ * Starts the bridge writing IPC frames to `path`, resolving uploads from
+ * g_test_upload. Knobs the test varies are set before this; the path is
+ * left set so a restart keeps the same file.
+ */
+static void start_ipc_test_bridge(const char *path) {
+  dx9mt_backend_init_desc init_desc = make_init_desc();
+  dx9mt_backend_present_target_desc target_desc = make_target_desc();
+
+  setenv("DX9MT_BACKEND_IPC_PATH", path, 1);
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  dx9mt_backend_bridge_set_upload_resolver(test_upload_resolve);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+}
+
+static void stop_ipc_test_bridge(void) {
+  dx9mt_backend_bridge_set_upload_resolver(NULL);
+  dx9mt_backend_bridge_shutdown();
+}
+
+/*
+ * The frame published at `path`: header, table and bulk bytes, from its
+ * ring slot when the ring is on. The caller frees it.
+ */
+static unsigned char *read_ipc_test_frame(const char *path) {
+  dx9mt_metal_ipc_header header;
+  unsigned char *frame;
+  FILE *file = fopen(path, "rb");
+  size_t bytes;
+  long base;
+
+  assert(file);
+  base = read_test_ipc_table(file, &header, sizeof(header));
+  bytes = (size_t)header.bulk_data_offset + header.bulk_data_used;
+  frame = malloc(bytes);
+  assert(frame);
+  assert(fseek(file, base, SEEK_SET) == 0);
+  assert(fread(frame, bytes, 1, file) == 1);
+  fclose(file);
+  memcpy(frame, &header, sizeof(header));
+  return frame;
+}
+
+/* Ends the frame the test's draws were submitted into and presents it. */
+static void present_ipc_test_frame(uint32_t frame_id, uint32_t *sequence) {
+  dx9mt_packet_present present;
+
+  memset(&present, 0, sizeof(present));
+  present.header.type = DX9MT_PACKET_PRESENT;
+  present.header.size = (uint16_t)sizeof(present);
+  present.header.sequence = ++*sequence;
+  present.frame_id = frame_id;
+  assert(dx9mt_backend_bridge_submit_packets(&present.header,
+                                             (uint32_t)sizeof(present)) == 0);
+  assert(dx9mt_backend_bridge_present(frame_id) == 0);
+}
+
+static void test_capture_replays_to_same_hash(void) {
+  dx9mt_backend_init_desc init_desc = make_init_desc();
+  dx9mt_backend_present_target_desc target_desc = make_target_desc();
+  dx9mt_packet_capture *capture = calloc(1, sizeof(*capture));
+  dx9mt_backend_ipc_stats ipc;
+  struct {
+    dx9mt_packet_begin_frame begin;
+    dx9mt_packet_draw_indexed draws[2];
+    dx9mt_packet_present present;
+  } stream;
+  static const uint32_t expected_types[] = {
+      DX9MT_CAPTURE_RECORD_INIT,    DX9MT_CAPTURE_RECORD_PRESENT_TARGET,
+      DX9MT_CAPTURE_RECORD_UPLOAD,  DX9MT_CAPTURE_RECORD_UPLOAD,
+      DX9MT_CAPTURE_RECORD_PACKETS, DX9MT_CAPTURE_RECORD_PRESENT,
+      DX9MT_CAPTURE_RECORD_END,
+  };
+  const dx9mt_capture_record *record;
+  unsigned char *file_bytes;
+  size_t file_size;
+  size_t cursor;
+  uint32_t recorded_hash;
+  uint32_t count = 0;
+  FILE *file;
+
+  assert(capture);
+  fill_test_upload();
+  memset(&stream, 0, sizeof(stream));
+  stream.begin.header.type = DX9MT_PACKET_BEGIN_FRAME;
+  stream.begin.header.size = (uint16_t)sizeof(stream.begin);
+  stream.begin.header.sequence = 1;
+  stream.begin.frame_id = 1;
+  stream.draws[0] = make_valid_draw_packet(2);
+  stream.draws[1] = make_valid_draw_packet(3);
+  stream.present.header.type = DX9MT_PACKET_PRESENT;
+  stream.present.header.size = (uint16_t)sizeof(stream.present);
+  stream.present.header.sequence = 4;
+  stream.present.frame_id = 1;
+
+  setenv("DX9MT_BACKEND_IPC_PATH", TEST_CAPTURE_IPC_PATH, 1);
+  assert(dx9mt_packet_capture_open(capture, TEST_CAPTURE_PATH, 1,
+                                   test_upload_resolve) == 0);
+  dx9mt_packet_capture_init(capture, &init_desc);
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  dx9mt_backend_bridge_set_upload_resolver(test_upload_resolve);
+  dx9mt_packet_capture_present_target(capture, &target_desc);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+  dx9mt_packet_capture_packets(capture, &stream.begin.header,
+                               (uint32_t)sizeof(stream));
+  assert(dx9mt_backend_bridge_submit_packets(&stream.begin.header,
+                                             (uint32_t)sizeof(stream)) == 0);
+  assert(dx9mt_backend_bridge_present(1) == 0);
+  recorded_hash = dx9mt_backend_bridge_debug_get_last_replay_hash();
+  dx9mt_packet_capture_present(capture, 1, 0, recorded_hash);
+  assert(!dx9mt_packet_capture_active(capture)); /* frame limit reached */
+  assert(capture->stats.uploads == 2);
+  dx9mt_backend_bridge_debug_get_ipc_stats(&ipc);
+  assert(ipc.frames == 1 && ipc.draw_count == 2);
+  assert(ipc.copied_bytes >= 8192u && ipc.frame_bytes > ipc.copied_bytes);
+  dx9mt_backend_bridge_shutdown();
+  unsetenv("DX9MT_BACKEND_IPC_PATH");
+
+  file = fopen(TEST_CAPTURE_PATH, "rb");
+  assert(file);
+  fseek(file, 0, SEEK_END);
+  file_size = (size_t)ftell(file);
+  fseek(file, 0, SEEK_SET);
+  file_bytes = malloc(file_size);
+  assert(file_bytes && fread(file_bytes, 1, file_size, file) == file_size);
+  fclose(file);
+
+  /* Replay from the captured payloads only. */
+  memset(g_test_upload, 0, sizeof(g_test_upload));
+  cursor = dx9mt_packet_capture_check_header(file_bytes, file_size);
+  assert(cursor == sizeof(dx9mt_capture_file_header));
+  while ((record = dx9mt_packet_capture_next(file_bytes, file_size,
+                                             &cursor)) != NULL) {
+    const void *payload = record + 1;
+
+    assert(count < sizeof(expected_types) / sizeof(expected_types[0]));
+    assert(record->type == expected_types[count++]);
+    if (record->type == DX9MT_CAPTURE_RECORD_INIT) {
+      assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+      dx9mt_backend_bridge_set_upload_resolver(test_upload_resolve);
+      assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+    } else if (record->type == DX9MT_CAPTURE_RECORD_UPLOAD) {
+      const dx9mt_capture_upload *upload = payload;
+      assert(record->bytes == sizeof(*upload) + upload->ref.size);
+      memcpy(g_test_upload + upload->ref.offset, upload + 1, upload->ref.size);
+    } else if (record->type == DX9MT_CAPTURE_RECORD_PACKETS) {
+      assert(record->bytes == sizeof(stream));
+      assert(dx9mt_backend_bridge_submit_packets(payload, record->bytes) == 0);
+    } else if (record->type == DX9MT_CAPTURE_RECORD_PRESENT) {
+      const dx9mt_capture_present *present = payload;
+      assert(present->frame_id == 1 && present->replay_hash == recorded_hash);
+      assert(dx9mt_backend_bridge_present(1) == 0);
+      assert(dx9mt_backend_bridge_debug_get_last_replay_hash() ==
+             recorded_hash);
+    }
+  }
+  assert(count == sizeof(expected_types) / sizeof(expected_types[0]));
+  assert(cursor == file_size);
+  assert(g_test_upload[4096] == (unsigned char)(4096u * 7u + 1u));
+  dx9mt_backend_bridge_set_upload_resolver(NULL);
+  dx9mt_backend_bridge_shutdown();
+
+  file_bytes[0] ^= 0xFFu;
+  assert(dx9mt_packet_capture_check_header(file_bytes, file_size) == 0);
+  free(file_bytes);
+  free(capture);
+  remove(TEST_CAPTURE_PATH);
+  remove(TEST_CAPTURE_IPC_PATH);
+}
+
+/*
+ * Presents after the first one are diffed against the published IPC frame:
+ * an identical present only bumps repeat_count, and a present that changes
+ * some draws rewrites just those table entries and appends their payloads.
+ * Draw 1 carries per-draw vertex data from g_test_upload[8192..8448),
+ * past the constant blocks.
+ */
+#define TEST_STATIC_IPC_PATH "/tmp/dx9mt_contract_static_ipc.bin"
+#define TEST_STATIC_VERTEX_OFFSET 8192u
+#define TEST_STATIC_VERTEX_BYTES 256u
+
+typedef struct test_static_ipc {
+  dx9mt_metal_ipc_header header;
+  dx9mt_metal_ipc_draw draws[3];
+} test_static_ipc;
+
+static void present_static_test_frame(uint32_t frame_id, uint32_t *sequence) {
+  dx9mt_packet_draw_indexed draws[3];
+
+  for (uint32_t i = 0; i < 3; ++i) {
+    draws[i] = make_valid_draw_packet(++*sequence);
+  }
+  draws[1].vertex_data.offset = TEST_STATIC_VERTEX_OFFSET;
+  draws[1].vertex_data.size = TEST_STATIC_VERTEX_BYTES;
+  draws[1].vertex_data_size = TEST_STATIC_VERTEX_BYTES;
+  assert(dx9mt_backend_bridge_begin_frame(frame_id) == 0);
+  assert(dx9mt_backend_bridge_submit_packets(&draws[0].header,
+                                             (uint32_t)sizeof(draws)) == 0);
+  present_ipc_test_frame(frame_id, sequence);
+}
+
+static void read_static_test_ipc(test_static_ipc *ipc, uint32_t *change_list,
+                                 uint32_t max_changes) {
+  unsigned char *frame = read_ipc_test_frame(TEST_STATIC_IPC_PATH);
+
+  memcpy(ipc, frame, sizeof(*ipc));
+  if (change_list && ipc->header.change_count > 0) {
+    assert(ipc->header.change_count <= max_changes);
+    memcpy(change_list,
+           frame + ipc->header.bulk_data_offset +
+               ipc->header.change_list_offset,
+           ipc->header.change_count * sizeof(uint32_t));
+  }
+  free(frame);
+}
+
+static void test_static_frames_repeat_last_ipc_frame(void) {
+  test_static_ipc ipc;
+  dx9mt_backend_ipc_stats stats;
+  uint32_t sequence = 0;
+  uint32_t frame_id;
+
+  fill_test_upload();
+  remove(TEST_STATIC_IPC_PATH);
+  start_ipc_test_bridge(TEST_STATIC_IPC_PATH);
+  for (frame_id = 1; frame_id <= 4; ++frame_id) {
+    present_static_test_frame(frame_id, &sequence);
+  }
+  dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+  read_static_test_ipc(&ipc, NULL, 0);
+  assert(stats.frames == 1 && stats.repeated_frames == 3);
+  assert(ipc.header.sequence == 1 && ipc.header.repeat_count == 3);
+  assert(ipc.header.frame_id == 1 && ipc.header.draw_count == 3);
+  assert(ipc.header.backend_caps & DX9MT_METAL_IPC_CAP_REPEAT_FRAME);
+
+  /* Same commands, different constant bytes: every draw is rewritten. */
+  g_test_upload[100] ^= 0xFFu;
+  present_static_test_frame(frame_id++, &sequence);
+  dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+  read_static_test_ipc(&ipc, NULL, 0);
+  assert(stats.frames == 2 && stats.repeated_frames == 3);
+  assert(stats.changed_draws == 3);
+  assert(ipc.header.sequence == 2 && ipc.header.frame_id == 5);
+
+  /* Repeats resume as soon as the new contents hold still. */
+  present_static_test_frame(frame_id++, &sequence);
+  dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+  assert(stats.frames == 2 && stats.repeated_frames == 4);
+  stop_ipc_test_bridge();
+
+  setenv("DX9MT_BACKEND_STATIC_FRAMES", "0", 1);
+  setenv("DX9MT_BACKEND_IPC_DELTA", "0", 1);
+  sequence = 0;
+  start_ipc_test_bridge(TEST_STATIC_IPC_PATH);
+  for (frame_id = 1; frame_id <= 4; ++frame_id) {
+    present_static_test_frame(frame_id, &sequence);
+  }
+  dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+  read_static_test_ipc(&ipc, NULL, 0);
+  assert(stats.frames == 4 && stats.repeated_frames == 0);
+  assert(ipc.header.base_sequence == 0 && ipc.header.repeat_count == 0);
+  stop_ipc_test_bridge();
+  unsetenv("DX9MT_BACKEND_IPC_DELTA");
+  unsetenv("DX9MT_BACKEND_STATIC_FRAMES");
+  unsetenv("DX9MT_BACKEND_IPC_PATH");
+  remove(TEST_STATIC_IPC_PATH);
+}
+
+static void test_ipc_delta_rewrites_changed_draws(void) {
+  test_static_ipc first;
+  test_static_ipc ipc;
+  dx9mt_backend_ipc_stats full_stats;
+  dx9mt_backend_ipc_stats stats;
+  uint32_t change_list[3];
+  uint32_t sequence = 0;
+
+  fill_test_upload();
+  remove(TEST_STATIC_IPC_PATH);
+  start_ipc_test_bridge(TEST_STATIC_IPC_PATH);
+  present_static_test_frame(1, &sequence);
+  dx9mt_backend_bridge_debug_get_ipc_stats(&full_stats);
+  read_static_test_ipc(&first, NULL, 0);
+  assert(first.header.base_sequence == 0 && full_stats.changed_draws == 3);
+  assert(first.draws[1].vb_bulk_size == TEST_STATIC_VERTEX_BYTES);
+
+  /* Only draw 1's vertex bytes change. */
+  g_test_upload[TEST_STATIC_VERTEX_OFFSET + 8u] ^= 0xFFu;
+  present_static_test_frame(2, &sequence);
+  dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+  read_static_test_ipc(&ipc, change_list, 3);
+  assert(stats.frames == 2 && stats.changed_draws == 1);
+  assert(stats.copied_bytes < full_stats.copied_bytes);
+  assert(stats.frame_bytes < full_stats.frame_bytes);
+  assert(ipc.header.sequence == 2 && ipc.header.base_sequence == 1);
+  assert(ipc.header.change_count == 1 && change_list[0] == 1);
+  assert(ipc.header.bulk_delta_offset == first.header.bulk_data_used);
+  assert(ipc.header.bulk_data_used > first.header.bulk_data_used);
+  assert(ipc.draws[1].vb_bulk_offset >= ipc.header.bulk_delta_offset);
+  assert(memcmp(&ipc.draws[0], &first.draws[0], sizeof(ipc.draws[0])) == 0);
+  assert(memcmp(&ipc.draws[2], &first.draws[2], sizeof(ipc.draws[2])) == 0);
+
+  /* With deltas off the same change is written whole. */
+  stop_ipc_test_bridge();
+  setenv("DX9MT_BACKEND_IPC_DELTA", "0", 1);
+  sequence = 0;
+  start_ipc_test_bridge(TEST_STATIC_IPC_PATH);
+  present_static_test_frame(1, &sequence);
+  g_test_upload[TEST_STATIC_VERTEX_OFFSET + 8u] ^= 0xFFu;
+  present_static_test_frame(2, &sequence);
+  dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+  read_static_test_ipc(&ipc, NULL, 0);
+  assert(stats.frames == 2 && stats.changed_draws == 3);
+  assert(ipc.header.base_sequence == 0);
+  assert(!(ipc.header.backend_caps & DX9MT_METAL_IPC_CAP_DRAW_DELTA));
+  stop_ipc_test_bridge();
+  unsetenv("DX9MT_BACKEND_IPC_DELTA");
+  unsetenv("DX9MT_BACKEND_IPC_PATH");
+  remove(TEST_STATIC_IPC_PATH);
+}
+
+/*
+ * A viewer that lost a buffer patch's base bumps viewer_resync in the
+ * control header. The bridge reports it to the frontend and keeps it
+ * across presents and remaps, and the frame that sees it change sends
+ * every earlier buffer upload whole, once.
+ */
+#define TEST_RESYNC_IPC_PATH "/tmp/dx9mt_contract_resync_ipc.bin"
+
+static void test_viewer_resync_resends_buffers(void) {
+  dx9mt_metal_ipc_header header;
+  uint32_t resync = 1;
+  uint32_t sequence = 0;
+  FILE *file;
+
+  remove(TEST_RESYNC_IPC_PATH);
+  start_ipc_test_bridge(TEST_RESYNC_IPC_PATH);
+  present_static_test_frame(1, &sequence);
+  assert(dx9mt_backend_bridge_viewer_resync() == 0);
+
+  /* The viewer skipped frame 1 and could not patch frame 2's buffers. */
+  file = fopen(TEST_RESYNC_IPC_PATH, "r+b");
+  assert(file);
+  assert(fseek(file, (long)offsetof(dx9mt_metal_ipc_header, viewer_resync),
+               SEEK_SET) == 0);
+  assert(fwrite(&resync, sizeof(resync), 1, file) == 1);
+  fclose(file);
+  assert(dx9mt_backend_bridge_viewer_resync() == 1);
+  present_static_test_frame(2, &sequence);
+  file = fopen(TEST_RESYNC_IPC_PATH, "rb");
+  assert(file);
+  assert(fread(&header, sizeof(header), 1, file) == 1);
+  fclose(file);
+  assert(header.viewer_resync == 1);
+  stop_ipc_test_bridge();
+  assert(dx9mt_backend_bridge_viewer_resync() == 0);
+  start_ipc_test_bridge(TEST_RESYNC_IPC_PATH);
+  assert(dx9mt_backend_bridge_viewer_resync() == 1);
+  stop_ipc_test_bridge();
+  unsetenv("DX9MT_BACKEND_IPC_PATH");
+  remove(TEST_RESYNC_IPC_PATH);
+
+  /* Frame 3 saw the change: a buffer sent whole at frame 1 goes again. */
+  assert(!dx9mt_upload_resend_due(1, 3, 0, 60));
+  assert(dx9mt_upload_resend_due(1, 3, 3, 60));
+  assert(!dx9mt_upload_resend_due(3, 4, 3, 60));
+  assert(dx9mt_upload_resend_due(0, 4, 3, 60));
+  assert(dx9mt_upload_resend_due(4, 64, 3, 60));
+}
+
+/*
+ * Shader bytecode is attached once and then referenced by hash. A viewer
+ * that missed the frame carrying it asks for a resync, and the next frame
+ * the frontend records re-attaches it instead of waiting out the 8-frame
+ * refresh. test_shader_sender plays the frontend: Present() polls the
+ * counter and the draw attaches bytecode when dx9mt_upload_resend_due().
+ */
+#define TEST_SHADER_IPC_PATH "/tmp/dx9mt_contract_shader_ipc.bin"
+#define TEST_SHADER_BYTECODE_OFFSET 9216u
+#define TEST_SHADER_BYTECODE_BYTES 64u
+#define TEST_SHADER_REFRESH_INTERVAL 8u
+
+typedef struct test_shader_sender {
+  uint32_t viewer_resync;
+  uint32_t resync_frame_id;
+  uint32_t sent_frame_id;
+} test_shader_sender;
+
+/* Presents one draw and returns its published bytecode bulk size. */
+static uint32_t present_shader_test_frame(test_shader_sender *sender,
+                                          uint32_t frame_id,
+                                          uint32_t *sequence) {
+  dx9mt_packet_draw_indexed draw;
+  const dx9mt_metal_ipc_header *header;
+  const dx9mt_metal_ipc_draw *ipc_draw;
+  unsigned char *frame;
+  uint32_t resync = dx9mt_backend_bridge_viewer_resync();
+  uint32_t bulk_size;
+
+  if (resync != sender->viewer_resync) {
+    sender->viewer_resync = resync;
+    sender->resync_frame_id = frame_id;
+  }
+  draw = make_valid_draw_packet(++*sequence);
+  draw.vs_bytecode_hash = 0x5EEDF00Du;
+  if (dx9mt_upload_resend_due(sender->sent_frame_id, frame_id,
+                              sender->resync_frame_id,
+                              TEST_SHADER_REFRESH_INTERVAL)) {
+    draw.vs_bytecode.offset = TEST_SHADER_BYTECODE_OFFSET;
+    draw.vs_bytecode.size = TEST_SHADER_BYTECODE_BYTES;
+    draw.vs_bytecode_dwords = TEST_SHADER_BYTECODE_BYTES / 4u;
+    sender->sent_frame_id = frame_id;
+  }
+  assert(dx9mt_backend_bridge_begin_frame(frame_id) == 0);
+  assert(dx9mt_backend_bridge_submit_packets(&draw.header,
+                                             (uint32_t)sizeof(draw)) == 0);
+  present_ipc_test_frame(frame_id, sequence);
+
+  frame = read_ipc_test_frame(TEST_SHADER_IPC_PATH);
+  header = (const dx9mt_metal_ipc_header *)frame;
+  ipc_draw = (const dx9mt_metal_ipc_draw *)(header + 1);
+  assert(header->frame_id == frame_id);
+  assert(ipc_draw->vs_bytecode_hash == 0x5EEDF00Du);
+  bulk_size = ipc_draw->vs_bytecode_bulk_size;
+  free(frame);
+  return bulk_size;
+}
+
+static void test_viewer_resync_reattaches_shader(void) {
+  test_shader_sender sender;
+  uint32_t resync = 1;
+  uint32_t sequence = 0;
+  FILE *file;
+
+  memset(&sender, 0, sizeof(sender));
+  fill_test_upload();
+  remove(TEST_SHADER_IPC_PATH);
+  /* Publish every frame's whole table so each attach decision shows. */
+  setenv("DX9MT_BACKEND_STATIC_FRAMES", "0", 1);
+  setenv("DX9MT_BACKEND_IPC_DELTA", "0", 1);
+  start_ipc_test_bridge(TEST_SHADER_IPC_PATH);
+  assert(present_shader_test_frame(&sender, 1, &sequence) ==
+         TEST_SHADER_BYTECODE_BYTES);
+  assert(present_shader_test_frame(&sender, 2, &sequence) == 0);
+
+  /* The viewer never saw frame 1, so frame 2's hash is unknown to it. */
+  file = fopen(TEST_SHADER_IPC_PATH, "r+b");
+  assert(file);
+  assert(fseek(file, (long)offsetof(dx9mt_metal_ipc_header, viewer_resync),
+               SEEK_SET) == 0);
+  assert(fwrite(&resync, sizeof(resync), 1, file) == 1);
+  fclose(file);
+  assert(!dx9mt_upload_resend_due(sender.sent_frame_id, 3, 0,
+                                  TEST_SHADER_REFRESH_INTERVAL));
+  assert(present_shader_test_frame(&sender, 3, &sequence) ==
+         TEST_SHADER_BYTECODE_BYTES);
+  assert(sender.resync_frame_id == 3);
+  /* Once re-attached it is referenced by hash again. */
+  assert(present_shader_test_frame(&sender, 4, &sequence) == 0);
+
+  stop_ipc_test_bridge();
+  unsetenv("DX9MT_BACKEND_IPC_DELTA");
+  unsetenv("DX9MT_BACKEND_STATIC_FRAMES");
+  unsetenv("DX9MT_BACKEND_IPC_PATH");
+  remove(TEST_SHADER_IPC_PATH);
+}
+
+/*
+ * Draw entries index per-frame tables of distinct state blocks. Draws 0/2
+ * and 1/3 share blend blocks, draw 3 alone samples stage 1; a later frame
+ * that gives draw 2 a new depth test is sent as a delta that appends the
+ * new block and leaves the other entries' indices alone.
+ */
+#define TEST_STATE_IPC_PATH "/tmp/dx9mt_contract_state_ipc.bin"
+
+static void present_state_test_frame(uint32_t frame_id, uint32_t *sequence,
+                                     uint32_t draw2_zfunc) {
+  dx9mt_packet_draw_indexed draws[4];
+  dx9mt_state_depth_stencil *ds;
+
+  for (uint32_t i = 0; i < 4; ++i) {
+    draws[i] = make_valid_draw_packet(++*sequence);
+    draws[i].render_state.blend.texture_factor = 0xFF000000u | (i & 1u);
+    draws[i].control_ps.b_mask = (uint16_t)(i & 1u);
+  }
+  draws[3].samplers[1].sampler =
+      dx9mt_packed_set(0, DX9MT_PACKED_MINFILTER, 2);
+  draws[1].tex_id[2] = 77;
+  draws[1].tex_width[2] = 16;
+  ds = &draws[2].render_state.depth_stencil;
+  ds->depth = dx9mt_packed_set(ds->depth, DX9MT_PACKED_ZFUNC, draw2_zfunc);
+  assert(dx9mt_backend_bridge_begin_frame(frame_id) == 0);
+  assert(dx9mt_backend_bridge_submit_packets(&draws[0].header,
+                                             (uint32_t)sizeof(draws)) == 0);
+  present_ipc_test_frame(frame_id, sequence);
+}
+
+static void test_ipc_interns_state_blocks(void) {
+  const volatile unsigned char *tables[DX9MT_METAL_IPC_STATE_GROUPS];
+  const dx9mt_metal_ipc_header *header;
+  const dx9mt_metal_ipc_draw *draws;
+  const dx9mt_state_depth_stencil *depth;
+  const dx9mt_state_blend *blend;
+  const dx9mt_metal_ipc_sampler_set *samplers;
+  const dx9mt_shader_control_constants *control_ps;
+  const dx9mt_metal_ipc_texture_set *textures;
+  dx9mt_metal_ipc_draw first[4];
+  dx9mt_backend_ipc_stats stats;
+  unsigned char *frame;
+  uint32_t sequence = 0;
+
+  fill_test_upload();
+  remove(TEST_STATE_IPC_PATH);
+  start_ipc_test_bridge(TEST_STATE_IPC_PATH);
+  present_state_test_frame(1, &sequence, 4);
+  dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+  assert(stats.state_blocks == 1u + 2u + 1u + 2u + 1u + 2u + 2u);
+  assert(stats.state_bytes ==
+         8u + 2u * 8u + 20u + 2u * 32u +
+             3u * (uint32_t)sizeof(dx9mt_shader_control_constants) +
+             2u * (uint32_t)sizeof(dx9mt_metal_ipc_texture_set));
+
+  frame = read_ipc_test_frame(TEST_STATE_IPC_PATH);
+  header = (const dx9mt_metal_ipc_header *)frame;
+  draws = (const dx9mt_metal_ipc_draw *)(header + 1);
+  assert(header->draw_count == 4 && header->base_sequence == 0);
+  assert(header->state_table_count[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL] == 1);
+  assert(header->state_table_count[DX9MT_METAL_IPC_STATE_BLEND] == 2);
+  assert(header->state_table_count[DX9MT_METAL_IPC_STATE_RASTER] == 1);
+  assert(header->state_table_count[DX9MT_METAL_IPC_STATE_SAMPLERS] == 2);
+  assert(header->state_table_count[DX9MT_METAL_IPC_STATE_CONTROL_VS] == 1);
+  assert(header->state_table_count[DX9MT_METAL_IPC_STATE_CONTROL_PS] == 2);
+  assert(header->state_table_count[DX9MT_METAL_IPC_STATE_TEXTURES] == 2);
+  assert(dx9mt_metal_ipc_state_tables(frame, tables));
+  blend = (const dx9mt_state_blend *)tables[DX9MT_METAL_IPC_STATE_BLEND];
+  samplers = (const dx9mt_metal_ipc_sampler_set *)
+      tables[DX9MT_METAL_IPC_STATE_SAMPLERS];
+  control_ps = (const dx9mt_shader_control_constants *)
+      tables[DX9MT_METAL_IPC_STATE_CONTROL_PS];
+  textures = (const dx9mt_metal_ipc_texture_set *)
+      tables[DX9MT_METAL_IPC_STATE_TEXTURES];
+  for (uint32_t i = 0; i < 4; ++i) {
+    const uint16_t *index = draws[i].state_index;
+
+    assert(index[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL] == 0);
+    assert(index[DX9MT_METAL_IPC_STATE_BLEND] == (i & 1u));
+    assert(blend[index[DX9MT_METAL_IPC_STATE_BLEND]].texture_factor ==
+           (0xFF000000u | (i & 1u)));
+    assert(index[DX9MT_METAL_IPC_STATE_SAMPLERS] == (i == 3 ? 1u : 0u));
+    assert(index[DX9MT_METAL_IPC_STATE_CONTROL_VS] == 0);
+    assert(control_ps[index[DX9MT_METAL_IPC_STATE_CONTROL_PS]].b_mask ==
+           (i & 1u));
+    assert(index[DX9MT_METAL_IPC_STATE_TEXTURES] == (i == 1 ? 1u : 0u));
+    assert(textures[index[DX9MT_METAL_IPC_STATE_TEXTURES]].stage[2].id ==
+           (i == 1 ? 77u : 0u));
+    assert(draws[i].tss0_combiner == 0);
+  }
+  assert(dx9mt_packed_get(samplers[1].stage[1].sampler,
+                          DX9MT_PACKED_MINFILTER) == 2);
+  assert(textures[1].stage[2].width == 16);
+  memcpy(first, draws, sizeof(first));
+  free(frame);
+
+  present_state_test_frame(2, &sequence, 3);
+  dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+  assert(stats.changed_draws == 1);
+  frame = read_ipc_test_frame(TEST_STATE_IPC_PATH);
+  header = (const dx9mt_metal_ipc_header *)frame;
+  draws = (const dx9mt_metal_ipc_draw *)(header + 1);
+  assert(header->base_sequence != 0 && header->change_count == 1);
+  assert(header->state_table_count[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL] == 2);
+  assert(header->state_table_offset[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL] >=
+         header->bulk_delta_offset);
+  assert(header->state_table_offset[DX9MT_METAL_IPC_STATE_BLEND] <
+         header->bulk_delta_offset);
+  assert(dx9mt_metal_ipc_state_tables(frame, tables));
+  depth = (const dx9mt_state_depth_stencil *)
+      tables[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL];
+  assert(draws[2].state_index[DX9MT_METAL_IPC_STATE_DEPTH_STENCIL] == 1);
+  assert(dx9mt_packed_get(depth[1].depth, DX9MT_PACKED_ZFUNC) == 3);
+  assert(dx9mt_packed_get(depth[0].depth, DX9MT_PACKED_ZFUNC) == 4);
+  assert(memcmp(draws[2].state_index + 1, first[2].state_index + 1,
+                (DX9MT_METAL_IPC_STATE_GROUPS - 1) * sizeof(uint16_t)) == 0);
+  for (uint32_t i = 0; i < 4; ++i) {
+    assert(i == 2 || memcmp(&draws[i], &first[i], sizeof(first[i])) == 0);
+  }
+  free(frame);
+
+  stop_ipc_test_bridge();
+  unsetenv("DX9MT_BACKEND_IPC_PATH");
+  remove(TEST_STATE_IPC_PATH);
+}
+
+/*
+ * State tables start small and double as blocks are interned. Frame 1's
+ * 128 draws use 64 distinct blend blocks, exactly the first size; frame 2
+ * adds a 65th in a delta, which grows the table without moving the
+ * indices frame 1's entries use; frame 3 gives every draw its own block,
+ * growing it again. The history the entries are compared against grows
+ * with the draw count too, so an identical frame 4 repeats.
+ */
+#define TEST_STATE_GROWTH_DRAWS 128u
+
+static void present_state_growth_frame(uint32_t frame_id, uint32_t *sequence,
+                                       uint32_t distinct,
+                                       uint32_t last_factor) {
+  dx9mt_packet_draw_indexed draw;
+
+  assert(dx9mt_backend_bridge_begin_frame(frame_id) == 0);
+  for (uint32_t i = 0; i < TEST_STATE_GROWTH_DRAWS; ++i) {
+    draw = make_valid_draw_packet(++*sequence);
+    draw.render_state.blend.texture_factor =
+        0xFF000000u |
+        (i + 1u == TEST_STATE_GROWTH_DRAWS ? last_factor : i % distinct);
+    assert(dx9mt_backend_bridge_submit_packets(&draw.header,
+                                               (uint32_t)sizeof(draw)) == 0);
+  }
+  present_ipc_test_frame(frame_id, sequence);
+}
+
+/* Checks every draw's blend index resolves to the factor it was sent. */
+static void check_state_growth_frame(uint32_t distinct, uint32_t last_factor,
+                                     uint32_t blend_blocks) {
+  const volatile unsigned char *tables[DX9MT_METAL_IPC_STATE_GROUPS];
+  const dx9mt_metal_ipc_header *header;
+  const dx9mt_metal_ipc_draw *draws;
+  const dx9mt_state_blend *blend;
+  unsigned char *frame = read_ipc_test_frame(TEST_STATE_IPC_PATH);
+
+  header = (const dx9mt_metal_ipc_header *)frame;
+  draws = (const dx9mt_metal_ipc_draw *)(header + 1);
+  assert(header->draw_count == TEST_STATE_GROWTH_DRAWS);
+  assert(header->state_table_count[DX9MT_METAL_IPC_STATE_BLEND] ==
+         blend_blocks);
+  assert(dx9mt_metal_ipc_state_tables(frame, tables));
+  blend = (const dx9mt_state_blend *)tables[DX9MT_METAL_IPC_STATE_BLEND];
+  for (uint32_t i = 0; i < TEST_STATE_GROWTH_DRAWS; ++i) {
+    uint16_t index = draws[i].state_index[DX9MT_METAL_IPC_STATE_BLEND];
+    uint32_t factor =
+        i + 1u == TEST_STATE_GROWTH_DRAWS ? last_factor : i % distinct;
+
+    assert(index < blend_blocks);
+    assert(blend[index].texture_factor == (0xFF000000u | factor));
+  }
+  free(frame);
+}
+
+static void test_ipc_state_tables_grow(void) {
+  dx9mt_backend_ipc_stats stats;
+  uint32_t sequence = 0;
+
+  fill_test_upload();
+  remove(TEST_STATE_IPC_PATH);
+  start_ipc_test_bridge(TEST_STATE_IPC_PATH);
+
+  present_state_growth_frame(1, &sequence, 64, 63);
+  check_state_growth_frame(64, 63, 64);
+
+  present_state_growth_frame(2, &sequence, 64, 1000);
+  dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+  assert(stats.changed_draws == 1);
+  check_state_growth_frame(64, 1000, 65);
+
+  present_state_growth_frame(3, &sequence, TEST_STATE_GROWTH_DRAWS,
+                             TEST_STATE_GROWTH_DRAWS - 1u);
+  dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+  /* Draws 64..127 change; the delta appends their 64 blocks, past 128. */
+  assert(stats.changed_draws == 64);
+  check_state_growth_frame(TEST_STATE_GROWTH_DRAWS,
+                           TEST_STATE_GROWTH_DRAWS - 1u, 65u + 64u);
+
+  present_state_growth_frame(4, &sequence, TEST_STATE_GROWTH_DRAWS,
+                             TEST_STATE_GROWTH_DRAWS - 1u);
+  dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+  assert(stats.repeated_frames == 1);
+
+  stop_ipc_test_bridge();
+  unsetenv("DX9MT_BACKEND_IPC_PATH");
+  remove(TEST_STATE_IPC_PATH);
+}
+
+/*
+ * Async present hands each frame to the present worker and returns; the
+ * worker writes the same IPC frames an inline present would, and retires
+ * each frame's uploads once it has serialized it.
+ */
+#define TEST_ASYNC_FRAMES 8u
+
+static void test_async_present_matches_inline(void) {
+  test_static_ipc inline_ipc;
+  test_static_ipc ipc;
+  dx9mt_backend_present_stats present_stats;
+  dx9mt_backend_ipc_stats stats;
+  uint32_t inline_hash;
+  uint32_t sequence = 0;
+  uint32_t fence;
+  uint32_t histogram_total = 0;
+  uint32_t frame_id;
+
+  fill_test_upload();
+  remove(TEST_STATIC_IPC_PATH);
+  setenv("DX9MT_BACKEND_STATIC_FRAMES", "0", 1);
+  start_ipc_test_bridge(TEST_STATIC_IPC_PATH);
+  for (frame_id = 1; frame_id <= TEST_ASYNC_FRAMES; ++frame_id) {
+    present_static_test_frame(frame_id, &sequence);
+  }
+  inline_hash = dx9mt_backend_bridge_debug_get_last_replay_hash();
+  read_static_test_ipc(&inline_ipc, NULL, 0);
+  dx9mt_backend_bridge_debug_get_present_stats(&present_stats);
+  assert(present_stats.frames_in_flight == 0 && present_stats.frames == 0);
+  stop_ipc_test_bridge();
+
+  setenv("DX9MT_BACKEND_FRAMES_IN_FLIGHT", "2", 1);
+  sequence = 0;
+  start_ipc_test_bridge(TEST_STATIC_IPC_PATH);
+  fence = dx9mt_backend_bridge_completed_fence();
+  for (frame_id = 1; frame_id <= TEST_ASYNC_FRAMES; ++frame_id) {
+    present_static_test_frame(frame_id, &sequence);
+    dx9mt_backend_bridge_debug_get_present_stats(&present_stats);
+    assert(present_stats.queue_depth >= 1 && present_stats.queue_depth <= 2);
+  }
+  /* The replay hash is still computed inside present(). */
+  assert(dx9mt_backend_bridge_debug_get_last_replay_hash() == inline_hash);
+  while (dx9mt_backend_bridge_completed_fence() - fence < TEST_ASYNC_FRAMES) {
+  }
+
+  dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+  dx9mt_backend_bridge_debug_get_present_stats(&present_stats);
+  read_static_test_ipc(&ipc, NULL, 0);
+  assert(stats.frames == TEST_ASYNC_FRAMES && stats.draw_count == 3);
+  assert(ipc.header.sequence == inline_ipc.header.sequence);
+  assert(ipc.header.frame_id == TEST_ASYNC_FRAMES);
+  assert(ipc.header.replay_hash == inline_hash);
+  assert(memcmp(ipc.draws, inline_ipc.draws, sizeof(ipc.draws)) == 0);
+  assert(present_stats.frames_in_flight == 2);
+  assert(present_stats.frames == TEST_ASYNC_FRAMES);
+  assert(present_stats.latency_max_us >= present_stats.latency_us);
+  assert(present_stats.depth_histogram[0] == 0);
+  for (uint32_t d = 0; d <= DX9MT_BACKEND_MAX_FRAMES_IN_FLIGHT; ++d) {
+    histogram_total += present_stats.depth_histogram[d];
+  }
+  assert(histogram_total == TEST_ASYNC_FRAMES);
+  assert(present_stats.depth_histogram[3] == 0 &&
+         present_stats.depth_histogram[4] == 0);
+
+  stop_ipc_test_bridge();
+  dx9mt_backend_bridge_debug_get_present_stats(&present_stats);
+  assert(present_stats.frames == 0);
+  unsetenv("DX9MT_BACKEND_FRAMES_IN_FLIGHT");
+  unsetenv("DX9MT_BACKEND_STATIC_FRAMES");
+  unsetenv("DX9MT_BACKEND_IPC_PATH");
+  remove(TEST_STATIC_IPC_PATH);
+}
+
+/*
+ * DX9MT_BACKEND_IPC_THREADS=N sizes a full frame's bulk layout first and
+ * then fills table ranges on N threads; the frame must match the
+ * single-threaded one byte for byte. Draws vary their vertex bytes, state
+ * blocks and shaders, and every third one reuses the running constant
+ * blocks.
+ */
+#define TEST_PARALLEL_IPC_PATH "/tmp/dx9mt_contract_parallel_ipc.bin"
+#define TEST_PARALLEL_DRAWS 600u
+
+static unsigned char *present_parallel_test_frame(const char *threads,
+                                                  uint32_t *out_bytes) {
+  dx9mt_packet_draw_indexed draw_packet;
+  dx9mt_backend_ipc_stats stats;
+  const dx9mt_metal_ipc_header *header;
+  unsigned char *frame;
+  uint32_t sequence = 0;
+  uint32_t i;
+
+  remove(TEST_PARALLEL_IPC_PATH);
+  setenv("DX9MT_BACKEND_IPC_THREADS", threads, 1);
+  start_ipc_test_bridge(TEST_PARALLEL_IPC_PATH);
+  assert(dx9mt_backend_bridge_begin_frame(1) == 0);
+  for (i = 0; i < TEST_PARALLEL_DRAWS; ++i) {
+    draw_packet = make_valid_draw_packet(++sequence);
+    if (i % 3u == 2u) {
+      draw_packet.constants_vs.size = 0;
+      draw_packet.constants_ps.size = 0;
+    }
+    draw_packet.vertex_data.offset = 8192u + (i * 16u) % 2048u;
+    draw_packet.vertex_data.size = 64u + (i % 5u) * 32u;
+    draw_packet.vertex_data_size = draw_packet.vertex_data.size;
+    draw_packet.pixel_shader_id = 0x07000001u + i % 4u;
+    draw_packet.render_state.blend.texture_factor = i % 7u;
+    draw_packet.samplers[0].sampler = i % 3u;
+    assert(dx9mt_backend_bridge_submit_packets(&draw_packet.header,
+                                               (uint32_t)sizeof(draw_packet)) ==
+           0);
+  }
+  present_ipc_test_frame(1, &sequence);
+  dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+  assert(stats.draw_count == TEST_PARALLEL_DRAWS);
+  assert(stats.threads == (uint32_t)atoi(threads));
+  stop_ipc_test_bridge();
+  unsetenv("DX9MT_BACKEND_IPC_THREADS");
+  unsetenv("DX9MT_BACKEND_IPC_PATH");
+
+  frame = read_ipc_test_frame(TEST_PARALLEL_IPC_PATH);
+  header = (const dx9mt_metal_ipc_header *)frame;
+  assert(header->draw_count == TEST_PARALLEL_DRAWS);
+  *out_bytes = header->bulk_data_offset + header->bulk_data_used;
+  remove(TEST_PARALLEL_IPC_PATH);
+  return frame;
+}
+
+static void test_parallel_ipc_matches_serial(void) {
+  unsigned char *serial;
+  unsigned char *parallel;
+  uint32_t serial_bytes;
+  uint32_t parallel_bytes;
+
+  fill_test_upload();
+  serial = present_parallel_test_frame("1", &serial_bytes);
+  parallel = present_parallel_test_frame("4", &parallel_bytes);
+  assert(serial_bytes == parallel_bytes);
+  assert(memcmp(serial, parallel, serial_bytes) == 0);
+  free(parallel);
+  free(serial);
+}
+
 int main(void) {
   test_accepts_valid_packet_stream();
   test_rejects_truncated_packet();
@@ -393,9 +2154,31 @@ int main(void) {
   test_rejects_draw_packet_with_wrong_size();
   test_rejects_present_without_target_metadata();
   test_rejects_present_packet_frame_mismatch();
+  test_heavy_frame_keeps_every_draw();
   test_accepts_draw_capture_overflow_and_presents();
   test_replay_hash_changes_with_draw_payload();
   test_begin_frame_via_packet_stream();
+  test_persistent_buffer_generation_feeds_replay_hash();
+  test_rejects_out_of_range_buffer_update();
+  test_constant_deltas_are_bounded();
+  test_present_advances_completed_fence();
+  test_state_group_packets_expand_slim_draws();
+  test_rejected_packet_does_not_drop_batch();
+  test_clears_replay_in_order();
+  test_draw_state_expand_ipc_matches_snapshot();
+  test_protocol_caps_negotiate_to_same_replay();
+  test_ipc_caps_follow_viewer();
+  test_packed_state_round_trips();
+  test_draw_range_trims_sub_range_draw();
+  test_capture_replays_to_same_hash();
+  test_static_frames_repeat_last_ipc_frame();
+  test_ipc_delta_rewrites_changed_draws();
+  test_viewer_resync_resends_buffers();
+  test_viewer_resync_reattaches_shader();
+  test_ipc_interns_state_blocks();
+  test_ipc_state_tables_grow();
+  test_async_present_matches_inline();
+  test_parallel_ipc_matches_serial();
   puts("backend_bridge_contract_test: PASS");
   return 0;
 }
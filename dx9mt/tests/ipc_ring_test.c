@@ -0,0 +1,322 @@
+/*
+ * Two-process test for the IPC frame ring: the parent presents through the
+ * bridge (async, two frames in flight) while a forked reader claims ring
+ * slots the way the viewer does and checks every frame it gets is whole,
+ * including the deltas patched into the slot holding the previous frame.
+ * Native only (Linux/macOS, -DDX9MT_NO_METAL, pthreads).
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dx9mt/backend_bridge.h"
+#include "dx9mt/metal_ipc.h"
+#include "dx9mt/packets.h"
+
+#define RING_TEST_IPC_PATH "/tmp/dx9mt_ipc_ring_test.bin"
+#define RING_TEST_FRAMES 20000u
+#define RING_TEST_MAX_DRAWS 16u
+/* Upload regions rotate; one is reused long after its frame serialized. */
+#define RING_TEST_REGIONS 8u
+#define RING_TEST_REGION_BYTES (RING_TEST_MAX_DRAWS * 256u)
+/* Reader gives up after this long without a new frame. */
+#define RING_TEST_IDLE_SECONDS 30
+
+static unsigned char g_ring_upload[RING_TEST_REGIONS * RING_TEST_REGION_BYTES];
+
+/*
+ * Every byte a frame carries depends on its frame id. Frames come in pairs
+ * with the same draw count whose first draw is the same, so the second of
+ * each pair is a delta that leaves draw 0 alone (and never a repeat).
+ */
+static uint32_t ring_test_draws(uint32_t frame_id) {
+  return 2u + (frame_id / 2u) % (RING_TEST_MAX_DRAWS - 1u);
+}
+
+static uint32_t ring_test_source(uint32_t frame_id, uint32_t draw) {
+  return draw == 0 ? frame_id / 2u : frame_id;
+}
+
+static uint32_t ring_test_vertex_bytes(uint32_t frame_id, uint32_t draw) {
+  return 64u + ((ring_test_source(frame_id, draw) + draw) % 12u) * 16u;
+}
+
+static unsigned char ring_test_byte(uint32_t frame_id, uint32_t draw,
+                                    uint32_t b) {
+  return (unsigned char)(ring_test_source(frame_id, draw) * 13u + draw * 7u +
+                         b);
+}
+
+static const void *ring_test_resolve(const dx9mt_upload_ref *ref) {
+  if (ref->arena_index != 0 ||
+      ref->offset + ref->size > sizeof(g_ring_upload)) {
+    return NULL;
+  }
+  return g_ring_upload + ref->offset;
+}
+
+static time_t ring_test_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+/* --- Reader process ---------------------------------------------------- */
+
+/* Returns 1 when the claimed slot holds the whole frame its header names. */
+static int ring_reader_check_frame(const unsigned char *frame) {
+  const dx9mt_metal_ipc_header *hdr = (const dx9mt_metal_ipc_header *)frame;
+  const dx9mt_metal_ipc_draw *draws =
+      (const dx9mt_metal_ipc_draw *)(frame + sizeof(*hdr));
+  uint32_t frame_id = hdr->frame_id;
+  uint32_t n;
+
+  /* A ring slot is rendered in place: nothing may live in the arena. */
+  if (hdr->magic != DX9MT_METAL_IPC_MAGIC ||
+      hdr->draw_count != ring_test_draws(frame_id) ||
+      hdr->arena_data_size != 0 ||
+      hdr->bulk_data_offset > DX9MT_METAL_IPC_RING_SLOT_BYTES ||
+      hdr->bulk_data_used >
+          DX9MT_METAL_IPC_RING_SLOT_BYTES - hdr->bulk_data_offset) {
+    return 0;
+  }
+  for (n = 0; n < hdr->draw_count; ++n) {
+    uint32_t bytes = ring_test_vertex_bytes(frame_id, n);
+    const unsigned char *vb;
+
+    if (draws[n].vb_bulk_size != bytes ||
+        draws[n].vb_bulk_offset + bytes > hdr->bulk_data_used) {
+      return 0;
+    }
+    vb = frame + hdr->bulk_data_offset + draws[n].vb_bulk_offset;
+    for (uint32_t b = 0; b < bytes; ++b) {
+      if (vb[b] != ring_test_byte(frame_id, n, b)) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+static dx9mt_metal_ipc_header *ring_reader_map(void) {
+  time_t start = ring_test_now();
+
+  while (ring_test_now() - start < RING_TEST_IDLE_SECONDS) {
+    int fd = open(RING_TEST_IPC_PATH, O_RDWR);
+    struct stat st;
+
+    if (fd >= 0 && fstat(fd, &st) == 0 &&
+        (size_t)st.st_size >= DX9MT_METAL_IPC_SIZE) {
+      void *map = mmap(NULL, DX9MT_METAL_IPC_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+      close(fd);
+      if (map == MAP_FAILED) {
+        return NULL;
+      }
+      return (dx9mt_metal_ipc_header *)map;
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    sched_yield();
+  }
+  return NULL;
+}
+
+/* Reads frames like the viewer until the last one; the exit status is 0
+ * when none was torn and some were deltas. */
+static int ring_reader_main(void) {
+  dx9mt_metal_ipc_header *control = ring_reader_map();
+  uint32_t last_seq = 0;
+  uint32_t last_frame = 0;
+  uint32_t frames_read = 0;
+  uint32_t deltas_read = 0;
+  uint32_t claims_missed = 0;
+  time_t last_progress;
+
+  if (!control) {
+    fprintf(stderr, "ipc_ring_test: reader could not map %s\n",
+            RING_TEST_IPC_PATH);
+    return 1;
+  }
+  while (__atomic_load_n(&control->magic, __ATOMIC_ACQUIRE) !=
+         DX9MT_METAL_IPC_MAGIC) {
+    sched_yield();
+  }
+  __atomic_store_n(&control->viewer_caps,
+                   DX9MT_METAL_IPC_CAPS_VALID | DX9MT_METAL_IPC_CAPS_ALL,
+                   __ATOMIC_RELEASE);
+
+  last_progress = ring_test_now();
+  while (last_frame < RING_TEST_FRAMES) {
+    uint32_t seq = __atomic_load_n(&control->sequence, __ATOMIC_ACQUIRE);
+    const unsigned char *frame;
+    const dx9mt_metal_ipc_header *hdr;
+    uint32_t frame_seq;
+    int slot;
+
+    if (ring_test_now() - last_progress > RING_TEST_IDLE_SECONDS) {
+      fprintf(stderr, "ipc_ring_test: reader stalled at frame %u\n",
+              last_frame);
+      return 1;
+    }
+    if (seq == last_seq || seq == 0 ||
+        !(control->backend_caps & DX9MT_METAL_IPC_CAP_FRAME_RING)) {
+      sched_yield();
+      continue;
+    }
+    slot = dx9mt_metal_ipc_ring_acquire(control);
+    if (slot < 0) {
+      ++claims_missed;
+      continue;
+    }
+    frame = dx9mt_metal_ipc_ring_slot(control, (uint32_t)slot);
+    hdr = (const dx9mt_metal_ipc_header *)frame;
+    frame_seq = __atomic_load_n(&hdr->sequence, __ATOMIC_ACQUIRE);
+    if (frame_seq != last_seq) {
+      if (frame_seq < last_seq || hdr->frame_id <= last_frame ||
+          !ring_reader_check_frame(frame) ||
+          __atomic_load_n(&hdr->sequence, __ATOMIC_ACQUIRE) != frame_seq) {
+        fprintf(stderr,
+                "ipc_ring_test: torn frame in slot %d: seq=%u frame=%u "
+                "after seq=%u frame=%u\n",
+                slot, frame_seq, hdr->frame_id, last_seq, last_frame);
+        return 1;
+      }
+      last_seq = frame_seq;
+      last_frame = hdr->frame_id;
+      ++frames_read;
+      deltas_read += hdr->base_sequence != 0;
+      last_progress = ring_test_now();
+    }
+    dx9mt_metal_ipc_ring_release(control, slot);
+  }
+  printf("ipc_ring_test: reader checked %u of %u frames, %u deltas (%u "
+         "claims missed)\n",
+         frames_read, RING_TEST_FRAMES, deltas_read, claims_missed);
+  fflush(stdout); /* the reader leaves through _exit */
+  munmap(control, DX9MT_METAL_IPC_SIZE);
+  return deltas_read > 0 ? 0 : 1;
+}
+
+/* --- Writer (this process) --------------------------------------------- */
+
+static void ring_writer_present(uint32_t frame_id, uint32_t *sequence) {
+  /* The draws, then the present packet right after the last one. */
+  dx9mt_packet_draw_indexed stream[RING_TEST_MAX_DRAWS + 1];
+  dx9mt_packet_present *present;
+  uint32_t region = (frame_id % RING_TEST_REGIONS) * RING_TEST_REGION_BYTES;
+  uint32_t draws = ring_test_draws(frame_id);
+  uint32_t n;
+
+  memset(stream, 0, sizeof(stream));
+  for (n = 0; n < draws; ++n) {
+    dx9mt_packet_draw_indexed *draw = &stream[n];
+    uint32_t offset = region + n * 256u;
+    uint32_t bytes = ring_test_vertex_bytes(frame_id, n);
+
+    for (uint32_t b = 0; b < bytes; ++b) {
+      g_ring_upload[offset + b] = ring_test_byte(frame_id, n, b);
+    }
+    draw->header.type = DX9MT_PACKET_DRAW_INDEXED;
+    draw->header.size = (uint16_t)sizeof(*draw);
+    draw->header.sequence = ++*sequence;
+    draw->primitive_type = 4;
+    draw->primitive_count = 1;
+    draw->render_target_id = 0x05000001u;
+    draw->vertex_buffer_id = 0x03000001u;
+    draw->index_buffer_id = 0x03000002u;
+    draw->vertex_decl_id = 0x0A000001u;
+    draw->stream0_stride = 32;
+    draw->vertex_data.offset = offset;
+    draw->vertex_data.size = bytes;
+    draw->vertex_data_size = bytes;
+  }
+  present = (dx9mt_packet_present *)&stream[draws];
+  present->header.type = DX9MT_PACKET_PRESENT;
+  present->header.size = (uint16_t)sizeof(*present);
+  present->header.sequence = ++*sequence;
+  present->frame_id = frame_id;
+
+  assert(dx9mt_backend_bridge_begin_frame(frame_id) == 0);
+  assert(dx9mt_backend_bridge_submit_packets(
+             &stream[0].header, (uint32_t)(draws * sizeof(stream[0]) +
+                                           sizeof(*present))) == 0);
+  assert(dx9mt_backend_bridge_present(frame_id) == 0);
+}
+
+static void test_reader_never_sees_a_torn_frame(void) {
+  dx9mt_backend_init_desc init_desc;
+  dx9mt_backend_present_target_desc target_desc;
+  dx9mt_backend_ipc_stats stats;
+  uint32_t sequence = 0;
+  uint32_t frame_id;
+  pid_t reader;
+  int status = 0;
+
+  remove(RING_TEST_IPC_PATH);
+  fflush(stdout);
+  reader = fork();
+  assert(reader >= 0);
+  if (reader == 0) {
+    _exit(ring_reader_main());
+  }
+
+  memset(&init_desc, 0, sizeof(init_desc));
+  init_desc.protocol_version = DX9MT_PROTOCOL_VERSION;
+  init_desc.capabilities = DX9MT_PROTOCOL_CAPS_ALL;
+  init_desc.ring_capacity_bytes = 1u << 20;
+  init_desc.upload_desc.slot_count = 3;
+  init_desc.upload_desc.bytes_per_slot = sizeof(g_ring_upload);
+  memset(&target_desc, 0, sizeof(target_desc));
+  target_desc.target_id = 1;
+  target_desc.width = 1280;
+  target_desc.height = 720;
+  target_desc.format = 21;
+  target_desc.windowed = 1;
+  setenv("DX9MT_BACKEND_IPC_PATH", RING_TEST_IPC_PATH, 1);
+  setenv("DX9MT_BACKEND_FRAMES_IN_FLIGHT", "2", 1);
+  assert(dx9mt_backend_bridge_init(&init_desc) == 0);
+  unsetenv("DX9MT_BACKEND_FRAMES_IN_FLIGHT");
+  unsetenv("DX9MT_BACKEND_IPC_PATH");
+  dx9mt_backend_bridge_set_upload_resolver(ring_test_resolve);
+  assert(dx9mt_backend_bridge_update_present_target(&target_desc) == 0);
+
+  for (frame_id = 1; frame_id <= RING_TEST_FRAMES; ++frame_id) {
+    ring_writer_present(frame_id, &sequence);
+  }
+  while ((int32_t)(dx9mt_backend_bridge_completed_fence() - RING_TEST_FRAMES) <
+         0) {
+    sched_yield();
+  }
+  dx9mt_backend_bridge_debug_get_ipc_stats(&stats);
+  assert(stats.frames == RING_TEST_FRAMES);
+  assert(stats.caps & DX9MT_METAL_IPC_CAP_FRAME_RING);
+  assert(!(stats.caps & DX9MT_METAL_IPC_CAP_ZERO_COPY));
+  assert(stats.ring_skipped == 0);
+  assert(stats.ring_slot < DX9MT_METAL_IPC_RING_SLOTS);
+
+  assert(waitpid(reader, &status, 0) == reader);
+  dx9mt_backend_bridge_set_upload_resolver(NULL);
+  dx9mt_backend_bridge_shutdown();
+  remove(RING_TEST_IPC_PATH);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main(void) {
+  test_reader_never_sees_a_torn_frame();
+  puts("ipc_ring_test: PASS");
+  return 0;
+}